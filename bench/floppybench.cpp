@@ -0,0 +1,500 @@
+// Benchmark suite for the hot paths: CRC, FM/MFM encode and decode,
+// controller commands, image open, full disk scan and (in GUI builds) the
+// disk widget frame. Every benchmark runs --repeat times and reports the
+// median. Results can be written as JSON and compared against a stored
+// baseline; any benchmark worse than the baseline by more than the
+// tolerance fails the run.
+//
+//   qt-floppy-bench [--json out.json] [--baseline bench/baseline.json]
+//                   [--tolerance 0.20] [--repeat 5] [--filter name]
+
+#include "bitstreamdecoder.h"
+#include "bitstreamencoder.h"
+#include "crc16.h"
+#include "diskimage.h"
+#include "floppydrive.h"
+#include "fluxdecoder.h"
+#include "fluxreader.h"
+#include "syntheticdisk.h"
+#include "wd1793.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef QT_FLOPPY_BENCH_RENDER
+#include "floppydiskwidget.h"
+#include <QApplication>
+#include <QImage>
+#endif
+
+namespace {
+
+struct Result {
+    std::string name;
+    double value;
+    std::string unit;
+    bool higherIsBetter;
+};
+
+struct Options {
+    std::string jsonPath;
+    std::string baselinePath;
+    std::string filter;
+    double tolerance = 0.20;
+    int repeat = 5;
+};
+
+class Suite
+{
+public:
+    explicit Suite(const Options &options) : m_options(options) {}
+
+    bool selected(const std::string &name) const
+    {
+        return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+    }
+
+    // 'measure' returns the value of one run; the median of all runs is kept
+    void run(const std::string &name, const std::string &unit, bool higherIsBetter, const std::function<double()> &measure)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        std::vector<double> values;
+        for (int i = 0; i < m_options.repeat; ++i) {
+            values.push_back(measure());
+        }
+        std::sort(values.begin(), values.end());
+        m_results.push_back({ name, values[values.size() / 2], unit, higherIsBetter });
+        std::printf("%-28s %14.3f %s\n", name.c_str(), m_results.back().value, unit.c_str());
+        std::fflush(stdout);
+    }
+
+    const std::vector<Result> &results() const { return m_results; }
+
+private:
+    const Options &m_options;
+    std::vector<Result> m_results;
+};
+
+template <typename F>
+double seconds(F &&body)
+{
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Keeps results alive so the optimizer cannot drop the work
+volatile uint64_t g_sink;
+
+void benchCrc(Suite &suite)
+{
+    std::vector<uint8_t> buffer(1 << 20);
+    std::mt19937 rng(16);
+    for (uint8_t &byte : buffer) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    suite.run("crc16", "MB/s", true, [&]() {
+        constexpr int PASSES = 64;
+        uint16_t crc = Crc16::INITIAL_VALUE;
+        const double s = seconds([&]() {
+            for (int i = 0; i < PASSES; ++i) {
+                crc = Crc16::update(crc, buffer.data(), buffer.size());
+            }
+        });
+        g_sink = crc;
+        return PASSES / s;
+    });
+}
+
+void benchCodec(Suite &suite, Encoding encoding, const char *prefix)
+{
+    constexpr int TRACKS = 200;
+    const Track track = SyntheticDisk::makeTrack(10, 0, encoding);
+    BitstreamEncoder encoder(encoding);
+
+    suite.run(std::string(prefix) + "_encode", "tracks/s", true, [&]() {
+        const double s = seconds([&]() {
+            for (int i = 0; i < TRACKS; ++i) {
+                encoder.encodeTrack(track);
+            }
+        });
+        g_sink = encoder.cellCount();
+        return TRACKS / s;
+    });
+
+    // Decode from flux run lengths, as the PLL delivers them
+    encoder.encodeTrack(track);
+    std::vector<int> runs;
+    const std::vector<uint8_t> &cells = encoder.cells();
+    int zeros = 0;
+    for (size_t cell = 0; cell < encoder.cellCount(); ++cell) {
+        if (cells[cell / 8] & (0x80 >> (cell % 8))) {
+            runs.push_back(zeros);
+            zeros = 0;
+        } else {
+            ++zeros;
+        }
+    }
+
+    suite.run(std::string(prefix) + "_decode", "tracks/s", true, [&]() {
+        BitstreamDecoder decoder(encoding);
+        size_t good = 0;
+        const double s = seconds([&]() {
+            for (int i = 0; i < TRACKS; ++i) {
+                decoder.reset();
+                for (int run : runs) {
+                    decoder.pushFlux(run);
+                }
+                decoder.finish();
+                good += static_cast<size_t>(decoder.goodSectorCount());
+            }
+        });
+        if (good != static_cast<size_t>(TRACKS) * SyntheticDisk::SECTORS) {
+            std::fprintf(stderr, "%s_decode: decoded %zu good sectors\n", prefix, good);
+            std::exit(2);
+        }
+        return TRACKS / s;
+    });
+}
+
+struct Machine {
+    FloppyDrive drive;
+    Wd1793 controller;
+    uint64_t now = 0;
+
+    Machine()
+    {
+        drive.insertDisk(SyntheticDisk::makeImage(80, 2));
+        controller.setDrive(&drive);
+    }
+
+    // Lets the command in progress run to completion
+    void finish()
+    {
+        while (controller.isBusy()) {
+            now += 1000000000ULL;
+            controller.advance(now);
+        }
+    }
+
+    void seek(int cylinder)
+    {
+        controller.write(Wd1793::DataRegister, static_cast<uint8_t>(cylinder), now);
+        controller.write(Wd1793::CommandRegister, 0x18, now);
+        finish();
+    }
+
+    size_t readSector(int id, uint8_t *buffer)
+    {
+        controller.write(Wd1793::SectorRegister, static_cast<uint8_t>(id), now);
+        controller.write(Wd1793::CommandRegister, 0x80, now);
+        const size_t moved = controller.readDataBlock(buffer, 256, now, 8000, &now);
+        finish();
+        return moved;
+    }
+
+    size_t writeSector(int id, const uint8_t *buffer)
+    {
+        controller.write(Wd1793::SectorRegister, static_cast<uint8_t>(id), now);
+        controller.write(Wd1793::CommandRegister, 0xA0, now);
+        const size_t moved = controller.writeDataBlock(buffer, 256, now, 8000, &now);
+        finish();
+        return moved;
+    }
+};
+
+// Reads every sector through the controller; returns how many differ from the image
+size_t scanDisk(Machine &machine)
+{
+    const std::shared_ptr<DiskImage> reference = machine.drive.disk();
+    uint8_t buffer[256];
+    size_t mismatches = 0;
+    for (int cylinder = 0; cylinder < reference->cylinderCount(); ++cylinder) {
+        machine.seek(cylinder);
+        for (int side = 0; side < reference->sideCount(); ++side) {
+            machine.drive.setSide(side);
+            const Track *track = reference->track(cylinder, side);
+            for (int id = 1; id <= SyntheticDisk::SECTORS; ++id) {
+                if (machine.readSector(id, buffer) != sizeof(buffer)
+                    || std::memcmp(buffer, track->findSector(id)->data.data(), sizeof(buffer)) != 0) {
+                    ++mismatches;
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+void benchController(Suite &suite)
+{
+    suite.run("seek_commands", "cmd/s", true, [&]() {
+        constexpr int COMMANDS = 50000;
+        Machine machine;
+        const double s = seconds([&]() {
+            for (int i = 0; i < COMMANDS; ++i) {
+                machine.seek((i & 1) ? 79 : 0);
+            }
+        });
+        return COMMANDS / s;
+    });
+
+    suite.run("read_sector_commands", "cmd/s", true, [&]() {
+        constexpr int COMMANDS = 200000;
+        Machine machine;
+        uint8_t buffer[256];
+        size_t moved = 0;
+        const double s = seconds([&]() {
+            for (int i = 0; i < COMMANDS; ++i) {
+                moved += machine.readSector(i % SyntheticDisk::SECTORS + 1, buffer);
+            }
+        });
+        g_sink = moved;
+        return COMMANDS / s;
+    });
+
+    suite.run("write_sector_commands", "cmd/s", true, [&]() {
+        constexpr int COMMANDS = 200000;
+        Machine machine;
+        uint8_t buffer[256] = {};
+        size_t moved = 0;
+        const double s = seconds([&]() {
+            for (int i = 0; i < COMMANDS; ++i) {
+                buffer[0] = static_cast<uint8_t>(i);
+                moved += machine.writeSector(i % SyntheticDisk::SECTORS + 1, buffer);
+            }
+        });
+        g_sink = moved;
+        return COMMANDS / s;
+    });
+
+    suite.run("full_disk_scan", "ms", false, [&]() {
+        constexpr int SCANS = 50;
+        Machine machine;
+        size_t mismatches = 0;
+        const double s = seconds([&]() {
+            for (int scan = 0; scan < SCANS; ++scan) {
+                mismatches += scanDisk(machine);
+            }
+        });
+        if (mismatches) {
+            std::fprintf(stderr, "full_disk_scan: %zu sectors read back wrong\n", mismatches);
+            std::exit(2);
+        }
+        return s * 1000.0 / SCANS;
+    });
+}
+
+double openImage(const std::string &path, bool cold)
+{
+#if defined(__unix__)
+    // Drop the capture from the page cache so the read really hits the disk
+    if (cold) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+#else
+    (void)cold;
+#endif
+    std::shared_ptr<DiskImage> image;
+    const double s = seconds([&]() {
+        std::unique_ptr<FluxReader> reader = FluxReader::open(path);
+        FluxDecodeOptions options;
+        options.threads = 1;
+        image = reader ? FluxDiskDecoder::decode(*reader, options) : nullptr;
+    });
+    if (!image || image->sectorTotal() != 80 * 2 * SyntheticDisk::SECTORS) {
+        std::fprintf(stderr, "image_open: %s did not decode\n", path.c_str());
+        std::exit(2);
+    }
+    return s * 1000.0;
+}
+
+void benchImageOpen(Suite &suite)
+{
+    if (!suite.selected("image_open")) {
+        return;
+    }
+    const std::string path = "floppybench.scp";
+    if (!SyntheticDisk::writeScp(path, 80, 2, 1)) {
+        std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+        std::exit(2);
+    }
+    suite.run("image_open_cold", "ms", false, [&]() { return openImage(path, true); });
+    suite.run("image_open_warm", "ms", false, [&]() { return openImage(path, false); });
+    std::remove(path.c_str());
+}
+
+#ifdef QT_FLOPPY_BENCH_RENDER
+void benchRender(Suite &suite, int &argc, char **argv)
+{
+    if (!suite.selected("widget_frame")) {
+        return;
+    }
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    FloppyDiskWidget widget;
+    widget.resize(640, 640);
+    // Measure the full-detail frame, not whatever level the pacer settles on
+    widget.setAdaptiveDetail(false);
+    widget.setDiskImage(SyntheticDisk::makeImage(80, 2));
+    QImage frame(widget.size(), QImage::Format_ARGB32_Premultiplied);
+
+    suite.run("widget_frame", "ms", false, [&]() {
+        constexpr int FRAMES = 120;
+        const double s = seconds([&]() {
+            for (int i = 0; i < FRAMES; ++i) {
+                widget.setRotationAngle(i * 3.0);
+                widget.render(&frame);
+            }
+        });
+        return s * 1000.0 / FRAMES;
+    });
+}
+#endif
+
+std::string jsonEscape(const std::string &text)
+{
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+bool writeJson(const std::string &path, const std::vector<Result> &results)
+{
+    std::ofstream out(path);
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        char value[64];
+        std::snprintf(value, sizeof(value), "%.6g", r.value);
+        out << "    { \"name\": \"" << jsonEscape(r.name) << "\", \"value\": " << value
+            << ", \"unit\": \"" << jsonEscape(r.unit) << "\", \"higherIsBetter\": "
+            << (r.higherIsBetter ? "true" : "false") << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+// Reads the "name"/"value" pairs of a file written by writeJson
+std::map<std::string, double> readBaseline(const std::string &path)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    const std::string json = text.str();
+
+    size_t at = 0;
+    while ((at = json.find("\"name\"", at)) != std::string::npos) {
+        const size_t open = json.find('"', json.find(':', at) + 1);
+        const size_t close = json.find('"', open + 1);
+        const size_t value = json.find("\"value\"", close);
+        if (open == std::string::npos || close == std::string::npos || value == std::string::npos) {
+            break;
+        }
+        baseline[json.substr(open + 1, close - open - 1)] = std::strtod(json.c_str() + json.find(':', value) + 1, nullptr);
+        at = close;
+    }
+    return baseline;
+}
+
+int compare(const std::vector<Result> &results, const std::map<std::string, double> &baseline, double tolerance)
+{
+    int regressions = 0;
+    std::printf("\n%-28s %14s %14s %9s\n", "benchmark", "value", "baseline", "change");
+    for (const Result &r : results) {
+        const auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0.0) {
+            std::printf("%-28s %14.3f %14s %9s\n", r.name.c_str(), r.value, "-", "new");
+            continue;
+        }
+        // Positive change is always an improvement
+        const double change = r.higherIsBetter ? r.value / it->second - 1.0 : it->second / r.value - 1.0;
+        const bool regressed = change < -tolerance;
+        regressions += regressed ? 1 : 0;
+        std::printf("%-28s %14.3f %14.3f %+8.1f%%%s\n", r.name.c_str(), r.value, it->second, change * 100.0,
+                    regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            options.baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            options.tolerance = std::atof(argv[++i]);
+        } else if (arg == "--repeat" && hasValue) {
+            options.repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        } else {
+            std::fprintf(stderr, "usage: %s [--json out.json] [--baseline file.json] [--tolerance 0.20] "
+                                 "[--repeat 5] [--filter name]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Suite suite(options);
+    benchCrc(suite);
+    benchCodec(suite, Encoding::MFM, "mfm");
+    benchCodec(suite, Encoding::FM, "fm");
+    benchController(suite);
+    benchImageOpen(suite);
+#ifdef QT_FLOPPY_BENCH_RENDER
+    benchRender(suite, argc, argv);
+#endif
+
+    if (!options.jsonPath.empty() && !writeJson(options.jsonPath, suite.results())) {
+        std::fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+        return 2;
+    }
+    if (!options.baselinePath.empty()) {
+        const std::map<std::string, double> baseline = readBaseline(options.baselinePath);
+        if (baseline.empty()) {
+            std::fprintf(stderr, "No baseline in %s\n", options.baselinePath.c_str());
+            return 2;
+        }
+        const int regressions = compare(suite.results(), baseline, options.tolerance);
+        if (regressions) {
+            std::printf("%d benchmark(s) regressed by more than %.0f%%\n", regressions, options.tolerance * 100.0);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Flux decode scaling benchmark: synthesizes an 80 x 2 x 5 revolution SCP
+// capture of a TR-DOS style disk and decodes it with 1..N threads, checking
+// that every run produces the same image as the single-threaded one.
+//
+//   qt-floppy-fluxbench [capture.scp] [max threads]
+
+#include "diskimage.h"
+#include "fluxdecoder.h"
+#include "fluxreader.h"
+#include "syntheticdisk.h"
+#include "taskpool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+constexpr int CYLINDERS = 80;
+constexpr int SIDES = 2;
+constexpr int REVOLUTIONS = 5;
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // The capture path is written to, so an option must never be taken for one
+    if (argc > 3 || (argc > 1 && argv[1][0] == '-') || (argc > 2 && argv[2][0] == '-')) {
+        std::fprintf(stderr, "usage: %s [capture.scp] [max threads]\n", argv[0]);
+        return 2;
+    }
+    const std::string path = argc > 1 ? argv[1] : "fluxdecodebench.scp";
+    const int maxThreads = argc > 2 ? std::atoi(argv[2]) : TaskPool::defaultThreadCount();
+
+    std::printf("Writing %d x %d x %d revolution capture to %s\n", CYLINDERS, SIDES, REVOLUTIONS, path.c_str());
+    if (!SyntheticDisk::writeScp(path, CYLINDERS, SIDES, REVOLUTIONS)) {
+        std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return 1;
+    }
+
+    std::shared_ptr<DiskImage> reference;
+    double baseline = 0.0;
+    std::printf("%8s %10s %8s %10s %s\n", "threads", "seconds", "speedup", "sectors", "identical");
+    for (int threads = 1; threads <= maxThreads; threads = (threads < maxThreads && threads * 2 > maxThreads) ? maxThreads : threads * 2) {
+        std::string error;
+        std::unique_ptr<FluxReader> reader = FluxReader::open(path, &error);
+        if (!reader) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        FluxDecodeOptions options;
+        options.threads = threads;
+
+        const auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<DiskImage> image = FluxDiskDecoder::decode(*reader, options);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (!reference) {
+            reference = image;
+            baseline = seconds;
+        }
+        const bool identical = SyntheticDisk::sameImage(*reference, *image);
+        std::printf("%8d %10.3f %8.2f %10d %s\n", threads, seconds, baseline / seconds, image->sectorTotal(),
+                    identical ? "yes" : "NO");
+        if (!identical) {
+            return 1;
+        }
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+
+    std::remove(path.c_str());
+    return 0;
+}
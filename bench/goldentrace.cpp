@@ -0,0 +1,792 @@
+// Golden trace regression harness for the WD1793 model. Runs scripted
+// command sequences against synthetic reference disks and hashes what the
+// controller did: every pin and register edge it reported through
+// SignalTrace plus the status the host read after each command (the event
+// trace), and every byte read together with the disk contents at the end
+// (the data). The hashes are compared with bench/golden.txt, which also
+// keeps 16 bits of the trace hash after every event, so a trace that
+// differs is reported at the exact event where it first diverges, printed
+// from the current run with the events leading up to it. Scripts run in
+// parallel on all cores. The default paths point into the source tree, so
+// the harness runs from any directory and as the ctest test 'golden'.
+//
+//   qt-floppy-golden [--scripts bench/golden.scripts] [--golden bench/golden.txt]
+//                    [--filter name] [--threads N] [--update] [--dump name] [--blocks]
+//
+// --update rewrites the golden file from the current model; review the
+// diff before committing it. --dump prints the full event trace of one
+// script, for diffing the output of two builds. --blocks replays every
+// script a second time with the host moving data through readDataBlock()
+// and writeDataBlock() and fails unless both runs read the same bytes,
+// leave the same disk and read the same status at the same time after
+// every command (ctest 'golden-blocks'). The bulk calls do not sample the
+// pins per byte, so the event traces themselves are not compared.
+
+#include "floppydrive.h"
+#include "sectorstore.h"
+#include "signaltrace.h"
+#include "syntheticdisk.h"
+#include "taskpool.h"
+#include "wd1793.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Set by the build; relative to the working directory otherwise
+#ifndef QT_FLOPPY_SOURCE_DIR
+#define QT_FLOPPY_SOURCE_DIR "."
+#endif
+
+namespace {
+
+// Pseudo signal of the status register read after every command
+constexpr uint8_t STATUS_EVENT = SignalTrace::SIGNAL_COUNT;
+// Events printed before the first diverging one
+constexpr size_t CONTEXT_EVENTS = 4;
+// A command still busy after this much emulated time is a hung script
+constexpr uint64_t COMMAND_LIMIT_NS = 30000000000ULL;
+// Bytes the host offers or accepts per bulk call; more than any transfer
+constexpr size_t BLOCK_BYTES = 8192;
+
+struct Step {
+    enum class Kind {
+        Command,
+        Side,
+        Register,
+        Idle,
+        HostByte,
+        Protect
+    };
+    Kind kind = Kind::Command;
+    int line = 0;
+    uint8_t command = 0;
+    int reg = 0;
+    int value = 0;          // Register value, side, microseconds, ns per byte, 0/1 or sectors to format
+    bool hasValue = false;  // Seek target or sector number goes to a register first
+    uint8_t fill = 0;       // First byte a write sends, later ones count up; data of formatted sectors
+    uint64_t stopNs = 0;    // Interrupt the command this long after issuing it
+    uint8_t stopCommand = 0xD0;
+};
+
+struct SectorEdit {
+    enum class Kind {
+        BadCrc,
+        Deleted,
+        Missing
+    };
+    Kind kind;
+    int cylinder;
+    int side;
+    int id;
+};
+
+struct Script {
+    std::string name;
+    int line = 0;
+    Encoding encoding = Encoding::MFM;
+    int cylinders = 80;
+    int sides = 2;
+    std::vector<SectorEdit> edits;
+    std::vector<Step> steps;
+};
+
+struct Outcome {
+    std::vector<SignalTrace::Edge> events;
+    std::vector<SignalTrace::Edge> statuses;    // Status read after every command
+    std::vector<uint16_t> checkpoints;  // Low 16 bits of the trace hash after every event
+    uint64_t traceHash = 0;
+    uint64_t dataHash = 0;
+    std::string error;
+};
+
+struct Golden {
+    size_t events = 0;
+    uint64_t traceHash = 0;
+    uint64_t dataHash = 0;
+    std::vector<uint16_t> checkpoints;
+};
+
+uint64_t chain(uint64_t hash, const uint8_t *data, size_t size)
+{
+    uint8_t record[8 + 64];
+    for (int i = 0; i < 8; ++i) {
+        record[i] = static_cast<uint8_t>(hash >> (i * 8));
+    }
+    uint64_t result = hash;
+    while (size > 0) {
+        const size_t chunk = std::min<size_t>(size, 64);
+        std::memcpy(record + 8, data, chunk);
+        result = SectorStore::hash(record, 8 + chunk);
+        for (int i = 0; i < 8; ++i) {
+            record[i] = static_cast<uint8_t>(result >> (i * 8));
+        }
+        data += chunk;
+        size -= chunk;
+    }
+    return result;
+}
+
+uint64_t chainEvent(uint64_t hash, const SignalTrace::Edge &event)
+{
+    uint8_t bytes[10];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<uint8_t>(event.timeNs >> (i * 8));
+    }
+    bytes[8] = event.signal;
+    bytes[9] = event.value;
+    return chain(hash, bytes, sizeof(bytes));
+}
+
+std::string describe(size_t index, const SignalTrace::Edge &event)
+{
+    char text[96];
+    std::snprintf(text, sizeof(text), "%6zu %14.3f us  %-6s %02X", index, event.timeNs / 1e3,
+                  event.signal == STATUS_EVENT ? "STATUS" : SignalTrace::signalName(event.signal), event.value);
+    return text;
+}
+
+// The stream a host sends to Write Track to format the current track with
+// sectors 1..count in the synthetic disk's sector size; F5/F6 become MFM
+// sync marks and F7 the CRC, as on the real controller
+std::vector<uint8_t> formatStream(Encoding encoding, uint8_t track, uint8_t side, int count, uint8_t fill)
+{
+    const bool mfm = encoding == Encoding::MFM;
+    const uint8_t gap = mfm ? 0x4E : 0xFF;
+    const size_t sync = mfm ? 12 : 6;
+    const uint8_t sizeCode = mfm ? 1 : 0;
+    std::vector<uint8_t> stream;
+    auto put = [&stream](uint8_t value, size_t times) { stream.insert(stream.end(), times, value); };
+    auto mark = [&](uint8_t syncByte, uint8_t value) {
+        put(0x00, sync);
+        if (mfm) {
+            put(syncByte, 3);
+        }
+        put(value, 1);
+    };
+
+    put(gap, mfm ? 80 : 40);
+    mark(0xF6, 0xFC);
+    put(gap, mfm ? 50 : 26);
+    for (int sector = 1; sector <= count; ++sector) {
+        mark(0xF5, 0xFE);
+        stream.insert(stream.end(), { track, side, static_cast<uint8_t>(sector), sizeCode, 0xF7 });
+        put(gap, mfm ? 22 : 11);
+        mark(0xF5, 0xFB);
+        put(fill, static_cast<size_t>(128) << sizeCode);
+        put(0xF7, 1);
+        put(gap, mfm ? 54 : 27);
+    }
+    return stream;
+}
+
+bool parseNumber(const std::string &token, int &value)
+{
+    char *end = nullptr;
+    const long parsed = std::strtol(token.c_str(), &end, 0);
+    if (token.empty() || *end != '\0') {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// One script line after the disk setup:
+//   <op> [arguments] [flags=N] [stop=MICROSECONDS] [force=N]
+bool parseStep(const std::vector<std::string> &tokens, Step &step, std::string &error)
+{
+    static const std::map<std::string, uint8_t> COMMANDS = {
+        { "restore", 0x00 }, { "seek", 0x10 }, { "step", 0x20 }, { "step-in", 0x40 }, { "step-out", 0x60 },
+        { "read", 0x80 }, { "write", 0xA0 }, { "read-address", 0xC0 }, { "force", 0xD0 }, { "read-track", 0xE0 },
+        { "write-track", 0xF0 },
+    };
+    std::vector<std::string> positional;
+    int flags = 0;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        const size_t equals = tokens[i].find('=');
+        if (equals == std::string::npos) {
+            positional.push_back(tokens[i]);
+            continue;
+        }
+        const std::string key = tokens[i].substr(0, equals);
+        int value = 0;
+        if (!parseNumber(tokens[i].substr(equals + 1), value)) {
+            error = "bad value in " + tokens[i];
+            return false;
+        }
+        if (key == "flags") {
+            flags = value;
+        } else if (key == "stop") {
+            step.stopNs = static_cast<uint64_t>(value) * 1000;
+        } else if (key == "force") {
+            step.stopCommand = static_cast<uint8_t>(value);
+        } else {
+            error = "unknown option " + key;
+            return false;
+        }
+    }
+
+    const std::string &op = tokens[0];
+    int value = 0;
+    const bool hasValue = !positional.empty() && parseNumber(positional[0], value);
+    if (op == "side" || op == "idle" || op == "host-byte" || op == "protect") {
+        if (!hasValue || positional.size() != 1) {
+            error = op + " takes one number";
+            return false;
+        }
+        step.kind = op == "side" ? Step::Kind::Side
+                  : op == "idle" ? Step::Kind::Idle
+                  : op == "host-byte" ? Step::Kind::HostByte : Step::Kind::Protect;
+        step.value = value;
+        return true;
+    }
+    if (op == "track" || op == "sector" || op == "data") {
+        if (!hasValue || positional.size() != 1) {
+            error = op + " takes one number";
+            return false;
+        }
+        step.kind = Step::Kind::Register;
+        step.reg = op == "track" ? Wd1793::TrackRegister : op == "sector" ? Wd1793::SectorRegister : Wd1793::DataRegister;
+        step.value = value;
+        return true;
+    }
+
+    const auto command = COMMANDS.find(op);
+    if (command == COMMANDS.end()) {
+        error = "unknown command " + op;
+        return false;
+    }
+    step.kind = Step::Kind::Command;
+    // Bit 4 tells Restore from Seek, so those take the low four flag bits only
+    step.command = static_cast<uint8_t>(command->second | (flags & (command->second < 0x20 ? 0x0F : 0x1F)));
+    // seek <cylinder>, read <sector>, write <sector> <fill>, write-track <sectors> <fill>
+    const bool format = op == "write-track";
+    const size_t arguments = op == "seek" || op == "read" ? 1 : op == "write" || format ? 2 : 0;
+    if (positional.size() != arguments || (arguments > 0 && !hasValue)) {
+        error = op + (arguments == 0 ? " takes no arguments" : " takes " + std::to_string(arguments) + " number(s)");
+        return false;
+    }
+    if (format) {
+        step.value = value;
+    } else if (arguments > 0) {
+        step.hasValue = true;
+        step.reg = op == "seek" ? Wd1793::DataRegister : Wd1793::SectorRegister;
+        step.value = value;
+    }
+    if (arguments == 2) {
+        int fill = 0;
+        if (!parseNumber(positional[1], fill)) {
+            error = "bad fill byte " + positional[1];
+            return false;
+        }
+        step.fill = static_cast<uint8_t>(fill);
+    }
+    return true;
+}
+
+bool readScripts(const std::string &path, std::vector<Script> &scripts, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        error = path + ": cannot open";
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        ++number;
+        std::istringstream stream(line.substr(0, line.find('#')));
+        std::vector<std::string> tokens;
+        for (std::string token; stream >> token;) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            continue;
+        }
+        const std::string where = path + ":" + std::to_string(number) + ": ";
+        if (tokens[0] == "script") {
+            if (tokens.size() != 2) {
+                error = where + "script takes a name";
+                return false;
+            }
+            Script script;
+            script.name = tokens[1];
+            script.line = number;
+            scripts.push_back(script);
+            continue;
+        }
+        if (scripts.empty()) {
+            error = where + "expected script <name>";
+            return false;
+        }
+        Script &script = scripts.back();
+        if (tokens[0] == "disk") {
+            int cylinders = 0;
+            int sides = 0;
+            if (tokens.size() != 4 || (tokens[1] != "fm" && tokens[1] != "mfm") || !parseNumber(tokens[2], cylinders)
+                || !parseNumber(tokens[3], sides) || cylinders <= 0 || sides < 1 || sides > 2) {
+                error = where + "expected disk fm|mfm <cylinders> <sides>";
+                return false;
+            }
+            script.encoding = tokens[1] == "fm" ? Encoding::FM : Encoding::MFM;
+            script.cylinders = cylinders;
+            script.sides = sides;
+            continue;
+        }
+        if (tokens[0] == "bad-crc" || tokens[0] == "deleted" || tokens[0] == "missing") {
+            SectorEdit edit{ tokens[0] == "bad-crc" ? SectorEdit::Kind::BadCrc
+                             : tokens[0] == "deleted" ? SectorEdit::Kind::Deleted : SectorEdit::Kind::Missing,
+                             0, 0, 0 };
+            if (tokens.size() != 4 || !parseNumber(tokens[1], edit.cylinder) || !parseNumber(tokens[2], edit.side)
+                || !parseNumber(tokens[3], edit.id)) {
+                error = where + "expected " + tokens[0] + " <cylinder> <side> <sector>";
+                return false;
+            }
+            script.edits.push_back(edit);
+            continue;
+        }
+        Step step;
+        step.line = number;
+        if (!parseStep(tokens, step, error)) {
+            error = where + error;
+            return false;
+        }
+        script.steps.push_back(step);
+    }
+    return true;
+}
+
+bool readGolden(const std::string &path, std::map<std::string, Golden> &golden)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line.substr(0, line.find('#')));
+        std::string name;
+        std::string trace;
+        std::string data;
+        Golden entry;
+        if (!(stream >> name >> entry.events >> trace >> data)) {
+            continue;
+        }
+        entry.traceHash = std::strtoull(trace.c_str(), nullptr, 16);
+        entry.dataHash = std::strtoull(data.c_str(), nullptr, 16);
+        // Four hex digits per event, run together
+        std::string checkpoints;
+        stream >> checkpoints;
+        for (size_t at = 0; at + 4 <= checkpoints.size(); at += 4) {
+            entry.checkpoints.push_back(static_cast<uint16_t>(std::strtoul(checkpoints.substr(at, 4).c_str(), nullptr, 16)));
+        }
+        golden[name] = entry;
+    }
+    return true;
+}
+
+class Runner
+{
+public:
+    // 'blocks' moves DRQ data through the bulk calls instead of the data register
+    explicit Runner(const Script &script, bool blocks = false)
+        : m_script(script)
+        , m_fdc(&m_drive)
+        , m_blocks(blocks)
+        , m_hostByteNs(0)
+        , m_host(0)
+    {
+    }
+
+    Outcome run()
+    {
+        auto disk = SyntheticDisk::makeImage(m_script.cylinders, m_script.sides, m_script.encoding);
+        for (const SectorEdit &edit : m_script.edits) {
+            Track *track = disk->track(edit.cylinder, edit.side);
+            auto sector = track ? std::find_if(track->sectors.begin(), track->sectors.end(),
+                                               [&](const Sector &s) { return s.id == edit.id; })
+                                : std::vector<Sector>::iterator();
+            if (!track || sector == track->sectors.end()) {
+                m_outcome.error = "no sector to edit at " + std::to_string(edit.cylinder) + "/" +
+                                  std::to_string(edit.side) + "/" + std::to_string(edit.id);
+                return m_outcome;
+            }
+            if (edit.kind == SectorEdit::Kind::BadCrc) {
+                sector->dataCrcOk = false;
+            } else if (edit.kind == SectorEdit::Kind::Deleted) {
+                sector->deleted = true;
+            } else {
+                track->sectors.erase(sector);
+            }
+        }
+        disk->refreshLayout();
+        m_drive.insertDisk(disk);
+        m_fdc.setDoubleDensity(m_script.encoding == Encoding::MFM);
+        m_fdc.setSignalTrace(&m_trace);
+        m_fdc.reset(0);
+
+        for (const Step &step : m_script.steps) {
+            m_host = std::max(m_host, m_fdc.time());
+            switch (step.kind) {
+            case Step::Kind::Side:
+                m_drive.setSide(step.value);
+                break;
+            case Step::Kind::Register:
+                m_fdc.write(step.reg, static_cast<uint8_t>(step.value), m_host);
+                break;
+            case Step::Kind::Idle:
+                m_host += static_cast<uint64_t>(step.value) * 1000;
+                break;
+            case Step::Kind::HostByte:
+                m_hostByteNs = static_cast<uint64_t>(step.value);
+                break;
+            case Step::Kind::Protect:
+                m_drive.setWriteProtected(step.value != 0);
+                break;
+            case Step::Kind::Command:
+                if (!runCommand(step)) {
+                    m_outcome.error = "line " + std::to_string(step.line) + ": command did not finish";
+                    return m_outcome;
+                }
+                break;
+            }
+            drain();
+        }
+
+        // The disk as the script left it
+        for (int cylinder = 0; cylinder < disk->cylinderCount(); ++cylinder) {
+            for (int side = 0; side < disk->sideCount(); ++side) {
+                for (const Sector &sector : disk->track(cylinder, side)->sectors) {
+                    m_outcome.dataHash = chain(m_outcome.dataHash, sector.data.data(), sector.data.size());
+                }
+            }
+        }
+        return m_outcome;
+    }
+
+private:
+    // Issues the command and plays a host that polls DRQ and needs
+    // hostByteNs per data byte, until the controller is idle again: each
+    // access happens once DRQ is up and hostByteNs after the previous one,
+    // which is the host readDataBlock() and writeDataBlock() assume. A byte
+    // still in the data register when the command ends is read as well.
+    bool runCommand(const Step &step)
+    {
+        if (step.hasValue) {
+            m_fdc.write(step.reg, static_cast<uint8_t>(step.value), m_host);
+        }
+        const bool formatting = (step.command & 0xF0) == 0xF0;
+        const bool writing = (step.command & 0xE0) == 0xA0 || formatting;
+        // Write Track gets the format stream and then gap bytes until the index ends it
+        const std::vector<uint8_t> stream = formatting
+            ? formatStream(m_script.encoding, m_fdc.read(Wd1793::TrackRegister, m_host),
+                           static_cast<uint8_t>(m_drive.side()), step.value, step.fill)
+            : std::vector<uint8_t>();
+        const uint8_t gap = m_script.encoding == Encoding::MFM ? 0x4E : 0xFF;
+        auto hostByte = [&](size_t index) {
+            return formatting ? (index < stream.size() ? stream[index] : gap) : static_cast<uint8_t>(step.fill + index);
+        };
+        m_fdc.write(Wd1793::CommandRegister, step.command, m_host);
+        const uint64_t stopAt = step.stopNs > 0 ? m_host + step.stopNs : UINT64_MAX;
+        const uint64_t limit = m_host + COMMAND_LIMIT_NS;
+        uint64_t ready = m_host;
+        size_t sent = 0;
+        bool stopped = false;
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> block(BLOCK_BYTES);
+
+        while (m_fdc.isBusy() || (m_fdc.drq() && !writing)) {
+            drain();
+            // A bulk call cannot be interrupted part way, so a stop= command goes byte by byte
+            if (m_blocks && m_fdc.drq() && stopAt == UINT64_MAX) {
+                const uint64_t now = std::max(m_fdc.time(), ready);
+                size_t moved = 0;
+                if (writing) {
+                    for (size_t i = 0; i < block.size(); ++i) {
+                        block[i] = hostByte(sent + i);
+                    }
+                    moved = m_fdc.writeDataBlock(block.data(), block.size(), now, m_hostByteNs, &ready);
+                    sent += moved;
+                } else {
+                    moved = m_fdc.readDataBlock(block.data(), block.size(), now, m_hostByteNs, &ready);
+                    bytes.insert(bytes.end(), block.begin(), block.begin() + moved);
+                }
+                // A host too slow for the disk goes on byte by byte
+                if (moved > 0) {
+                    continue;
+                }
+            }
+            const uint64_t next = m_fdc.drq() ? std::max(m_fdc.time(), ready) : std::max(m_fdc.nextEventTime(), m_fdc.time());
+            if (next > limit) {
+                return false;
+            }
+            if (!stopped && stopAt <= next) {
+                m_fdc.write(Wd1793::CommandRegister, step.stopCommand, std::max(stopAt, m_fdc.time()));
+                stopped = true;
+            } else if (m_fdc.drq() && writing) {
+                m_fdc.write(Wd1793::DataRegister, hostByte(sent++), next);
+                ready = next + m_hostByteNs;
+            } else if (m_fdc.drq()) {
+                bytes.push_back(m_fdc.read(Wd1793::DataRegister, next));
+                ready = next + m_hostByteNs;
+            } else {
+                m_fdc.advance(next);
+            }
+        }
+        m_outcome.dataHash = chain(m_outcome.dataHash, bytes.data(), bytes.size());
+
+        m_host = m_fdc.time();
+        drain();
+        const SignalTrace::Edge status{ m_host, STATUS_EVENT, m_fdc.read(Wd1793::StatusRegister, m_host) };
+        m_outcome.statuses.push_back(status);
+        record(status);
+        return true;
+    }
+
+    void drain()
+    {
+        SignalTrace::Edge edge;
+        while (m_trace.pop(edge)) {
+            record(edge);
+        }
+    }
+
+    void record(const SignalTrace::Edge &event)
+    {
+        m_outcome.events.push_back(event);
+        m_outcome.traceHash = chainEvent(m_outcome.traceHash, event);
+        m_outcome.checkpoints.push_back(static_cast<uint16_t>(m_outcome.traceHash));
+    }
+
+    const Script &m_script;
+    FloppyDrive m_drive;
+    Wd1793 m_fdc;
+    SignalTrace m_trace;
+    const bool m_blocks;
+    uint64_t m_hostByteNs;
+    uint64_t m_host;        // Host clock; never behind the controller
+    Outcome m_outcome;
+};
+
+// Empty when the outcome matches
+std::string compare(const Outcome &outcome, const Golden &golden)
+{
+    std::string report;
+    if (outcome.events.size() != golden.events || outcome.traceHash != golden.traceHash) {
+        // The hashes are chained, so every checkpoint after the first
+        // diverging event differs as well
+        size_t first = 0;
+        while (first < outcome.checkpoints.size() && first < golden.checkpoints.size()
+               && outcome.checkpoints[first] == golden.checkpoints[first]) {
+            ++first;
+        }
+        char line[160];
+        std::snprintf(line, sizeof(line), "  event trace differs (%zu events, golden %zu); first divergence at event %zu:\n",
+                      outcome.events.size(), golden.events, first);
+        report += line;
+        const size_t from = first > CONTEXT_EVENTS ? first - CONTEXT_EVENTS : 0;
+        for (size_t index = from; index <= first && index < outcome.events.size(); ++index) {
+            report += (index == first ? "> " : "  ") + describe(index, outcome.events[index]) + "\n";
+        }
+        if (first >= outcome.events.size()) {
+            report += "  (the run ends here; golden has more events)\n";
+        }
+    }
+    if (outcome.dataHash != golden.dataHash) {
+        report += "  data read or written differs\n";
+    }
+    return report;
+}
+
+// Empty when the bulk run left the host and the disk where the byte run did
+std::string compareBlocks(const Outcome &bytes, const Outcome &blocks)
+{
+    std::string report;
+    size_t first = 0;
+    while (first < bytes.statuses.size() && first < blocks.statuses.size()
+           && bytes.statuses[first].timeNs == blocks.statuses[first].timeNs
+           && bytes.statuses[first].value == blocks.statuses[first].value) {
+        ++first;
+    }
+    if (first < bytes.statuses.size() || first < blocks.statuses.size()) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "  status after command %zu differs:\n", first);
+        report += line;
+        if (first < bytes.statuses.size()) {
+            report += "  bytes  " + describe(first, bytes.statuses[first]) + "\n";
+        }
+        if (first < blocks.statuses.size()) {
+            report += "  blocks " + describe(first, blocks.statuses[first]) + "\n";
+        }
+    }
+    if (bytes.dataHash != blocks.dataHash) {
+        report += "  data read or written differs\n";
+    }
+    return report;
+}
+
+bool writeGolden(const std::string &path, const std::vector<Script> &scripts, const std::vector<Outcome> &outcomes)
+{
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    std::fprintf(file, "# Golden traces of bench/golden.scripts; regenerate with qt-floppy-golden --update\n");
+    std::fprintf(file, "# <script> <events> <trace hash> <data hash> <low 16 bits of the trace hash after every event>\n");
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        const Outcome &outcome = outcomes[i];
+        std::fprintf(file, "%s %zu %016llx %016llx", scripts[i].name.c_str(), outcome.events.size(),
+                     static_cast<unsigned long long>(outcome.traceHash), static_cast<unsigned long long>(outcome.dataHash));
+        if (!outcome.checkpoints.empty()) {
+            std::fprintf(file, " ");
+        }
+        for (uint16_t checkpoint : outcome.checkpoints) {
+            std::fprintf(file, "%04x", checkpoint);
+        }
+        std::fprintf(file, "\n");
+    }
+    return std::fclose(file) == 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string scriptsPath = QT_FLOPPY_SOURCE_DIR "/bench/golden.scripts";
+    std::string goldenPath = QT_FLOPPY_SOURCE_DIR "/bench/golden.txt";
+    std::string filter;
+    std::string dump;
+    int threads = 0;
+    bool update = false;
+    bool blocks = false;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--scripts" && hasValue) {
+            scriptsPath = argv[++i];
+        } else if (arg == "--golden" && hasValue) {
+            goldenPath = argv[++i];
+        } else if (arg == "--filter" && hasValue) {
+            filter = argv[++i];
+        } else if (arg == "--dump" && hasValue) {
+            dump = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg == "--blocks") {
+            blocks = true;
+        } else {
+            usage = true;
+        }
+    }
+    if (usage || (update && (!filter.empty() || blocks))) {
+        std::fprintf(stderr, "usage: %s [--scripts bench/golden.scripts] [--golden bench/golden.txt]\n"
+                             "       [--filter name] [--threads N] [--update] [--dump name] [--blocks]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    std::vector<Script> scripts;
+    std::string error;
+    if (!readScripts(scriptsPath, scripts, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    const std::string only = dump.empty() ? filter : dump;
+    if (!only.empty()) {
+        scripts.erase(std::remove_if(scripts.begin(), scripts.end(),
+                                     [&](const Script &script) { return script.name.find(only) == std::string::npos; }),
+                      scripts.end());
+    }
+
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<Outcome> outcomes(scripts.size());
+    std::vector<Outcome> blockOutcomes(blocks ? scripts.size() : 0);
+    TaskPool pool(threads);
+    pool.parallelFor(scripts.size(), [&](size_t index, int) {
+        outcomes[index] = Runner(scripts[index]).run();
+        if (blocks) {
+            blockOutcomes[index] = Runner(scripts[index], true).run();
+        }
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    int failures = 0;
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        const std::string &error = outcomes[i].error.empty() && blocks ? blockOutcomes[i].error : outcomes[i].error;
+        if (!error.empty()) {
+            std::printf("%s: %s\n", scripts[i].name.c_str(), error.c_str());
+            ++failures;
+        }
+    }
+    if (failures > 0) {
+        return 1;
+    }
+
+    if (blocks) {
+        size_t commands = 0;
+        for (size_t i = 0; i < scripts.size(); ++i) {
+            commands += outcomes[i].statuses.size();
+            const std::string report = compareBlocks(outcomes[i], blockOutcomes[i]);
+            if (!report.empty()) {
+                std::printf("%s: BLOCKS DIFFER (script at %s:%d)\n%s", scripts[i].name.c_str(), scriptsPath.c_str(),
+                            scripts[i].line, report.c_str());
+                ++failures;
+            }
+        }
+        std::printf("%zu scripts, %zu commands, %d differ with block transfers, %.2f s\n", scripts.size(), commands,
+                    failures, elapsed.count());
+        return failures > 0 ? 1 : 0;
+    }
+
+    if (!dump.empty()) {
+        for (size_t i = 0; i < scripts.size(); ++i) {
+            std::printf("# %s\n", scripts[i].name.c_str());
+            for (size_t index = 0; index < outcomes[i].events.size(); ++index) {
+                std::printf("%s\n", describe(index, outcomes[i].events[index]).c_str());
+            }
+        }
+        return 0;
+    }
+    if (update) {
+        if (!writeGolden(goldenPath, scripts, outcomes)) {
+            std::fprintf(stderr, "%s: cannot write\n", goldenPath.c_str());
+            return 1;
+        }
+        std::printf("%zu scripts written to %s\n", scripts.size(), goldenPath.c_str());
+        return 0;
+    }
+
+    std::map<std::string, Golden> golden;
+    if (!readGolden(goldenPath, golden)) {
+        std::fprintf(stderr, "%s: cannot open\n", goldenPath.c_str());
+        return 1;
+    }
+    size_t events = 0;
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        events += outcomes[i].events.size();
+        const auto found = golden.find(scripts[i].name);
+        if (found == golden.end()) {
+            std::printf("%s: no golden trace\n", scripts[i].name.c_str());
+            ++failures;
+            continue;
+        }
+        const std::string report = compare(outcomes[i], found->second);
+        if (!report.empty()) {
+            std::printf("%s: MISMATCH (script at %s:%d)\n%s", scripts[i].name.c_str(), scriptsPath.c_str(),
+                        scripts[i].line, report.c_str());
+            ++failures;
+        }
+    }
+    std::printf("%zu scripts, %zu events, %d mismatched, %.2f s\n", scripts.size(), events, failures, elapsed.count());
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,334 @@
+// Shared memory bus vs. local socket: runs the same Beta Disk style polling
+// loop (status/pins polls and data reads, one round trip per port access)
+// over a Unix domain socket with the batched protocol, over the shared
+// memory rings served by another thread, and over the rings drained by the
+// host thread itself. Fails unless the ring is at least 10x faster than
+// the socket and all paths read the same bytes. The cross-thread ring is
+// the one checked; on a single CPU, where every round trip there is a
+// context switch just like the socket's, the host-drained ring is.
+//
+// It also checks a host that submits commands and never polls events: the
+// service has to stop taking commands once the event ring is full, leave
+// the controller lock free and still stop when asked. --stalled-host runs
+// only that check, as ctest does.
+
+#include "diskimage.h"
+#include "fdchostprotocol.h"
+#include "fdcsharedbus.h"
+#include "floppydrive.h"
+#include "syntheticdisk.h"
+#include "wd1793.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int SECTORS_TO_READ = 24;
+constexpr uint32_t CLOCK_HZ = 3500000;
+constexpr double REQUIRED_SPEEDUP = 10.0;
+
+using Access = std::function<uint8_t(bool write, uint8_t reg, uint8_t value, uint64_t cycle)>;
+
+// TR-DOS style read loop; returns the number of port accesses and a checksum of everything read
+struct Result {
+    size_t accesses = 0;
+    uint64_t checksum = 0;
+    double seconds = 0;
+};
+
+Result runWorkload(const Access &access)
+{
+    using namespace FdcHostProtocol;
+    Result result;
+    uint64_t cycle = 0;
+    auto port = [&](bool write, uint8_t reg, uint8_t value) {
+        const uint8_t read = access(write, reg, value, cycle);
+        ++result.accesses;
+        result.checksum = result.checksum * 1099511628211ULL + read + (write ? 0 : 1);
+        return read;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    port(true, REG_SYSTEM, SYSTEM_DOUBLE_DENSITY);
+    for (int n = 0; n < SECTORS_TO_READ; ++n) {
+        port(true, REG_SECTOR, static_cast<uint8_t>(n % 16 + 1));
+        port(true, REG_STATUS_COMMAND, 0x80);
+        cycle += 100;
+        for (;;) {
+            const uint8_t pins = port(false, REG_SYSTEM, 0);
+            cycle += 27;
+            if (pins & SYSTEM_DRQ) {
+                port(false, REG_DATA, 0);
+                cycle += 21;
+            } else if (pins & SYSTEM_INTRQ) {
+                break;
+            }
+        }
+        port(false, REG_STATUS_COMMAND, 0);
+        cycle += 1000;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+struct Machine {
+    FloppyDrive drive;
+    Wd1793 controller;
+    std::mutex lock;
+
+    Machine()
+    {
+        drive.insertDisk(SyntheticDisk::makeImage(80, 2));
+        controller.setDrive(&drive);
+    }
+};
+
+bool readFully(int fd, void *data, size_t size)
+{
+    uint8_t *out = static_cast<uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t got = ::read(fd, out, size);
+        if (got <= 0) {
+            return false;
+        }
+        out += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void *data, size_t size)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t put = ::write(fd, in, size);
+        if (put <= 0) {
+            return false;
+        }
+        in += put;
+        size -= static_cast<size_t>(put);
+    }
+    return true;
+}
+
+Result runSocket()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::perror("socketpair");
+        std::exit(2);
+    }
+
+    // Same framing as FdcHostServer, without the Qt event loop
+    Machine machine;
+    std::thread server([&machine, fd = fds[1]]() {
+        std::vector<uint8_t> request;
+        std::vector<uint8_t> reply;
+        uint8_t prefix[sizeof(uint32_t)];
+        while (readFully(fd, prefix, sizeof(prefix))) {
+            const uint32_t length = FdcHostProtocol::loadLe32(prefix);
+            request.resize(length);
+            if (!readFully(fd, request.data(), length)) {
+                break;
+            }
+            reply.assign(sizeof(uint32_t), 0);
+            FdcHostProtocol::execute(machine.controller, request.data(), length, reply);
+            FdcHostProtocol::storeLe32(reply.data(), static_cast<uint32_t>(reply.size() - sizeof(uint32_t)));
+            if (!writeFully(fd, reply.data(), reply.size())) {
+                break;
+            }
+        }
+    });
+
+    FdcHostProtocol::BatchWriter batch(CLOCK_HZ);
+    std::vector<uint8_t> reply;
+    const int fd = fds[0];
+    Result result = runWorkload([&](bool write, uint8_t reg, uint8_t value, uint64_t cycle) -> uint8_t {
+        batch.begin(cycle);
+        if (write) {
+            batch.write(reg, value, cycle);
+        } else {
+            batch.read(reg, cycle);
+        }
+        const std::vector<uint8_t> &frame = batch.frame();
+        uint8_t prefix[sizeof(uint32_t)];
+        if (!writeFully(fd, frame.data(), frame.size()) || !readFully(fd, prefix, sizeof(prefix))) {
+            std::exit(2);
+        }
+        const uint32_t length = FdcHostProtocol::loadLe32(prefix);
+        reply.resize(length);
+        readFully(fd, reply.data(), length);
+        return write ? 0 : reply[sizeof(FdcHostProtocol::ReplyHeader)];
+    });
+
+    shutdown(fd, SHUT_RDWR);
+    server.join();
+    close(fds[0]);
+    close(fds[1]);
+    return result;
+}
+
+Result runSharedBus(bool serviceThread)
+{
+    using namespace FdcSharedBusLayout;
+    std::string error;
+    const std::string name = "/qt-floppy-bench-" + std::to_string(getpid());
+    std::unique_ptr<FdcSharedBus> owner = FdcSharedBus::create(name, &error);
+    if (!owner) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        std::exit(2);
+    }
+    // The host maps the region on its own, as an external emulator would
+    std::unique_ptr<FdcSharedBus> host = FdcSharedBus::open(name, &error);
+    if (!host) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        std::exit(2);
+    }
+    host->region().clockHz.store(CLOCK_HZ);
+
+    Machine machine;
+    FdcSharedBusService service(*owner, machine.controller, machine.lock);
+    if (serviceThread) {
+        service.start();
+    }
+
+    const int spinLimit = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+    Result result = runWorkload([&](bool write, uint8_t reg, uint8_t value, uint64_t cycle) -> uint8_t {
+        BusCommand command = {};
+        command.cycle = cycle;
+        command.kind = write ? COMMAND_WRITE : COMMAND_READ;
+        command.reg = reg;
+        command.value = value;
+        host->submit(command);
+        BusEvent event;
+        int spins = 0;
+        while (!host->poll(event)) {
+            if (!serviceThread) {
+                service.drain();
+            } else if (++spins > spinLimit) {
+                std::this_thread::yield();
+            }
+        }
+        return event.value;
+    });
+
+    service.stop();
+    return result;
+}
+
+bool runStalledHost()
+{
+    using namespace FdcSharedBusLayout;
+    std::string error;
+    const std::string name = "/qt-floppy-stall-" + std::to_string(getpid());
+    std::unique_ptr<FdcSharedBus> owner = FdcSharedBus::create(name, &error);
+    std::unique_ptr<FdcSharedBus> host = owner ? FdcSharedBus::open(name, &error) : nullptr;
+    if (!host) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        std::exit(2);
+    }
+    host->region().clockHz.store(CLOCK_HZ);
+
+    Machine machine;
+    FdcSharedBusService service(*owner, machine.controller, machine.lock);
+    service.start();
+
+    // Enough to fill the event ring and then the command ring behind it
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    BusCommand command = {};
+    command.kind = COMMAND_READ;
+    command.reg = FdcHostProtocol::REG_TRACK;
+    size_t submitted = 0;
+    while (submitted < 2 * RING_SLOTS && std::chrono::steady_clock::now() < deadline) {
+        if (host->submit(command)) {
+            ++submitted;
+            command.cycle += 30;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    const Region &region = host->region();
+    while (region.commandsExecuted.load() < RING_SLOTS && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const uint64_t executed = region.commandsExecuted.load();
+    const bool commandRingFull = !host->submit(command);
+    const bool lockFree = machine.lock.try_lock();
+    if (lockFree) {
+        machine.lock.unlock();
+    }
+
+    std::atomic<bool> stopped(false);
+    std::thread stopper([&service, &stopped]() {
+        service.stop();
+        stopped.store(true);
+    });
+    while (!stopped.load() && std::chrono::steady_clock::now() < deadline + std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!stopped.load()) {
+        std::fprintf(stderr, "stalled host: service did not stop\n");
+        std::_Exit(1);
+    }
+    stopper.join();
+
+    size_t answered = 0;
+    BusEvent event;
+    while (host->poll(event)) {
+        ++answered;
+    }
+    const bool ok = submitted == 2 * RING_SLOTS && executed == RING_SLOTS && answered == RING_SLOTS
+                 && commandRingFull && lockFree;
+    std::printf("stalled host: %zu submitted, %llu executed, %zu answered, lock %s: %s\n", submitted,
+                static_cast<unsigned long long>(executed), answered, lockFree ? "free" : "HELD", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+void report(const char *name, const Result &result, double baseline)
+{
+    std::printf("%-22s %10zu %10.3f %12.2f %9.1fx\n", name, result.accesses, result.seconds,
+                result.accesses / result.seconds / 1e6, baseline / result.seconds);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::strcmp(argv[1], "--stalled-host") == 0) {
+        return runStalledHost() ? 0 : 1;
+    }
+
+    const Result socket = runSocket();
+    const Result ring = runSharedBus(true);
+    const Result inline_ = runSharedBus(false);
+
+    std::printf("%-22s %10s %10s %12s %10s\n", "path", "accesses", "seconds", "Maccess/s", "speedup");
+    report("local socket", socket, socket.seconds);
+    report("shm ring (thread)", ring, socket.seconds);
+    report("shm ring (inline)", inline_, socket.seconds);
+
+    const bool identical = ring.checksum == socket.checksum && inline_.checksum == socket.checksum
+                        && ring.accesses == socket.accesses && inline_.accesses == socket.accesses;
+    const bool singleCpu = std::thread::hardware_concurrency() < 2;
+    const double speedup = socket.seconds / (singleCpu ? inline_.seconds : ring.seconds);
+    std::printf("identical: %s\n", identical ? "yes" : "NO");
+    std::printf("shm ring%s vs socket: %.1fx (required %.0fx)\n", singleCpu ? " (inline, single CPU)" : "",
+                speedup, REQUIRED_SPEEDUP);
+    const bool stalled = runStalledHost();
+    return identical && speedup >= REQUIRED_SPEEDUP && stalled ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include "syntheticdisk.h"
+#include "bitstreamencoder.h"
+
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace SyntheticDisk {
+
+namespace {
+
+constexpr double CELL_NS = 2000.0;
+constexpr double SCP_TICK_NS = 25.0;
+
+void putLe32(std::vector<uint8_t> &out, size_t at, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out[at + i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+
+// Writes the cells as jittered 16-bit SCP samples
+void appendRevolution(std::vector<uint8_t> &out, const BitstreamEncoder &encoder, std::mt19937 &rng, uint32_t &fluxCount)
+{
+    std::normal_distribution<double> jitter(0.0, 60.0);
+    const std::vector<uint8_t> &cells = encoder.cells();
+    uint32_t run = 0;
+    fluxCount = 0;
+    for (size_t cell = 0; cell < encoder.cellCount(); ++cell) {
+        ++run;
+        if (cells[cell / 8] & (0x80 >> (cell % 8))) {
+            const double ns = run * CELL_NS + jitter(rng);
+            const uint32_t ticks = static_cast<uint32_t>(ns / SCP_TICK_NS + 0.5);
+            out.push_back(static_cast<uint8_t>(ticks >> 8));
+            out.push_back(static_cast<uint8_t>(ticks & 0xFF));
+            ++fluxCount;
+            run = 0;
+        }
+    }
+}
+
+} // namespace
+
+Track makeTrack(int cylinder, int side, Encoding encoding)
+{
+    Track track;
+    track.cylinder = cylinder;
+    track.side = side;
+    track.encoding = encoding;
+    track.revolutions = 1;
+    const int sizeCode = encoding == Encoding::MFM ? 1 : 0;
+    for (int id = 1; id <= SECTORS; ++id) {
+        Sector sector;
+        sector.cylinder = static_cast<uint8_t>(cylinder);
+        sector.head = static_cast<uint8_t>(side);
+        sector.id = static_cast<uint8_t>(id);
+        sector.sizeCode = static_cast<uint8_t>(sizeCode);
+        sector.data.resize(static_cast<size_t>(sector.size()));
+        for (size_t i = 0; i < sector.data.size(); ++i) {
+            sector.data[i] = static_cast<uint8_t>(cylinder * 31 + side * 7 + id * 3 + i);
+        }
+        track.sectors.push_back(sector);
+    }
+    return track;
+}
+
+std::shared_ptr<DiskImage> makeImage(int cylinders, int sides, Encoding encoding)
+{
+    auto image = std::make_shared<DiskImage>(cylinders, sides);
+    for (int cylinder = 0; cylinder < cylinders; ++cylinder) {
+        for (int side = 0; side < sides; ++side) {
+            *image->track(cylinder, side) = makeTrack(cylinder, side, encoding);
+        }
+    }
+    image->updateLayout();
+    return image;
+}
+
+bool writeScp(const std::string &path, int cylinders, int sides, int revolutions, unsigned seed)
+{
+    const int tracks = cylinders * sides;
+    std::vector<uint8_t> file(0x10 + 168 * 4, 0);
+    std::memcpy(file.data(), "SCP", 3);
+    file[3] = 0x22;
+    file[5] = static_cast<uint8_t>(revolutions);
+    file[6] = 0;
+    file[7] = static_cast<uint8_t>(tracks - 1);
+    file[8] = 0x01;
+
+    std::mt19937 rng(seed);
+    BitstreamEncoder encoder(Encoding::MFM);
+    for (int track = 0; track < tracks; ++track) {
+        encoder.encodeTrack(makeTrack(track / sides, track % sides));
+        const size_t header = file.size();
+        putLe32(file, 0x10 + track * 4, static_cast<uint32_t>(header));
+        file.resize(header + 4 + revolutions * 12, 0);
+        std::memcpy(&file[header], "TRK", 3);
+        file[header + 3] = static_cast<uint8_t>(track);
+        for (int revolution = 0; revolution < revolutions; ++revolution) {
+            const uint32_t offset = static_cast<uint32_t>(file.size() - header);
+            uint32_t fluxCount = 0;
+            appendRevolution(file, encoder, rng, fluxCount);
+            putLe32(file, header + 4 + revolution * 12, static_cast<uint32_t>(200e6 / SCP_TICK_NS));
+            putLe32(file, header + 8 + revolution * 12, fluxCount);
+            putLe32(file, header + 12 + revolution * 12, offset);
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+    return static_cast<bool>(out);
+}
+
+bool sameImage(const DiskImage &a, const DiskImage &b)
+{
+    if (a.cylinderCount() != b.cylinderCount() || a.sideCount() != b.sideCount()) {
+        return false;
+    }
+    for (int cylinder = 0; cylinder < a.cylinderCount(); ++cylinder) {
+        for (int side = 0; side < a.sideCount(); ++side) {
+            const Track *ta = a.track(cylinder, side);
+            const Track *tb = b.track(cylinder, side);
+            if (ta->sectors.size() != tb->sectors.size() || ta->encoding != tb->encoding) {
+                return false;
+            }
+            for (size_t i = 0; i < ta->sectors.size(); ++i) {
+                const Sector &sa = ta->sectors[i];
+                const Sector &sb = tb->sectors[i];
+                if (sa.id != sb.id || sa.dataCrcOk != sb.dataCrcOk || sa.weak != sb.weak
+                    || sa.angle != sb.angle || sa.data != sb.data) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace SyntheticDisk
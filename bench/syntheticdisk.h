@@ -0,0 +1,26 @@
+#ifndef SYNTHETICDISK_H
+#define SYNTHETICDISK_H
+
+#include "diskimage.h"
+
+#include <memory>
+#include <string>
+
+// Deterministic TR-DOS style test disks shared by the benches: 16 sectors
+// of 256 bytes per track with a data pattern derived from the position.
+namespace SyntheticDisk {
+
+constexpr int SECTORS = 16;
+
+Track makeTrack(int cylinder, int side, Encoding encoding = Encoding::MFM);
+std::shared_ptr<DiskImage> makeImage(int cylinders, int sides, Encoding encoding = Encoding::MFM);
+
+// Writes an SCP capture of makeImage() with jittered flux, 'revolutions'
+// revolutions per track
+bool writeScp(const std::string &path, int cylinders, int sides, int revolutions, unsigned seed = 1793);
+
+bool sameImage(const DiskImage &a, const DiskImage &b);
+
+} // namespace SyntheticDisk
+
+#endif // SYNTHETICDISK_H
@@ -0,0 +1,72 @@
+#include "accesstrace.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+bool AccessTrace::load(const std::string &path, std::string *error)
+{
+    std::ifstream in(path);
+    if (!in) {
+        if (error) {
+            *error = "Cannot open " + path;
+        }
+        return false;
+    }
+
+    std::vector<Access> accesses;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream fields(line);
+        std::string kind;
+        if (!(fields >> kind)) {
+            continue;
+        }
+        Access access;
+        double idleUs = 0.0;
+        if ((kind != "R" && kind != "W") || !(fields >> access.cylinder >> access.side >> access.sector >> idleUs)
+            || access.cylinder < 0 || access.side < 0 || access.side > 1 || idleUs < 0.0) {
+            if (error) {
+                *error = path + ":" + std::to_string(lineNumber) + ": expected R|W cylinder side sector idle_us";
+            }
+            return false;
+        }
+        access.write = kind == "W";
+        access.idleNs = static_cast<uint64_t>(idleUs * 1000.0 + 0.5);
+        accesses.push_back(access);
+    }
+    m_accesses = std::move(accesses);
+    return true;
+}
+
+bool AccessTrace::save(const std::string &path, std::string *error) const
+{
+    std::ofstream out(path);
+    if (!out) {
+        if (error) {
+            *error = "Cannot create " + path;
+        }
+        return false;
+    }
+    out << "# qt-floppy access trace: R|W cylinder side sector idle_us\n";
+    char line[64];
+    for (const Access &access : m_accesses) {
+        std::snprintf(line, sizeof(line), "%c %d %d %d %.3f\n", access.write ? 'W' : 'R', access.cylinder,
+                      access.side, access.sector, access.idleNs / 1000.0);
+        out << line;
+    }
+    out.flush();
+    if (!out) {
+        if (error) {
+            *error = "Cannot write " + path;
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef ACCESSTRACE_H
+#define ACCESSTRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sector accesses of a host program in the order it issued them, each with
+// the time the host spent on its own between controller commands (seeks
+// and other commands do not count; they are redone on replay). Wd1793
+// records into it; the text form has one access per line:
+//   R|W <cylinder> <side> <sector id> <idle microseconds>
+// with '#' starting a comment.
+class AccessTrace
+{
+public:
+    struct Access {
+        int cylinder = 0;
+        int side = 0;
+        int sector = 1;
+        bool write = false;
+        uint64_t idleNs = 0;
+    };
+
+    void clear() { m_accesses.clear(); }
+    void append(const Access &access) { m_accesses.push_back(access); }
+
+    const std::vector<Access> &accesses() const { return m_accesses; }
+    size_t size() const { return m_accesses.size(); }
+    bool empty() const { return m_accesses.empty(); }
+
+    bool load(const std::string &path, std::string *error = nullptr);
+    bool save(const std::string &path, std::string *error = nullptr) const;
+
+private:
+    std::vector<Access> m_accesses;
+};
+
+#endif // ACCESSTRACE_H
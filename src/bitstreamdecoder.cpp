@@ -0,0 +1,303 @@
+#include "bitstreamdecoder.h"
+#include "crc16.h"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// Interleaves a clock and a data byte into the 16 cells written to disk
+constexpr uint16_t encodeWord(uint8_t clock, uint8_t data)
+{
+    uint16_t raw = 0;
+    for (int bit = 7; bit >= 0; --bit) {
+        raw = static_cast<uint16_t>((raw << 2) | (((clock >> bit) & 1) << 1) | ((data >> bit) & 1));
+    }
+    return raw;
+}
+
+// A1 with the clock between bits 4 and 5 missing
+constexpr uint16_t MFM_SYNC_WORD = 0x4489;
+constexpr uint8_t MFM_SYNC_BYTE = 0xA1;
+
+// FM address marks carry a C7 clock pattern
+constexpr uint8_t FM_MARK_CLOCK = 0xC7;
+constexpr uint16_t FM_IDAM_WORD = encodeWord(FM_MARK_CLOCK, 0xFE);
+constexpr uint16_t FM_DAM_WORD = encodeWord(FM_MARK_CLOCK, 0xFB);
+constexpr uint16_t FM_DDAM_WORD = encodeWord(FM_MARK_CLOCK, 0xF8);
+constexpr uint16_t FM_DAM_F9_WORD = encodeWord(FM_MARK_CLOCK, 0xF9);
+constexpr uint16_t FM_DAM_FA_WORD = encodeWord(FM_MARK_CLOCK, 0xFA);
+
+constexpr uint8_t IDAM = 0xFE;
+
+// The WD1793 gives up on a data mark this many bytes after the ID field
+constexpr uint64_t MFM_DAM_WINDOW_CELLS = 43 * 16;
+constexpr uint64_t FM_DAM_WINDOW_CELLS = 30 * 16;
+
+// Data bits of the 8 cells in a byte of the raw stream (the even positions)
+constexpr std::array<uint8_t, 256> makeDataBits()
+{
+    std::array<uint8_t, 256> table{};
+    for (int cells = 0; cells < 256; ++cells) {
+        table[cells] = static_cast<uint8_t>((cells & 1) | ((cells >> 1) & 2) | ((cells >> 2) & 4) | ((cells >> 3) & 8));
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> DATA_BITS = makeDataBits();
+
+bool isDataMark(uint8_t mark)
+{
+    return mark >= 0xF8 && mark <= 0xFB;
+}
+
+} // namespace
+
+BitstreamDecoder::BitstreamDecoder(Encoding encoding)
+    : m_encoding(encoding)
+    , m_state(State::Hunting)
+    , m_shift(0)
+    , m_cells(0)
+    , m_cellsInWord(0)
+    , m_syncCount(0)
+    , m_crc(Crc16::INITIAL_VALUE)
+    , m_markCell(0)
+    , m_deletedMark(false)
+    , m_fieldLength(0)
+    , m_hasPendingId(false)
+    , m_pendingIdCell(0)
+    , m_pendingIdEnd(0)
+{
+    m_field.reserve(1024 + 2);
+}
+
+void BitstreamDecoder::reset()
+{
+    m_state = State::Hunting;
+    m_shift = 0;
+    m_cells = 0;
+    m_cellsInWord = 0;
+    m_syncCount = 0;
+    m_hasPendingId = false;
+    m_field.clear();
+    m_sectors.clear();
+    m_sectorCells.clear();
+}
+
+uint8_t BitstreamDecoder::decodeWord(uint16_t raw)
+{
+    // Data cells sit on the even bit positions, clock cells on the odd ones
+    return static_cast<uint8_t>((DATA_BITS[raw >> 8] << 4) | DATA_BITS[raw & 0xFF]);
+}
+
+void BitstreamDecoder::pushCell(bool transition)
+{
+    m_shift = (m_shift << 1) | (transition ? 1u : 0u);
+    ++m_cells;
+
+    if (m_state == State::Hunting) {
+        const uint16_t raw = static_cast<uint16_t>(m_shift);
+        if (isMark(raw)) {
+            startMark(raw);
+        }
+        return;
+    }
+
+    if (++m_cellsInWord < 16) {
+        return;
+    }
+    m_cellsInWord = 0;
+    handleWord(static_cast<uint16_t>(m_shift));
+}
+
+void BitstreamDecoder::pushWords(const uint8_t *cells, size_t words)
+{
+    auto word = [cells](size_t index) { return static_cast<uint16_t>((cells[2 * index] << 8) | cells[2 * index + 1]); };
+
+    size_t i = 0;
+    while (i < words) {
+        const uint16_t raw = word(i);
+        if (m_state == State::Hunting ? markBeforeWordEnd(raw) : m_cellsInWord != 0) {
+            for (int bit = 15; bit >= 0; --bit) {
+                pushCell((raw >> bit) & 1);
+            }
+            ++i;
+        } else if (m_state == State::IdField || m_state == State::DataField) {
+            // The rest of the field in one go
+            const size_t have = m_field.size();
+            const size_t take = std::min(m_fieldLength - have, words - i);
+            m_field.resize(have + take);
+            for (size_t k = 0; k < take; ++k) {
+                const uint16_t value = word(i + k);
+                m_field[have + k] = decodeWord(value);
+                m_shift = (m_shift << 16) | value;
+            }
+            m_cells += 16 * take;
+            i += take;
+            if (m_field.size() == m_fieldLength) {
+                completeField();
+            }
+        } else {
+            m_shift = (m_shift << 16) | raw;
+            m_cells += 16;
+            ++i;
+            if (m_state == State::Marks) {
+                handleWord(raw);
+            } else if (isMark(raw)) {
+                startMark(raw);
+            }
+        }
+    }
+}
+
+bool BitstreamDecoder::isMark(uint16_t raw) const
+{
+    if (m_encoding == Encoding::MFM) {
+        return raw == MFM_SYNC_WORD;
+    }
+    return raw == FM_IDAM_WORD || raw == FM_DAM_WORD || raw == FM_DDAM_WORD || raw == FM_DAM_F9_WORD ||
+           raw == FM_DAM_FA_WORD;
+}
+
+bool BitstreamDecoder::markBeforeWordEnd(uint16_t raw) const
+{
+    const uint32_t cells = (m_shift << 16) | raw;
+    for (int shift = 1; shift < 16; ++shift) {
+        if (isMark(static_cast<uint16_t>(cells >> shift))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BitstreamDecoder::startMark(uint16_t raw)
+{
+    m_cellsInWord = 0;
+    m_markCell = m_cells - 16;
+    if (m_encoding == Encoding::MFM) {
+        m_state = State::Marks;
+        m_syncCount = 1;
+        return;
+    }
+    const uint8_t mark = decodeWord(raw);
+    startField(mark, Crc16::update(Crc16::INITIAL_VALUE, mark));
+}
+
+void BitstreamDecoder::handleWord(uint16_t raw)
+{
+    if (m_state == State::Marks) {
+        if (raw == MFM_SYNC_WORD) {
+            ++m_syncCount;
+            return;
+        }
+        // The CRC covers every A1 the controller synced on; only three make a valid field
+        uint16_t crc = Crc16::INITIAL_VALUE;
+        for (int i = 0; i < m_syncCount; ++i) {
+            crc = Crc16::update(crc, MFM_SYNC_BYTE);
+        }
+        const uint8_t mark = decodeWord(raw);
+        startField(mark, Crc16::update(crc, mark));
+        return;
+    }
+
+    m_field.push_back(decodeWord(raw));
+    if (m_field.size() == m_fieldLength) {
+        completeField();
+    }
+}
+
+void BitstreamDecoder::startField(uint8_t mark, uint16_t crc)
+{
+    m_crc = crc;
+    m_field.clear();
+
+    if (mark == IDAM) {
+        flushPendingId();
+        m_state = State::IdField;
+        m_fieldLength = 4 + 2;
+        return;
+    }
+
+    const uint64_t window = (m_encoding == Encoding::MFM) ? MFM_DAM_WINDOW_CELLS : FM_DAM_WINDOW_CELLS;
+    if (isDataMark(mark) && m_hasPendingId && m_markCell - m_pendingIdEnd <= window) {
+        m_state = State::DataField;
+        m_fieldLength = static_cast<size_t>(m_pendingId.size()) + 2;
+        m_deletedMark = (mark == 0xF8 || mark == 0xF9);
+        return;
+    }
+
+    m_state = State::Hunting;
+}
+
+void BitstreamDecoder::completeField()
+{
+    // Running the CRC over the field and its stored CRC leaves zero when intact
+    const bool crcOk = Crc16::update(m_crc, m_field.data(), m_field.size()) == 0;
+
+    if (m_state == State::IdField) {
+        Sector sector;
+        sector.cylinder = m_field[0];
+        sector.head = m_field[1];
+        sector.id = m_field[2];
+        sector.sizeCode = m_field[3];
+        sector.idCrcOk = crcOk;
+        sector.dataCrcOk = false;
+        if (crcOk) {
+            m_pendingId = sector;
+            m_hasPendingId = true;
+            m_pendingIdCell = m_markCell;
+            m_pendingIdEnd = m_cells;
+        } else {
+            m_sectors.push_back(sector);
+            m_sectorCells.push_back(m_markCell);
+        }
+    } else {
+        Sector sector = m_pendingId;
+        sector.data.assign(m_field.begin(), m_field.end() - 2);
+        sector.dataCrcOk = crcOk;
+        sector.deleted = m_deletedMark;
+        m_sectors.push_back(std::move(sector));
+        m_sectorCells.push_back(m_pendingIdCell);
+        m_hasPendingId = false;
+    }
+
+    m_state = State::Hunting;
+}
+
+void BitstreamDecoder::flushPendingId()
+{
+    // An ID field without a data field still marks the sector as present
+    if (m_hasPendingId) {
+        m_sectors.push_back(m_pendingId);
+        m_sectorCells.push_back(m_pendingIdCell);
+        m_hasPendingId = false;
+    }
+}
+
+void BitstreamDecoder::finish()
+{
+    flushPendingId();
+    m_state = State::Hunting;
+
+    const double total = m_cells > 0 ? static_cast<double>(m_cells) : 1.0;
+    for (size_t i = 0; i < m_sectors.size(); ++i) {
+        m_sectors[i].angle = static_cast<float>(static_cast<double>(m_sectorCells[i]) / total);
+    }
+}
+
+std::vector<Sector> BitstreamDecoder::takeSectors()
+{
+    std::vector<Sector> result;
+    result.swap(m_sectors);
+    m_sectorCells.clear();
+    return result;
+}
+
+int BitstreamDecoder::goodSectorCount() const
+{
+    int count = 0;
+    for (const Sector &sector : m_sectors) {
+        count += (sector.idCrcOk && sector.dataCrcOk) ? 1 : 0;
+    }
+    return count;
+}
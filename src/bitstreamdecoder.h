@@ -0,0 +1,89 @@
+#ifndef BITSTREAMDECODER_H
+#define BITSTREAMDECODER_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Streaming FM/MFM decoder. Bitcells are pushed one revolution at a time
+// (cell 0 is the index pulse); address marks are found in the raw cell
+// stream, ID and data fields are decoded and CRC-checked as they pass.
+class BitstreamDecoder
+{
+public:
+    explicit BitstreamDecoder(Encoding encoding = Encoding::MFM);
+
+    Encoding encoding() const { return m_encoding; }
+
+    // Starts a new revolution, dropping any decoded sectors
+    void reset();
+
+    void pushCell(bool transition);
+
+    // Convenience for the PLL output: 'zeros' empty cells then a transition
+    void pushFlux(int zeros)
+    {
+        for (int i = 0; i < zeros; ++i) {
+            pushCell(false);
+        }
+        pushCell(true);
+    }
+
+    // Same as pushing the 16 * 'words' cells one by one, for cells packed
+    // most significant bit first. Goes a 16-cell word at a time while the
+    // fields line up with the words, as they do in streams written byte by
+    // byte; a mark that starts off the word grid drops to single cells.
+    void pushWords(const uint8_t *cells, size_t words);
+
+    // Ends the revolution and resolves sector angles against its length
+    void finish();
+
+    const std::vector<Sector> &sectors() const { return m_sectors; }
+    std::vector<Sector> takeSectors();
+    int goodSectorCount() const;
+    uint64_t cellCount() const { return m_cells; }
+
+    static uint8_t decodeWord(uint16_t raw);
+
+private:
+    enum class State {
+        Hunting,
+        Marks,
+        IdField,
+        DataField
+    };
+
+    bool isMark(uint16_t raw) const;
+    // A mark ends in the 16 cells before 'raw' and its first 15 cells
+    bool markBeforeWordEnd(uint16_t raw) const;
+    void startMark(uint16_t raw);
+    void handleWord(uint16_t raw);
+    void startField(uint8_t mark, uint16_t crc);
+    void completeField();
+    void flushPendingId();
+
+    Encoding m_encoding;
+    State m_state;
+    uint32_t m_shift;
+    uint64_t m_cells;
+    int m_cellsInWord;
+    int m_syncCount;
+    uint16_t m_crc;
+    uint64_t m_markCell;
+    bool m_deletedMark;
+
+    std::vector<uint8_t> m_field;
+    size_t m_fieldLength;
+
+    Sector m_pendingId;
+    bool m_hasPendingId;
+    uint64_t m_pendingIdCell;
+    uint64_t m_pendingIdEnd;
+
+    std::vector<Sector> m_sectors;
+    std::vector<uint64_t> m_sectorCells;
+};
+
+#endif // BITSTREAMDECODER_H
@@ -0,0 +1,329 @@
+#include "bitstreamencoder.h"
+#include "crc16.h"
+#include "diskgeometry.h"
+
+#include <array>
+
+namespace {
+
+constexpr uint8_t FM_CLOCK = 0xFF;
+constexpr uint8_t FM_MARK_CLOCK = 0xC7;
+constexpr uint8_t FM_INDEX_MARK_CLOCK = 0xD7;
+constexpr uint8_t INDEX_MARK = 0xFC;
+constexpr uint8_t IDAM = 0xFE;
+constexpr uint8_t DAM = 0xFB;
+constexpr uint8_t DELETED_DAM = 0xF8;
+
+constexpr int NO_MISSING_CLOCK = -1;
+
+// The 16 cells of a byte, clock and data interleaved from the MSB
+constexpr uint16_t interleave(uint8_t clock, uint8_t data)
+{
+    uint16_t cells = 0;
+    for (int bit = 7; bit >= 0; --bit) {
+        cells = static_cast<uint16_t>((cells << 2) | (((clock >> bit) & 1) << 1) | ((data >> bit) & 1));
+    }
+    return cells;
+}
+
+constexpr std::array<uint16_t, 256> makeFmCells()
+{
+    std::array<uint16_t, 256> table{};
+    for (int value = 0; value < 256; ++value) {
+        table[value] = interleave(FM_CLOCK, static_cast<uint8_t>(value));
+    }
+    return table;
+}
+
+// Indexed by the previous data bit (bit 8) and the byte: a clock cell is
+// set only between two zero data cells
+constexpr std::array<uint16_t, 512> makeMfmCells()
+{
+    std::array<uint16_t, 512> table{};
+    for (int index = 0; index < 512; ++index) {
+        const int value = index & 0xFF;
+        const int clock = ~(value | (value >> 1) | ((index >> 8) << 7)) & 0xFF;
+        table[index] = interleave(static_cast<uint8_t>(clock), static_cast<uint8_t>(value));
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> FM_CELLS = makeFmCells();
+constexpr std::array<uint16_t, 512> MFM_CELLS = makeMfmCells();
+
+struct Layout {
+    uint8_t gapByte;
+    int gap4a;
+    int gap1;
+    int sync;
+    int gap2;
+    int gap3Max;
+};
+
+constexpr Layout MFM_LAYOUT = { 0x4E, 80, 50, 12, 22, 54 };
+constexpr Layout FM_LAYOUT = { 0xFF, 40, 26, 6, 11, 27 };
+
+} // namespace
+
+BitstreamEncoder::BitstreamEncoder(Encoding encoding)
+    : m_encoding(encoding)
+    , m_cellCount(0)
+    , m_lastDataBit(false)
+    , m_lastWasSync(false)
+    , m_crc(Crc16::INITIAL_VALUE)
+{
+}
+
+size_t BitstreamEncoder::defaultTrackBytes(Encoding encoding)
+{
+    return Geometry::standard(true, encoding == Encoding::MFM).trackBytes();
+}
+
+size_t BitstreamEncoder::sectorBytes(Encoding encoding, int dataSize)
+{
+    const Layout &layout = (encoding == Encoding::MFM) ? MFM_LAYOUT : FM_LAYOUT;
+    const int syncMarks = (encoding == Encoding::MFM) ? 3 : 0;
+    return static_cast<size_t>(2 * (layout.sync + syncMarks + 1) + 4 + 2 + layout.gap2 + dataSize + 2);
+}
+
+void BitstreamEncoder::clear()
+{
+    m_cells.clear();
+    m_cellCount = 0;
+    m_lastDataBit = false;
+    m_lastWasSync = false;
+    m_crc = Crc16::INITIAL_VALUE;
+}
+
+BitstreamEncoder::State BitstreamEncoder::state() const
+{
+    State state;
+    state.encoding = m_encoding;
+    state.cells = m_cells;
+    state.cellCount = m_cellCount;
+    state.lastDataBit = m_lastDataBit;
+    state.lastWasSync = m_lastWasSync;
+    state.crc = m_crc;
+    return state;
+}
+
+void BitstreamEncoder::restoreState(const State &state)
+{
+    m_encoding = state.encoding;
+    m_cells = state.cells;
+    m_cellCount = state.cellCount;
+    m_lastDataBit = state.lastDataBit;
+    m_lastWasSync = state.lastWasSync;
+    m_crc = state.crc;
+}
+
+void BitstreamEncoder::writeRaw(uint8_t clock, uint8_t data)
+{
+    for (int bit = 7; bit >= 0; --bit) {
+        pushCell((clock >> bit) & 1);
+        pushCell((data >> bit) & 1);
+    }
+    m_lastDataBit = data & 1;
+}
+
+void BitstreamEncoder::writeMfm(uint8_t data, int missingClockBit)
+{
+    // A clock cell is set only between two zero data cells
+    for (int bit = 7; bit >= 0; --bit) {
+        const bool dataBit = (data >> bit) & 1;
+        pushCell(!m_lastDataBit && !dataBit && bit != missingClockBit);
+        pushCell(dataBit);
+        m_lastDataBit = dataBit;
+    }
+}
+
+void BitstreamEncoder::writeByte(uint8_t value)
+{
+    if (m_encoding == Encoding::MFM) {
+        writeMfm(value, NO_MISSING_CLOCK);
+    } else {
+        writeRaw(FM_CLOCK, value);
+    }
+    m_crc = Crc16::update(m_crc, value);
+    m_lastWasSync = false;
+}
+
+void BitstreamEncoder::writeBytes(uint8_t value, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    if (m_encoding == Encoding::MFM) {
+        writeData<Encoding::MFM>(&value, static_cast<size_t>(count), 0);
+    } else {
+        writeData<Encoding::FM>(&value, static_cast<size_t>(count), 0);
+    }
+}
+
+void BitstreamEncoder::writeBytes(const uint8_t *data, size_t size)
+{
+    if (m_encoding == Encoding::MFM) {
+        writeData<Encoding::MFM>(data, size, 1);
+    } else {
+        writeData<Encoding::FM>(data, size, 1);
+    }
+}
+
+template <Encoding Enc>
+void BitstreamEncoder::writeData(const uint8_t *data, size_t size, size_t step)
+{
+    // Whole bytes are always 16 cells, so the stream stays byte aligned
+    // unless padTo() cut it; then it goes cell by cell
+    if ((m_cellCount & 7) != 0) {
+        for (size_t i = 0; i < size; ++i) {
+            writeByte(data[i * step]);
+        }
+        return;
+    }
+
+    const size_t at = m_cells.size();
+    m_cells.resize(at + 2 * size);
+    uint8_t *out = m_cells.data() + at;
+    unsigned last = m_lastDataBit ? 1 : 0;
+    for (size_t i = 0; i < size; ++i) {
+        const uint8_t value = data[i * step];
+        const uint16_t cells = Enc == Encoding::MFM ? MFM_CELLS[(last << 8) | value] : FM_CELLS[value];
+        out[2 * i] = static_cast<uint8_t>(cells >> 8);
+        out[2 * i + 1] = static_cast<uint8_t>(cells);
+        last = value & 1;
+    }
+    if (step != 0) {
+        m_crc = Crc16::update(m_crc, data, size);
+    } else {
+        for (size_t i = 0; i < size; ++i) {
+            m_crc = Crc16::update(m_crc, data[0]);
+        }
+    }
+    m_cellCount += 16 * size;
+    m_lastDataBit = last != 0;
+    m_lastWasSync = false;
+}
+
+void BitstreamEncoder::writeSyncMark()
+{
+    if (!m_lastWasSync) {
+        m_crc = Crc16::INITIAL_VALUE;
+    }
+    if (m_encoding == Encoding::MFM) {
+        writeMfm(0xA1, 2);
+    } else {
+        writeRaw(FM_CLOCK, 0xA1);
+    }
+    m_crc = Crc16::update(m_crc, 0xA1);
+    m_lastWasSync = true;
+}
+
+void BitstreamEncoder::writeIndexSync()
+{
+    if (m_encoding == Encoding::MFM) {
+        writeMfm(0xC2, 3);
+    } else {
+        writeRaw(FM_CLOCK, 0xC2);
+    }
+    m_lastWasSync = false;
+}
+
+void BitstreamEncoder::writeAddressMark(uint8_t mark)
+{
+    if (m_encoding == Encoding::MFM) {
+        writeByte(mark);
+        return;
+    }
+    writeRaw(mark == INDEX_MARK ? FM_INDEX_MARK_CLOCK : FM_MARK_CLOCK, mark);
+    m_crc = Crc16::update(Crc16::INITIAL_VALUE, mark);
+    m_lastWasSync = false;
+}
+
+void BitstreamEncoder::writeCrc()
+{
+    const uint16_t crc = m_crc;
+    writeByte(static_cast<uint8_t>(crc >> 8));
+    writeByte(static_cast<uint8_t>(crc & 0xFF));
+}
+
+void BitstreamEncoder::writeFieldCrc(bool intact)
+{
+    // A recorded CRC error is reproduced by storing the complement
+    const uint16_t crc = intact ? m_crc : static_cast<uint16_t>(~m_crc);
+    writeByte(static_cast<uint8_t>(crc >> 8));
+    writeByte(static_cast<uint8_t>(crc & 0xFF));
+}
+
+void BitstreamEncoder::padTo(size_t trackBytes, uint8_t value)
+{
+    const size_t targetCells = trackBytes * 16;
+    if (m_cellCount < targetCells) {
+        writeBytes(value, static_cast<int>((targetCells - m_cellCount + 15) / 16));
+    }
+    if (m_cellCount > targetCells) {
+        m_cellCount = targetCells;
+        m_cells.resize((targetCells + 7) / 8);
+    }
+}
+
+void BitstreamEncoder::encodeTrack(const Track &track, size_t trackBytes)
+{
+    const Layout &layout = (m_encoding == Encoding::MFM) ? MFM_LAYOUT : FM_LAYOUT;
+    const int syncMarks = (m_encoding == Encoding::MFM) ? 3 : 0;
+    if (trackBytes == 0) {
+        trackBytes = defaultTrackBytes(m_encoding);
+    }
+
+    // Shrink gap 3 so every sector fits before the index
+    size_t used = static_cast<size_t>(layout.gap4a + layout.sync + syncMarks + 1 + layout.gap1);
+    for (const Sector &sector : track.sectors) {
+        used += sectorBytes(m_encoding, sector.size());
+    }
+    int gap3 = layout.gap3Max;
+    if (!track.sectors.empty() && used < trackBytes) {
+        const size_t fit = (trackBytes - used) / track.sectors.size();
+        gap3 = fit < static_cast<size_t>(gap3) ? static_cast<int>(fit) : gap3;
+    } else if (!track.sectors.empty()) {
+        gap3 = 1;
+    }
+
+    clear();
+    writeBytes(layout.gapByte, layout.gap4a);
+    writeBytes(0x00, layout.sync);
+    for (int i = 0; i < syncMarks; ++i) {
+        writeIndexSync();
+    }
+    writeAddressMark(INDEX_MARK);
+    writeBytes(layout.gapByte, layout.gap1);
+
+    for (const Sector &sector : track.sectors) {
+        writeBytes(0x00, layout.sync);
+        for (int i = 0; i < syncMarks; ++i) {
+            writeSyncMark();
+        }
+        writeAddressMark(IDAM);
+        const uint8_t id[4] = { sector.cylinder, sector.head, sector.id, sector.sizeCode };
+        writeBytes(id, sizeof(id));
+        writeFieldCrc(sector.idCrcOk);
+        writeBytes(layout.gapByte, layout.gap2);
+        if (!sector.hasData()) {
+            // ID field without a data field
+            writeBytes(layout.gapByte, gap3);
+            continue;
+        }
+
+        writeBytes(0x00, layout.sync);
+        for (int i = 0; i < syncMarks; ++i) {
+            writeSyncMark();
+        }
+        writeAddressMark(sector.deleted ? DELETED_DAM : DAM);
+        const size_t size = static_cast<size_t>(sector.size());
+        const size_t stored = sector.data.size() < size ? sector.data.size() : size;
+        writeBytes(sector.data.data(), stored);
+        writeBytes(0x00, static_cast<int>(size - stored));
+        writeFieldCrc(sector.dataCrcOk);
+        writeBytes(layout.gapByte, gap3);
+    }
+
+    padTo(trackBytes, layout.gapByte);
+}
@@ -0,0 +1,94 @@
+#ifndef BITSTREAMENCODER_H
+#define BITSTREAMENCODER_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Builds the FM/MFM cell stream of a track, either byte by byte with the
+// same primitives the WD1793 Write Track command offers (sync marks, address
+// marks, CRC) or for a whole Track in the standard IBM layout.
+// Cells are packed most significant bit first, cell 0 is the index pulse.
+class BitstreamEncoder
+{
+public:
+    explicit BitstreamEncoder(Encoding encoding = Encoding::MFM);
+
+    Encoding encoding() const { return m_encoding; }
+
+    // Track length in bytes at 300 RPM: 6250 for MFM DD, 3125 for FM SD
+    static size_t defaultTrackBytes(Encoding encoding);
+    // Bytes from the ID field sync to the end of the data CRC in the standard layout
+    static size_t sectorBytes(Encoding encoding, int dataSize);
+
+    void clear();
+
+    void writeByte(uint8_t value);
+    void writeBytes(uint8_t value, int count);
+    void writeBytes(const uint8_t *data, size_t size);
+
+    // MFM A1 with a missing clock (Write Track F5); the first one presets the CRC
+    void writeSyncMark();
+    // MFM C2 with a missing clock (Write Track F6), used before the index mark
+    void writeIndexSync();
+    // FM: mark with C7 clock (D7 for the FC index mark), presets the CRC.
+    // MFM: the mark byte after the A1 syncs.
+    void writeAddressMark(uint8_t mark);
+    // Two CRC bytes (Write Track F7)
+    void writeCrc();
+
+    // Fills with 'value' up to trackBytes, or cuts the stream there
+    void padTo(size_t trackBytes, uint8_t value);
+
+    const std::vector<uint8_t> &cells() const { return m_cells; }
+    size_t cellCount() const { return m_cellCount; }
+    size_t byteCount() const { return m_cellCount / 16; }
+    uint16_t crc() const { return m_crc; }
+
+    // Formats 'track' in the standard layout; gap 3 shrinks to fit trackBytes.
+    // Sectors keep their recorded CRC errors, and those without data get no
+    // data field, so decoding the cells gives back the same sector states.
+    void encodeTrack(const Track &track, size_t trackBytes = 0);
+
+    // Everything needed to continue a stream later, for save states
+    struct State {
+        Encoding encoding = Encoding::MFM;
+        std::vector<uint8_t> cells;
+        size_t cellCount = 0;
+        bool lastDataBit = false;
+        bool lastWasSync = false;
+        uint16_t crc = 0;
+    };
+    State state() const;
+    void restoreState(const State &state);
+
+private:
+    void pushCell(bool bit)
+    {
+        if ((m_cellCount & 7) == 0) {
+            m_cells.push_back(0);
+        }
+        if (bit) {
+            m_cells.back() |= static_cast<uint8_t>(0x80 >> (m_cellCount & 7));
+        }
+        ++m_cellCount;
+    }
+
+    // Table-driven bulk path for writeBytes(); step 0 repeats data[0]
+    template <Encoding Enc>
+    void writeData(const uint8_t *data, size_t size, size_t step);
+    void writeFieldCrc(bool intact);
+    void writeRaw(uint8_t clock, uint8_t data);
+    void writeMfm(uint8_t data, int missingClockBit);
+
+    Encoding m_encoding;
+    std::vector<uint8_t> m_cells;
+    size_t m_cellCount;
+    bool m_lastDataBit;
+    bool m_lastWasSync;
+    uint16_t m_crc;
+};
+
+#endif // BITSTREAMENCODER_H
@@ -0,0 +1,37 @@
+#include "crc16.h"
+
+namespace Crc16 {
+
+uint16_t update(uint16_t crc, const uint8_t *data, size_t size)
+{
+    switch (size) {
+    case 4:
+        return update<4>(crc, data);
+    case 6:
+        return update<6>(crc, data);
+    case 128:
+        return update<128>(crc, data);
+    case 130:
+        return update<130>(crc, data);
+    case 256:
+        return update<256>(crc, data);
+    case 258:
+        return update<258>(crc, data);
+    case 512:
+        return update<512>(crc, data);
+    case 514:
+        return update<514>(crc, data);
+    default:
+        break;
+    }
+    // Anything else, such as whole tracks, goes in unrolled blocks
+    for (; size >= 256; data += 256, size -= 256) {
+        crc = update<256>(crc, data);
+    }
+    for (size_t i = 0; i < size; ++i) {
+        crc = update(crc, data[i]);
+    }
+    return crc;
+}
+
+} // namespace Crc16
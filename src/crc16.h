@@ -0,0 +1,65 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// CRC-16/CCITT (polynomial 0x1021, preset 0xFFFF) as computed by the WD1793
+// over address marks, ID fields and data fields.
+namespace Crc16 {
+
+constexpr uint16_t INITIAL_VALUE = 0xFFFF;
+
+namespace detail {
+
+constexpr std::array<uint16_t, 256> makeTable()
+{
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; ++i) {
+        uint16_t crc = static_cast<uint16_t>(i << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                                 : static_cast<uint16_t>(crc << 1);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> TABLE = makeTable();
+
+template <size_t... Index>
+inline uint16_t updateUnrolled(uint16_t crc, const uint8_t *data, std::index_sequence<Index...>)
+{
+    ((crc = static_cast<uint16_t>((crc << 8) ^ TABLE[((crc >> 8) ^ data[Index]) & 0xFF])), ...);
+    return crc;
+}
+
+} // namespace detail
+
+inline uint16_t update(uint16_t crc, uint8_t byte)
+{
+    return static_cast<uint16_t>((crc << 8) ^ detail::TABLE[((crc >> 8) ^ byte) & 0xFF]);
+}
+
+// Fixed-size form: one table step per byte, fully unrolled, no loop branch
+template <size_t Size>
+inline uint16_t update(uint16_t crc, const uint8_t *data)
+{
+    return detail::updateUnrolled(crc, data, std::make_index_sequence<Size>());
+}
+
+// Uses the fixed-size form for ID fields and standard sector sizes, with or
+// without their CRC bytes, and a plain loop for anything else
+uint16_t update(uint16_t crc, const uint8_t *data, size_t size);
+
+inline uint16_t compute(const uint8_t *data, size_t size)
+{
+    return update(INITIAL_VALUE, data, size);
+}
+
+} // namespace Crc16
+
+#endif // CRC16_H
@@ -0,0 +1,73 @@
+#ifndef DISKGEOMETRY_H
+#define DISKGEOMETRY_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Layout and recording parameters of a disk format. Everything derived
+// from them (track length, byte time, sizes) is constexpr, so the standard
+// formats below cost nothing at run time.
+struct DiskGeometry {
+    int cylinders;
+    int sides;
+    Encoding encoding;
+    int sectors;        // Per track
+    int sectorSize;     // Bytes
+    int dataRateKbps;   // Data bits per second: 125 FM SD, 250 MFM DD, 500 MFM HD
+
+    static constexpr uint64_t REVOLUTION_NS = 200000000;  // 300 RPM
+
+    constexpr int trackCount() const { return cylinders * sides; }
+    // ID field N
+    constexpr int sizeCode() const
+    {
+        return sectorSize <= 128 ? 0 : sectorSize <= 256 ? 1 : sectorSize <= 512 ? 2 : 3;
+    }
+    constexpr uint64_t byteNs() const { return 8000000ULL / static_cast<uint64_t>(dataRateKbps); }
+    // Bytes that fit on one revolution: 6250 for MFM DD, 3125 for FM SD
+    constexpr size_t trackBytes() const { return static_cast<size_t>(REVOLUTION_NS / byteNs()); }
+    constexpr size_t trackDataBytes() const { return static_cast<size_t>(sectors) * static_cast<size_t>(sectorSize); }
+    constexpr size_t diskDataBytes() const { return trackDataBytes() * static_cast<size_t>(trackCount()); }
+
+    constexpr bool operator==(const DiskGeometry &other) const
+    {
+        return cylinders == other.cylinders && sides == other.sides && encoding == other.encoding &&
+               sectors == other.sectors && sectorSize == other.sectorSize && dataRateKbps == other.dataRateKbps;
+    }
+    constexpr bool operator!=(const DiskGeometry &other) const { return !(*this == other); }
+};
+
+namespace Geometry {
+
+// TR-DOS: 16 x 256 byte MFM sectors
+constexpr DiskGeometry TRDOS_80DS = { 80, 2, Encoding::MFM, 16, 256, 250 };
+constexpr DiskGeometry TRDOS_80SS = { 80, 1, Encoding::MFM, 16, 256, 250 };
+constexpr DiskGeometry TRDOS_40DS = { 40, 2, Encoding::MFM, 16, 256, 250 };
+constexpr DiskGeometry TRDOS_40SS = { 40, 1, Encoding::MFM, 16, 256, 250 };
+// Single density: 10 x 256 byte FM sectors (Acorn DFS, TR-DOS SD)
+constexpr DiskGeometry FM_40SS = { 40, 1, Encoding::FM, 10, 256, 125 };
+constexpr DiskGeometry FM_40DS = { 40, 2, Encoding::FM, 10, 256, 125 };
+// PC
+constexpr DiskGeometry PC_360K = { 40, 2, Encoding::MFM, 9, 512, 250 };
+constexpr DiskGeometry PC_720K = { 80, 2, Encoding::MFM, 9, 512, 250 };
+constexpr DiskGeometry PC_1440K = { 80, 2, Encoding::MFM, 18, 512, 500 };
+
+// Longest standard drive travel
+constexpr int MAX_CYLINDERS = 80;
+
+// The format a disk with just these switches is assumed to have: TR-DOS for
+// double density, 40 track FM for single density
+constexpr DiskGeometry standard(bool doubleSided, bool doubleDensity)
+{
+    return doubleDensity ? (doubleSided ? TRDOS_80DS : TRDOS_80SS) : (doubleSided ? FM_40DS : FM_40SS);
+}
+
+static_assert(TRDOS_80DS.diskDataBytes() == 655360, "TR-DOS disk size");
+static_assert(TRDOS_80DS.trackBytes() == 6250 && FM_40SS.trackBytes() == 3125, "Track length");
+static_assert(PC_1440K.diskDataBytes() == 1474560, "1.44M disk size");
+
+} // namespace Geometry
+
+#endif // DISKGEOMETRY_H
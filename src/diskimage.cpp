@@ -0,0 +1,326 @@
+#include "diskimage.h"
+#include "disklayout.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+// Longest sector a fill pattern covers; longer uniform data gets a block
+constexpr size_t PATTERN_BYTES = SectorPool::MAX_CLASS;
+
+const uint8_t *fillPattern(uint8_t value)
+{
+    static std::atomic<const uint8_t *> patterns[256];
+    static std::mutex mutex;
+    const uint8_t *pattern = patterns[value].load(std::memory_order_acquire);
+    if (!pattern) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pattern = patterns[value].load(std::memory_order_relaxed);
+        if (!pattern) {
+            // Never freed: copies of the image may outlive everything else
+            uint8_t *bytes = new uint8_t[PATTERN_BYTES];
+            std::memset(bytes, value, PATTERN_BYTES);
+            patterns[value].store(bytes, std::memory_order_release);
+            pattern = bytes;
+        }
+    }
+    return pattern;
+}
+
+} // namespace
+
+SectorData::SectorData(const SectorData &other)
+    : m_block(other.m_block)
+    , m_view(other.m_view)
+    , m_size(other.m_size)
+    , m_owner(other.m_owner)
+{
+    if (m_block) {
+        SectorPool::retain(m_block);
+    }
+}
+
+SectorData::SectorData(SectorData &&other) noexcept
+    : m_block(other.m_block)
+    , m_view(other.m_view)
+    , m_size(other.m_size)
+    , m_owner(std::move(other.m_owner))
+{
+    other.m_block = nullptr;
+    other.m_view = nullptr;
+    other.m_size = 0;
+}
+
+SectorData &SectorData::operator=(const SectorData &other)
+{
+    if (this != &other) {
+        if (other.m_block) {
+            SectorPool::retain(other.m_block);
+        }
+        release();
+        m_block = other.m_block;
+        m_view = other.m_view;
+        m_size = other.m_size;
+        m_owner = other.m_owner;
+    }
+    return *this;
+}
+
+SectorData &SectorData::operator=(SectorData &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        m_block = other.m_block;
+        m_view = other.m_view;
+        m_size = other.m_size;
+        m_owner = std::move(other.m_owner);
+        other.m_block = nullptr;
+        other.m_view = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+SectorData SectorData::view(const uint8_t *bytes, size_t size, std::shared_ptr<const void> owner)
+{
+    SectorData data;
+    data.m_view = bytes;
+    data.m_size = size;
+    data.m_owner = std::move(owner);
+    return data;
+}
+
+SectorData SectorData::filled(size_t size, uint8_t value)
+{
+    SectorData data;
+    if (size > PATTERN_BYTES) {
+        data.m_block = SectorPool::allocate(size);
+        std::memset(data.m_block->bytes(), value, size);
+    } else if (size > 0) {
+        data.m_view = fillPattern(value);
+    }
+    data.m_size = size;
+    return data;
+}
+
+void SectorData::adopt(const uint8_t *bytes, size_t size)
+{
+    if (size > 0 && std::all_of(bytes + 1, bytes + size, [&](uint8_t byte) { return byte == bytes[0]; })) {
+        *this = filled(size, bytes[0]);
+        return;
+    }
+    if (size > 0) {
+        m_block = SectorPool::allocate(size);
+        std::memcpy(m_block->bytes(), bytes, size);
+    }
+    m_size = size;
+}
+
+void SectorData::release()
+{
+    if (m_block) {
+        SectorPool::release(m_block);
+        m_block = nullptr;
+    }
+    m_view = nullptr;
+    m_size = 0;
+    m_owner.reset();
+}
+
+void SectorData::detach()
+{
+    if (m_size == 0 || (m_block && m_block->refs.load(std::memory_order_acquire) == 1)) {
+        return;
+    }
+    SectorPool::Block *block = SectorPool::allocate(m_size);
+    std::memcpy(block->bytes(), data(), m_size);
+    const size_t size = m_size;
+    release();
+    m_block = block;
+    m_size = size;
+}
+
+void SectorData::resize(size_t size)
+{
+    if (size == m_size) {
+        return;
+    }
+    if (m_block && m_block->refs.load(std::memory_order_acquire) == 1 && size <= m_block->capacity) {
+        if (size > m_size) {
+            std::memset(m_block->bytes() + m_size, 0, size - m_size);
+        }
+        m_size = size;
+        return;
+    }
+    SectorPool::Block *block = size > 0 ? SectorPool::allocate(size) : nullptr;
+    const size_t kept = std::min(size, m_size);
+    if (kept > 0) {
+        std::memcpy(block->bytes(), data(), kept);
+    }
+    if (size > kept) {
+        std::memset(block->bytes() + kept, 0, size - kept);
+    }
+    release();
+    m_block = block;
+    m_size = size;
+}
+
+bool SectorData::operator==(const SectorData &other) const
+{
+    return size() == other.size() && (size() == 0 || std::memcmp(data(), other.data(), size()) == 0);
+}
+
+const Sector *Track::findSector(int id) const
+{
+    for (const Sector &sector : sectors) {
+        if (sector.id == id) {
+            return &sector;
+        }
+    }
+    return nullptr;
+}
+
+double Track::idAngle(size_t index) const
+{
+    if (index >= sectors.size()) {
+        return 0.0;
+    }
+    return idAngle(index, hasRecordedAngles());
+}
+
+bool Track::hasRecordedAngles() const
+{
+    for (const Sector &sector : sectors) {
+        if (sector.angle != 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+DiskImage::DiskImage(int cylinders, int sides)
+    : m_cylinders(0)
+    , m_sides(0)
+{
+    resize(cylinders, sides);
+}
+
+void DiskImage::resize(int cylinders, int sides)
+{
+    m_cylinders = cylinders > 0 ? cylinders : 0;
+    m_sides = (sides == 2) ? 2 : 1;
+    m_tracks.assign(static_cast<size_t>(m_cylinders * m_sides), Track());
+    for (int cylinder = 0; cylinder < m_cylinders; ++cylinder) {
+        for (int side = 0; side < m_sides; ++side) {
+            Track &t = m_tracks[static_cast<size_t>(cylinder * m_sides + side)];
+            t.cylinder = cylinder;
+            t.side = side;
+        }
+    }
+}
+
+Track *DiskImage::track(int cylinder, int side)
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return nullptr;
+    }
+    return &m_tracks[static_cast<size_t>(cylinder * m_sides + side)];
+}
+
+const Track *DiskImage::track(int cylinder, int side) const
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return nullptr;
+    }
+    return &m_tracks[static_cast<size_t>(cylinder * m_sides + side)];
+}
+
+bool DiskImage::isDoubleDensity() const
+{
+    for (const Track &t : m_tracks) {
+        if (t.isFormatted()) {
+            return t.encoding == Encoding::MFM;
+        }
+    }
+    return true;
+}
+
+int DiskImage::sectorTotal() const
+{
+    int total = 0;
+    for (const Track &t : m_tracks) {
+        total += static_cast<int>(t.sectors.size());
+    }
+    return total;
+}
+
+int DiskImage::weakSectorTotal() const
+{
+    int total = 0;
+    for (const Track &t : m_tracks) {
+        for (const Sector &sector : t.sectors) {
+            total += sector.weak ? 1 : 0;
+        }
+    }
+    return total;
+}
+
+int DiskImage::badSectorTotal() const
+{
+    int total = 0;
+    for (const Track &t : m_tracks) {
+        for (const Sector &sector : t.sectors) {
+            total += (!sector.idCrcOk || !sector.dataCrcOk) ? 1 : 0;
+        }
+    }
+    return total;
+}
+
+std::shared_ptr<const DiskLayout> DiskImage::layout() const
+{
+    return std::atomic_load(&m_layout);
+}
+
+void DiskImage::updateLayout()
+{
+    std::atomic_store(&m_layout, std::shared_ptr<const DiskLayout>(std::make_shared<DiskLayout>(*this)));
+    m_changedTracks.clear();
+    m_layoutStale = false;
+}
+
+void DiskImage::refreshLayout()
+{
+    if (layout()) {
+        updateLayout();
+    }
+}
+
+void DiskImage::markTrackChanged(int cylinder, int side)
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return;
+    }
+    if (m_changedTracks.size() != m_tracks.size()) {
+        m_changedTracks.assign(m_tracks.size(), 0);
+    }
+    m_changedTracks[static_cast<size_t>(cylinder * m_sides + side)] = 1;
+    m_layoutStale = true;
+}
+
+bool DiskImage::publishLayout()
+{
+    if (!m_layoutStale) {
+        return false;
+    }
+    const std::shared_ptr<const DiskLayout> previous = layout();
+    if (previous) {
+        std::atomic_store(&m_layout, std::shared_ptr<const DiskLayout>(
+            std::make_shared<DiskLayout>(*previous, *this, m_changedTracks)));
+    }
+    m_changedTracks.assign(m_tracks.size(), 0);
+    m_layoutStale = false;
+    return previous != nullptr;
+}
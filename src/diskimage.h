@@ -0,0 +1,175 @@
+#ifndef DISKIMAGE_H
+#define DISKIMAGE_H
+
+#include "sectorpool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class DiskLayout;
+
+enum class Encoding {
+    FM,
+    MFM
+};
+
+// Sector contents, copy-on-write. Copies share the bytes until one of them
+// is written through a mutable accessor, so copying a whole image costs a
+// reference count per sector. Owned bytes live in SectorPool blocks. Data
+// that is one byte value throughout (unused or freshly formatted sectors)
+// views a shared read-only pattern instead and costs nothing until it is
+// written. Sectors loaded from a SectorStore view its read-only mapping and
+// are copied out the same way on the first write.
+class SectorData
+{
+public:
+    SectorData() = default;
+    SectorData(const std::vector<uint8_t> &bytes) { adopt(bytes.data(), bytes.size()); }
+    SectorData(const SectorData &other);
+    SectorData(SectorData &&other) noexcept;
+    SectorData &operator=(const SectorData &other);
+    SectorData &operator=(SectorData &&other) noexcept;
+    ~SectorData() { release(); }
+
+    // Bytes owned by someone else, kept valid by 'owner'
+    static SectorData view(const uint8_t *bytes, size_t size, std::shared_ptr<const void> owner);
+    // 'size' bytes of 'value' from the shared pattern
+    static SectorData filled(size_t size, uint8_t value);
+
+    bool isView() const { return m_view != nullptr; }
+    // True when both refer to the same bytes rather than equal ones
+    bool isSharedWith(const SectorData &other) const { return size() == other.size() && data() == other.data(); }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const uint8_t *data() const { return m_view ? m_view : (m_block ? m_block->bytes() : nullptr); }
+    uint8_t *data()
+    {
+        detach();
+        return m_block ? m_block->bytes() : nullptr;
+    }
+    const uint8_t *begin() const { return data(); }
+    const uint8_t *end() const { return data() + size(); }
+    uint8_t operator[](size_t index) const { return data()[index]; }
+    uint8_t &operator[](size_t index)
+    {
+        detach();
+        return m_block->bytes()[index];
+    }
+
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last)
+    {
+        const std::vector<uint8_t> bytes(first, last);
+        *this = SectorData(bytes);
+    }
+    void assign(const uint8_t *first, const uint8_t *last)
+    {
+        release();
+        adopt(first, static_cast<size_t>(last - first));
+    }
+    // New bytes are zero
+    void resize(size_t size);
+    void clear() { *this = SectorData(); }
+
+    bool operator==(const SectorData &other) const;
+    bool operator!=(const SectorData &other) const { return !(*this == other); }
+
+private:
+    // Pattern view when all bytes are equal, a pool block otherwise
+    void adopt(const uint8_t *bytes, size_t size);
+    // Makes the bytes exclusively ours in a pool block. Another thread may
+    // drop its copy at any time, but none can add one, so a count of one
+    // stays one.
+    void detach();
+    void release();
+
+    SectorPool::Block *m_block = nullptr;
+    const uint8_t *m_view = nullptr;    // Store mapping or fill pattern
+    size_t m_size = 0;
+    std::shared_ptr<const void> m_owner; // Null for patterns, which live forever
+};
+
+// One sector as found on a track: the ID field (C/H/R/N) followed by its data field
+struct Sector {
+    uint8_t cylinder = 0;   // ID field C
+    uint8_t head = 0;       // ID field H
+    uint8_t id = 1;         // ID field R
+    uint8_t sizeCode = 1;   // ID field N, data size is 128 << N bytes
+    bool idCrcOk = true;
+    bool dataCrcOk = true;
+    bool deleted = false;   // Data field used the F8 (deleted data) address mark
+    bool weak = false;      // Data or CRC state differed between revolutions
+    float angle = 0.0f;     // Start of the ID field as a fraction of a revolution from index
+    SectorData data;
+
+    int size() const { return 128 << (sizeCode & 3); }
+    bool hasData() const { return !data.empty(); }
+};
+
+struct Track {
+    int cylinder = 0;
+    int side = 0;
+    Encoding encoding = Encoding::MFM;
+    int revolutions = 0;    // Number of revolutions the sectors were merged from
+    std::vector<Sector> sectors; // Ordered by angular position from index
+
+    bool isFormatted() const { return !sectors.empty(); }
+    const Sector *findSector(int id) const;
+
+    // Angular position of sector 'index'; images without recorded positions
+    // (all zero) get their sectors spread evenly over the revolution
+    double idAngle(size_t index) const;
+    // For loops over a track: hasRecordedAngles() once, then idAngle(i, recorded)
+    bool hasRecordedAngles() const;
+    double idAngle(size_t index, bool recorded) const
+    {
+        return recorded ? sectors[index].angle : static_cast<double>(index) / sectors.size();
+    }
+};
+
+// Decoded contents of a whole disk, indexed by (cylinder, side)
+class DiskImage
+{
+public:
+    DiskImage(int cylinders = 0, int sides = 1);
+
+    void resize(int cylinders, int sides);
+    int cylinderCount() const { return m_cylinders; }
+    int sideCount() const { return m_sides; }
+
+    Track *track(int cylinder, int side);
+    const Track *track(int cylinder, int side) const;
+
+    bool isDoubleDensity() const;
+    int sectorTotal() const;
+    int weakSectorTotal() const;
+    int badSectorTotal() const;
+
+    // Angular layout of all tracks for renderers and schedulers; null until
+    // the image layer calls updateLayout() after filling the tracks. May be
+    // read from one thread while another one updates it.
+    std::shared_ptr<const DiskLayout> layout() const;
+    void updateLayout();
+    // Rebuilds the layout after sectors changed, if anyone built one
+    void refreshLayout();
+    // Cheap enough for every sector write: records that the sectors of one
+    // track changed. publishLayout() then rebuilds only the tracks recorded
+    // since the last call; both run on the thread that owns the tracks,
+    // readers of layout() see the new layout once it is published.
+    void markTrackChanged(int cylinder, int side);
+    bool publishLayout();
+
+private:
+    int m_cylinders;
+    int m_sides;
+    std::vector<Track> m_tracks;
+    std::shared_ptr<const DiskLayout> m_layout;
+    std::vector<uint8_t> m_changedTracks;   // Per track, since the last publishLayout()
+    bool m_layoutStale = false;
+};
+
+#endif // DISKIMAGE_H
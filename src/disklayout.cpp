@@ -0,0 +1,112 @@
+#include "disklayout.h"
+#include "bitstreamencoder.h"
+
+#include <algorithm>
+#include <cmath>
+
+DiskLayout::DiskLayout(const DiskImage &image)
+    : m_cylinders(image.cylinderCount())
+    , m_sides(image.sideCount())
+    , m_doubleDensity(image.isDoubleDensity())
+{
+    m_offsets.reserve(static_cast<size_t>(m_cylinders * m_sides) + 1);
+    m_slots.reserve(static_cast<size_t>(image.sectorTotal()));
+    for (int cylinder = 0; cylinder < m_cylinders; ++cylinder) {
+        for (int side = 0; side < m_sides; ++side) {
+            m_offsets.push_back(static_cast<uint32_t>(m_slots.size()));
+            appendSlots(*image.track(cylinder, side), m_slots);
+        }
+    }
+    m_offsets.push_back(static_cast<uint32_t>(m_slots.size()));
+}
+
+DiskLayout::DiskLayout(const DiskLayout &previous, const DiskImage &image, const std::vector<uint8_t> &changed)
+    : m_cylinders(image.cylinderCount())
+    , m_sides(image.sideCount())
+    , m_doubleDensity(image.isDoubleDensity())
+{
+    if (previous.m_cylinders != m_cylinders || previous.m_sides != m_sides) {
+        *this = DiskLayout(image);
+        return;
+    }
+    m_offsets.reserve(previous.m_offsets.size());
+    m_slots.reserve(previous.m_slots.size());
+    for (int cylinder = 0; cylinder < m_cylinders; ++cylinder) {
+        for (int side = 0; side < m_sides; ++side) {
+            const size_t index = static_cast<size_t>(cylinder * m_sides + side);
+            m_offsets.push_back(static_cast<uint32_t>(m_slots.size()));
+            if (index < changed.size() && changed[index]) {
+                appendSlots(*image.track(cylinder, side), m_slots);
+            } else {
+                m_slots.insert(m_slots.end(), previous.m_slots.begin() + previous.m_offsets[index],
+                               previous.m_slots.begin() + previous.m_offsets[index + 1]);
+            }
+        }
+    }
+    m_offsets.push_back(static_cast<uint32_t>(m_slots.size()));
+}
+
+void DiskLayout::appendSlots(const Track &track, std::vector<SectorSlot> &slots)
+{
+    const size_t count = track.sectors.size();
+    if (count == 0) {
+        return;
+    }
+    const bool recorded = track.hasRecordedAngles();
+    const double trackBytes = BitstreamEncoder::defaultTrackBytes(track.encoding);
+    double start = track.idAngle(0, recorded);
+    for (size_t index = 0; index < count; ++index) {
+        const Sector &sector = track.sectors[index];
+        const double next = track.idAngle((index + 1) % count, recorded);
+
+        // A sector never reaches past the start of the next one, even when the
+        // recorded positions are tighter than the standard gaps
+        double span = BitstreamEncoder::sectorBytes(track.encoding, sector.size()) / trackBytes;
+        if (count > 1) {
+            double gap = next - start;
+            if (gap <= 0.0) {
+                gap += 1.0;
+            }
+            span = std::min(span, gap);
+        }
+
+        SectorSlot slot;
+        slot.start = static_cast<float>(start);
+        slot.end = static_cast<float>(std::fmod(start + std::min(span, 1.0), 1.0));
+        slot.id = sector.id;
+        slot.sizeCode = sector.sizeCode;
+        slot.flags = static_cast<uint8_t>((sector.weak ? SLOT_WEAK : 0)
+                                        | ((!sector.idCrcOk || !sector.dataCrcOk) ? SLOT_BAD : 0)
+                                        | (sector.deleted ? SLOT_DELETED : 0));
+        slots.push_back(slot);
+        start = next;
+    }
+}
+
+DiskLayout::TrackSlots DiskLayout::track(int cylinder, int side) const
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return TrackSlots();
+    }
+    const size_t index = static_cast<size_t>(cylinder * m_sides + side);
+    return TrackSlots(m_slots.data() + m_offsets[index], m_offsets[index + 1] - m_offsets[index]);
+}
+
+int DiskLayout::slotAt(int cylinder, int side, double angle) const
+{
+    const TrackSlots slots = track(cylinder, side);
+    if (slots.empty()) {
+        return -1;
+    }
+    angle -= std::floor(angle);
+    // Slots are in index order: the last start at or before the angle wins,
+    // and before the first start the last slot (wrapping past index) does
+    int found = static_cast<int>(slots.size()) - 1;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (slots[i].start > angle) {
+            break;
+        }
+        found = static_cast<int>(i);
+    }
+    return found;
+}
@@ -0,0 +1,80 @@
+#ifndef DISKLAYOUT_H
+#define DISKLAYOUT_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Where a sector sits on its track, without its contents
+struct SectorSlot {
+    float start = 0.0f;     // ID field, fraction of a revolution from index
+    float end = 0.0f;       // End of the data CRC; below start when it wraps past index
+    uint8_t id = 1;         // ID field R
+    uint8_t sizeCode = 0;   // ID field N
+    uint8_t flags = 0;      // SLOT_* bits
+
+    float span() const { return end >= start ? end - start : end + 1.0f - start; }
+};
+
+// Angular layout of every track of an image in one flat array: the slots of
+// all tracks back to back, reached through an offset table indexed by
+// (cylinder, side). Tracks may differ in sector count, size, IDs and
+// interleave; slots are in index order. A layout never changes once built,
+// so it can be read without the lock that guards the image's tracks.
+class DiskLayout
+{
+public:
+    static constexpr uint8_t SLOT_WEAK = 0x01;
+    static constexpr uint8_t SLOT_BAD = 0x02;      // ID or data CRC error
+    static constexpr uint8_t SLOT_DELETED = 0x04;
+
+    class TrackSlots
+    {
+    public:
+        TrackSlots(const SectorSlot *slots = nullptr, size_t count = 0) : m_slots(slots), m_count(count) {}
+
+        const SectorSlot *begin() const { return m_slots; }
+        const SectorSlot *end() const { return m_slots + m_count; }
+        const SectorSlot &operator[](size_t index) const { return m_slots[index]; }
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+
+    private:
+        const SectorSlot *m_slots;
+        size_t m_count;
+    };
+
+    DiskLayout() = default;
+    explicit DiskLayout(const DiskImage &image);
+    // 'previous' with the tracks flagged in 'changed' (one byte per track,
+    // cylinder-major) rebuilt from 'image'; the other slots are copied
+    DiskLayout(const DiskLayout &previous, const DiskImage &image, const std::vector<uint8_t> &changed);
+
+    int cylinderCount() const { return m_cylinders; }
+    int sideCount() const { return m_sides; }
+    // As DiskImage::isDoubleDensity() when the layout was built
+    bool isDoubleDensity() const { return m_doubleDensity; }
+    size_t slotTotal() const { return m_slots.size(); }
+
+    // Empty for unformatted tracks and out of range positions
+    TrackSlots track(int cylinder, int side) const;
+
+    // Slot whose extent covers 'angle' (fraction of a revolution), or the
+    // last one starting before it when the angle falls in a gap; -1 when the
+    // track is unformatted
+    int slotAt(int cylinder, int side, double angle) const;
+
+    // Slots for the sectors of a track as the standard layout records them
+    static void appendSlots(const Track &track, std::vector<SectorSlot> &slots);
+
+private:
+    int m_cylinders = 0;
+    int m_sides = 0;
+    bool m_doubleDensity = true;
+    std::vector<uint32_t> m_offsets;    // cylinders * sides + 1 entries
+    std::vector<SectorSlot> m_slots;
+};
+
+#endif // DISKLAYOUT_H
@@ -0,0 +1,157 @@
+#include "drqmonitor.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+constexpr size_t SUB_BUCKET_COUNT = size_t(1) << LatencyHistogram::SUB_BUCKET_BITS;
+constexpr uint64_t MAX_VALUE = (uint64_t(1) << LatencyHistogram::MAX_VALUE_BITS) - 1;
+
+int highestBit(uint64_t value)
+{
+    int bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram()
+{
+    clear();
+}
+
+void LatencyHistogram::clear()
+{
+    for (std::atomic<uint64_t> &bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+    value = std::min(value, MAX_VALUE);
+    const int shift = std::max(0, highestBit(value) - SUB_BUCKET_BITS);
+    // Below 2 * SUB_BUCKET_COUNT the shift is 0 and the index is the value
+    return (static_cast<size_t>(shift) << SUB_BUCKET_BITS) + static_cast<size_t>(value >> shift);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index)
+{
+    if (index < 2 * SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const int shift = static_cast<int>(index >> SUB_BUCKET_BITS) - 1;
+    const uint64_t mantissa = index - (static_cast<size_t>(shift) << SUB_BUCKET_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    bump(m_buckets[bucketIndex(value)], 1);
+    bump(m_count, 1);
+    bump(m_sum, value);
+    if (value > m_max.load(std::memory_order_relaxed)) {
+        m_max.store(value, std::memory_order_relaxed);
+    }
+}
+
+double LatencyHistogram::mean() const
+{
+    const uint64_t samples = count();
+    return samples ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / samples : 0.0;
+}
+
+uint64_t LatencyHistogram::valueAtPercentile(double percentile) const
+{
+    const uint64_t samples = count();
+    if (samples == 0) {
+        return 0;
+    }
+    percentile = std::min(100.0, std::max(0.0, percentile));
+    const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100.0 * samples + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            // Never report more than was actually recorded
+            return std::min(bucketUpperBound(i), max());
+        }
+    }
+    return max();
+}
+
+void DrqMonitor::recordLostData(const LostDataEvent &event)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_lostDataCount.store(m_lostDataCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (m_events.size() == MAX_EVENTS) {
+        m_events.pop_front();
+    }
+    m_events.push_back(event);
+}
+
+void DrqMonitor::clear()
+{
+    for (LatencyHistogram &histogram : m_histograms) {
+        histogram.clear();
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_lostDataCount.store(0, std::memory_order_relaxed);
+    m_events.clear();
+}
+
+std::vector<DrqMonitor::LostDataEvent> DrqMonitor::lostDataEvents() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return std::vector<LostDataEvent>(m_events.begin(), m_events.end());
+}
+
+const char *DrqMonitor::commandName(Command command)
+{
+    switch (command) {
+    case ReadSector:
+        return "Read Sector";
+    case WriteSector:
+        return "Write Sector";
+    case ReadAddress:
+        return "Read Address";
+    case ReadTrack:
+        return "Read Track";
+    case WriteTrack:
+        return "Write Track";
+    default:
+        return "?";
+    }
+}
+
+std::string DrqMonitor::reportText() const
+{
+    std::string text;
+    char line[160];
+    for (int i = 0; i < COMMAND_COUNT; ++i) {
+        const LatencyHistogram &latency = m_histograms[i];
+        if (latency.count() == 0) {
+            continue;
+        }
+        std::snprintf(line, sizeof(line), "%-12s n=%llu mean=%.2fus p50=%.2fus p99=%.2fus p99.9=%.2fus max=%.2fus\n",
+                      commandName(static_cast<Command>(i)), static_cast<unsigned long long>(latency.count()),
+                      latency.mean() / 1000.0, latency.valueAtPercentile(50.0) / 1000.0,
+                      latency.valueAtPercentile(99.0) / 1000.0, latency.valueAtPercentile(99.9) / 1000.0,
+                      latency.max() / 1000.0);
+        text += line;
+    }
+    for (const LostDataEvent &event : lostDataEvents()) {
+        std::snprintf(line, sizeof(line), "Lost Data: %s cylinder %d side %d track reg %u sector reg %u byte %zu at %.6fs\n",
+                      commandName(event.command), event.cylinder, event.side, event.trackRegister,
+                      event.sectorRegister, event.byteOffset, event.timeNs / 1e9);
+        text += line;
+    }
+    return text;
+}
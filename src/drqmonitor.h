@@ -0,0 +1,112 @@
+#ifndef DRQMONITOR_H
+#define DRQMONITOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 64 are exact, above that every power of two is split into 32 buckets, so
+// any reported value is within 1/32 (about 3%) of what was recorded. Values
+// beyond 2^MAX_VALUE_BITS land in the last bucket. One thread records with
+// relaxed stores; any thread may read.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int MAX_VALUE_BITS = 40;      // About 18 minutes in ns
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    void record(uint64_t value);
+    void clear();
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double mean() const;
+    // Highest value equivalent to the one at 'percentile' (0..100); 0 when empty
+    uint64_t valueAtPercentile(double percentile) const;
+
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketUpperBound(size_t index);
+
+private:
+    static void bump(std::atomic<uint64_t> &value, uint64_t amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+// DRQ service latency per data transfer command and a log of transfers that
+// lost data. The controller reports every byte the host answers, with the
+// emulated time DRQ was up, and every byte a real WD1793 would have dropped,
+// with where on the disk it happened. Written by the thread driving the
+// controller, read from anywhere.
+class DrqMonitor
+{
+public:
+    enum Command {
+        ReadSector,
+        WriteSector,
+        ReadAddress,
+        ReadTrack,
+        WriteTrack,
+        COMMAND_COUNT
+    };
+
+    struct LostDataEvent {
+        Command command = ReadSector;
+        int cylinder = 0;           // Physical head position
+        int side = 0;
+        uint8_t trackRegister = 0;
+        uint8_t sectorRegister = 0;
+        size_t byteOffset = 0;      // In the data field, or in the track for Read/Write Track
+        uint64_t timeNs = 0;        // Emulated time the byte was dropped
+    };
+
+    // Lost Data events kept for inspection; older ones only stay counted
+    static constexpr size_t MAX_EVENTS = 64;
+
+    DrqMonitor() = default;
+
+    DrqMonitor(const DrqMonitor &) = delete;
+    DrqMonitor &operator=(const DrqMonitor &) = delete;
+
+    void recordService(Command command, uint64_t latencyNs) { m_histograms[command].record(latencyNs); }
+    void recordLostData(const LostDataEvent &event);
+
+    // Not safe against a concurrent recordService(); call it where the
+    // controller is driven from, e.g. under the controller lock
+    void clear();
+
+    const LatencyHistogram &histogram(Command command) const { return m_histograms[command]; }
+    uint64_t lostDataCount() const { return m_lostDataCount.load(std::memory_order_relaxed); }
+    // Oldest first
+    std::vector<LostDataEvent> lostDataEvents() const;
+
+    static const char *commandName(Command command);
+
+    // One line per command with samples and one per kept Lost Data event
+    std::string reportText() const;
+
+private:
+    LatencyHistogram m_histograms[COMMAND_COUNT];
+    std::atomic<uint64_t> m_lostDataCount{0};
+    mutable std::mutex m_mutex;
+    std::deque<LostDataEvent> m_events;
+};
+
+#endif // DRQMONITOR_H
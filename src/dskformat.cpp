@@ -0,0 +1,279 @@
+#include "dskformat.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 256;
+constexpr char DSK_SIGNATURE[] = "MV - CPC";
+constexpr char EDSK_SIGNATURE[] = "EXTENDED";
+constexpr char EDSK_HEADER[] = "EXTENDED CPC DSK File\r\nDisk-Info\r\n";
+constexpr char CREATOR[] = "qt-floppy";
+constexpr char TRACK_SIGNATURE[] = "Track-Info\r\n";
+
+// Disk Information block
+constexpr size_t DISK_CREATOR = 0x22;
+constexpr size_t DISK_TRACKS = 0x30;
+constexpr size_t DISK_SIDES = 0x31;
+constexpr size_t DISK_TRACK_SIZE = 0x32;        // DSK only
+constexpr size_t DISK_TRACK_TABLE = 0x34;       // EDSK only, high bytes of the track sizes
+constexpr size_t MAX_TABLE_ENTRIES = HEADER_SIZE - DISK_TRACK_TABLE;
+
+// Track Information block
+constexpr size_t TRACK_CYLINDER = 0x10;
+constexpr size_t TRACK_SIDE = 0x11;
+constexpr size_t TRACK_DATA_RATE = 0x12;        // EDSK: 1 SD/DD, 2 HD
+constexpr size_t TRACK_RECORDING = 0x13;        // EDSK: 1 FM, 2 MFM
+constexpr size_t TRACK_SIZE_CODE = 0x14;
+constexpr size_t TRACK_SECTORS = 0x15;
+constexpr size_t TRACK_GAP3 = 0x16;
+constexpr size_t TRACK_FILLER = 0x17;
+constexpr size_t TRACK_SECTOR_INFO = 0x18;
+constexpr size_t SECTOR_INFO_SIZE = 8;
+constexpr size_t MAX_SECTORS = (HEADER_SIZE - TRACK_SECTOR_INFO) / SECTOR_INFO_SIZE;
+
+// uPD765 result bits
+constexpr uint8_t ST1_MISSING_ADDRESS_MARK = 0x01;
+constexpr uint8_t ST1_DATA_ERROR = 0x20;
+constexpr uint8_t ST2_MISSING_DATA_MARK = 0x01;
+constexpr uint8_t ST2_DATA_ERROR_IN_DATA = 0x20;
+constexpr uint8_t ST2_CONTROL_MARK = 0x40;
+
+uint16_t readLe16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+// Largest sector the uPD765 transfers; N above 6 still only moves 6 KB
+size_t nominalSize(uint8_t sizeCode)
+{
+    return sizeCode > 6 ? 0x1800 : static_cast<size_t>(128) << sizeCode;
+}
+
+} // namespace
+
+DskReader::DskReader()
+    : m_extended(false)
+    , m_cylinders(0)
+    , m_sides(0)
+{
+}
+
+bool DskReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+    uint8_t header[HEADER_SIZE];
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        return fail("Truncated DSK header");
+    }
+    if (std::memcmp(header, EDSK_SIGNATURE, 8) == 0) {
+        m_extended = true;
+    } else if (std::memcmp(header, DSK_SIGNATURE, 8) != 0) {
+        return fail("Not a DSK image");
+    }
+
+    m_cylinders = header[DISK_TRACKS];
+    m_sides = header[DISK_SIDES];
+    if (m_sides < 1 || m_sides > 2) {
+        return fail("DSK image has " + std::to_string(m_sides) + " sides");
+    }
+    const size_t tracks = static_cast<size_t>(m_cylinders) * m_sides;
+    if (m_extended && tracks > MAX_TABLE_ENTRIES) {
+        return fail("EDSK track size table overflows its header");
+    }
+
+    uint64_t offset = HEADER_SIZE;
+    for (size_t i = 0; i < tracks; ++i) {
+        const uint32_t size = m_extended ? header[DISK_TRACK_TABLE + i] * 256u
+                                         : readLe16(header + DISK_TRACK_SIZE);
+        m_offsets.push_back(offset);
+        m_sizes.push_back(size);
+        offset += size;
+    }
+    return true;
+}
+
+bool DskReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    const size_t index = static_cast<size_t>(cylinder * m_sides + side);
+    block.cylinder = cylinder;
+    block.side = side;
+    block.bytes.resize(m_sizes[index]);
+    if (block.bytes.empty()) {
+        return true;
+    }
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(m_offsets[index]));
+    if (!m_file.read(reinterpret_cast<char *>(block.bytes.data()), static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Truncated DSK track " + std::to_string(cylinder) + "/" + std::to_string(side));
+    }
+    return true;
+}
+
+Track DskReader::decode(const TrackBlock &block) const
+{
+    Track track;
+    track.cylinder = block.cylinder;
+    track.side = block.side;
+    const std::vector<uint8_t> &bytes = block.bytes;
+    if (bytes.size() < HEADER_SIZE || std::memcmp(bytes.data(), TRACK_SIGNATURE, 10) != 0) {
+        return track;
+    }
+    track.encoding = (m_extended && bytes[TRACK_RECORDING] == 1) ? Encoding::FM : Encoding::MFM;
+
+    const size_t count = bytes[TRACK_SECTORS] < MAX_SECTORS ? bytes[TRACK_SECTORS] : MAX_SECTORS;
+    size_t position = HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *info = bytes.data() + TRACK_SECTOR_INFO + i * SECTOR_INFO_SIZE;
+        Sector sector;
+        sector.cylinder = info[0];
+        sector.head = info[1];
+        sector.id = info[2];
+        sector.sizeCode = info[3];
+        const uint8_t st1 = info[4];
+        const uint8_t st2 = info[5];
+
+        const size_t nominal = nominalSize(sector.sizeCode);
+        size_t stored = m_extended ? readLe16(info + 6) : nominalSize(bytes[TRACK_SIZE_CODE]);
+        if (position + stored > bytes.size()) {
+            stored = position < bytes.size() ? bytes.size() - position : 0;
+        }
+
+        // ST1 DE alone is an ID field CRC error, with ST2 DD the data field's
+        sector.idCrcOk = !(st1 & ST1_DATA_ERROR) || (st2 & ST2_DATA_ERROR_IN_DATA);
+        sector.dataCrcOk = !(st2 & ST2_DATA_ERROR_IN_DATA);
+        sector.deleted = (st2 & ST2_CONTROL_MARK) != 0;
+        // Copies of a sector that reads differently each time are stored back to back
+        sector.weak = m_extended && stored > nominal && stored % nominal == 0;
+        if (!(st1 & ST1_MISSING_ADDRESS_MARK) && !(st2 & ST2_MISSING_DATA_MARK)) {
+            const size_t size = sector.weak ? nominal : stored;
+            sector.data.assign(bytes.begin() + position, bytes.begin() + position + size);
+        }
+        position += stored;
+        track.sectors.push_back(std::move(sector));
+    }
+    return track;
+}
+
+DskWriter::DskWriter()
+    : m_sides(1)
+    , m_dataRateKbps(250)
+{
+}
+
+bool DskWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    m_sides = sides;
+    m_dataRateKbps = dataRateKbps;
+    if (static_cast<size_t>(cylinders) * sides > MAX_TABLE_ENTRIES || cylinders > 255) {
+        return fail("EDSK holds at most " + std::to_string(MAX_TABLE_ENTRIES) + " tracks");
+    }
+    m_sizeTable.assign(static_cast<size_t>(cylinders) * sides, 0);
+
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    uint8_t header[HEADER_SIZE] = {};
+    std::memcpy(header, EDSK_HEADER, sizeof(EDSK_HEADER) - 1);
+    std::memcpy(header + DISK_CREATOR, CREATOR, sizeof(CREATOR) - 1);
+    header[DISK_TRACKS] = static_cast<uint8_t>(cylinders);
+    header[DISK_SIDES] = static_cast<uint8_t>(sides);
+    if (!m_file.write(reinterpret_cast<const char *>(header), sizeof(header))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool DskWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    block.bytes.clear();
+    if (!track.isFormatted()) {
+        return true;
+    }
+    if (track.sectors.size() > MAX_SECTORS) {
+        if (error) {
+            *error = "Track " + std::to_string(track.cylinder) + "/" + std::to_string(track.side) +
+                     " has more sectors than EDSK can list";
+        }
+        return false;
+    }
+
+    block.bytes.assign(HEADER_SIZE, 0);
+    uint8_t *header = block.bytes.data();
+    std::memcpy(header, TRACK_SIGNATURE, sizeof(TRACK_SIGNATURE) - 1);
+    header[TRACK_CYLINDER] = static_cast<uint8_t>(track.cylinder);
+    header[TRACK_SIDE] = static_cast<uint8_t>(track.side);
+    header[TRACK_DATA_RATE] = m_dataRateKbps > 250 ? 2 : 1;
+    header[TRACK_RECORDING] = track.encoding == Encoding::FM ? 1 : 2;
+    header[TRACK_SIZE_CODE] = track.sectors.front().sizeCode;
+    header[TRACK_SECTORS] = static_cast<uint8_t>(track.sectors.size());
+    header[TRACK_GAP3] = 0x4E;
+    header[TRACK_FILLER] = 0xE5;
+
+    for (size_t i = 0; i < track.sectors.size(); ++i) {
+        const Sector &sector = track.sectors[i];
+        uint8_t st1 = 0;
+        uint8_t st2 = 0;
+        if (!sector.idCrcOk) {
+            st1 |= ST1_DATA_ERROR;
+        } else if (!sector.hasData()) {
+            st1 |= ST1_MISSING_ADDRESS_MARK;
+            st2 |= ST2_MISSING_DATA_MARK;
+        } else if (!sector.dataCrcOk) {
+            st1 |= ST1_DATA_ERROR;
+            st2 |= ST2_DATA_ERROR_IN_DATA;
+        }
+        if (sector.deleted) {
+            st2 |= ST2_CONTROL_MARK;
+        }
+
+        uint8_t *info = block.bytes.data() + TRACK_SECTOR_INFO + i * SECTOR_INFO_SIZE;
+        info[0] = sector.cylinder;
+        info[1] = sector.head;
+        info[2] = sector.id;
+        info[3] = sector.sizeCode;
+        info[4] = st1;
+        info[5] = st2;
+        info[6] = static_cast<uint8_t>(sector.data.size());
+        info[7] = static_cast<uint8_t>(sector.data.size() >> 8);
+        block.bytes.insert(block.bytes.end(), sector.data.begin(), sector.data.end());
+    }
+
+    block.bytes.resize((block.bytes.size() + 255) & ~static_cast<size_t>(255), 0);
+    if (block.bytes.size() > 255 * 256) {
+        if (error) {
+            *error = "Track " + std::to_string(track.cylinder) + "/" + std::to_string(track.side) +
+                     " is too large for EDSK";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool DskWriter::writeBlock(const TrackBlock &block)
+{
+    m_sizeTable[static_cast<size_t>(block.cylinder * m_sides + block.side)] =
+        static_cast<uint8_t>(block.bytes.size() / 256);
+    if (!m_file.write(reinterpret_cast<const char *>(block.bytes.data()),
+                      static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool DskWriter::finish()
+{
+    m_file.seekp(static_cast<std::streamoff>(DISK_TRACK_TABLE));
+    if (!m_file.write(reinterpret_cast<const char *>(m_sizeTable.data()),
+                      static_cast<std::streamsize>(m_sizeTable.size()))) {
+        return fail("Write error");
+    }
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
@@ -0,0 +1,57 @@
+#ifndef DSKFORMAT_H
+#define DSKFORMAT_H
+
+#include "trackstream.h"
+
+#include <fstream>
+#include <vector>
+
+// CPCEMU disk images. Both the original DSK (one track size for the whole
+// disk) and Extended DSK (a size per track, per-sector stored lengths) are
+// read; writing always produces Extended DSK, whose track size table is
+// filled in by finish(). FDC status bytes carry the CRC and deleted data
+// state, and EDSK sectors stored several times over are marked weak.
+class DskReader : public TrackReader
+{
+public:
+    DskReader();
+
+    const char *formatName() const override { return m_extended ? "EDSK" : "DSK"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    std::ifstream m_file;
+    bool m_extended;
+    int m_cylinders;
+    int m_sides;
+    std::vector<uint64_t> m_offsets;    // Per track, cylinder-major
+    std::vector<uint32_t> m_sizes;
+};
+
+class DskWriter : public TrackWriter
+{
+public:
+    DskWriter();
+
+    const char *formatName() const override { return "EDSK"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    std::ofstream m_file;
+    int m_sides;
+    int m_dataRateKbps;
+    std::vector<uint8_t> m_sizeTable;   // Track sizes in 256 byte units
+};
+
+#endif // DSKFORMAT_H
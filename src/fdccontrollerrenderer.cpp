@@ -0,0 +1,101 @@
+#include "fdccontrollerrenderer.h"
+#include "drqmonitor.h"
+#include <QPen>
+#include <QBrush>
+#include <QFont>
+#include <QRect>
+
+void FDCControllerRenderer::paint(QPainter &painter, const QSize &size, const FDCControllerState &state)
+{
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    // Draw background
+    painter.fillRect(QRect(QPoint(0, 0), size), Qt::white);
+    painter.setPen(QPen(Qt::black, 1));
+
+    // Draw title
+    painter.setFont(QFont("Arial", 12, QFont::Bold));
+    painter.drawText(10, 20, "WD1793 FDC Status");
+
+    // Draw registers
+    int y = 40;
+    drawRegister(painter, "Status", state.status, 10, y);
+    drawRegister(painter, "Command", state.command, 10, y + 30);
+    drawRegister(painter, "Track", state.track, 10, y + 60);
+    drawRegister(painter, "Sector", state.sector, 10, y + 90);
+    drawRegister(painter, "Data", state.data, 10, y + 120);
+
+    // Draw status indicators
+    drawStatus(painter, "INT", state.intrq, 200, y);
+    drawStatus(painter, "DRQ", state.drq, 200, y + 30);
+
+    if (state.drqMonitor) {
+        drawDrqLatency(painter, state, 300, y);
+    }
+}
+
+void FDCControllerRenderer::drawDrqLatency(QPainter &painter, const FDCControllerState &state, int x, int y)
+{
+    painter.setPen(QPen(Qt::black, 1));
+    painter.setFont(QFont("Arial", 10, QFont::Bold));
+    painter.drawText(x, y, "DRQ latency (us)   p50     p99     max");
+
+    painter.setFont(QFont("Arial", 10));
+    int row = y + 20;
+    for (int i = 0; i < DrqMonitor::COMMAND_COUNT; ++i) {
+        const DrqMonitor::Command command = static_cast<DrqMonitor::Command>(i);
+        const LatencyHistogram &latency = state.drqMonitor->histogram(command);
+        if (latency.count() == 0) {
+            continue;
+        }
+        painter.drawText(x, row, QString::fromLatin1(DrqMonitor::commandName(command)));
+        painter.drawText(x + 110, row, QString::number(latency.valueAtPercentile(50.0) / 1000.0, 'f', 1));
+        painter.drawText(x + 160, row, QString::number(latency.valueAtPercentile(99.0) / 1000.0, 'f', 1));
+        painter.drawText(x + 210, row, QString::number(latency.max() / 1000.0, 'f', 1));
+        row += 20;
+    }
+
+    // The most recent byte a real controller would have dropped
+    if (state.lostDataEvents > 0) {
+        const std::vector<DrqMonitor::LostDataEvent> events = state.drqMonitor->lostDataEvents();
+        if (!events.empty()) {
+            const DrqMonitor::LostDataEvent &event = events.back();
+            painter.setPen(QPen(Qt::red, 1));
+            painter.drawText(x, y + 120, QString("Lost Data x%1: %2 C%3 H%4 S%5 byte %6")
+                                             .arg(state.lostDataEvents)
+                                             .arg(QString::fromLatin1(DrqMonitor::commandName(event.command)))
+                                             .arg(event.cylinder)
+                                             .arg(event.side)
+                                             .arg(event.sectorRegister)
+                                             .arg(event.byteOffset));
+        }
+    }
+}
+
+void FDCControllerRenderer::drawRegister(QPainter &painter, const QString &name, quint8 value, int x, int y)
+{
+    painter.setFont(QFont("Arial", 10));
+    painter.drawText(x, y, name + ":");
+    painter.drawText(x + 80, y, formatBinary(value));
+    painter.drawText(x + 200, y, QString("0x%1").arg(value, 2, 16, QChar('0')));
+}
+
+void FDCControllerRenderer::drawStatus(QPainter &painter, const QString &name, bool active, int x, int y)
+{
+    painter.setFont(QFont("Arial", 10));
+    painter.drawText(x, y, name + ":");
+
+    QColor color = active ? Qt::red : Qt::gray;
+    painter.setPen(QPen(color, 1));
+    painter.setBrush(QBrush(color));
+    painter.drawEllipse(x + 40, y - 5, 10, 10);
+}
+
+QString FDCControllerRenderer::formatBinary(quint8 value)
+{
+    QString binary;
+    for (int i = 7; i >= 0; --i) {
+        binary += (value & (1 << i)) ? "1" : "0";
+    }
+    return binary;
+}
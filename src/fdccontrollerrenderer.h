@@ -0,0 +1,37 @@
+#ifndef FDCCONTROLLERRENDERER_H
+#define FDCCONTROLLERRENDERER_H
+
+#include <QPainter>
+#include <QSize>
+#include <QString>
+
+class DrqMonitor;
+
+// Everything one frame of the controller panel shows
+struct FDCControllerState {
+    quint8 status = 0;
+    quint8 command = 0;
+    quint8 track = 0;
+    quint8 sector = 0;
+    quint8 data = 0;
+    bool intrq = false;
+    bool drq = false;
+    const DrqMonitor *drqMonitor = nullptr;    // Latency table when set
+    quint64 lostDataEvents = 0;
+};
+
+// Paints the controller panel from an FDCControllerState. Not a QObject, so
+// FrameExporter workers can each own one, like FloppyDiskRenderer.
+class FDCControllerRenderer
+{
+public:
+    void paint(QPainter &painter, const QSize &size, const FDCControllerState &state);
+
+private:
+    void drawRegister(QPainter &painter, const QString &name, quint8 value, int x, int y);
+    void drawStatus(QPainter &painter, const QString &name, bool active, int x, int y);
+    void drawDrqLatency(QPainter &painter, const FDCControllerState &state, int x, int y);
+    QString formatBinary(quint8 value);
+};
+
+#endif // FDCCONTROLLERRENDERER_H
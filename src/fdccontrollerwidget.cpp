@@ -1,18 +1,15 @@
 #include "fdccontrollerwidget.h"
+#include "drqmonitor.h"
+#include "fdchostprotocol.h"
+#include "fdcsharedbus.h"
+#include "wd1793.h"
 #include <QPainter>
-#include <QPen>
-#include <QBrush>
-#include <QFont>
 
 FDCControllerWidget::FDCControllerWidget(QWidget *parent)
     : QWidget(parent)
-    , statusReg(0)
-    , commandReg(0)
-    , trackReg(0)
-    , sectorReg(0)
-    , dataReg(0)
-    , interruptActive(false)
-    , dataRequestActive(false)
+    , controller(nullptr)
+    , sharedBus(nullptr)
+    , drqSamples(0)
 {
     setMinimumSize(300, 200);
 }
@@ -23,102 +20,126 @@ FDCControllerWidget::~FDCControllerWidget()
 
 void FDCControllerWidget::setStatusRegister(quint8 status)
 {
-    statusReg = status;
+    state.status = status;
     update();
 }
 
 void FDCControllerWidget::setCommandRegister(quint8 command)
 {
-    commandReg = command;
+    state.command = command;
     update();
 }
 
 void FDCControllerWidget::setTrackRegister(quint8 track)
 {
-    trackReg = track;
+    state.track = track;
     update();
 }
 
 void FDCControllerWidget::setSectorRegister(quint8 sector)
 {
-    sectorReg = sector;
+    state.sector = sector;
     update();
 }
 
 void FDCControllerWidget::setDataRegister(quint8 data)
 {
-    dataReg = data;
+    state.data = data;
     update();
 }
 
 void FDCControllerWidget::setInterruptStatus(bool active)
 {
-    interruptActive = active;
+    state.intrq = active;
     update();
 }
 
-void FDCControllerWidget::setDataRequest(bool active)
+void FDCControllerWidget::setController(const Wd1793 *fdc)
 {
-    dataRequestActive = active;
-    update();
+    controller = fdc;
+    sampleController();
 }
 
-void FDCControllerWidget::paintEvent(QPaintEvent *event)
+void FDCControllerWidget::setSharedBus(const FdcSharedBus *bus)
 {
-    Q_UNUSED(event);
-    QPainter painter(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    // Draw background
-    painter.fillRect(rect(), Qt::white);
-    painter.setPen(QPen(Qt::black, 1));
-
-    // Draw title
-    painter.setFont(QFont("Arial", 12, QFont::Bold));
-    painter.drawText(10, 20, "WD1793 FDC Status");
-
-    // Draw registers
-    int y = 40;
-    drawRegister(painter, "Status", statusReg, 10, y);
-    drawRegister(painter, "Command", commandReg, 10, y + 30);
-    drawRegister(painter, "Track", trackReg, 10, y + 60);
-    drawRegister(painter, "Sector", sectorReg, 10, y + 90);
-    drawRegister(painter, "Data", dataReg, 10, y + 120);
-
-    // Draw status indicators
-    drawStatus(painter, "INT", interruptActive, 200, y);
-    drawStatus(painter, "DRQ", dataRequestActive, 200, y + 30);
+    sharedBus = bus;
+    sampleController();
 }
 
-void FDCControllerWidget::drawRegister(QPainter &painter, const QString &name, quint8 value, int x, int y)
+void FDCControllerWidget::setDrqMonitor(const DrqMonitor *monitor)
 {
-    painter.setFont(QFont("Arial", 10));
-    painter.drawText(x, y, name + ":");
-    painter.drawText(x + 80, y, formatBinary(value));
-    painter.drawText(x + 200, y, QString("0x%1").arg(value, 2, 16, QChar('0')));
+    state.drqMonitor = monitor;
+    drqSamples = 0;
+    state.lostDataEvents = 0;
+    setMinimumWidth(monitor ? 560 : 300);
+    update();
 }
 
-void FDCControllerWidget::drawStatus(QPainter &painter, const QString &name, bool active, int x, int y)
+void FDCControllerWidget::sampleController()
 {
-    painter.setFont(QFont("Arial", 10));
-    painter.drawText(x, y, name + ":");
-    
-    QColor color = active ? Qt::red : Qt::gray;
-    painter.setPen(QPen(color, 1));
-    painter.setBrush(QBrush(color));
-    painter.drawEllipse(x + 40, y - 5, 10, 10);
+    quint8 status, command, track, sector, data;
+    bool intrq, drq;
+    if (sharedBus) {
+        const FdcSharedBusLayout::RegisterFile file = sharedBus->registers();
+        status = file.status;
+        command = file.command;
+        track = file.track;
+        sector = file.sector;
+        data = file.data;
+        intrq = (file.pins & FdcHostProtocol::SYSTEM_INTRQ) != 0;
+        drq = (file.pins & FdcHostProtocol::SYSTEM_DRQ) != 0;
+    } else if (controller) {
+        status = controller->statusRegister();
+        command = controller->commandRegister();
+        track = controller->trackRegister();
+        sector = controller->sectorRegister();
+        data = controller->dataRegister();
+        intrq = controller->intrq();
+        drq = controller->drq();
+    } else {
+        return;
+    }
+
+    bool drqChanged = false;
+    if (state.drqMonitor) {
+        quint64 samples = 0;
+        for (int i = 0; i < DrqMonitor::COMMAND_COUNT; ++i) {
+            samples += state.drqMonitor->histogram(static_cast<DrqMonitor::Command>(i)).count();
+        }
+        const quint64 lost = state.drqMonitor->lostDataCount();
+        drqChanged = samples != drqSamples || lost != state.lostDataEvents;
+        drqSamples = samples;
+        state.lostDataEvents = lost;
+    }
+    if (!drqChanged && status == state.status && command == state.command && track == state.track
+        && sector == state.sector && data == state.data && intrq == state.intrq && drq == state.drq) {
+        return;
+    }
+
+    state.status = status;
+    state.command = command;
+    state.track = track;
+    state.sector = sector;
+    state.data = data;
+    state.intrq = intrq;
+    state.drq = drq;
+    update();
 }
 
-QString FDCControllerWidget::formatBinary(quint8 value)
+void FDCControllerWidget::setDataRequest(bool active)
 {
-    QString binary;
-    for (int i = 7; i >= 0; --i) {
-        binary += (value & (1 << i)) ? "1" : "0";
-    }
-    return binary;
+    state.drq = active;
+    update();
+}
+
+void FDCControllerWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    renderer.paint(painter, size(), state);
 }
 
 QSize FDCControllerWidget::sizeHint() const
 {
     return QSize(300, 200);
-} 
\ No newline at end of file
+} 
\ No newline at end of file
@@ -2,7 +2,11 @@
 #define FDCCONTROLLERWIDGET_H
 
 #include <QWidget>
-#include <QPainter>
+#include "fdccontrollerrenderer.h"
+
+class DrqMonitor;
+class FdcSharedBus;
+class Wd1793;
 
 class FDCControllerWidget : public QWidget
 {
@@ -20,22 +24,26 @@ public:
     void setInterruptStatus(bool active);
     void setDataRequest(bool active);
 
+    // Registers are sampled from the controller at display rate rather than
+    // pushed per access, so bulk transfers cost no repaints
+    void setController(const Wd1793 *controller);
+    // Observes the register file published on the shared memory bus
+    // instead; takes precedence over setController()
+    void setSharedBus(const FdcSharedBus *bus);
+    // DRQ service latency and the last Lost Data event next to the DRQ pin
+    void setDrqMonitor(const DrqMonitor *monitor);
+    void sampleController();
+
 protected:
     void paintEvent(QPaintEvent *event) override;
     QSize sizeHint() const override;
 
 private:
-    quint8 statusReg;
-    quint8 commandReg;
-    quint8 trackReg;
-    quint8 sectorReg;
-    quint8 dataReg;
-    bool interruptActive;
-    bool dataRequestActive;
-
-    void drawRegister(QPainter &painter, const QString &name, quint8 value, int x, int y);
-    void drawStatus(QPainter &painter, const QString &name, bool active, int x, int y);
-    QString formatBinary(quint8 value);
+    FDCControllerState state;
+    FDCControllerRenderer renderer;
+    const Wd1793 *controller;
+    const FdcSharedBus *sharedBus;
+    quint64 drqSamples;
 };
 
-#endif // FDCCONTROLLERWIDGET_H 
\ No newline at end of file
+#endif // FDCCONTROLLERWIDGET_H 
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "fdchostprotocol.h"
+#include "wd1793.h"
+
+#include <cstring>
+
+namespace FdcHostProtocol {
+
+namespace {
+
+uint64_t loadLe64(const uint8_t *bytes)
+{
+    return static_cast<uint64_t>(loadLe32(bytes)) | static_cast<uint64_t>(loadLe32(bytes + 4)) << 32;
+}
+
+void storeLe64(uint8_t *bytes, uint64_t value)
+{
+    storeLe32(bytes, static_cast<uint32_t>(value));
+    storeLe32(bytes + 4, static_cast<uint32_t>(value >> 32));
+}
+
+BatchHeader loadBatchHeader(const uint8_t *bytes)
+{
+    BatchHeader header;
+    header.magic = loadLe32(bytes);
+    header.opCount = loadLe32(bytes + 4);
+    header.baseCycle = loadLe64(bytes + 8);
+    header.clockHz = loadLe32(bytes + 16);
+    header.reserved = loadLe32(bytes + 20);
+    return header;
+}
+
+void storeBatchHeader(uint8_t *bytes, const BatchHeader &header)
+{
+    storeLe32(bytes, header.magic);
+    storeLe32(bytes + 4, header.opCount);
+    storeLe64(bytes + 8, header.baseCycle);
+    storeLe32(bytes + 16, header.clockHz);
+    storeLe32(bytes + 20, header.reserved);
+}
+
+Op loadOp(const uint8_t *bytes)
+{
+    Op op;
+    op.kind = bytes[0];
+    op.reg = bytes[1];
+    op.value = bytes[2];
+    op.reserved = bytes[3];
+    op.cycleOffset = loadLe32(bytes + 4);
+    return op;
+}
+
+void storeOp(uint8_t *bytes, const Op &op)
+{
+    bytes[0] = op.kind;
+    bytes[1] = op.reg;
+    bytes[2] = op.value;
+    bytes[3] = op.reserved;
+    storeLe32(bytes + 4, op.cycleOffset);
+}
+
+void appendReply(std::vector<uint8_t> &reply, size_t headerAt, uint32_t status, uint32_t readCount,
+                 uint32_t executed, const Wd1793 &controller)
+{
+    uint8_t *bytes = reply.data() + headerAt;
+    std::memset(bytes, 0, sizeof(ReplyHeader));
+    storeLe32(bytes, REPLY_MAGIC);
+    storeLe32(bytes + 4, status);
+    storeLe32(bytes + 8, readCount);
+    storeLe32(bytes + 12, executed);
+    bytes[16] = controller.statusRegister();
+    bytes[17] = pins(controller);
+}
+
+} // namespace
+
+uint32_t loadLe32(const uint8_t *bytes)
+{
+    return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8
+         | static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+void storeLe32(uint8_t *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+ReplyHeader loadReplyHeader(const uint8_t *bytes)
+{
+    ReplyHeader header = {};
+    header.magic = loadLe32(bytes);
+    header.status = loadLe32(bytes + 4);
+    header.readCount = loadLe32(bytes + 8);
+    header.executed = loadLe32(bytes + 12);
+    header.statusRegister = bytes[16];
+    header.pins = bytes[17];
+    return header;
+}
+
+uint64_t cyclesToNs(uint64_t cycles, uint32_t clockHz)
+{
+    if (clockHz == 0) {
+        return cycles;
+    }
+    return (cycles / clockHz) * 1000000000ULL + (cycles % clockHz) * 1000000000ULL / clockHz;
+}
+
+uint8_t pins(const Wd1793 &controller)
+{
+    return static_cast<uint8_t>((controller.intrq() ? SYSTEM_INTRQ : 0) | (controller.drq() ? SYSTEM_DRQ : 0));
+}
+
+bool readRegister(Wd1793 &controller, uint8_t reg, uint64_t now, uint8_t &value)
+{
+    if (reg == REG_SYSTEM) {
+        controller.advance(now);
+        value = pins(controller);
+        return true;
+    }
+    if (reg > REG_DATA) {
+        return false;
+    }
+    value = controller.read(reg, now);
+    return true;
+}
+
+bool writeRegister(Wd1793 &controller, uint8_t reg, uint8_t value, uint64_t now)
+{
+    if (reg == REG_SYSTEM) {
+        controller.advance(now);
+        if (FloppyDrive *drive = controller.drive()) {
+            drive->setSide((value & SYSTEM_SIDE1) ? 1 : 0);
+        }
+        controller.setDoubleDensity((value & SYSTEM_DOUBLE_DENSITY) != 0);
+        if (value & SYSTEM_RESET) {
+            controller.reset(now);
+        }
+        return true;
+    }
+    if (reg > REG_DATA) {
+        return false;
+    }
+    controller.write(reg, value, now);
+    return true;
+}
+
+void execute(Wd1793 &controller, const uint8_t *request, size_t size, std::vector<uint8_t> &reply)
+{
+    const size_t headerAt = reply.size();
+    reply.resize(headerAt + sizeof(ReplyHeader));
+
+    if (size < sizeof(BatchHeader)) {
+        appendReply(reply, headerAt, REPLY_TRUNCATED, 0, 0, controller);
+        return;
+    }
+    const BatchHeader header = loadBatchHeader(request);
+    if (header.magic != REQUEST_MAGIC) {
+        appendReply(reply, headerAt, REPLY_BAD_MAGIC, 0, 0, controller);
+        return;
+    }
+    if (header.opCount > (size - sizeof(header)) / sizeof(Op)) {
+        appendReply(reply, headerAt, REPLY_TRUNCATED, 0, 0, controller);
+        return;
+    }
+
+    const uint8_t *ops = request + sizeof(header);
+    uint32_t reads = 0;
+    for (uint32_t i = 0; i < header.opCount; ++i) {
+        const Op op = loadOp(ops + i * sizeof(Op));
+        const uint64_t now = cyclesToNs(header.baseCycle + op.cycleOffset, header.clockHz);
+
+        bool ok = false;
+        if (op.kind == OP_READ) {
+            uint8_t value = 0;
+            ok = readRegister(controller, op.reg, now, value);
+            if (ok) {
+                reply.push_back(value);
+                ++reads;
+            }
+        } else if (op.kind == OP_WRITE) {
+            ok = writeRegister(controller, op.reg, op.value, now);
+        }
+        if (!ok) {
+            appendReply(reply, headerAt, REPLY_BAD_OP, reads, i, controller);
+            return;
+        }
+    }
+    appendReply(reply, headerAt, REPLY_OK, reads, header.opCount, controller);
+}
+
+BatchWriter::BatchWriter(uint32_t clockHz)
+    : m_clockHz(clockHz)
+    , m_baseCycle(0)
+    , m_reads(0)
+{
+}
+
+void BatchWriter::begin(uint64_t baseCycle)
+{
+    m_baseCycle = baseCycle;
+    m_reads = 0;
+    m_ops.clear();
+}
+
+void BatchWriter::read(uint8_t reg, uint64_t cycle)
+{
+    m_ops.push_back({ OP_READ, reg, 0, 0, static_cast<uint32_t>(cycle - m_baseCycle) });
+    ++m_reads;
+}
+
+void BatchWriter::write(uint8_t reg, uint8_t value, uint64_t cycle)
+{
+    m_ops.push_back({ OP_WRITE, reg, value, 0, static_cast<uint32_t>(cycle - m_baseCycle) });
+}
+
+const std::vector<uint8_t> &BatchWriter::frame()
+{
+    BatchHeader header = {};
+    header.magic = REQUEST_MAGIC;
+    header.opCount = static_cast<uint32_t>(m_ops.size());
+    header.baseCycle = m_baseCycle;
+    header.clockHz = m_clockHz;
+
+    const uint32_t length = static_cast<uint32_t>(sizeof(header) + m_ops.size() * sizeof(Op));
+    m_frame.resize(sizeof(length) + length);
+    storeLe32(m_frame.data(), length);
+    storeBatchHeader(m_frame.data() + sizeof(length), header);
+    uint8_t *ops = m_frame.data() + sizeof(length) + sizeof(header);
+    for (size_t i = 0; i < m_ops.size(); ++i) {
+        storeOp(ops + i * sizeof(Op), m_ops[i]);
+    }
+    return m_frame;
+}
+
+} // namespace FdcHostProtocol
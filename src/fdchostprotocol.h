@@ -0,0 +1,132 @@
+#ifndef FDCHOSTPROTOCOL_H
+#define FDCHOSTPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Wd1793;
+
+// Batched port I/O protocol used by external emulators and test rigs.
+//
+// Every message on the wire is a frame: a little-endian uint32 payload
+// length followed by the payload. A request payload is a BatchHeader and
+// opCount 8-byte Op records; the controller runs them in order and answers
+// with one ReplyHeader followed by one byte per read, in request order.
+// Ops carry CPU cycles relative to the batch base cycle, which are turned
+// into controller time with the host clock from the header, so a batch
+// behaves exactly as if the accesses had been made one by one.
+//
+// The structs below give field order and sizes. Every multi-byte field is
+// little-endian on the wire whatever the host byte order, so frames go
+// through the load/store helpers rather than memcpy.
+namespace FdcHostProtocol {
+
+constexpr uint32_t REQUEST_MAGIC = 0x31424457;   // "WDB1"
+constexpr uint32_t REPLY_MAGIC = 0x31524457;     // "WDR1"
+constexpr size_t MAX_FRAME_BYTES = 16 * 1024 * 1024;
+
+// Register numbers 0-3 are the WD1793 ports; 4 is the drive control latch
+constexpr uint8_t REG_STATUS_COMMAND = 0;
+constexpr uint8_t REG_TRACK = 1;
+constexpr uint8_t REG_SECTOR = 2;
+constexpr uint8_t REG_DATA = 3;
+constexpr uint8_t REG_SYSTEM = 4;
+
+// REG_SYSTEM read: controller output pins
+constexpr uint8_t SYSTEM_INTRQ = 0x80;
+constexpr uint8_t SYSTEM_DRQ = 0x40;
+// REG_SYSTEM write: drive control
+constexpr uint8_t SYSTEM_SIDE1 = 0x01;
+constexpr uint8_t SYSTEM_DOUBLE_DENSITY = 0x02;
+constexpr uint8_t SYSTEM_RESET = 0x04;
+
+enum OpKind : uint8_t {
+    OP_READ = 0,
+    OP_WRITE = 1
+};
+
+enum ReplyStatus : uint32_t {
+    REPLY_OK = 0,
+    REPLY_BAD_MAGIC = 1,
+    REPLY_TRUNCATED = 2,
+    REPLY_BAD_OP = 3
+};
+
+#pragma pack(push, 1)
+struct BatchHeader {
+    uint32_t magic;
+    uint32_t opCount;
+    uint64_t baseCycle;     // Absolute host cycle the op offsets are relative to
+    uint32_t clockHz;       // Host CPU clock used to convert cycles to time
+    uint32_t reserved;
+};
+
+struct Op {
+    uint8_t kind;
+    uint8_t reg;
+    uint8_t value;          // Written value; ignored for reads
+    uint8_t reserved;
+    uint32_t cycleOffset;
+};
+
+struct ReplyHeader {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t readCount;     // Result bytes that follow
+    uint32_t executed;      // Ops run before an error, opCount on success
+    uint8_t statusRegister; // State after the last op
+    uint8_t pins;           // SYSTEM_INTRQ / SYSTEM_DRQ
+    uint8_t reserved[6];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(BatchHeader) == 24, "BatchHeader layout");
+static_assert(sizeof(Op) == 8, "Op layout");
+static_assert(sizeof(ReplyHeader) == 24, "ReplyHeader layout");
+
+// Little-endian wire integers
+uint32_t loadLe32(const uint8_t *bytes);
+void storeLe32(uint8_t *bytes, uint32_t value);
+// Reply header as received, for clients
+ReplyHeader loadReplyHeader(const uint8_t *bytes);
+
+// Host cycles to nanoseconds without overflowing for long sessions
+uint64_t cyclesToNs(uint64_t cycles, uint32_t clockHz);
+
+// Single port access at controller time 'now', including REG_SYSTEM;
+// false for an unknown register
+bool readRegister(Wd1793 &controller, uint8_t reg, uint64_t now, uint8_t &value);
+bool writeRegister(Wd1793 &controller, uint8_t reg, uint8_t value, uint64_t now);
+uint8_t pins(const Wd1793 &controller);
+
+// Runs one request payload against the controller and appends the reply
+// payload (without the frame length) to 'reply'
+void execute(Wd1793 &controller, const uint8_t *request, size_t size, std::vector<uint8_t> &reply);
+
+// Client side helper: collects ops and produces a framed request
+class BatchWriter
+{
+public:
+    explicit BatchWriter(uint32_t clockHz = 3500000);
+
+    void begin(uint64_t baseCycle);
+    void read(uint8_t reg, uint64_t cycle);
+    void write(uint8_t reg, uint8_t value, uint64_t cycle);
+
+    size_t opCount() const { return m_ops.size(); }
+    size_t readCount() const { return m_reads; }
+    // Frame length, BatchHeader and ops, ready to send
+    const std::vector<uint8_t> &frame();
+
+private:
+    uint32_t m_clockHz;
+    uint64_t m_baseCycle;
+    size_t m_reads;
+    std::vector<Op> m_ops;
+    std::vector<uint8_t> m_frame;
+};
+
+} // namespace FdcHostProtocol
+
+#endif // FDCHOSTPROTOCOL_H
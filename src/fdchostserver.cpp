@@ -0,0 +1,150 @@
+#include "fdchostserver.h"
+#include "fdchostprotocol.h"
+#include "fdcsharedbus.h"
+#include "wd1793.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QtEndian>
+
+FdcHostServer::FdcHostServer(Wd1793 *fdc, QObject *parent)
+    : QObject(parent)
+    , controller(fdc)
+    , controllerLock(nullptr)
+    , sharedBus(nullptr)
+    , server(new QLocalServer(this))
+    , batches(0)
+    , operations(0)
+{
+    connect(server, &QLocalServer::newConnection, this, &FdcHostServer::onNewConnection);
+}
+
+FdcHostServer::~FdcHostServer()
+{
+    close();
+}
+
+bool FdcHostServer::listen(const QString &name)
+{
+    listenError.clear();
+    if (server->listen(name)) {
+        return true;
+    }
+    // A previous instance that crashed leaves its socket file behind; only
+    // a socket nobody answers on is stale, a live one belongs to another
+    // instance and stays
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(PROBE_TIMEOUT_MS)) {
+        probe.abort();
+        listenError = tr("another instance is already serving %1").arg(name);
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    return server->listen(name);
+}
+
+void FdcHostServer::close()
+{
+    server->close();
+    const QList<QLocalSocket *> sockets = pending.keys();
+    for (QLocalSocket *socket : sockets) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+    }
+    pending.clear();
+}
+
+bool FdcHostServer::isListening() const
+{
+    return server->isListening();
+}
+
+QString FdcHostServer::serverName() const
+{
+    return server->fullServerName();
+}
+
+QString FdcHostServer::errorString() const
+{
+    return listenError.isEmpty() ? server->errorString() : listenError;
+}
+
+QString FdcHostServer::defaultServerName()
+{
+    return QStringLiteral("qt-floppy-fdc");
+}
+
+void FdcHostServer::onNewConnection()
+{
+    while (QLocalSocket *socket = server->nextPendingConnection()) {
+        pending.insert(socket, QByteArray());
+        connect(socket, &QLocalSocket::readyRead, this, &FdcHostServer::onReadyRead);
+        connect(socket, &QLocalSocket::disconnected, this, &FdcHostServer::onDisconnected);
+        emit clientConnected();
+    }
+}
+
+void FdcHostServer::onReadyRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    if (!socket || !pending.contains(socket)) {
+        return;
+    }
+
+    QByteArray &buffer = pending[socket];
+    buffer.append(socket->readAll());
+
+    // Run every complete frame, then send all replies in one write
+    std::unique_lock<std::mutex> guard;
+    if (controllerLock) {
+        guard = std::unique_lock<std::mutex>(*controllerLock);
+    }
+    reply.clear();
+    qsizetype offset = 0;
+    while (buffer.size() - offset >= static_cast<qsizetype>(sizeof(quint32))) {
+        const quint32 length = qFromLittleEndian<quint32>(buffer.constData() + offset);
+        if (length > FdcHostProtocol::MAX_FRAME_BYTES) {
+            socket->abort();
+            return;
+        }
+        if (buffer.size() - offset < static_cast<qsizetype>(sizeof(length) + length)) {
+            break;
+        }
+
+        const size_t frameAt = reply.size();
+        reply.resize(frameAt + sizeof(quint32));
+        const uint8_t *payload = reinterpret_cast<const uint8_t *>(buffer.constData() + offset + sizeof(length));
+        FdcHostProtocol::execute(*controller, payload, length, reply);
+        const quint32 replyLength = static_cast<quint32>(reply.size() - frameAt - sizeof(quint32));
+        qToLittleEndian(replyLength, reply.data() + frameAt);
+
+        const FdcHostProtocol::ReplyHeader header = FdcHostProtocol::loadReplyHeader(reply.data() + frameAt + sizeof(quint32));
+        ++batches;
+        operations += header.executed;
+        offset += sizeof(length) + length;
+    }
+    buffer.remove(0, offset);
+    if (sharedBus && !reply.empty()) {
+        sharedBus->publish(*controller);
+    }
+    if (guard.owns_lock()) {
+        guard.unlock();
+    }
+
+    if (!reply.empty()) {
+        socket->write(reinterpret_cast<const char *>(reply.data()), static_cast<qint64>(reply.size()));
+    }
+}
+
+void FdcHostServer::onDisconnected()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    if (!socket) {
+        return;
+    }
+    pending.remove(socket);
+    socket->deleteLater();
+    emit clientDisconnected();
+}
@@ -0,0 +1,69 @@
+#ifndef FDCHOSTSERVER_H
+#define FDCHOSTSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+#include <mutex>
+#include <vector>
+
+class FdcSharedBus;
+class QLocalServer;
+class QLocalSocket;
+class Wd1793;
+
+// Serves the batched port I/O protocol (see fdchostprotocol.h) on a local
+// socket. Each complete frame is executed against the controller on the
+// GUI thread and answered with a single reply frame; several frames that
+// arrive together are answered with one write.
+class FdcHostServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FdcHostServer(Wd1793 *controller, QObject *parent = nullptr);
+    ~FdcHostServer();
+
+    // Fails without touching the socket when another instance answers on
+    // it; errorString() then says so
+    bool listen(const QString &name);
+    void close();
+    bool isListening() const;
+    QString serverName() const;
+    QString errorString() const;
+
+    quint64 batchCount() const { return batches; }
+    quint64 operationCount() const { return operations; }
+
+    // Shares the controller with the shared memory bus service
+    void setControllerLock(std::mutex *lock) { controllerLock = lock; }
+    void setSharedBus(FdcSharedBus *bus) { sharedBus = bus; }
+
+    static QString defaultServerName();
+
+signals:
+    void clientConnected();
+    void clientDisconnected();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+private:
+    static constexpr int PROBE_TIMEOUT_MS = 200;
+
+    Wd1793 *controller;
+    std::mutex *controllerLock;
+    FdcSharedBus *sharedBus;
+    QLocalServer *server;
+    QString listenError;
+    QHash<QLocalSocket *, QByteArray> pending;
+    std::vector<uint8_t> reply;
+    quint64 batches;
+    quint64 operations;
+};
+
+#endif // FDCHOSTSERVER_H
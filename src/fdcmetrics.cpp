@@ -0,0 +1,145 @@
+#include "fdcmetrics.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+std::atomic<uint64_t> g_nextRegistryId(1);
+
+struct CounterInfo {
+    const char *key;        // JSON key
+    const char *metric;     // Prometheus metric name
+    const char *label;      // Optional label, same metric shared by several counters
+    const char *help;
+    bool nanoseconds;       // Exported in seconds
+};
+
+const CounterInfo COUNTERS[FdcMetrics::COUNTER_COUNT] = {
+    { "commands_type_i", "qtfloppy_fdc_commands_total", "type=\"I\"", "Commands started by type", false },
+    { "commands_type_ii", "qtfloppy_fdc_commands_total", "type=\"II\"", nullptr, false },
+    { "commands_type_iii", "qtfloppy_fdc_commands_total", "type=\"III\"", nullptr, false },
+    { "commands_type_iv", "qtfloppy_fdc_commands_total", "type=\"IV\"", nullptr, false },
+    { "sectors_read", "qtfloppy_fdc_sectors_read_total", nullptr, "Sectors read with a good data CRC", false },
+    { "sectors_written", "qtfloppy_fdc_sectors_written_total", nullptr, "Sectors written", false },
+    { "crc_errors", "qtfloppy_fdc_crc_errors_total", nullptr, "Commands ending with CRC Error", false },
+    { "record_not_found", "qtfloppy_fdc_record_not_found_total", nullptr, "Commands ending with Record Not Found", false },
+    { "lost_data", "qtfloppy_fdc_lost_data_total", nullptr, "Commands ending with Lost Data", false },
+    { "steps", "qtfloppy_drive_steps_total", nullptr, "Head step pulses", false },
+    { "seek_ns", "qtfloppy_drive_seek_seconds_total", nullptr, "Emulated time spent in Type I commands", true },
+    { "drq_serviced", "qtfloppy_fdc_drq_serviced_total", nullptr, "Data requests answered by the host", false },
+    { "drq_latency_ns", "qtfloppy_fdc_drq_latency_seconds_total", nullptr, "Emulated time DRQ stayed up before the host answered", true },
+    { "emulated_ns", "qtfloppy_emulated_seconds_total", nullptr, "Emulated time advanced by all controllers", true },
+};
+
+uint64_t steadyNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+std::string formatValue(const CounterInfo &info, uint64_t value)
+{
+    char text[32];
+    if (info.nanoseconds) {
+        std::snprintf(text, sizeof(text), "%.9f", value / 1e9);
+    } else {
+        std::snprintf(text, sizeof(text), "%llu", static_cast<unsigned long long>(value));
+    }
+    return text;
+}
+
+} // namespace
+
+FdcMetrics::FdcMetrics()
+    : m_id(g_nextRegistryId.fetch_add(1))
+{
+}
+
+FdcMetrics::~FdcMetrics()
+{
+}
+
+FdcMetrics::Shard *FdcMetrics::registerThread()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    Shard *&shard = m_threads[std::this_thread::get_id()];
+    if (!shard) {
+        m_shards.emplace_back(new Shard());
+        shard = m_shards.back().get();
+        for (std::atomic<uint64_t> &value : shard->values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+    return shard;
+}
+
+FdcMetrics::Snapshot FdcMetrics::snapshot() const
+{
+    Snapshot snapshot;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (const std::unique_ptr<Shard> &shard : m_shards) {
+            for (int i = 0; i < COUNTER_COUNT; ++i) {
+                snapshot.values[i] += shard->values[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    snapshot.wallNs = steadyNs();
+    return snapshot;
+}
+
+double FdcMetrics::emulatedWallRatio(const Snapshot &current, const Snapshot &previous)
+{
+    if (current.wallNs <= previous.wallNs) {
+        return 0.0;
+    }
+    return static_cast<double>(current[EmulatedNs] - previous[EmulatedNs])
+         / static_cast<double>(current.wallNs - previous.wallNs);
+}
+
+const char *FdcMetrics::key(Counter counter)
+{
+    return COUNTERS[counter].key;
+}
+
+std::string FdcMetrics::prometheusText(const Snapshot &current, const Snapshot *previous)
+{
+    std::string text;
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        const CounterInfo &info = COUNTERS[i];
+        if (info.help) {
+            text += std::string("# HELP ") + info.metric + " " + info.help + "\n";
+            text += std::string("# TYPE ") + info.metric + " counter\n";
+        }
+        text += info.metric;
+        if (info.label) {
+            text += std::string("{") + info.label + "}";
+        }
+        text += " " + formatValue(info, current.values[i]) + "\n";
+    }
+    if (previous) {
+        char ratio[32];
+        std::snprintf(ratio, sizeof(ratio), "%.6f", emulatedWallRatio(current, *previous));
+        text += "# HELP qtfloppy_emulated_wall_ratio Emulated time per wall time since the previous scrape\n";
+        text += "# TYPE qtfloppy_emulated_wall_ratio gauge\n";
+        text += std::string("qtfloppy_emulated_wall_ratio ") + ratio + "\n";
+    }
+    return text;
+}
+
+std::string FdcMetrics::jsonText(const Snapshot &current, const Snapshot *previous)
+{
+    std::string text = "{";
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        text += std::string(i ? ", " : "") + "\"" + COUNTERS[i].key + "\": "
+              + std::to_string(current.values[i]);
+    }
+    if (previous) {
+        char ratio[32];
+        std::snprintf(ratio, sizeof(ratio), "%.6f", emulatedWallRatio(current, *previous));
+        text += std::string(", \"emulated_wall_ratio\": ") + ratio;
+    }
+    text += "}\n";
+    return text;
+}
@@ -0,0 +1,95 @@
+#ifndef FDCMETRICS_H
+#define FDCMETRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Controller and drive counters for scraping. Each thread that counts gets
+// its own cache-line aligned shard, written only by that thread with plain
+// relaxed stores, so the emulation never contends on a shared line or takes
+// a lock after its first increment. Readers sum all shards.
+class FdcMetrics
+{
+public:
+    enum Counter {
+        CommandsTypeI,
+        CommandsTypeII,
+        CommandsTypeIII,
+        CommandsTypeIV,
+        SectorsRead,
+        SectorsWritten,
+        CrcErrors,
+        RecordNotFound,
+        LostData,
+        Steps,
+        SeekTimeNs,         // Emulated time spent in Type I commands
+        DrqServiced,
+        DrqLatencyNs,       // Emulated time DRQ was up before the host answered
+        EmulatedNs,         // Emulated time advanced, over all controllers
+        COUNTER_COUNT
+    };
+
+    struct Snapshot {
+        uint64_t values[COUNTER_COUNT] = {};
+        uint64_t wallNs = 0;    // Steady clock at the time of the snapshot
+
+        uint64_t operator[](Counter counter) const { return values[counter]; }
+    };
+
+    FdcMetrics();
+    ~FdcMetrics();
+
+    FdcMetrics(const FdcMetrics &) = delete;
+    FdcMetrics &operator=(const FdcMetrics &) = delete;
+
+    void add(Counter counter, uint64_t amount = 1)
+    {
+        std::atomic<uint64_t> &value = localShard()->values[counter];
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    // Emulated over wall time between two snapshots; 0 if no wall time passed
+    static double emulatedWallRatio(const Snapshot &current, const Snapshot &previous);
+
+    static const char *key(Counter counter);
+
+    // Prometheus text exposition format; the ratio gauge is only included
+    // when a previous snapshot is given
+    static std::string prometheusText(const Snapshot &current, const Snapshot *previous = nullptr);
+    static std::string jsonText(const Snapshot &current, const Snapshot *previous = nullptr);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> values[COUNTER_COUNT];
+    };
+
+    Shard *localShard()
+    {
+        // One cached shard per thread; a thread counting into several
+        // registries falls back to the registry's map on a switch
+        thread_local uint64_t cachedRegistry = 0;
+        thread_local Shard *cachedShard = nullptr;
+        if (cachedRegistry != m_id) {
+            cachedShard = registerThread();
+            cachedRegistry = m_id;
+        }
+        return cachedShard;
+    }
+
+    Shard *registerThread();
+
+    const uint64_t m_id;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::unordered_map<std::thread::id, Shard *> m_threads;
+};
+
+#endif // FDCMETRICS_H
@@ -0,0 +1,365 @@
+#include "fdcsharedbus.h"
+#include "fdchostprotocol.h"
+#include "perftrace.h"
+#include "wd1793.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FDC_HAVE_POSIX_SHM 1
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+using namespace FdcSharedBusLayout;
+
+namespace {
+
+// Idle polls before the service thread starts yielding, then sleeping
+constexpr int SPIN_POLLS = 2000;
+constexpr int YIELD_POLLS = 20000;
+
+void setError(std::string *error, const std::string &message)
+{
+    if (error) {
+        *error = message + ": " + std::strerror(errno);
+    }
+}
+
+#ifdef FDC_HAVE_POSIX_SHM
+
+enum class Leftover {
+    Stale,      // Its creator has exited
+    Live,
+    Unknown     // Not (yet) a region of this version
+};
+
+Leftover inspectLeftover(const std::string &name, uint32_t *ownerPid)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        // Unlinked meanwhile; the next create attempt decides
+        return errno == ENOENT ? Leftover::Stale : Leftover::Unknown;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Region)) {
+        close(fd);
+        return Leftover::Unknown;
+    }
+    void *memory = mmap(nullptr, sizeof(Region), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return Leftover::Unknown;
+    }
+    const Region *region = static_cast<const Region *>(memory);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    Leftover result = Leftover::Unknown;
+    if (region->magic == MAGIC && region->version == VERSION && region->ownerPid != 0) {
+        *ownerPid = region->ownerPid;
+        // EPERM: the process exists but belongs to someone else
+        const pid_t pid = static_cast<pid_t>(region->ownerPid);
+        result = (kill(pid, 0) == 0 || errno == EPERM) ? Leftover::Live : Leftover::Stale;
+    }
+    munmap(memory, sizeof(Region));
+    return result;
+}
+
+#endif
+
+} // namespace
+
+uint64_t FdcSharedBusLayout::packRegisters(const RegisterFile &file)
+{
+    return static_cast<uint64_t>(file.status)
+         | static_cast<uint64_t>(file.command) << 8
+         | static_cast<uint64_t>(file.track) << 16
+         | static_cast<uint64_t>(file.sector) << 24
+         | static_cast<uint64_t>(file.data) << 32
+         | static_cast<uint64_t>(file.pins) << 40
+         | static_cast<uint64_t>(file.cylinder) << 48
+         | static_cast<uint64_t>(file.side) << 56;
+}
+
+RegisterFile FdcSharedBusLayout::unpackRegisters(uint64_t word)
+{
+    RegisterFile file;
+    file.status = static_cast<uint8_t>(word);
+    file.command = static_cast<uint8_t>(word >> 8);
+    file.track = static_cast<uint8_t>(word >> 16);
+    file.sector = static_cast<uint8_t>(word >> 24);
+    file.data = static_cast<uint8_t>(word >> 32);
+    file.pins = static_cast<uint8_t>(word >> 40);
+    file.cylinder = static_cast<uint8_t>(word >> 48);
+    file.side = static_cast<uint8_t>(word >> 56);
+    return file;
+}
+
+FdcSharedBus::FdcSharedBus(std::string name, Region *region, bool owner)
+    : m_name(std::move(name))
+    , m_region(region)
+    , m_owner(owner)
+{
+}
+
+#ifdef FDC_HAVE_POSIX_SHM
+
+FdcSharedBus::~FdcSharedBus()
+{
+    munmap(m_region, sizeof(Region));
+    if (m_owner) {
+        shm_unlink(m_name.c_str());
+    }
+}
+
+std::unique_ptr<FdcSharedBus> FdcSharedBus::create(const std::string &name, std::string *error)
+{
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        // Only a region left over from a crashed instance is replaced
+        uint32_t ownerPid = 0;
+        switch (inspectLeftover(name, &ownerPid)) {
+        case Leftover::Stale:
+            shm_unlink(name.c_str());
+            fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            break;
+        case Leftover::Live:
+            if (error) {
+                *error = name + ": in use by process " + std::to_string(ownerPid);
+            }
+            return nullptr;
+        case Leftover::Unknown:
+            if (error) {
+                *error = name + ": exists and is not a region of this version; remove it if no instance is running";
+            }
+            return nullptr;
+        }
+    }
+    if (fd < 0) {
+        setError(error, "shm_open " + name);
+        return nullptr;
+    }
+    if (ftruncate(fd, sizeof(Region)) != 0) {
+        setError(error, "ftruncate " + name);
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    void *memory = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        setError(error, "mmap " + name);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    Region *region = new (memory) Region();
+    region->size = sizeof(Region);
+    region->version = VERSION;
+    region->ownerPid = static_cast<uint32_t>(getpid());
+    region->clockHz.store(3500000, std::memory_order_relaxed);
+    region->registers.store(0, std::memory_order_relaxed);
+    region->timeNs.store(0, std::memory_order_relaxed);
+    region->commandsExecuted.store(0, std::memory_order_relaxed);
+    region->commands.head.store(0, std::memory_order_relaxed);
+    region->commands.tail.store(0, std::memory_order_relaxed);
+    region->events.head.store(0, std::memory_order_relaxed);
+    region->events.tail.store(0, std::memory_order_relaxed);
+    // The magic goes last: a host that sees it sees an initialised region
+    std::atomic_thread_fence(std::memory_order_release);
+    region->magic = MAGIC;
+
+    return std::unique_ptr<FdcSharedBus>(new FdcSharedBus(name, region, true));
+}
+
+std::unique_ptr<FdcSharedBus> FdcSharedBus::open(const std::string &name, std::string *error)
+{
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        setError(error, "shm_open " + name);
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Region)) {
+        if (error) {
+            *error = name + ": region too small";
+        }
+        close(fd);
+        return nullptr;
+    }
+    void *memory = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        setError(error, "mmap " + name);
+        return nullptr;
+    }
+
+    Region *region = static_cast<Region *>(memory);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (region->magic != MAGIC || region->version != VERSION || region->size != sizeof(Region)) {
+        if (error) {
+            *error = name + ": not a compatible controller bus";
+        }
+        munmap(memory, sizeof(Region));
+        return nullptr;
+    }
+    return std::unique_ptr<FdcSharedBus>(new FdcSharedBus(name, region, false));
+}
+
+#else
+
+FdcSharedBus::~FdcSharedBus()
+{
+}
+
+std::unique_ptr<FdcSharedBus> FdcSharedBus::create(const std::string &name, std::string *error)
+{
+    if (error) {
+        *error = name + ": POSIX shared memory is not available on this platform";
+    }
+    return nullptr;
+}
+
+std::unique_ptr<FdcSharedBus> FdcSharedBus::open(const std::string &name, std::string *error)
+{
+    return create(name, error);
+}
+
+#endif
+
+RegisterFile FdcSharedBus::registers() const
+{
+    return unpackRegisters(m_region->registers.load(std::memory_order_acquire));
+}
+
+void FdcSharedBus::publish(const Wd1793 &controller)
+{
+    RegisterFile file;
+    file.status = controller.statusRegister();
+    file.command = controller.commandRegister();
+    file.track = controller.trackRegister();
+    file.sector = controller.sectorRegister();
+    file.data = controller.dataRegister();
+    file.pins = FdcHostProtocol::pins(controller);
+    const FloppyDrive *drive = controller.drive();
+    file.cylinder = drive ? static_cast<uint8_t>(drive->cylinder()) : 0;
+    file.side = drive ? static_cast<uint8_t>(drive->side()) : 0;
+    m_region->timeNs.store(controller.time(), std::memory_order_relaxed);
+    m_region->registers.store(packRegisters(file), std::memory_order_release);
+}
+
+FdcSharedBusService::FdcSharedBusService(FdcSharedBus &bus, Wd1793 &controller, std::mutex &lock)
+    : m_bus(bus)
+    , m_controller(controller)
+    , m_lock(lock)
+    , m_stopping(false)
+    , m_sequence(0)
+{
+}
+
+FdcSharedBusService::~FdcSharedBusService()
+{
+    stop();
+}
+
+void FdcSharedBusService::start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_stopping.store(false);
+    m_thread = std::thread(&FdcSharedBusService::run, this);
+}
+
+void FdcSharedBusService::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_stopping.store(true);
+    m_thread.join();
+}
+
+void FdcSharedBusService::run()
+{
+    FLOPPY_TRACE_THREAD("FdcSharedBusService");
+    // Spinning only pays when the host runs on another core
+    const int spinPolls = std::thread::hardware_concurrency() > 1 ? SPIN_POLLS : 0;
+    int idle = 0;
+    while (!m_stopping.load(std::memory_order_relaxed)) {
+        if (drain() > 0) {
+            idle = 0;
+            continue;
+        }
+        // Spin while the host is active, back off once it goes quiet
+        ++idle;
+        if (idle > YIELD_POLLS) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        } else if (idle > spinPolls) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+size_t FdcSharedBusService::drain()
+{
+    Region &region = m_bus.region();
+    if (region.commands.empty() || region.events.full()) {
+        return 0;
+    }
+
+    FLOPPY_TRACE_ZONE("fdc", "FdcSharedBusService::drain");
+    std::lock_guard<std::mutex> guard(m_lock);
+    size_t executed = 0;
+    BusCommand command;
+    // Only take a command whose answer has a slot, so a host that stops
+    // polling is held back by its own full command ring
+    while (!region.events.full() && region.commands.pop(command)) {
+        BusEvent event = {};
+        execute(command, event);
+        region.events.push(event);
+        ++executed;
+    }
+    m_bus.publish(m_controller);
+    region.commandsExecuted.fetch_add(executed, std::memory_order_relaxed);
+    return executed;
+}
+
+void FdcSharedBusService::execute(const BusCommand &command, BusEvent &event)
+{
+    Region &region = m_bus.region();
+    const uint32_t clockHz = region.clockHz.load(std::memory_order_relaxed);
+    const uint64_t now = FdcHostProtocol::cyclesToNs(command.cycle, clockHz);
+
+    event.kind = command.kind;
+    event.sequence = m_sequence++;
+    switch (command.kind) {
+    case COMMAND_READ:
+        FdcHostProtocol::readRegister(m_controller, command.reg, now, event.value);
+        break;
+    case COMMAND_WRITE:
+        FdcHostProtocol::writeRegister(m_controller, command.reg, command.value, now);
+        break;
+    case COMMAND_READ_BLOCK:
+    case COMMAND_WRITE_BLOCK: {
+        // Transfers go straight between the controller and the shared buffer
+        const size_t count = std::min<size_t>(command.count, SECTOR_BUFFER_BYTES);
+        const uint64_t hostByteNs = FdcHostProtocol::cyclesToNs(command.hostCycles, clockHz);
+        event.count = static_cast<uint32_t>(command.kind == COMMAND_READ_BLOCK
+            ? m_controller.readDataBlock(region.sectorBuffer, count, now, hostByteNs)
+            : m_controller.writeDataBlock(region.sectorBuffer, count, now, hostByteNs));
+        break;
+    }
+    default:
+        break;
+    }
+    event.timeNs = m_controller.time();
+    event.status = m_controller.statusRegister();
+    event.pins = FdcHostProtocol::pins(m_controller);
+}
@@ -0,0 +1,196 @@
+#ifndef FDCSHAREDBUS_H
+#define FDCSHAREDBUS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Wd1793;
+
+// Shared memory bus for emulators that embed the controller. A POSIX shm
+// region holds a published copy of the register file, a command ring
+// (host -> controller), an event ring (controller -> host) and a sector
+// buffer that block transfers read and write in place. Both rings are
+// single producer / single consumer and lock-free, so neither side ever
+// makes a system call on the fast path.
+namespace FdcSharedBusLayout {
+
+constexpr uint32_t MAGIC = 0x42434457;  // "WDCB"
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t RING_SLOTS = 4096;   // Power of two
+constexpr size_t SECTOR_BUFFER_BYTES = 8192;
+constexpr size_t CACHE_LINE = 64;
+
+enum CommandKind : uint8_t {
+    COMMAND_READ = 0,           // Register read, result in BusEvent::value
+    COMMAND_WRITE = 1,          // Register write
+    COMMAND_READ_BLOCK = 2,     // readDataBlock into the sector buffer
+    COMMAND_WRITE_BLOCK = 3     // writeDataBlock from the sector buffer
+};
+
+struct BusCommand {
+    uint64_t cycle;             // Host CPU cycle of the access
+    uint32_t count;             // Block transfers: bytes; host cycles per byte in 'hostCycles'
+    uint16_t hostCycles;
+    uint8_t kind;
+    uint8_t reg;                // 0-3 WD1793 ports, 4 system latch as in FdcHostProtocol
+    uint8_t value;
+    uint8_t reserved[7];
+};
+
+struct BusEvent {
+    uint64_t timeNs;            // Controller time after the command
+    uint32_t count;             // Block transfers: bytes moved
+    uint8_t kind;
+    uint8_t value;
+    uint8_t status;
+    uint8_t pins;               // FdcHostProtocol::SYSTEM_INTRQ / SYSTEM_DRQ
+    uint64_t sequence;          // Index of the command this answers
+};
+
+static_assert(sizeof(BusCommand) == 24, "BusCommand layout");
+static_assert(sizeof(BusEvent) == 24, "BusEvent layout");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "ring indices must be lock-free across processes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "register snapshot must be lock-free across processes");
+
+template <typename T>
+struct Ring {
+    alignas(CACHE_LINE) std::atomic<uint32_t> head;     // Next slot the producer writes
+    alignas(CACHE_LINE) std::atomic<uint32_t> tail;     // Next slot the consumer reads
+    alignas(CACHE_LINE) T slots[RING_SLOTS];
+
+    bool push(const T &item)
+    {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == RING_SLOTS) {
+            return false;
+        }
+        slots[h & (RING_SLOTS - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t) {
+            return false;
+        }
+        item = slots[t & (RING_SLOTS - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+    // Producer side: no slot left for push
+    bool full() const { return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) == RING_SLOTS; }
+};
+
+struct Region {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t ownerPid;                      // Process that created the region
+    std::atomic<uint32_t> clockHz;          // Host CPU clock, set by the host
+    // Status, command, track, sector, data, pins, cylinder, side packed
+    // into one word so observers always see a consistent register file
+    alignas(CACHE_LINE) std::atomic<uint64_t> registers;
+    std::atomic<uint64_t> timeNs;
+    std::atomic<uint64_t> commandsExecuted;
+    Ring<BusCommand> commands;
+    Ring<BusEvent> events;
+    alignas(CACHE_LINE) uint8_t sectorBuffer[SECTOR_BUFFER_BYTES];
+};
+
+struct RegisterFile {
+    uint8_t status;
+    uint8_t command;
+    uint8_t track;
+    uint8_t sector;
+    uint8_t data;
+    uint8_t pins;
+    uint8_t cylinder;
+    uint8_t side;
+};
+
+uint64_t packRegisters(const RegisterFile &file);
+RegisterFile unpackRegisters(uint64_t word);
+
+} // namespace FdcSharedBusLayout
+
+class FdcSharedBus
+{
+public:
+    ~FdcSharedBus();
+
+    FdcSharedBus(const FdcSharedBus &) = delete;
+    FdcSharedBus &operator=(const FdcSharedBus &) = delete;
+
+    // Creates (and on destruction unlinks) the region; name is a shm name like "/qt-floppy-fdc".
+    // A region whose creator has exited is replaced; one that is still in
+    // use, or that cannot be told apart from one, makes this fail.
+    static std::unique_ptr<FdcSharedBus> create(const std::string &name, std::string *error = nullptr);
+    // Maps an existing region, as the host emulator does
+    static std::unique_ptr<FdcSharedBus> open(const std::string &name, std::string *error = nullptr);
+
+    static std::string defaultName() { return "/qt-floppy-fdc"; }
+
+    const std::string &name() const { return m_name; }
+    FdcSharedBusLayout::Region &region() { return *m_region; }
+    const FdcSharedBusLayout::Region &region() const { return *m_region; }
+
+    // Host side
+    bool submit(const FdcSharedBusLayout::BusCommand &command) { return m_region->commands.push(command); }
+    bool poll(FdcSharedBusLayout::BusEvent &event) { return m_region->events.pop(event); }
+    uint8_t *sectorBuffer() { return m_region->sectorBuffer; }
+
+    // Observer side: the last published register file
+    FdcSharedBusLayout::RegisterFile registers() const;
+
+    // Controller side: copies the controller state into the region
+    void publish(const Wd1793 &controller);
+
+private:
+    FdcSharedBus(std::string name, FdcSharedBusLayout::Region *region, bool owner);
+
+    std::string m_name;
+    FdcSharedBusLayout::Region *m_region;
+    bool m_owner;
+};
+
+// Drains the command ring on its own thread and answers on the event ring.
+// Every access to the controller happens with 'lock' held, so the socket
+// interface and the GUI can share the controller with it.
+class FdcSharedBusService
+{
+public:
+    FdcSharedBusService(FdcSharedBus &bus, Wd1793 &controller, std::mutex &lock);
+    ~FdcSharedBusService();
+
+    void start();
+    void stop();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // Runs queued commands while the event ring has room for their answers;
+    // returns how many ran. A host that stops polling events fills its own
+    // command ring instead of stalling the service. Used by the service
+    // thread and by hosts that drive the bus from their own thread.
+    size_t drain();
+
+private:
+    void run();
+    void execute(const FdcSharedBusLayout::BusCommand &command, FdcSharedBusLayout::BusEvent &event);
+
+    FdcSharedBus &m_bus;
+    Wd1793 &m_controller;
+    std::mutex &m_lock;
+    std::thread m_thread;
+    std::atomic<bool> m_stopping;
+    uint64_t m_sequence;
+};
+
+#endif // FDCSHAREDBUS_H
@@ -0,0 +1,371 @@
+#include "floppycore.h"
+#include "diskimage.h"
+#include "floppydrive.h"
+#include "fluxdecoder.h"
+#include "fluxreader.h"
+#include "imagewriteback.h"
+#include "trackstream.h"
+#include "wd1793.h"
+
+#include <exception>
+#include <memory>
+#include <string>
+
+struct FloppyCore {
+    FloppyDrive drive;
+    Wd1793 controller;
+    std::unique_ptr<ImageWriteBack> writeBack;
+    std::string error;
+
+    FloppyCore() { controller.setDrive(&drive); }
+};
+
+#ifndef FLOPPYCORE_VERSION
+#define FLOPPYCORE_VERSION "unknown"
+#endif
+
+namespace {
+
+int fail(FloppyCore *core, const std::string &message)
+{
+    core->error = message;
+    return -1;
+}
+
+// Exceptions must not unwind into C callers. Called from a catch block;
+// keeps the message on the handle when it can.
+int failCurrent(FloppyCore *core) noexcept
+{
+    try {
+        try {
+            throw;
+        } catch (const std::exception &exception) {
+            core->error = exception.what();
+        } catch (...) {
+            core->error = "unexpected error";
+        }
+    } catch (...) {
+    }
+    return -1;
+}
+
+// Saves what is queued for the disk going out
+void closeWriteBack(FloppyCore *core)
+{
+    core->controller.setWriteBack(nullptr);
+    core->writeBack.reset();
+}
+
+} // namespace
+
+const char *floppycore_version(void)
+{
+    return FLOPPYCORE_VERSION;
+}
+
+FloppyCore *floppycore_create(void)
+{
+    try {
+        return new FloppyCore();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void floppycore_destroy(FloppyCore *core)
+{
+    delete core;
+}
+
+const char *floppycore_last_error(const FloppyCore *core)
+{
+    return core ? core->error.c_str() : "";
+}
+
+int floppycore_open_flux(FloppyCore *core, const char *path, int threads)
+{
+    if (!core) {
+        return -1;
+    }
+    try {
+        core->error.clear();
+        std::string error;
+        std::unique_ptr<FluxReader> reader = FluxReader::open(path ? path : "", &error);
+        if (!reader) {
+            return fail(core, error);
+        }
+        FluxDecodeOptions options;
+        options.threads = threads;
+        std::shared_ptr<DiskImage> image = FluxDiskDecoder::decode(*reader, options);
+        if (!image) {
+            return fail(core, reader->errorString().empty() ? "decode failed" : reader->errorString());
+        }
+        closeWriteBack(core);
+        core->drive.insertDisk(image);
+        return 0;
+    } catch (...) {
+        return failCurrent(core);
+    }
+}
+
+int floppycore_open_image(FloppyCore *core, const char *path, int savePolicy, int maxDelayMs)
+{
+    if (!core) {
+        return -1;
+    }
+    try {
+        core->error.clear();
+        if (savePolicy < FLOPPYCORE_SAVE_NEVER || savePolicy > FLOPPYCORE_SAVE_ON_EJECT) {
+            return fail(core, "invalid save policy");
+        }
+        std::string error;
+        std::shared_ptr<DiskImage> image = TrackReader::loadImage(path ? path : "", &error);
+        if (!image) {
+            return fail(core, error);
+        }
+        std::unique_ptr<ImageWriteBack> writeBack;
+        if (savePolicy != FLOPPYCORE_SAVE_NEVER) {
+            WriteBackOptions options;
+            options.policy = savePolicy == FLOPPYCORE_SAVE_WRITE_THROUGH ? WriteBackPolicy::WriteThrough
+                             : savePolicy == FLOPPYCORE_SAVE_TIME_BOUNDED ? WriteBackPolicy::TimeBounded
+                                                                          : WriteBackPolicy::OnEject;
+            options.maxDelayMs = maxDelayMs;
+            writeBack.reset(new ImageWriteBack(options));
+            if (!writeBack->open(path, *image, &error)) {
+                return fail(core, error);
+            }
+        }
+        closeWriteBack(core);
+        core->drive.insertDisk(image);
+        core->writeBack = std::move(writeBack);
+        core->controller.setWriteBack(core->writeBack.get());
+        return 0;
+    } catch (...) {
+        return failCurrent(core);
+    }
+}
+
+int floppycore_insert_blank(FloppyCore *core, int cylinders, int sides)
+{
+    if (!core) {
+        return -1;
+    }
+    try {
+        core->error.clear();
+        if (cylinders <= 0 || cylinders > FloppyDrive::MAX_CYLINDER + 1 || sides < 1 || sides > 2) {
+            return fail(core, "invalid geometry");
+        }
+        closeWriteBack(core);
+        core->drive.insertDisk(std::make_shared<DiskImage>(cylinders, sides));
+        return 0;
+    } catch (...) {
+        return failCurrent(core);
+    }
+}
+
+int floppycore_sync(FloppyCore *core)
+{
+    if (!core) {
+        return -1;
+    }
+    try {
+        core->error.clear();
+        std::string error;
+        if (core->writeBack && !core->writeBack->sync(&error)) {
+            return fail(core, error);
+        }
+        return 0;
+    } catch (...) {
+        return failCurrent(core);
+    }
+}
+
+int floppycore_save_stats(const FloppyCore *core, FloppyCoreSaveStats *stats)
+{
+    if (!core || !core->writeBack || !stats) {
+        return -1;
+    }
+    try {
+        const WriteBackStats current = core->writeBack->stats();
+        stats->queueDepth = current.queueDepth;
+        stats->trackWrites = current.trackWrites;
+        stats->coalesced = current.coalesced;
+        stats->flushedTracks = current.flushedTracks;
+        stats->batches = current.batches;
+        stats->bytesWritten = current.bytesWritten;
+        stats->lastFlushNs = current.lastFlushNs;
+        stats->maxFlushNs = current.maxFlushNs;
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+void floppycore_eject(FloppyCore *core)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        closeWriteBack(core);
+        core->drive.ejectDisk();
+    } catch (...) {
+    }
+}
+
+int floppycore_disk_info(const FloppyCore *core, FloppyCoreDiskInfo *info)
+{
+    if (!core || !info) {
+        return -1;
+    }
+    try {
+        const std::shared_ptr<DiskImage> disk = core->drive.disk();
+        if (!disk) {
+            return -1;
+        }
+        info->cylinders = disk->cylinderCount();
+        info->sides = disk->sideCount();
+        info->sectors = disk->sectorTotal();
+        info->weakSectors = disk->weakSectorTotal();
+        info->badSectors = disk->badSectorTotal();
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+void floppycore_set_write_protect(FloppyCore *core, int writeProtected)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->drive.setWriteProtected(writeProtected != 0);
+    } catch (...) {
+    }
+}
+
+void floppycore_set_side(FloppyCore *core, int side)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->drive.setSide(side);
+    } catch (...) {
+    }
+}
+
+void floppycore_set_double_density(FloppyCore *core, int doubleDensity)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->controller.setDoubleDensity(doubleDensity != 0);
+    } catch (...) {
+    }
+}
+
+void floppycore_reset(FloppyCore *core, uint64_t nowNs)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->controller.reset(nowNs);
+    } catch (...) {
+    }
+}
+
+uint8_t floppycore_read(FloppyCore *core, int reg, uint64_t nowNs)
+{
+    if (!core) {
+        return 0xFF;
+    }
+    try {
+        return core->controller.read(reg, nowNs);
+    } catch (...) {
+        return 0xFF;
+    }
+}
+
+void floppycore_write(FloppyCore *core, int reg, uint8_t value, uint64_t nowNs)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->controller.write(reg, value, nowNs);
+    } catch (...) {
+    }
+}
+
+size_t floppycore_read_block(FloppyCore *core, uint8_t *buffer, size_t count,
+                             uint64_t nowNs, uint64_t hostByteNs, uint64_t *endNs)
+{
+    if (!core || (!buffer && count > 0)) {
+        return 0;
+    }
+    try {
+        return core->controller.readDataBlock(buffer, count, nowNs, hostByteNs, endNs);
+    } catch (...) {
+        return 0;
+    }
+}
+
+size_t floppycore_write_block(FloppyCore *core, const uint8_t *buffer, size_t count,
+                              uint64_t nowNs, uint64_t hostByteNs, uint64_t *endNs)
+{
+    if (!core || (!buffer && count > 0)) {
+        return 0;
+    }
+    try {
+        return core->controller.writeDataBlock(buffer, count, nowNs, hostByteNs, endNs);
+    } catch (...) {
+        return 0;
+    }
+}
+
+void floppycore_advance(FloppyCore *core, uint64_t nowNs)
+{
+    if (!core) {
+        return;
+    }
+    try {
+        core->controller.advance(nowNs);
+    } catch (...) {
+    }
+}
+
+int floppycore_intrq(const FloppyCore *core)
+{
+    if (!core) {
+        return 0;
+    }
+    return core->controller.intrq() ? 1 : 0;
+}
+
+int floppycore_drq(const FloppyCore *core)
+{
+    if (!core) {
+        return 0;
+    }
+    return core->controller.drq() ? 1 : 0;
+}
+
+int floppycore_busy(const FloppyCore *core)
+{
+    if (!core) {
+        return 0;
+    }
+    return core->controller.isBusy() ? 1 : 0;
+}
+
+int floppycore_cylinder(const FloppyCore *core)
+{
+    if (!core) {
+        return -1;
+    }
+    return core->drive.cylinder();
+}
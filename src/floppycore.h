@@ -0,0 +1,118 @@
+#ifndef FLOPPYCORE_H
+#define FLOPPYCORE_H
+
+/*
+ * C interface to the floppy core: drive, WD1793 controller and disk images,
+ * without Qt. One FloppyCore handle is one drive with its controller; handles
+ * are independent, but a single handle must not be used from two threads at
+ * once. Times are emulated nanoseconds and must not go backwards.
+ *
+ * Every function accepts a NULL handle and then does nothing: calls that
+ * report success return -1, floppycore_read returns 0xFF (no device on the
+ * bus), floppycore_cylinder -1 and the other outputs 0. The block calls move
+ * nothing from or to a NULL buffer. No C++ exception leaves the library: a
+ * call that runs out of memory or threads fails the same way, and the calls
+ * that set floppycore_last_error say why.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(FLOPPYCORE_SHARED)
+#  if defined(FLOPPYCORE_BUILD)
+#    define FLOPPYCORE_API __declspec(dllexport)
+#  else
+#    define FLOPPYCORE_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define FLOPPYCORE_API __attribute__((visibility("default")))
+#else
+#  define FLOPPYCORE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct FloppyCore FloppyCore;
+
+/* Register numbers for floppycore_read/floppycore_write */
+enum {
+    FLOPPYCORE_REG_STATUS = 0,      /* Read: status, write: command */
+    FLOPPYCORE_REG_TRACK = 1,
+    FLOPPYCORE_REG_SECTOR = 2,
+    FLOPPYCORE_REG_DATA = 3
+};
+
+/* When floppycore_open_image saves written tracks back to the image file */
+enum {
+    FLOPPYCORE_SAVE_NEVER = 0,          /* Writes stay in memory */
+    FLOPPYCORE_SAVE_WRITE_THROUGH = 1,
+    FLOPPYCORE_SAVE_TIME_BOUNDED = 2,   /* Within maxDelayMs of the first unsaved write */
+    FLOPPYCORE_SAVE_ON_EJECT = 3        /* On floppycore_sync and eject only */
+};
+
+typedef struct FloppyCoreDiskInfo {
+    int cylinders;
+    int sides;
+    int sectors;
+    int weakSectors;
+    int badSectors;
+} FloppyCoreDiskInfo;
+
+typedef struct FloppyCoreSaveStats {
+    size_t queueDepth;          /* Written tracks not yet durable */
+    uint64_t trackWrites;
+    uint64_t coalesced;         /* Track writes merged into one already queued */
+    uint64_t flushedTracks;
+    uint64_t batches;           /* One fsync each */
+    uint64_t bytesWritten;
+    uint64_t lastFlushNs;       /* Wall time */
+    uint64_t maxFlushNs;
+} FloppyCoreSaveStats;
+
+FLOPPYCORE_API const char *floppycore_version(void);
+
+FLOPPYCORE_API FloppyCore *floppycore_create(void);
+FLOPPYCORE_API void floppycore_destroy(FloppyCore *core);
+
+/* Message for the last failed call on this handle, empty if none */
+FLOPPYCORE_API const char *floppycore_last_error(const FloppyCore *core);
+
+/* Disk handling; return 0 on success, -1 on failure */
+FLOPPYCORE_API int floppycore_open_flux(FloppyCore *core, const char *path, int threads);
+/* Any save policy but FLOPPYCORE_SAVE_NEVER fails for SCL, which keeps files rather than sectors */
+FLOPPYCORE_API int floppycore_open_image(FloppyCore *core, const char *path, int savePolicy, int maxDelayMs);
+FLOPPYCORE_API int floppycore_insert_blank(FloppyCore *core, int cylinders, int sides);
+/* Saving never blocks emulation; sync waits until every write so far is on disk */
+FLOPPYCORE_API int floppycore_sync(FloppyCore *core);
+FLOPPYCORE_API int floppycore_save_stats(const FloppyCore *core, FloppyCoreSaveStats *stats);
+FLOPPYCORE_API void floppycore_eject(FloppyCore *core);
+FLOPPYCORE_API int floppycore_disk_info(const FloppyCore *core, FloppyCoreDiskInfo *info);
+FLOPPYCORE_API void floppycore_set_write_protect(FloppyCore *core, int writeProtected);
+
+/* Drive and controller inputs */
+FLOPPYCORE_API void floppycore_set_side(FloppyCore *core, int side);
+FLOPPYCORE_API void floppycore_set_double_density(FloppyCore *core, int doubleDensity);
+FLOPPYCORE_API void floppycore_reset(FloppyCore *core, uint64_t nowNs);
+
+/* Port access and time */
+FLOPPYCORE_API uint8_t floppycore_read(FloppyCore *core, int reg, uint64_t nowNs);
+FLOPPYCORE_API void floppycore_write(FloppyCore *core, int reg, uint8_t value, uint64_t nowNs);
+FLOPPYCORE_API size_t floppycore_read_block(FloppyCore *core, uint8_t *buffer, size_t count,
+                                            uint64_t nowNs, uint64_t hostByteNs, uint64_t *endNs);
+FLOPPYCORE_API size_t floppycore_write_block(FloppyCore *core, const uint8_t *buffer, size_t count,
+                                             uint64_t nowNs, uint64_t hostByteNs, uint64_t *endNs);
+FLOPPYCORE_API void floppycore_advance(FloppyCore *core, uint64_t nowNs);
+
+/* Outputs, as of the last access */
+FLOPPYCORE_API int floppycore_intrq(const FloppyCore *core);
+FLOPPYCORE_API int floppycore_drq(const FloppyCore *core);
+FLOPPYCORE_API int floppycore_busy(const FloppyCore *core);
+FLOPPYCORE_API int floppycore_cylinder(const FloppyCore *core);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLOPPYCORE_H */
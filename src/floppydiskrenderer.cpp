@@ -0,0 +1,810 @@
+#include "floppydiskrenderer.h"
+#include "diskimage.h"
+#include <QPen>
+#include <QBrush>
+#include <QFont>
+#include <QtMath>
+
+namespace {
+// Based on the blueprint, index hole should be closer to the center
+constexpr qreal INDEX_HOLE_RADIAL_PCT = 0.13; // 13% - closer to center as per blueprint
+constexpr qreal ENVELOPE_INDEX_HOLE_RADIUS_PCT = 0.018; // Smaller index hole (3.6% diameter)
+constexpr qreal DISK_INDEX_HOLE_RADIUS_PCT = 0.0095; // 1.9% (diameter 1.9%, so radius 0.95%)
+constexpr qreal INDEX_HOLE_ANGLE_DEG = 30.0;
+// Track rings are spaced slightly wider than the recording band divided by the track count
+constexpr qreal TRACK_SPACING_FACTOR = 1.1;
+// Rings closer than this blur into noise; draw every n-th ring instead
+constexpr qreal MIN_RING_SPACING_PX = 2.0;
+}
+
+int FloppyDiskRenderer::trackCount(const FloppyDiskState &state)
+{
+    if (state.layout && state.layout->cylinderCount() > 0) {
+        return state.layout->cylinderCount();
+    }
+    // Standard format for the density and side switches
+    return Geometry::standard(state.doubleSided, state.doubleDensity).cylinders;
+}
+
+DiskLayout::TrackSlots FloppyDiskRenderer::currentSlots(const FloppyDiskState &state)
+{
+    return state.layout ? state.layout->track(state.track, state.side) : DiskLayout::TrackSlots();
+}
+
+void FloppyDiskState::followTrackLayout()
+{
+    const DiskLayout::TrackSlots slots = FloppyDiskRenderer::currentSlots(*this);
+    if (slots.empty()) {
+        return;
+    }
+    sectorCount = static_cast<int>(slots.size());
+    if (currentSector >= sectorCount) {
+        currentSector = 0;
+    }
+}
+
+QPainterPath FloppyDiskRenderer::ringSegment(qreal innerRadius, qreal outerRadius, qreal startDeg, qreal spanDeg) const
+{
+    QRectF innerRect(-innerRadius, -innerRadius, innerRadius * 2, innerRadius * 2);
+    QRectF outerRect(-outerRadius, -outerRadius, outerRadius * 2, outerRadius * 2);
+    QPainterPath segment;
+    segment.arcMoveTo(outerRect, -startDeg);
+    segment.arcTo(outerRect, -startDeg, -spanDeg);
+    segment.arcTo(innerRect, -(startDeg + spanDeg), spanDeg);
+    segment.closeSubpath();
+    return segment;
+}
+
+const FloppyDiskRenderer::TrackGeometry &FloppyDiskRenderer::currentGeometry()
+{
+    // The controller publishes a new layout after writes; radii follow the frame size
+    if (m_state->layout != m_geometryLayout) {
+        m_geometryLayout = m_state->layout;
+        m_geometryCache.clear();
+    }
+    if (m_geometryMinRadius != m_minTrackRadius || m_geometryMaxRadius != m_maxTrackRadius
+        || m_geometrySpacing != m_trackSpacing) {
+        m_geometryMinRadius = m_minTrackRadius;
+        m_geometryMaxRadius = m_maxTrackRadius;
+        m_geometrySpacing = m_trackSpacing;
+        m_geometryCache.clear();
+    }
+
+    const DiskLayout::TrackSlots slots = currentSlots(*m_state);
+    // Unformatted tracks share uniform wedges keyed by their count
+    const int key = slots.empty() ? -m_state->sectorCount : m_state->track * 2 + m_state->side;
+    auto cached = m_geometryCache.constFind(key);
+    if (cached != m_geometryCache.constEnd()) {
+        return *cached;
+    }
+
+    TrackGeometry geometry;
+    if (slots.empty()) {
+        const qreal sectorAngle = 360.0 / m_state->sectorCount;
+        for (int i = 0; i < m_state->sectorCount; i++) {
+            geometry.startDeg.append(i * sectorAngle);
+            geometry.spanDeg.append(sectorAngle);
+        }
+    } else {
+        for (const SectorSlot &slot : slots) {
+            geometry.startDeg.append(slot.start * 360.0);
+            geometry.spanDeg.append(slot.span() * 360.0);
+        }
+    }
+
+    for (int i = 0; i < static_cast<int>(geometry.startDeg.size()); i++) {
+        const qreal angleRad = qDegreesToRadians(geometry.startDeg[i]);
+        const QLineF line(m_minTrackRadius * qCos(angleRad), m_minTrackRadius * qSin(angleRad),
+                          m_maxTrackRadius * qCos(angleRad), m_maxTrackRadius * qSin(angleRad));
+        if (i == 0) {
+            geometry.firstBoundary = line;
+        } else {
+            geometry.boundaries.moveTo(line.p1());
+            geometry.boundaries.lineTo(line.p2());
+        }
+    }
+
+    const qreal currentTrackIndex = trackCount(*m_state) - m_state->track;
+    const qreal innerRadius = m_minTrackRadius + (currentTrackIndex - 0.5) * m_trackSpacing;
+    const qreal outerRadius = m_minTrackRadius + (currentTrackIndex + 0.5) * m_trackSpacing;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].flags & DiskLayout::SLOT_WEAK) {
+            geometry.weak.addPath(ringSegment(innerRadius, outerRadius, geometry.startDeg[int(i)], geometry.spanDeg[int(i)]));
+        } else if (slots[i].flags & DiskLayout::SLOT_BAD) {
+            geometry.bad.addPath(ringSegment(innerRadius, outerRadius, geometry.startDeg[int(i)], geometry.spanDeg[int(i)]));
+        }
+    }
+
+    return *m_geometryCache.insert(key, geometry);
+}
+
+int FloppyDiskRenderer::geometrySectorAt(const TrackGeometry &geometry, qreal angleDeg) const
+{
+    // Sectors are in index order; before the first start the last one still runs
+    int found = static_cast<int>(geometry.startDeg.size()) - 1;
+    for (int i = 0; i < static_cast<int>(geometry.startDeg.size()); i++) {
+        if (geometry.startDeg[i] > angleDeg) {
+            break;
+        }
+        found = i;
+    }
+    return found;
+}
+
+void FloppyDiskRenderer::paint(QPainter &painter, const QSize &size, const FloppyDiskState &state)
+{
+    m_state = &state;
+    m_size = size;
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    // Calculate the largest centered square
+    int margin = 20;
+    int side = qMin(m_size.width(), m_size.height()) - 2 * margin;
+    int x0 = (m_size.width() - side) / 2;
+    int y0 = (m_size.height() - side) / 2;
+    QRectF floppyRect(x0, y0, side, side);
+
+    // Save the painter state before potentially flipping
+    painter.save();
+
+    if (!m_state->frontView) {
+        // Apply a vertical flip transformation for the back view
+        painter.translate(m_size.width() / 2.0, m_size.height() / 2.0);
+        painter.scale(-1.0, 1.0); // Corrected for horizontal flip
+        painter.translate(-m_size.width() / 2.0, -m_size.height() / 2.0);
+    }
+
+    // Draw the envelope (jacket) with correct holes and notches
+    drawEnvelope(painter, floppyRect);
+
+    // Draw overlays in correct order for proper visibility
+    // First draw tracks without highlighting
+    drawTracks(painter, floppyRect);
+
+    // Mark weak and unreadable sectors of the current track from the disk image
+    drawSectorStates(painter, floppyRect);
+    
+    // Then draw sector highlighting on top of tracks
+    drawSectors(painter, floppyRect);
+    
+    // Finally draw the head
+    drawHead(painter, floppyRect);
+
+    // Restore painter state before drawing status (which should not be flipped)
+    painter.restore();
+
+    // Sector labels stay readable in the back view
+    drawSectorOrder(painter, floppyRect);
+
+    // Draw status text (should not be flipped)
+    drawStatus(painter);
+    m_state = nullptr;
+}
+
+void FloppyDiskRenderer::drawEnvelope(QPainter &painter, const QRectF& envelopeRect)
+{
+    qreal radius = 16.0;
+    QPointF center = envelopeRect.center();
+    qreal scale = envelopeRect.width() / 5.25; // 1 unit = 1 inch
+
+    // --- Envelope base ---
+    QPainterPath envelopePath;
+    envelopePath.addRoundedRect(envelopeRect, radius, radius);
+
+    // --- Center hub hole ---
+    qreal hubRadius = scale * 1.0 / 2.0; // 1.0" diameter
+    envelopePath.addEllipse(center, hubRadius, hubRadius);
+
+    // --- Index hole (window) ---
+    qreal indexHoleAngleRad = qDegreesToRadians(INDEX_HOLE_ANGLE_DEG);
+    qreal indexHoleRadialDist = envelopeRect.width() * INDEX_HOLE_RADIAL_PCT;
+    QPointF indexHoleCenter = center + QPointF(indexHoleRadialDist * qCos(indexHoleAngleRad),
+                                               indexHoleRadialDist * qSin(indexHoleAngleRad));
+    qreal envelopeIndexHoleRadius = envelopeRect.width() * ENVELOPE_INDEX_HOLE_RADIUS_PCT;
+    envelopePath.addEllipse(indexHoleCenter, envelopeIndexHoleRadius, envelopeIndexHoleRadius);
+
+    // --- Read/Write window (vertical rounded rect) ---
+    qreal rwWidth = scale * 0.45; // Narrower window
+    qreal rwHeight = scale * 1.7; // Tall window
+    
+    // Calculate track-based offset to shift the window lower
+    qreal rwTrackOffset = 2.5; // Shift window lower by this many tracks - we can adjust Y position here
+    qreal rwVerticalShift = rwTrackOffset * m_trackSpacing; // Convert tracks to pixels
+    
+    qreal rwX = center.x() - rwWidth/2;
+    qreal rwY = envelopeRect.bottom() - scale * 0.20 - rwHeight + rwVerticalShift; // Apply the vertical shift
+    QRectF rwRect(rwX, rwY, rwWidth, rwHeight);
+    envelopePath.addRoundedRect(rwRect, rwWidth/2, rwWidth/2);
+
+    // --- Write-protect notch (right edge, small rect) ---
+    qreal wpWidth = scale * 0.25;
+    qreal wpHeight = scale * 0.25;
+    qreal wpX = envelopeRect.right() - wpWidth;
+    qreal wpY = envelopeRect.top() + scale * 0.5;
+    QRectF wpRect(wpX, wpY, wpWidth, wpHeight);
+    
+    // Create a cutout in the envelope path for the write-protect notch
+    QPainterPath wpNotchPath;
+    wpNotchPath.addRect(wpRect);
+    envelopePath = envelopePath.subtracted(wpNotchPath);
+    
+    // --- Add insertion guide cutouts at the bottom (rounded triangles) ---
+    qreal guideWidth = scale * 0.3;
+    qreal guideHeight = scale * 0.08;
+    qreal guideSpacing = scale * 0.85; // Space between the two guides
+    
+    // Left guide
+    QPainterPath leftGuidePath;
+    QPointF leftGuideCenter(center.x() - guideSpacing/2, envelopeRect.bottom());
+    QPolygonF leftGuidePolygon;
+    leftGuidePolygon << QPointF(leftGuideCenter.x() - guideWidth/2, envelopeRect.bottom())
+                     << QPointF(leftGuideCenter.x() + guideWidth/2, envelopeRect.bottom())
+                     << QPointF(leftGuideCenter.x(), envelopeRect.bottom() - guideHeight);
+    leftGuidePath.addPolygon(leftGuidePolygon);
+    
+    // Right guide
+    QPainterPath rightGuidePath;
+    QPointF rightGuideCenter(center.x() + guideSpacing/2, envelopeRect.bottom());
+    QPolygonF rightGuidePolygon;
+    rightGuidePolygon << QPointF(rightGuideCenter.x() - guideWidth/2, envelopeRect.bottom())
+                      << QPointF(rightGuideCenter.x() + guideWidth/2, envelopeRect.bottom())
+                      << QPointF(rightGuideCenter.x(), envelopeRect.bottom() - guideHeight);
+    rightGuidePath.addPolygon(rightGuidePolygon);
+    
+    // Subtract both guides from the envelope path
+    envelopePath = envelopePath.subtracted(leftGuidePath);
+    envelopePath = envelopePath.subtracted(rightGuidePath);
+    
+    // --- Draw envelope with transparency ---
+    QColor plasticColor(60, 60, 80, int(m_state->envelopeTransparency * 255));
+    painter.setBrush(plasticColor);
+    painter.setPen(QPen(Qt::black, 2));
+    
+    // Draw the main envelope path with the write-protect notch cutout
+    painter.drawPath(envelopePath);
+
+    // --- Draw outlines for wireframe effect ---
+    painter.setBrush(Qt::NoBrush);
+    painter.setPen(QPen(Qt::black, 1, Qt::DashLine));
+    
+    // Create a custom outline path for the envelope that excludes the write-protect notch
+    QPainterPath outlinePath;
+    
+    // Start with a rounded rectangle for the envelope
+    QPainterPath envelopeOutline;
+    envelopeOutline.addRoundedRect(envelopeRect, radius, radius);
+    
+    // Create a path for the write-protect notch area (slightly larger to ensure no artifacts)
+    QPainterPath wpOutlineExclude;
+    qreal wpOutlineMargin = 1.0; // Small margin to ensure clean exclusion
+    QRectF wpOutlineRect = wpRect.adjusted(-wpOutlineMargin, -wpOutlineMargin, wpOutlineMargin, wpOutlineMargin);
+    wpOutlineExclude.addRect(wpOutlineRect);
+    
+    // Subtract the write-protect notch from the envelope outline
+    outlinePath = envelopeOutline.subtracted(wpOutlineExclude);
+    
+    // Draw the custom envelope outline
+    painter.drawPath(outlinePath);
+    
+    // Draw other outlines
+    painter.drawEllipse(center, hubRadius, hubRadius);
+    
+    // Draw index hole with grayish color
+    painter.setPen(QPen(Qt::black, 1));
+    painter.setBrush(QBrush(QColor(160, 160, 160))); // Grayish color
+    painter.drawEllipse(indexHoleCenter, envelopeIndexHoleRadius, envelopeIndexHoleRadius);
+    
+    // Reset brush and draw read/write window
+    painter.setBrush(Qt::NoBrush);
+    painter.drawRoundedRect(rwRect, rwWidth/2, rwWidth/2);
+
+    // --- Mask for disk: only visible through center hole, index hole, and read/write window ---
+    QPainterPath diskMask;
+    diskMask.addEllipse(center, hubRadius, hubRadius);
+    diskMask.addEllipse(indexHoleCenter, envelopeIndexHoleRadius, envelopeIndexHoleRadius);
+    diskMask.addRoundedRect(rwRect, rwWidth/2, rwWidth/2);
+    painter.save();
+    painter.setClipPath(diskMask);
+    drawDisk(painter, envelopeRect);
+    
+    // Draw sector lines visible through the holes and write-protect notch
+    QPainterPath sectorMask = diskMask;
+    
+    // Add the write-protect notch to the sector mask so sectors are visible there too
+    sectorMask.addRect(wpRect);
+    
+    // Create disk area as the whole disk circle
+    qreal diskRadius = scale * 2.5; // 5" diameter
+    
+    QPainterPath diskArea;
+    diskArea.addEllipse(center, diskRadius, diskRadius);
+    
+    // Set the clip path to the intersection of the sector mask and full disk area
+    painter.setClipPath(sectorMask.intersected(diskArea));
+    drawSectors(painter, envelopeRect);
+    painter.restore();
+}
+
+void FloppyDiskRenderer::drawDisk(QPainter &painter, const QRectF& envelopeRect)
+{
+    QPointF center = envelopeRect.center();
+    qreal scale = envelopeRect.width() / 5.25;
+    qreal diskRadius = scale * 2.5; // 5" diameter
+
+    // Calculate disk index hole parameters - use same position as envelope index hole but apply rotation
+    qreal diskIndexHoleRadialDist = envelopeRect.width() * INDEX_HOLE_RADIAL_PCT;
+    qreal diskIndexHoleBaseAngleRad = qDegreesToRadians(INDEX_HOLE_ANGLE_DEG);
+    qreal diskIndexHoleEffectiveAngleRad = diskIndexHoleBaseAngleRad + qDegreesToRadians(m_state->rotationAngle);
+    QPointF diskIndexHoleCenter = center + QPointF(diskIndexHoleRadialDist * qCos(diskIndexHoleEffectiveAngleRad),
+                                                  diskIndexHoleRadialDist * qSin(diskIndexHoleEffectiveAngleRad));
+    qreal diskIndexHoleRadius = envelopeRect.width() * DISK_INDEX_HOLE_RADIUS_PCT;
+    
+    // Create disk path with index hole cutout
+    QPainterPath diskPath;
+    diskPath.addEllipse(center, diskRadius, diskRadius);
+    
+    // Create index hole path
+    QPainterPath indexHolePath;
+    indexHolePath.addEllipse(diskIndexHoleCenter, diskIndexHoleRadius, diskIndexHoleRadius);
+    
+    // Subtract index hole from disk path
+    QPainterPath finalDiskPath = diskPath.subtracted(indexHolePath);
+    
+    // Draw disk with index hole cutout
+    painter.setPen(QPen(Qt::black, 2));
+    painter.setBrush(QBrush(Qt::black));
+    painter.drawPath(finalDiskPath);
+}
+
+void FloppyDiskRenderer::drawTracks(QPainter &painter, const QRectF& envelopeRect)
+{
+    // Draw concentric circles representing tracks
+    QPointF center = envelopeRect.center();
+    qreal scale = envelopeRect.width() / 5.25;
+    
+    // Start tracks further from the hub to match screenshot
+    qreal hubRadius = scale * 0.5; // 1.0" diameter hub
+    
+    // Shift all tracks 10% closer to the center
+    m_minTrackRadius = scale * 0.8; // Decreased by 10% to shift tracks closer to center
+    int numTracks = trackCount(*m_state);
+    
+    // Calculate track spacing based on available space and number of tracks
+    // We'll determine the max radius dynamically after drawing all tracks
+    qreal initialMaxRadius = scale * 2.3; // Initial estimate
+    m_trackSpacing = TRACK_SPACING_FACTOR * ((initialMaxRadius - m_minTrackRadius) / numTracks);
+    
+    painter.save();
+    
+    // Draw all tracks with blue/violet color. Rings that would sit closer
+    // than a couple of pixels are decimated, more so at lower detail; the
+    // innermost and outermost ring always stay.
+    int ringStep = m_trackSpacing > 0 ? qMax(1, qCeil(MIN_RING_SPACING_PX / m_trackSpacing)) : 1;
+    if (m_state->detail == FramePacer::Detail::Reduced) {
+        ringStep *= 2;
+    } else if (m_state->detail == FramePacer::Detail::Minimal) {
+        ringStep *= 4;
+        painter.setRenderHint(QPainter::Antialiasing, false);
+    }
+    painter.setPen(QPen(QColor(100, 100, 255, 120), scale * 0.01));
+    for (int i = 0; i < numTracks; i += ringStep) {
+        qreal radius = m_minTrackRadius + i * m_trackSpacing;
+        painter.drawEllipse(center, radius, radius);
+    }
+    
+    // The outermost ring is the maximum track radius
+    m_maxTrackRadius = m_minTrackRadius + numTracks * m_trackSpacing;
+    painter.drawEllipse(center, m_maxTrackRadius, m_maxTrackRadius);
+    
+    // Highlight current track if enabled - fill the entire track with green
+    if (m_state->highlightTrack && m_state->track >= 0 && m_state->track < numTracks) {
+        // Calculate inner and outer radius of the current track
+        qreal currentTrackIndex = numTracks - m_state->track;
+        
+        // Store these values in class fields for use in other methods
+        m_trackInnerRadius = m_minTrackRadius + (currentTrackIndex - 0.5) * m_trackSpacing;
+        m_trackOuterRadius = m_minTrackRadius + (currentTrackIndex + 0.5) * m_trackSpacing;
+        
+        // Create a path for the track ring
+        QPainterPath trackPath;
+        trackPath.addEllipse(center, m_trackOuterRadius, m_trackOuterRadius);
+        trackPath.addEllipse(center, m_trackInnerRadius, m_trackInnerRadius);
+        
+        // Fill the track with semi-transparent green
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(0, 200, 0, 80)); // Semi-transparent green
+        painter.drawPath(trackPath);
+        
+        // Draw track outline
+        qreal currentRadius = m_minTrackRadius + currentTrackIndex * m_trackSpacing;
+        painter.setPen(QPen(QColor(0, 200, 0, 180), scale * 0.02));
+        painter.setBrush(Qt::NoBrush);
+        painter.drawEllipse(center, currentRadius, currentRadius);
+    }
+    
+    painter.restore();
+}
+
+void FloppyDiskRenderer::drawSectorBoundaries(QPainter &painter, const QRectF& envelopeRect)
+{
+    QPointF center = envelopeRect.center();
+
+    // Use the same radius values as in drawTracks for consistency
+    // No need to recalculate - use the class fields initialized in drawTracks
+    const TrackGeometry &geometry = currentGeometry();
+
+    painter.save();
+
+    // Geometry is relative to the index hole; rotate it with the disk
+    painter.translate(center);
+    painter.rotate(INDEX_HOLE_ANGLE_DEG + m_state->rotationAngle);
+    if (m_state->detail != FramePacer::Detail::Full) {
+        painter.setRenderHint(QPainter::Antialiasing, false);
+    }
+
+    // Other sector delimiters - semi-transparent red
+    painter.setPen(QPen(QColor(255, 0, 0, 100), 1));
+    painter.setBrush(Qt::NoBrush);
+    painter.drawPath(geometry.boundaries);
+
+    // First sector delimiter (at index hole) - white and 2x wider
+    painter.setPen(QPen(Qt::white, 2));
+    painter.drawLine(geometry.firstBoundary);
+
+    painter.restore();
+}
+
+void FloppyDiskRenderer::drawHighlightedSector(QPainter &painter, const QRectF& envelopeRect)
+{
+    QPointF center = envelopeRect.center();
+    qreal scale = envelopeRect.width() / 5.25;
+    
+    // Use the same radius values as in drawTracks for consistency
+    // These are now stored in class fields for synchronization across methods
+    
+    // Calculate index hole position (for reference)
+    qreal indexHoleAngleDeg = INDEX_HOLE_ANGLE_DEG;
+    
+    const TrackGeometry &geometry = currentGeometry();
+    int sectors = static_cast<int>(geometry.startDeg.size());
+    
+    // Only draw the highlighted sector if enabled and valid sector
+    if (m_state->highlightSector && m_state->currentSector >= 0 && m_state->currentSector < sectors) {
+        painter.save();
+        
+        // We'll fill the entire sector from min to max radius
+        // But we'll still highlight the active track with a more intense color
+        
+        // Make sure we have valid track inner/outer radius values
+        if (m_trackInnerRadius <= 0 || m_trackOuterRadius <= 0) {
+            // Calculate default values if they're not set
+            int numTracks = trackCount(*m_state);
+            // Use the class field for track spacing
+            if (m_trackSpacing <= 0) {
+                m_trackSpacing = TRACK_SPACING_FACTOR * ((m_maxTrackRadius - m_minTrackRadius) / numTracks);
+            }
+            qreal currentTrackIndex = numTracks - m_state->track;
+            m_trackInnerRadius = m_minTrackRadius + (currentTrackIndex - 0.5) * m_trackSpacing;
+            m_trackOuterRadius = m_minTrackRadius + (currentTrackIndex + 0.5) * m_trackSpacing;
+        }
+        
+        // Use the class member variables for consistent track highlighting
+        qreal innerRadius = m_minTrackRadius; // Use minimum radius for the entire sector
+        qreal outerRadius = m_maxTrackRadius; // Use maximum radius for the entire sector
+        
+        // Calculate the sector that should be highlighted under the head
+        // This makes the sector static below the head
+        
+        // For a fixed sector that stays aligned with the head position at 90 degrees (top),
+        // we need to determine which sector is currently under the head
+        
+        // The head is fixed at 90 degrees (top of disk)
+        qreal headAngleDeg = 90.0;
+        
+        // First, normalize the rotation angle to 0-360 degrees
+        qreal normalizedRotation = fmod(m_state->rotationAngle, 360.0);
+        if (normalizedRotation < 0) normalizedRotation += 360.0;
+        
+        // Determine which sector is under the head
+        // We need to find which sector is at the head position (90 degrees) given the current rotation
+        // For this, we calculate the absolute angle in the disk's reference frame
+        qreal diskAngle = headAngleDeg - normalizedRotation; // Subtract because disk rotates clockwise
+        if (diskAngle < 0) diskAngle += 360.0;
+        
+        // Now find which sector contains this angle
+        int headSector = geometrySectorAt(geometry, fmod(diskAngle - indexHoleAngleDeg + 360.0, 360.0));
+        
+        // Use this sector for highlighting
+        int sectorToHighlight = headSector;
+        qreal sectorAngle = geometry.spanDeg[sectorToHighlight];
+        
+        // To make the sector rotate with the disk, we need to calculate its starting angle
+        // in the screen's reference frame, which means adding the rotation angle
+        qreal startAngle = indexHoleAngleDeg + geometry.startDeg[sectorToHighlight] + m_state->rotationAngle;
+        
+        // Create a completely clean sector shape without ANY parasitic lines
+        // Instead of creating a closed path, we'll draw two separate arcs and fill the area between them
+        
+        // Create a proper sector path that follows the outer radius curve
+        QPainterPath clipPath;
+        
+        // Start at the center
+        clipPath.moveTo(center);
+        
+        // Draw first radial line to the outer edge
+        clipPath.lineTo(center.x() + m_maxTrackRadius * qCos(qDegreesToRadians(startAngle)),
+                        center.y() + m_maxTrackRadius * qSin(qDegreesToRadians(startAngle)));
+        
+        // Draw an arc along the outer edge from startAngle to startAngle+sectorAngle
+        clipPath.arcTo(
+            center.x() - m_maxTrackRadius, // left
+            center.y() - m_maxTrackRadius, // top
+            m_maxTrackRadius * 2,          // width
+            m_maxTrackRadius * 2,          // height
+            -startAngle,                   // start angle (Qt uses counter-clockwise angles from 3 o'clock)
+            -sectorAngle                   // span angle (negative for clockwise)
+        );
+        
+        // Close the path back to the center
+        clipPath.closeSubpath();
+        
+        // Save painter state before applying clip
+        painter.save();
+        
+        // Apply the sector clip path
+        painter.setClipPath(clipPath);
+        if (m_state->detail == FramePacer::Detail::Minimal) {
+            painter.setRenderHint(QPainter::Antialiasing, false);
+        }
+        
+        // First draw the entire sector from min to max radius with semi-transparent red
+        QPainterPath fullSectorPath;
+        fullSectorPath.addEllipse(center, outerRadius, outerRadius);
+        fullSectorPath.addEllipse(center, innerRadius, innerRadius);
+        
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(255, 0, 0, 60)); // Light semi-transparent red for the full sector
+        painter.drawPath(fullSectorPath);
+        
+        // Then highlight the active track portion with a more intense red
+        QPainterPath activeTrackPath;
+        activeTrackPath.addEllipse(center, m_trackOuterRadius, m_trackOuterRadius);
+        activeTrackPath.addEllipse(center, m_trackInnerRadius, m_trackInnerRadius);
+        
+        painter.setBrush(QColor(255, 0, 0, 180)); // More intense red for the active track
+        painter.drawPath(activeTrackPath);
+        
+        // Restore painter state
+        painter.restore();
+        
+        painter.restore();
+    }
+}
+
+void FloppyDiskRenderer::drawSectorStates(QPainter &painter, const QRectF& envelopeRect)
+{
+    if (currentSlots(*m_state).empty()) {
+        return;
+    }
+
+    const TrackGeometry &geometry = currentGeometry();
+    if (geometry.weak.isEmpty() && geometry.bad.isEmpty()) {
+        return;
+    }
+
+    painter.save();
+    painter.translate(envelopeRect.center());
+    painter.rotate(INDEX_HOLE_ANGLE_DEG + m_state->rotationAngle);
+    painter.setPen(Qt::NoPen);
+
+    // Orange: unstable between revolutions
+    painter.setBrush(QColor(255, 165, 0, 200));
+    painter.drawPath(geometry.weak);
+
+    // Magenta: no good read at all
+    painter.setBrush(QColor(200, 0, 200, 200));
+    painter.drawPath(geometry.bad);
+
+    painter.restore();
+}
+
+void FloppyDiskRenderer::drawSectors(QPainter &painter, const QRectF& envelopeRect)
+{
+    // Draw sector boundary lines first
+    drawSectorBoundaries(painter, envelopeRect);
+    
+    // Then draw the highlighted sector on top
+    drawHighlightedSector(painter, envelopeRect);
+}
+
+void FloppyDiskRenderer::drawHead(QPainter &painter, const QRectF& envelopeRect)
+{
+    // Read/write window geometry (must match drawEnvelope)
+    QPointF center = envelopeRect.center();
+    qreal scale = envelopeRect.width() / 5.25;
+    qreal rwWidth = scale * 0.45; // Match the current narrower window width
+    qreal rwHeight = scale * 1.7; // Match the current window height in drawEnvelope
+    qreal rwX = center.x() - rwWidth/2;
+    // Shifted 5% lower to match drawEnvelope
+    qreal rwY = envelopeRect.bottom() - scale * 0.15 - rwHeight;
+    QRectF rwRect(rwX, rwY, rwWidth, rwHeight);
+
+    // Calculate head position based on animation or track
+    qreal headX = rwRect.center().x();
+    qreal headY;
+    
+    // Determine the current track (either from animation or direct track value)
+    int numTracks = trackCount(*m_state);
+    int mappedTrack;
+    
+    if (m_state->headAnimating) {
+        // When animating, use the animation step to determine position
+        qreal normalizedStep = (qreal)m_state->animationStep / (ANIMATION_STEPS - 1);
+        // Ensure normalizedStep is within valid bounds [0.0, 1.0]
+        normalizedStep = qBound(0.0, normalizedStep, 1.0);
+        mappedTrack = static_cast<int>(normalizedStep * (numTracks - 1));
+    } else {
+        // Ensure m_state->track is within valid bounds [0, numTracks-1]
+        mappedTrack = qBound(0, m_state->track, numTracks - 1);
+    }
+    
+    // Make sure we have valid radius values before calculating
+    if (m_maxTrackRadius <= m_minTrackRadius) {
+        // If radii aren't initialized yet, use safe defaults
+        m_minTrackRadius = scale * 0.8;
+        m_maxTrackRadius = scale * 2.3;
+        // Also initialize track spacing
+        m_trackSpacing = TRACK_SPACING_FACTOR * ((m_maxTrackRadius - m_minTrackRadius) / numTracks);
+    }
+    qreal trackRadius;
+    
+    // Ensure we have valid track inner/outer radius values
+    if (m_trackInnerRadius <= 0 || m_trackOuterRadius <= 0) {
+        // Calculate default values if they're not set
+        qreal currentTrackIndex = numTracks - mappedTrack;
+        m_trackInnerRadius = m_minTrackRadius + (currentTrackIndex - 0.5) * m_trackSpacing;
+        m_trackOuterRadius = m_minTrackRadius + (currentTrackIndex + 0.5) * m_trackSpacing;
+    }
+    
+    // Calculate the radius based on the track
+    if (m_state->highlightTrack && mappedTrack == m_state->track) {
+        // If we're on the highlighted track, use the center of the highlighted track
+        trackRadius = (m_trackInnerRadius + m_trackOuterRadius) / 2.0;
+    } else if (mappedTrack == 0) {
+        // For track 0 (outermost track), use the exact maximum radius
+        trackRadius = m_maxTrackRadius;
+    } else {
+        // For all other tracks, calculate based on the class fields
+        // Use the same formula as in drawTracks but invert the track numbering
+        trackRadius = m_minTrackRadius + (numTracks - mappedTrack) * m_trackSpacing;
+    }
+    
+    // Ensure the radius is within valid bounds
+    trackRadius = qBound(m_minTrackRadius, trackRadius, m_maxTrackRadius);
+    
+    // Calculate the intersection point of this track with the vertical line at 90 degrees (top)
+    qreal trackY = center.y() + trackRadius * qSin(qDegreesToRadians(90.0));
+    
+    // Position the head at this exact Y coordinate
+    headY = trackY;
+    
+    // This positions the head at the top of the disk, matching the orientation
+    // of the center hole and correcting the head position
+
+    // Plastic mount (semi-transparent rectangle)
+    qreal mountWidth = rwWidth * 0.95;
+    qreal mountHeight = rwWidth * 0.38;
+    QRectF mountRect(headX - mountWidth/2, headY - mountHeight/2, mountWidth, mountHeight);
+    QColor mountColor(120, 180, 255, 90); // Light blue, semi-transparent
+    painter.setPen(QPen(Qt::black, 1));
+    painter.setBrush(mountColor);
+    painter.drawRect(mountRect);
+
+    // Head size and shape (oval metallic)
+    qreal headWidth = rwWidth * 0.7;
+    qreal headHeight = rwWidth * 0.28;
+    QRectF headRect(headX - headWidth/2, headY - headHeight/2, headWidth, headHeight);
+    qreal headRadius = headHeight * 0.4;
+
+    painter.setPen(QPen(Qt::black, 1));
+    if (m_state->detail == FramePacer::Detail::Full) {
+        // Metallic gradient
+        QLinearGradient grad(headRect.topLeft(), headRect.bottomRight());
+        grad.setColorAt(0, QColor(220, 220, 220));
+        grad.setColorAt(0.5, QColor(180, 180, 180));
+        grad.setColorAt(1, QColor(120, 120, 120));
+        painter.setBrush(grad);
+    } else {
+        // The gradient's middle tone
+        painter.setBrush(QColor(180, 180, 180));
+    }
+    painter.drawRoundedRect(headRect, headRadius, headRadius);
+
+    // Draw the pad/slot in the center
+    QRectF padRect(headX - headWidth*0.12, headY - headHeight*0.18, headWidth*0.24, headHeight*0.36);
+    painter.setBrush(QColor(60, 60, 60));
+    painter.drawRoundedRect(padRect, headRadius*0.5, headRadius*0.5);
+
+    // Optional: highlight for write operation
+    if (m_state->write) {
+        painter.setBrush(QColor(255, 0, 0, 120));
+        painter.drawRoundedRect(headRect, headRadius, headRadius);
+    }
+}
+
+void FloppyDiskRenderer::drawSectorOrder(QPainter &painter, const QRectF& envelopeRect)
+{
+    if (!m_state->interleavePreview) {
+        return;
+    }
+    const TrackGeometry &geometry = currentGeometry();
+    const DiskLayout::TrackSlots before = currentSlots(*m_state);
+    const Track *after = m_state->interleavePreview->track(m_state->track, m_state->side);
+    if (!after || before.size() != after->sectors.size()
+        || static_cast<int>(before.size()) != static_cast<int>(geometry.startDeg.size())) {
+        return;
+    }
+
+    QPointF center = envelopeRect.center();
+    qreal beforeRadius = m_maxTrackRadius + m_trackSpacing * 4;
+    qreal afterRadius = m_minTrackRadius - m_trackSpacing * 4;
+
+    painter.save();
+    painter.setFont(QFont("Arial", 8, QFont::Bold));
+
+    auto drawLabel = [&](qreal radius, qreal angleDeg, int id) {
+        qreal angleRad = qDegreesToRadians(INDEX_HOLE_ANGLE_DEG + angleDeg + m_state->rotationAngle);
+        QPointF point(center.x() + radius * qCos(angleRad), center.y() + radius * qSin(angleRad));
+        if (!m_state->frontView) {
+            point.setX(m_size.width() - point.x());
+        }
+        painter.drawText(QRectF(point.x() - 12, point.y() - 7, 24, 14), Qt::AlignCenter, QString::number(id));
+    };
+
+    // Both layouts share the physical slots, only the IDs in them differ
+    for (int i = 0; i < static_cast<int>(geometry.startDeg.size()); i++) {
+        qreal middle = geometry.startDeg[i] + geometry.spanDeg[i] / 2;
+        painter.setPen(QColor(255, 255, 255, 220));
+        drawLabel(beforeRadius, middle, before[static_cast<size_t>(i)].id);
+        painter.setPen(QColor(0, 220, 0));
+        drawLabel(afterRadius, middle, after->sectors[i].id);
+    }
+
+    painter.setPen(Qt::black);
+    painter.setFont(QFont("Arial", 10));
+    painter.drawText(10, 20, "Sector order: outside current, inside optimized");
+    painter.restore();
+}
+
+void FloppyDiskRenderer::drawStatus(QPainter &painter)
+{
+    painter.setPen(Qt::black);
+    painter.setFont(QFont("Arial", 10));
+    
+    // Include the sector number in the status display
+    QString status = QString("Track: %1  Side: %2  Sector: %3  %4  %5")
+        .arg(m_state->track)
+        .arg(m_state->side)
+        .arg(m_state->currentSector)
+        .arg(m_state->write ? "Write" : "Read")
+        .arg(m_state->doubleDensity ? "DD" : "SD");
+
+    if (m_state->layout) {
+        int weak = 0;
+        int bad = 0;
+        for (const SectorSlot &slot : currentSlots(*m_state)) {
+            weak += (slot.flags & DiskLayout::SLOT_WEAK) ? 1 : 0;
+            bad += (slot.flags & DiskLayout::SLOT_BAD) ? 1 : 0;
+        }
+        status += QString("  Weak: %1  Bad: %2").arg(weak).arg(bad);
+    }
+
+    // Only worth a mention when the renderer had to cut back
+    if (m_state->detail != FramePacer::Detail::Full) {
+        status += QString("  Detail: %1 (%2 ms)")
+            .arg(FramePacer::detailName(m_state->detail))
+            .arg(m_state->averagePaintMs, 0, 'f', 1);
+    }
+    
+    painter.drawText(10, m_size.height() - 10, status);
+}
@@ -0,0 +1,107 @@
+#ifndef FLOPPYDISKRENDERER_H
+#define FLOPPYDISKRENDERER_H
+
+#include <QHash>
+#include <QLineF>
+#include <QPainter>
+#include <QPainterPath>
+#include <QSize>
+#include <QVector>
+#include <memory>
+#include "diskgeometry.h"
+#include "disklayout.h"
+#include "framepacer.h"
+
+class DiskImage;
+
+// Everything one frame of the disk view shows
+struct FloppyDiskState {
+    int track = 0;
+    int side = 0;
+    int headPosition = 0;
+    bool write = false;
+    bool doubleSided = true;
+    bool doubleDensity = true;
+    qreal rotationAngle = 0.0;      // Degrees
+    bool indexPulse = false;
+    qreal envelopeTransparency = 1.0;
+    int sectorCount = Geometry::TRDOS_80DS.sectors;     // Wedges of tracks the layout has no slots for
+    int currentSector = 0;
+    bool highlightTrack = true;
+    bool highlightSector = true;
+    bool frontView = true;
+    bool headAnimating = false;     // The head follows animationStep instead of the track
+    int animationStep = 0;
+    FramePacer::Detail detail = FramePacer::Detail::Full;
+    qreal averagePaintMs = 0.0;     // Shown next to a reduced detail level
+    std::shared_ptr<const DiskLayout> layout;               // Null without an image
+    std::shared_ptr<const DiskImage> interleavePreview;     // See FloppyDiskWidget::setInterleavePreview()
+
+    // Takes the sector count of the current track from the layout;
+    // unformatted tracks keep the previous wedges
+    void followTrackLayout();
+};
+
+// Paints the disk view from a FloppyDiskState. Not a QObject and touches
+// nothing but its own caches, so each thread that renders frames (see
+// FrameExporter) can own one and paint into its own QImage; FloppyDiskWidget
+// paints through one as well.
+class FloppyDiskRenderer
+{
+public:
+    static constexpr int ANIMATION_STEPS = Geometry::MAX_CYLINDERS; // One step per track of the longest standard disk
+
+    void paint(QPainter &painter, const QSize &size, const FloppyDiskState &state);
+
+    // Cylinders of the image, or of the standard format for the switches without one
+    static int trackCount(const FloppyDiskState &state);
+    // Slots of the current track; empty without a layout or on unformatted tracks
+    static DiskLayout::TrackSlots currentSlots(const FloppyDiskState &state);
+
+private:
+    // Sector geometry of one track in the disk's own frame (index at 0
+    // degrees), built once per track and drawn rotated, so mixed layouts
+    // cost the same per frame as uniform wedges
+    struct TrackGeometry {
+        QVector<qreal> startDeg;
+        QVector<qreal> spanDeg;
+        QLineF firstBoundary;       // Start of the first sector after index
+        QPainterPath boundaries;    // Starts of the other sectors
+        QPainterPath weak;          // Ring segments of this track
+        QPainterPath bad;
+    };
+
+    const FloppyDiskState *m_state = nullptr;   // During paint()
+    QSize m_size;
+
+    // Track radius calculations - stored to avoid duplication
+    qreal m_trackInnerRadius = 0.0;
+    qreal m_trackOuterRadius = 0.0;
+
+    // Track radius constants - used across all methods
+    qreal m_minTrackRadius = 0.0;
+    qreal m_maxTrackRadius = 0.0;
+    qreal m_trackSpacing = 0.0; // Track spacing factor
+
+    std::shared_ptr<const DiskLayout> m_geometryLayout;    // What m_geometryCache was built from
+    QHash<int, TrackGeometry> m_geometryCache;
+    qreal m_geometryMinRadius = 0.0;
+    qreal m_geometryMaxRadius = 0.0;
+    qreal m_geometrySpacing = 0.0;
+    const TrackGeometry &currentGeometry();
+    int geometrySectorAt(const TrackGeometry &geometry, qreal angleDeg) const;
+    QPainterPath ringSegment(qreal innerRadius, qreal outerRadius, qreal startDeg, qreal spanDeg) const;
+
+    void drawDisk(QPainter &painter, const QRectF& envelopeRect);
+    void drawTracks(QPainter &painter, const QRectF& envelopeRect);
+    void drawSectors(QPainter &painter, const QRectF& envelopeRect);
+    void drawSectorBoundaries(QPainter &painter, const QRectF& envelopeRect);
+    void drawHighlightedSector(QPainter &painter, const QRectF& envelopeRect);
+    void drawSectorStates(QPainter &painter, const QRectF& envelopeRect);
+    void drawHead(QPainter &painter, const QRectF& envelopeRect);
+    void drawStatus(QPainter &painter);
+    void drawEnvelope(QPainter &painter, const QRectF& envelopeRect);
+    void drawSectorOrder(QPainter &painter, const QRectF& envelopeRect);
+};
+
+#endif // FLOPPYDISKRENDERER_H
@@ -2,8 +2,10 @@
 #define FLOPPYDISKWIDGET_H
 
 #include <QWidget>
-#include <QPainter>
 #include <QTimer>
+#include <memory>
+#include "floppydiskrenderer.h"
+#include "framepacer.h"
 
 class FloppyDiskWidget : public QWidget
 {
@@ -43,6 +45,28 @@ public:
     // View control
     void setFrontView(bool isFront);
 
+    // Decoded disk contents; sector count and sector states follow the current
+    // track. Only the image's published layout is read, never its tracks, so
+    // the controller may keep writing to the image on another thread.
+    void setDiskImage(std::shared_ptr<const DiskImage> image);
+    std::shared_ptr<const DiskImage> diskImage() const;
+
+    // Another layout of the same disk, e.g. an optimized interleave: its
+    // sector IDs are labelled inside the tracks, the current ones outside.
+    // Null hides the comparison.
+    void setInterleavePreview(std::shared_ptr<const DiskImage> layout);
+
+    // Level of detail follows measured paint time so frames stay within
+    // budget; with adaptation off every frame is drawn at full detail
+    void setAdaptiveDetail(bool adaptive);
+    bool adaptiveDetail() const;
+    FramePacer::Detail detailLevel() const;
+    // Running average of paint time in milliseconds
+    qreal averagePaintMs() const;
+
+signals:
+    void detailLevelChanged(FramePacer::Detail detail);
+
 private slots:
     void animateHead();
     void animateSide();
@@ -52,52 +76,21 @@ protected:
     QSize sizeHint() const override;
 
 private:
-    // Animation constants
-    static constexpr int ANIMATION_STEPS = 80;
-    static constexpr int DISK_RPM = 300; // 300 RPM = 5 RPS
-
-    int currentTrack;
-    int currentSide;
-    int headPosition;
-    bool isWriteOperation;
-    bool isDoubleSided;
-    bool isDoubleDensity;
-    qreal rotationAngle;
-    bool indexPulseActive;
-    qreal m_envelopeTransparency;
-    int m_sectorCount;
-    int m_currentSector;
-    bool m_highlightTrack;
-    bool m_highlightSector;
-    
-    // Track radius calculations - stored to avoid duplication
-    qreal m_trackInnerRadius;
-    qreal m_trackOuterRadius;
-    
-    // Track radius constants - used across all methods
-    qreal m_minTrackRadius;
-    qreal m_maxTrackRadius;
-    qreal m_trackSpacing; // Track spacing factor
-    
+    // Everything drawn is in m_state; the renderer keeps only its caches
+    FloppyDiskState m_state;
+    FloppyDiskRenderer m_renderer;
+
     // Animation properties
     QTimer* m_animationTimer = nullptr;
     QTimer* m_sideAnimationTimer = nullptr;
-    bool m_isHeadAnimating = false;
-    int m_animationStep = 0;
     bool m_animationDirectionUp = true;
     qreal m_animationSpeed;
 
-    bool m_isFrontView = true; // New member variable to track view
-
-    void drawDisk(QPainter &painter, const QRectF& envelopeRect);
-    void drawTracks(QPainter &painter, const QRectF& envelopeRect);
-    void drawSectors(QPainter &painter, const QRectF& envelopeRect);
-    void drawSectorBoundaries(QPainter &painter, const QRectF& envelopeRect);
-    void drawHighlightedSector(QPainter &painter, const QRectF& envelopeRect);
-    void drawIndexHole(QPainter &painter);
-    void drawHead(QPainter &painter, const QRectF& envelopeRect);
-    void drawStatus(QPainter &painter);
-    void drawEnvelope(QPainter &painter, const QRectF& envelopeRect);
+    FramePacer m_pacer;
+    bool m_adaptiveDetail = true;
+    FramePacer::Detail detail() const { return m_adaptiveDetail ? m_pacer.detail() : FramePacer::Detail::Full; }
+
+    std::shared_ptr<const DiskImage> m_diskImage;
 };
 
 #endif // FLOPPYDISKWIDGET_H 
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "floppydrive.h"
+
+#include <cmath>
+
+FloppyDrive::FloppyDrive()
+    : m_writeProtected(false)
+    , m_cylinder(0)
+    , m_side(0)
+    , m_stepCount(0)
+{
+}
+
+FloppyDrive::State FloppyDrive::state() const
+{
+    State state;
+    state.writeProtected = m_writeProtected;
+    state.cylinder = m_cylinder;
+    state.side = m_side;
+    state.stepCount = m_stepCount;
+    return state;
+}
+
+void FloppyDrive::restoreState(const State &state)
+{
+    m_writeProtected = state.writeProtected;
+    setCylinder(state.cylinder);
+    setSide(state.side);
+    m_stepCount = state.stepCount;
+}
+
+void FloppyDrive::insertDisk(std::shared_ptr<DiskImage> disk)
+{
+    m_disk = std::move(disk);
+}
+
+void FloppyDrive::ejectDisk()
+{
+    m_disk.reset();
+}
+
+void FloppyDrive::setCylinder(int cylinder)
+{
+    m_cylinder = cylinder < 0 ? 0 : (cylinder > MAX_CYLINDER ? MAX_CYLINDER : cylinder);
+}
+
+void FloppyDrive::step(int direction)
+{
+    // The head stops mechanically at both ends but the pulse is still counted
+    ++m_stepCount;
+    setCylinder(m_cylinder + (direction > 0 ? 1 : -1));
+}
+
+Track *FloppyDrive::currentTrack()
+{
+    return m_disk ? m_disk->track(m_cylinder, m_side) : nullptr;
+}
+
+const Track *FloppyDrive::currentTrack() const
+{
+    return m_disk ? m_disk->track(m_cylinder, m_side) : nullptr;
+}
+
+double FloppyDrive::angleAt(uint64_t timeNs) const
+{
+    return static_cast<double>(timeNs % REVOLUTION_NS) / REVOLUTION_NS;
+}
+
+bool FloppyDrive::indexAt(uint64_t timeNs) const
+{
+    return hasDisk() && (timeNs % REVOLUTION_NS) < INDEX_PULSE_NS;
+}
+
+uint64_t FloppyDrive::timeOfAngle(double angle, uint64_t fromNs) const
+{
+    const uint64_t revolutionStart = fromNs - fromNs % REVOLUTION_NS;
+    const double wrapped = angle - std::floor(angle);
+    uint64_t time = revolutionStart + static_cast<uint64_t>(wrapped * REVOLUTION_NS);
+    if (time < fromNs) {
+        time += REVOLUTION_NS;
+    }
+    return time;
+}
@@ -0,0 +1,70 @@
+#ifndef FLOPPYDRIVE_H
+#define FLOPPYDRIVE_H
+
+#include "diskgeometry.h"
+#include "diskimage.h"
+
+#include <cstdint>
+#include <memory>
+
+// Mechanical model of a 5.25" drive: head position, side select, spindle
+// rotation and the index sensor. Time is emulated nanoseconds; the disk
+// spins continuously while inserted, so the rotation angle is a pure
+// function of time.
+class FloppyDrive
+{
+public:
+    static constexpr uint64_t REVOLUTION_NS = DiskGeometry::REVOLUTION_NS;  // 300 RPM
+    static constexpr uint64_t INDEX_PULSE_NS = 4000000;   // Index hole passes the sensor for ~4 ms
+    static constexpr int MAX_CYLINDER = 83;
+
+    FloppyDrive();
+
+    void insertDisk(std::shared_ptr<DiskImage> disk);
+    void ejectDisk();
+    bool hasDisk() const { return static_cast<bool>(m_disk); }
+    std::shared_ptr<DiskImage> disk() const { return m_disk; }
+
+    bool isWriteProtected() const { return m_writeProtected; }
+    void setWriteProtected(bool writeProtected) { m_writeProtected = writeProtected; }
+
+    int cylinder() const { return m_cylinder; }
+    void setCylinder(int cylinder);
+    void step(int direction);
+    bool isTrack0() const { return m_cylinder == 0; }
+    int stepCount() const { return m_stepCount; }
+
+    int side() const { return m_side; }
+    void setSide(int side) { m_side = side ? 1 : 0; }
+
+    // Track under the head, or nullptr without a disk or beyond the image
+    Track *currentTrack();
+    const Track *currentTrack() const;
+
+    // Rotation position at timeNs as a fraction of a revolution after index
+    double angleAt(uint64_t timeNs) const;
+    bool indexAt(uint64_t timeNs) const;
+    // Earliest time >= fromNs at which the head sees 'angle'
+    uint64_t timeOfAngle(double angle, uint64_t fromNs) const;
+    uint64_t nextIndex(uint64_t fromNs) const { return timeOfAngle(0.0, fromNs); }
+
+    // Head and switches, for save states. The disk is saved separately and
+    // the rotation follows from the controller's time.
+    struct State {
+        bool writeProtected = false;
+        int cylinder = 0;
+        int side = 0;
+        int stepCount = 0;
+    };
+    State state() const;
+    void restoreState(const State &state);
+
+private:
+    std::shared_ptr<DiskImage> m_disk;
+    bool m_writeProtected;
+    int m_cylinder;
+    int m_side;
+    int m_stepCount;
+};
+
+#endif // FLOPPYDRIVE_H
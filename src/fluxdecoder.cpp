@@ -0,0 +1,353 @@
+#include "fluxdecoder.h"
+#include "perftrace.h"
+#include "taskpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <tuple>
+
+namespace {
+
+constexpr double DEFAULT_MFM_CELL_NS = 2000.0;
+
+struct SectorKey {
+    uint8_t cylinder;
+    uint8_t head;
+    uint8_t id;
+    uint8_t sizeCode;
+    bool idCrcOk;
+
+    bool operator<(const SectorKey &other) const
+    {
+        return std::tie(cylinder, head, id, sizeCode, idCrcOk)
+             < std::tie(other.cylinder, other.head, other.id, other.sizeCode, other.idCrcOk);
+    }
+};
+
+struct SectorGroup {
+    std::vector<const Sector *> candidates; // In revolution order
+};
+
+std::vector<uint8_t> voteBytes(const std::vector<const Sector *> &candidates)
+{
+    std::vector<uint8_t> result(candidates.front()->data.begin(), candidates.front()->data.end());
+    if (candidates.size() < 3) {
+        return result;
+    }
+    for (size_t pos = 0; pos < result.size(); ++pos) {
+        size_t bestVotes = 0;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const uint8_t value = candidates[i]->data[pos];
+            size_t votes = 0;
+            for (const Sector *other : candidates) {
+                votes += (other->data[pos] == value) ? 1 : 0;
+            }
+            // Strictly greater keeps the earliest revolution on a tie
+            if (votes > bestVotes) {
+                bestVotes = votes;
+                result[pos] = value;
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+int RevolutionResult::goodSectorCount(Encoding encoding) const
+{
+    int count = 0;
+    for (const Sector &sector : (encoding == Encoding::MFM) ? mfm : fm) {
+        count += (sector.idCrcOk && sector.dataCrcOk) ? 1 : 0;
+    }
+    return count;
+}
+
+FluxRevolutionDecoder::FluxRevolutionDecoder(double mfmCellNs, bool decodeMfm, bool decodeFm)
+    : m_mfm{ FluxPll(mfmCellNs), BitstreamDecoder(Encoding::MFM), decodeMfm }
+    , m_fm{ FluxPll(mfmCellNs * 2.0), BitstreamDecoder(Encoding::FM), decodeFm }
+{
+}
+
+void FluxRevolutionDecoder::fluxBlock(const uint32_t *intervalsNs, size_t count)
+{
+    for (Channel *channel : { &m_mfm, &m_fm }) {
+        if (!channel->active) {
+            continue;
+        }
+        FluxPll &pll = channel->pll;
+        BitstreamDecoder &decoder = channel->decoder;
+        for (size_t i = 0; i < count; ++i) {
+            const int zeros = pll.feed(intervalsNs[i]);
+            if (zeros >= 0) {
+                decoder.pushFlux(zeros);
+            }
+        }
+    }
+}
+
+RevolutionResult FluxRevolutionDecoder::finish()
+{
+    RevolutionResult result;
+    result.mfmDecoded = m_mfm.active;
+    result.fmDecoded = m_fm.active;
+    if (m_mfm.active) {
+        m_mfm.decoder.finish();
+        result.mfm = m_mfm.decoder.takeSectors();
+    }
+    if (m_fm.active) {
+        m_fm.decoder.finish();
+        result.fm = m_fm.decoder.takeSectors();
+    }
+    return result;
+}
+
+FluxTrackDecoder::FluxTrackDecoder(double mfmCellNs)
+    : m_cellNs(mfmCellNs)
+{
+}
+
+void FluxTrackDecoder::beginRevolution()
+{
+    Encoding encoding = Encoding::MFM;
+    const bool decided = !m_revolutions.empty() && isEncodingDecided(m_revolutions.front(), &encoding);
+    m_current.reset(new FluxRevolutionDecoder(m_cellNs, !decided || encoding == Encoding::MFM,
+                                              !decided || encoding == Encoding::FM));
+}
+
+void FluxTrackDecoder::fluxBlock(const uint32_t *intervalsNs, size_t count)
+{
+    if (m_current) {
+        m_current->fluxBlock(intervalsNs, count);
+    }
+}
+
+void FluxTrackDecoder::endRevolution()
+{
+    if (m_current) {
+        m_revolutions.push_back(m_current->finish());
+        m_current.reset();
+    }
+}
+
+Track FluxTrackDecoder::result(int cylinder, int side) const
+{
+    return mergeTrack(cylinder, side, m_revolutions);
+}
+
+bool FluxTrackDecoder::isEncodingDecided(const RevolutionResult &first, Encoding *encoding)
+{
+    const int mfmGood = first.goodSectorCount(Encoding::MFM);
+    const int fmGood = first.goodSectorCount(Encoding::FM);
+    if (mfmGood == 0 && fmGood == 0) {
+        return false;
+    }
+    if (encoding) {
+        *encoding = (fmGood > mfmGood) ? Encoding::FM : Encoding::MFM;
+    }
+    return true;
+}
+
+Encoding FluxTrackDecoder::chooseEncoding(const std::vector<RevolutionResult> &revolutions)
+{
+    Encoding encoding = Encoding::MFM;
+    if (revolutions.empty() || isEncodingDecided(revolutions.front(), &encoding)) {
+        return encoding;
+    }
+
+    // Revolution 0 read nothing cleanly: go by totals, then by sectors seen at all
+    int mfmGood = 0, fmGood = 0;
+    size_t mfmSeen = 0, fmSeen = 0;
+    for (const RevolutionResult &revolution : revolutions) {
+        mfmGood += revolution.goodSectorCount(Encoding::MFM);
+        fmGood += revolution.goodSectorCount(Encoding::FM);
+        mfmSeen += revolution.mfm.size();
+        fmSeen += revolution.fm.size();
+    }
+    if (fmGood != mfmGood) {
+        return fmGood > mfmGood ? Encoding::FM : Encoding::MFM;
+    }
+    return fmSeen > mfmSeen ? Encoding::FM : Encoding::MFM;
+}
+
+Track FluxTrackDecoder::mergeTrack(int cylinder, int side, const std::vector<RevolutionResult> &revolutions)
+{
+    const Encoding encoding = chooseEncoding(revolutions);
+    std::vector<std::vector<Sector>> sectors;
+    sectors.reserve(revolutions.size());
+    for (const RevolutionResult &revolution : revolutions) {
+        sectors.push_back((encoding == Encoding::MFM) ? revolution.mfm : revolution.fm);
+    }
+    return mergeRevolutions(cylinder, side, encoding, sectors);
+}
+
+Track FluxTrackDecoder::mergeRevolutions(int cylinder, int side, Encoding encoding,
+                                         const std::vector<std::vector<Sector>> &revolutions)
+{
+    Track track;
+    track.cylinder = cylinder;
+    track.side = side;
+    track.encoding = encoding;
+    track.revolutions = static_cast<int>(revolutions.size());
+
+    std::map<SectorKey, size_t> groupIndex;
+    std::vector<SectorGroup> groups;
+    std::vector<bool> idSeenGood(256, false);
+    for (const std::vector<Sector> &revolution : revolutions) {
+        for (const Sector &sector : revolution) {
+            const SectorKey key{ sector.cylinder, sector.head, sector.id, sector.sizeCode, sector.idCrcOk };
+            auto it = groupIndex.find(key);
+            if (it == groupIndex.end()) {
+                it = groupIndex.emplace(key, groups.size()).first;
+                groups.emplace_back();
+            }
+            groups[it->second].candidates.push_back(&sector);
+            if (sector.idCrcOk) {
+                idSeenGood[sector.id] = true;
+            }
+        }
+    }
+
+    for (const SectorGroup &group : groups) {
+        const Sector &first = *group.candidates.front();
+        // A damaged ID is only worth reporting if no revolution read it cleanly
+        if (!first.idCrcOk && idSeenGood[first.id]) {
+            continue;
+        }
+
+        std::vector<const Sector *> good;
+        std::vector<const Sector *> withData;
+        for (const Sector *candidate : group.candidates) {
+            if (candidate->hasData()) {
+                withData.push_back(candidate);
+                if (candidate->dataCrcOk) {
+                    good.push_back(candidate);
+                }
+            }
+        }
+
+        Sector merged = first;
+        bool differs = group.candidates.size() < revolutions.size();
+        if (!good.empty()) {
+            merged = *good.front();
+            differs = differs || good.size() != group.candidates.size();
+            for (const Sector *candidate : good) {
+                differs = differs || candidate->data != merged.data;
+            }
+        } else if (!withData.empty()) {
+            merged = *withData.front();
+            merged.data = voteBytes(withData);
+            merged.dataCrcOk = false;
+            differs = differs || withData.size() != group.candidates.size();
+            for (const Sector *candidate : withData) {
+                differs = differs || candidate->data != withData.front()->data;
+            }
+        }
+        merged.angle = first.angle;
+        merged.weak = differs;
+        track.sectors.push_back(std::move(merged));
+    }
+
+    std::stable_sort(track.sectors.begin(), track.sectors.end(),
+                     [](const Sector &a, const Sector &b) { return a.angle < b.angle; });
+    return track;
+}
+
+double FluxDiskDecoder::effectiveCellNs(const FluxReader &reader, const FluxDecodeOptions &options)
+{
+    if (options.cellNs > 0.0) {
+        return options.cellNs;
+    }
+    return reader.nominalCellNs() > 0.0 ? reader.nominalCellNs() : DEFAULT_MFM_CELL_NS;
+}
+
+std::shared_ptr<DiskImage> FluxDiskDecoder::decode(FluxReader &reader, const FluxDecodeOptions &options,
+                                                   const ProgressCallback &progress)
+{
+    auto image = std::make_shared<DiskImage>(reader.cylinderCount(), reader.sideCount());
+    const double cellNs = effectiveCellNs(reader, options);
+    const int sides = image->sideCount();
+    const size_t trackTotal = static_cast<size_t>(image->cylinderCount() * sides);
+
+    std::vector<std::vector<RevolutionResult>> results(trackTotal);
+    // Per revolution, so concurrent tasks of one track never share a flag
+    std::vector<std::vector<uint8_t>> failed(trackTotal);
+    struct RevolutionTask {
+        size_t track;
+        int revolution;
+    };
+    std::vector<RevolutionTask> firstPass;
+    std::vector<RevolutionTask> secondPass;
+    for (size_t track = 0; track < trackTotal; ++track) {
+        int revolutions = reader.revolutionCount(static_cast<int>(track) / sides, static_cast<int>(track) % sides);
+        if (options.maxRevolutions > 0 && revolutions > options.maxRevolutions) {
+            revolutions = options.maxRevolutions;
+        }
+        results[track].resize(static_cast<size_t>(revolutions));
+        failed[track].assign(static_cast<size_t>(revolutions), 0);
+        for (int revolution = 0; revolution < revolutions; ++revolution) {
+            (revolution == 0 ? firstPass : secondPass).push_back({ track, revolution });
+        }
+    }
+
+    TaskPool pool(options.threads);
+    std::vector<std::unique_ptr<FluxReader>> workerReaders(static_cast<size_t>(pool.threadCount()));
+    const int total = static_cast<int>(firstPass.size() + secondPass.size());
+    std::atomic<int> done(0);
+
+    // Worker 0 is the calling thread and keeps the caller's reader
+    auto readerFor = [&](int worker) -> FluxReader * {
+        if (worker == 0) {
+            return &reader;
+        }
+        std::unique_ptr<FluxReader> &own = workerReaders[static_cast<size_t>(worker)];
+        if (!own) {
+            own = FluxReader::open(reader.path());
+        }
+        return own.get();
+    };
+
+    auto runPass = [&](const std::vector<RevolutionTask> &tasks) {
+        pool.parallelFor(tasks.size(), [&](size_t index, int worker) {
+            FLOPPY_TRACE_ZONE("decode", "FluxDecoder revolution");
+            const RevolutionTask &task = tasks[index];
+            const int cylinder = static_cast<int>(task.track) / sides;
+            const int side = static_cast<int>(task.track) % sides;
+
+            Encoding encoding = Encoding::MFM;
+            const bool decided = task.revolution > 0 && FluxTrackDecoder::isEncodingDecided(results[task.track][0], &encoding);
+            FluxRevolutionDecoder decoder(cellNs, !decided || encoding == Encoding::MFM,
+                                          !decided || encoding == Encoding::FM);
+            FluxReader *source = readerFor(worker);
+            if (source && source->readRevolution(cylinder, side, task.revolution, decoder)) {
+                results[task.track][static_cast<size_t>(task.revolution)] = decoder.finish();
+            } else {
+                failed[task.track][static_cast<size_t>(task.revolution)] = 1;
+            }
+            if (progress) {
+                progress(++done, total);
+            }
+        });
+    };
+    runPass(firstPass);
+    runPass(secondPass);
+
+    pool.parallelFor(trackTotal, [&](size_t track, int) {
+        FLOPPY_TRACE_ZONE("decode", "FluxDecoder merge");
+        const int cylinder = static_cast<int>(track) / sides;
+        const int side = static_cast<int>(track) % sides;
+        // A revolution that failed to read truncates the track like the sequential decoder does
+        std::vector<RevolutionResult> &revolutions = results[track];
+        if (std::find(failed[track].begin(), failed[track].end(), 1) != failed[track].end()) {
+            size_t keep = 0;
+            while (keep < revolutions.size() && (revolutions[keep].mfmDecoded || revolutions[keep].fmDecoded)) {
+                ++keep;
+            }
+            revolutions.resize(keep);
+        }
+        *image->track(cylinder, side) = FluxTrackDecoder::mergeTrack(cylinder, side, revolutions);
+    });
+    image->updateLayout();
+    return image;
+}
@@ -0,0 +1,99 @@
+#ifndef FLUXDECODER_H
+#define FLUXDECODER_H
+
+#include "bitstreamdecoder.h"
+#include "diskimage.h"
+#include "fluxpll.h"
+#include "fluxreader.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct FluxDecodeOptions {
+    double cellNs = 0.0;        // Nominal MFM cell period; 0 uses the image rate or 2000 ns (DD)
+    int maxRevolutions = 0;     // 0 decodes every captured revolution
+    int threads = 0;            // Decoder threads; 0 uses every core
+};
+
+// Sectors one revolution produced on each channel that was listening
+struct RevolutionResult {
+    bool mfmDecoded = false;
+    bool fmDecoded = false;
+    std::vector<Sector> mfm;
+    std::vector<Sector> fm;
+
+    int goodSectorCount(Encoding encoding) const;
+};
+
+// Streams one revolution through PLL and FM/MFM decoder. Channels that are
+// not needed (encoding already known) are switched off. FM listens at twice
+// the MFM cell period.
+class FluxRevolutionDecoder : public FluxSink
+{
+public:
+    FluxRevolutionDecoder(double mfmCellNs, bool decodeMfm, bool decodeFm);
+
+    void fluxBlock(const uint32_t *intervalsNs, size_t count) override;
+    RevolutionResult finish();
+
+private:
+    struct Channel {
+        FluxPll pll;
+        BitstreamDecoder decoder;
+        bool active;
+    };
+
+    Channel m_mfm;
+    Channel m_fm;
+};
+
+// Decodes the revolutions of one track in order and merges them. Revolution 0
+// is heard on both channels; once one of them reads a good sector the other
+// is dropped for the remaining revolutions.
+class FluxTrackDecoder : public FluxSink
+{
+public:
+    explicit FluxTrackDecoder(double mfmCellNs);
+
+    void beginRevolution();
+    void fluxBlock(const uint32_t *intervalsNs, size_t count) override;
+    void endRevolution();
+
+    const std::vector<RevolutionResult> &revolutions() const { return m_revolutions; }
+    Track result(int cylinder, int side) const;
+
+    // The encoding revolution 0 settles on, if any
+    static bool isEncodingDecided(const RevolutionResult &first, Encoding *encoding = nullptr);
+    static Encoding chooseEncoding(const std::vector<RevolutionResult> &revolutions);
+
+    // Picks the encoding, then merges the per-revolution sector lists: the
+    // earliest good CRC wins, otherwise data is voted byte by byte. Sectors
+    // whose data, CRC state or presence differ between revolutions are marked
+    // weak. The result only depends on the order of 'revolutions'.
+    static Track mergeTrack(int cylinder, int side, const std::vector<RevolutionResult> &revolutions);
+    static Track mergeRevolutions(int cylinder, int side, Encoding encoding,
+                                  const std::vector<std::vector<Sector>> &revolutions);
+
+private:
+    double m_cellNs;
+    std::unique_ptr<FluxRevolutionDecoder> m_current;
+    std::vector<RevolutionResult> m_revolutions;
+};
+
+// Decodes a whole flux image. Revolution 0 of every track is decoded first,
+// then all remaining revolutions, each batch spread over a task pool with one
+// reader per worker. Output is identical for any thread count.
+class FluxDiskDecoder
+{
+public:
+    using ProgressCallback = std::function<void(int done, int total)>;
+
+    // progress is called from worker threads with completed revolutions
+    static std::shared_ptr<DiskImage> decode(FluxReader &reader, const FluxDecodeOptions &options = FluxDecodeOptions(),
+                                             const ProgressCallback &progress = ProgressCallback());
+
+    static double effectiveCellNs(const FluxReader &reader, const FluxDecodeOptions &options);
+};
+
+#endif // FLUXDECODER_H
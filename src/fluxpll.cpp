@@ -0,0 +1,24 @@
+#include "fluxpll.h"
+
+FluxPll::FluxPll(double cellNs)
+    : m_nominal(cellNs)
+    , m_clock(cellNs)
+    , m_clockMin(cellNs * 0.9)
+    , m_clockMax(cellNs * 1.1)
+    , m_ticks(0.0)
+{
+}
+
+void FluxPll::reset()
+{
+    m_clock = m_nominal;
+    m_ticks = 0.0;
+}
+
+void FluxPll::setCellPeriod(double cellNs)
+{
+    m_nominal = cellNs;
+    m_clockMin = cellNs * 0.9;
+    m_clockMax = cellNs * 1.1;
+    reset();
+}
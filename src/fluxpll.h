@@ -0,0 +1,67 @@
+#ifndef FLUXPLL_H
+#define FLUXPLL_H
+
+#include <cstdint>
+
+// Software data separator: turns flux transition intervals into bitcells.
+// The clock period tracks the incoming flux within +/-10% of nominal and the
+// phase error is partially absorbed on every transition, like the analog PLL
+// in a real data separator.
+class FluxPll
+{
+public:
+    explicit FluxPll(double cellNs = 2000.0);
+
+    void reset();
+    void setCellPeriod(double cellNs);
+    double cellPeriod() const { return m_nominal; }
+
+    // Feeds one flux interval and returns the number of empty cells that
+    // precede the transition cell; returns -1 while the interval is still
+    // shorter than half a cell and has been folded into the next one.
+    int feed(uint32_t intervalNs)
+    {
+        m_ticks += intervalNs;
+        if (m_ticks < m_clock / 2) {
+            return -1;
+        }
+
+        int zeros = 0;
+        for (;;) {
+            m_ticks -= m_clock;
+            if (m_ticks >= m_clock / 2) {
+                ++zeros;
+            } else {
+                break;
+            }
+        }
+
+        // Frequency: follow short runs, drift back to nominal on long ones
+        if (zeros <= 3) {
+            m_clock += m_ticks * PERIOD_ADJUST;
+        } else {
+            m_clock += (m_nominal - m_clock) * PERIOD_ADJUST;
+        }
+        if (m_clock < m_clockMin) {
+            m_clock = m_clockMin;
+        } else if (m_clock > m_clockMax) {
+            m_clock = m_clockMax;
+        }
+
+        // Phase: keep only part of the error for the next transition
+        m_ticks *= (1.0 - PHASE_ADJUST);
+        return zeros;
+    }
+
+private:
+    static constexpr double PERIOD_ADJUST = 0.05;
+    static constexpr double PHASE_ADJUST = 0.60;
+
+    double m_nominal;
+    double m_clock;
+    double m_clockMin;
+    double m_clockMax;
+    double m_ticks;
+};
+
+#endif // FLUXPLL_H
@@ -0,0 +1,70 @@
+#include "fluxreader.h"
+#include "hfereader.h"
+#include "kfstreamreader.h"
+#include "scpreader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+std::string lowerExtension(const std::string &path)
+{
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) {
+        return std::string();
+    }
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+} // namespace
+
+std::unique_ptr<FluxReader> FluxReader::open(const std::string &path, std::string *error)
+{
+    char signature[8] = {};
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            if (error) {
+                *error = "Cannot open " + path;
+            }
+            return nullptr;
+        }
+        file.read(signature, sizeof(signature));
+    }
+
+    const std::string ext = lowerExtension(path);
+    std::unique_ptr<FluxReader> reader;
+    if (std::memcmp(signature, "SCP", 3) == 0) {
+        reader.reset(new ScpReader());
+    } else if (std::memcmp(signature, "HXCPICFE", 8) == 0 || std::memcmp(signature, "HXCHFEV3", 8) == 0) {
+        reader.reset(new HfeReader());
+    } else if (ext == "raw" || KfStreamReader::isStreamFileName(path)) {
+        reader.reset(new KfStreamReader());
+    } else if (ext == "scp") {
+        reader.reset(new ScpReader());
+    } else if (ext == "hfe") {
+        reader.reset(new HfeReader());
+    }
+
+    if (!reader) {
+        if (error) {
+            *error = "Unrecognized flux image format";
+        }
+        return nullptr;
+    }
+
+    reader->m_path = path;
+    if (!reader->load(path)) {
+        if (error) {
+            *error = reader->errorString();
+        }
+        return nullptr;
+    }
+    return reader;
+}
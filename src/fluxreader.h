@@ -0,0 +1,57 @@
+#ifndef FLUXREADER_H
+#define FLUXREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Receives flux transition intervals in nanoseconds, a block at a time.
+// Readers never hold more than one block per revolution in memory.
+class FluxSink
+{
+public:
+    virtual ~FluxSink() = default;
+    virtual void fluxBlock(const uint32_t *intervalsNs, size_t count) = 0;
+};
+
+// Base class for flux-level image formats (SuperCard Pro, HxC HFE, KryoFlux
+// stream). A reader is not thread-safe; open one per thread instead.
+class FluxReader
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    virtual ~FluxReader() = default;
+
+    // Picks the reader from the file signature, falling back to the extension
+    static std::unique_ptr<FluxReader> open(const std::string &path, std::string *error = nullptr);
+
+    virtual const char *formatName() const = 0;
+    virtual int cylinderCount() const = 0;
+    virtual int sideCount() const = 0;
+    virtual int revolutionCount(int cylinder, int side) const = 0;
+
+    // Streams one index-to-index revolution into the sink
+    virtual bool readRevolution(int cylinder, int side, int revolution, FluxSink &sink) = 0;
+
+    // Nominal MFM cell period if the format records one, otherwise 0
+    virtual double nominalCellNs() const { return 0.0; }
+
+    const std::string &path() const { return m_path; }
+    const std::string &errorString() const { return m_error; }
+
+protected:
+    virtual bool load(const std::string &path) = 0;
+
+    bool fail(const std::string &message)
+    {
+        m_error = message;
+        return false;
+    }
+
+    std::string m_path;
+    std::string m_error;
+};
+
+#endif // FLUXREADER_H
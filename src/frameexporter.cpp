@@ -0,0 +1,193 @@
+#include "frameexporter.h"
+#include "fdccontrollerrenderer.h"
+#include "floppydiskrenderer.h"
+#include "taskpool.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QObject>
+#include <QPainter>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Frames each worker gets per batch; bounds how far the replay reads ahead
+constexpr size_t FRAMES_PER_WORKER = 8;
+
+// Everything a worker touches while rendering is its own
+struct Worker {
+    FloppyDiskState disk;
+    FDCControllerState panel;
+    FloppyDiskRenderer diskRenderer;
+    FDCControllerRenderer panelRenderer;
+    QImage canvas;
+};
+
+void render(Worker &worker, const ReplayFrame &frame, const FrameExportOptions &options)
+{
+    FloppyDiskState &disk = worker.disk;
+    disk.track = frame.cylinder;
+    disk.side = frame.side;
+    disk.followTrackLayout();
+    disk.write = frame.write;
+    disk.indexPulse = frame.indexPulse;
+    disk.rotationAngle = frame.angle * 360.0;
+
+    FDCControllerState &panel = worker.panel;
+    panel.status = frame.status;
+    panel.command = frame.command;
+    panel.track = frame.track;
+    panel.sector = frame.sector;
+    panel.data = frame.data;
+    panel.intrq = frame.intrq;
+    panel.drq = frame.drq;
+
+    worker.canvas.fill(Qt::white);
+    QPainter painter(&worker.canvas);
+    worker.diskRenderer.paint(painter, QSize(options.diskSize, options.diskSize), disk);
+    painter.translate(options.diskSize, 0);
+    worker.panelRenderer.paint(painter, QSize(options.panelWidth, options.diskSize), panel);
+}
+
+// BT.601 full range, as Y4M's C420jpeg expects; chroma is the average of
+// each 2x2 block. Fixed point with 8 (luma) or 10 (chroma of four pixels)
+// fraction bits, offset so every intermediate stays non-negative.
+void toYuv420(const QImage &image, QByteArray &out)
+{
+    const int width = image.width();
+    const int height = image.height();
+    out.resize(width * height * 3 / 2);
+    uchar *y = reinterpret_cast<uchar *>(out.data());
+    uchar *u = y + width * height;
+    uchar *v = u + (width / 2) * (height / 2);
+
+    for (int row = 0; row < height; row += 2) {
+        const QRgb *lines[2] = { reinterpret_cast<const QRgb *>(image.constScanLine(row)),
+                                 reinterpret_cast<const QRgb *>(image.constScanLine(row + 1)) };
+        for (int col = 0; col < width; col += 2) {
+            int r = 0;
+            int g = 0;
+            int b = 0;
+            for (int dy = 0; dy < 2; ++dy) {
+                for (int dx = 0; dx < 2; ++dx) {
+                    const QRgb pixel = lines[dy][col + dx];
+                    const int pr = qRed(pixel);
+                    const int pg = qGreen(pixel);
+                    const int pb = qBlue(pixel);
+                    y[(row + dy) * width + col + dx] = static_cast<uchar>((77 * pr + 150 * pg + 29 * pb + 128) >> 8);
+                    r += pr;
+                    g += pg;
+                    b += pb;
+                }
+            }
+            const int chroma = (row / 2) * (width / 2) + col / 2;
+            u[chroma] = static_cast<uchar>(qBound(0, (131584 - 43 * r - 85 * g + 128 * b) >> 10, 255));
+            v[chroma] = static_cast<uchar>(qBound(0, (131584 + 128 * r - 107 * g - 21 * b) >> 10, 255));
+        }
+    }
+}
+
+} // namespace
+
+bool FrameExporter::exportFrames(TraceReplay &replay, const QString &path, const FrameExportOptions &options,
+                                 FrameExportStats *stats, QString *error, const Progress &progress)
+{
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    if (options.diskSize < 2 || options.panelWidth < 0) {
+        return fail(QObject::tr("Invalid frame size"));
+    }
+    const bool y4m = options.format == FrameExportOptions::Format::Y4m;
+    // 4:2:0 needs even dimensions; the odd column or row stays white
+    const int width = (options.diskSize + options.panelWidth + 1) & ~1;
+    const int height = (options.diskSize + 1) & ~1;
+
+    QFile stream(path);
+    QDir dir(path);
+    if (y4m) {
+        if (!stream.open(QIODevice::WriteOnly)) {
+            return fail(stream.errorString());
+        }
+        const QByteArray header = QStringLiteral("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C420jpeg\n")
+                                      .arg(width).arg(height).arg(replay.framesPerSecond()).toLatin1();
+        stream.write(header);
+    } else if (!QDir().mkpath(path)) {
+        return fail(QObject::tr("Cannot create %1").arg(path));
+    }
+
+    TaskPool pool(options.threads);
+    std::vector<Worker> workers(static_cast<size_t>(pool.threadCount()));
+    // Every frame is drawn at full detail, the default
+    const std::shared_ptr<const DiskLayout> layout = replay.disk() ? replay.disk()->layout() : nullptr;
+    for (Worker &worker : workers) {
+        worker.disk.layout = layout;
+        if (layout) {
+            worker.disk.doubleSided = layout->sideCount() == 2;
+            worker.disk.doubleDensity = layout->isDoubleDensity();
+        }
+        worker.canvas = QImage(width, height, QImage::Format_RGB32);
+    }
+
+    const size_t batchSize = workers.size() * FRAMES_PER_WORKER;
+    std::vector<ReplayFrame> batch;
+    batch.reserve(batchSize);
+    std::vector<QByteArray> encoded(y4m ? batchSize : 0);
+    std::vector<QString> failures(batchSize);
+    size_t frames = 0;
+    for (;;) {
+        batch.clear();
+        ReplayFrame frame;
+        while (batch.size() < batchSize && replay.next(frame)) {
+            batch.push_back(frame);
+        }
+        if (batch.empty()) {
+            break;
+        }
+
+        pool.parallelFor(batch.size(), [&](size_t index, int worker) {
+            Worker &own = workers[static_cast<size_t>(worker)];
+            render(own, batch[index], options);
+            if (y4m) {
+                toYuv420(own.canvas, encoded[index]);
+                return;
+            }
+            const QString file = dir.filePath(QStringLiteral("frame%1.png").arg(batch[index].index, 6, 10, QLatin1Char('0')));
+            if (!own.canvas.save(file, "PNG")) {
+                failures[index] = QObject::tr("Cannot write %1").arg(file);
+            }
+        });
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!failures[i].isEmpty()) {
+                return fail(failures[i]);
+            }
+            if (y4m && (stream.write("FRAME\n") != 6 || stream.write(encoded[i]) != encoded[i].size())) {
+                return fail(stream.errorString());
+            }
+        }
+        frames += batch.size();
+        if (progress) {
+            progress(frames);
+        }
+    }
+
+    if (y4m && !stream.flush()) {
+        return fail(stream.errorString());
+    }
+    if (stats) {
+        stats->frames = frames;
+        stats->seconds = timer.nsecsElapsed() / 1e9;
+    }
+    return true;
+}
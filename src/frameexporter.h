@@ -0,0 +1,44 @@
+#ifndef FRAMEEXPORTER_H
+#define FRAMEEXPORTER_H
+
+#include "tracereplay.h"
+
+#include <QString>
+
+#include <cstddef>
+#include <functional>
+
+struct FrameExportOptions {
+    enum class Format {
+        Png,    // Numbered files frame000000.png, ... in a directory
+        Y4m     // One raw YUV4MPEG2 4:2:0 stream
+    };
+    Format format = Format::Png;
+    int threads = 0;        // 0 uses all cores
+    int diskSize = 480;     // Side of the disk view
+    int panelWidth = 320;   // Controller panel, right of the disk view
+};
+
+struct FrameExportStats {
+    size_t frames = 0;
+    double seconds = 0.0;   // Wall time
+};
+
+// Renders a replay to a frame sequence without a window: the disk view and
+// the controller panel side by side, one frame per ReplayFrame. Frames are
+// drawn in parallel, each worker with its own FloppyDiskRenderer and
+// FDCControllerRenderer painting into its own QImage, and PNG encoding or
+// the YUV conversion runs on the workers too. The replay is read ahead a
+// batch at a time; Y4M frames are written in order once their batch is
+// done. Needs a QGuiApplication for fonts but no widgets or GUI thread.
+class FrameExporter
+{
+public:
+    using Progress = std::function<void(size_t frames)>;
+
+    static bool exportFrames(TraceReplay &replay, const QString &path, const FrameExportOptions &options,
+                             FrameExportStats *stats = nullptr, QString *error = nullptr,
+                             const Progress &progress = Progress());
+};
+
+#endif // FRAMEEXPORTER_H
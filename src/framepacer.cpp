@@ -0,0 +1,71 @@
+#include "framepacer.h"
+
+namespace {
+// Weight of the newest frame in the running average
+constexpr double AVERAGE_WEIGHT = 1.0 / 8;
+}
+
+FramePacer::FramePacer(uint64_t budgetNs)
+    : m_budgetNs(budgetNs ? budgetNs : DEFAULT_BUDGET_NS)
+{
+    reset();
+}
+
+void FramePacer::reset()
+{
+    m_detail = Detail::Full;
+    m_averageNs = 0.0;
+    m_lastNs = 0;
+    m_overFrames = 0;
+    m_underFrames = 0;
+}
+
+void FramePacer::setBudgetNs(uint64_t budgetNs)
+{
+    if (budgetNs) {
+        m_budgetNs = budgetNs;
+        m_overFrames = 0;
+        m_underFrames = 0;
+    }
+}
+
+bool FramePacer::frameDone(uint64_t paintNs)
+{
+    m_lastNs = paintNs;
+    m_averageNs = m_averageNs > 0.0 ? m_averageNs + (static_cast<double>(paintNs) - m_averageNs) * AVERAGE_WEIGHT
+                                    : static_cast<double>(paintNs);
+
+    const double budget = static_cast<double>(m_budgetNs);
+    m_overFrames = m_averageNs > budget * HIGH_LOAD ? m_overFrames + 1 : 0;
+    m_underFrames = m_averageNs < budget * LOW_LOAD ? m_underFrames + 1 : 0;
+
+    Detail next = m_detail;
+    if (m_overFrames >= DOWN_FRAMES && m_detail != Detail::Minimal) {
+        next = static_cast<Detail>(static_cast<int>(m_detail) + 1);
+    } else if (m_underFrames >= UP_FRAMES && m_detail != Detail::Full) {
+        next = static_cast<Detail>(static_cast<int>(m_detail) - 1);
+    }
+    if (next == m_detail) {
+        return false;
+    }
+
+    // Frames at the new level start a fresh average
+    m_detail = next;
+    m_averageNs = 0.0;
+    m_overFrames = 0;
+    m_underFrames = 0;
+    return true;
+}
+
+const char *FramePacer::detailName(Detail detail)
+{
+    switch (detail) {
+    case Detail::Full:
+        return "Full";
+    case Detail::Reduced:
+        return "Reduced";
+    case Detail::Minimal:
+        return "Minimal";
+    }
+    return "Unknown";
+}
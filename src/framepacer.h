@@ -0,0 +1,53 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <cstdint>
+
+// Picks a level of detail that keeps painting within a frame budget. The
+// renderer reports how long each frame took; a running average that stays
+// above HIGH_LOAD of the budget steps detail down, one that stays below
+// LOW_LOAD steps it back up. Stepping up takes much longer than stepping
+// down, so a level that just fits is not left again after a few cheap
+// frames, and every change restarts the average so one slow frame cannot
+// drop two levels.
+class FramePacer
+{
+public:
+    enum class Detail {
+        Full,       // Everything, antialiased
+        Reduced,    // Fewer track rings, aliased spokes, flat head
+        Minimal     // Also aliased rings and sector wedges
+    };
+
+    static constexpr uint64_t DEFAULT_BUDGET_NS = 16666667;  // 60 FPS
+    static constexpr double HIGH_LOAD = 0.75;   // Of the budget; leaves room for compositing
+    static constexpr double LOW_LOAD = 0.35;    // Headroom the next level up is expected to need
+    static constexpr int DOWN_FRAMES = 8;
+    static constexpr int UP_FRAMES = 120;       // Two seconds at 60 FPS
+
+    explicit FramePacer(uint64_t budgetNs = DEFAULT_BUDGET_NS);
+
+    // Records one frame; returns true if the detail level changed
+    bool frameDone(uint64_t paintNs);
+    // Back to full detail with no history, e.g. after a resize
+    void reset();
+
+    Detail detail() const { return m_detail; }
+    uint64_t budgetNs() const { return m_budgetNs; }
+    void setBudgetNs(uint64_t budgetNs);
+    // Exponential average of recent paint times; 0 before the first frame
+    double averageNs() const { return m_averageNs; }
+    uint64_t lastNs() const { return m_lastNs; }
+
+    static const char *detailName(Detail detail);
+
+private:
+    uint64_t m_budgetNs;
+    Detail m_detail;
+    double m_averageNs;
+    uint64_t m_lastNs;
+    int m_overFrames;
+    int m_underFrames;
+};
+
+#endif // FRAMEPACER_H
@@ -0,0 +1,277 @@
+#include "hfeformat.h"
+#include "bitstreamdecoder.h"
+#include "bitstreamencoder.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr size_t BLOCK = 512;
+constexpr size_t SIDE_CHUNK = BLOCK / 2;
+
+// Header fields
+constexpr size_t HEADER_REVISION = 8;
+constexpr size_t HEADER_TRACKS = 9;
+constexpr size_t HEADER_SIDES = 10;
+constexpr size_t HEADER_ENCODING = 11;
+constexpr size_t HEADER_BIT_RATE = 12;
+constexpr size_t HEADER_RPM = 14;
+constexpr size_t HEADER_INTERFACE = 16;
+constexpr size_t HEADER_RESERVED = 17;
+constexpr size_t HEADER_TRACK_LIST = 18;
+constexpr size_t HEADER_WRITE_ALLOWED = 20;
+
+constexpr uint8_t ENCODING_ISOIBM_MFM = 0x00;
+constexpr uint8_t ENCODING_ISOIBM_FM = 0x02;
+constexpr uint8_t INTERFACE_GENERIC_SHUGART_DD = 0x07;
+
+uint16_t readLe16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+void writeLe16(uint8_t *p, uint32_t value)
+{
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// Bytes of one side of a track; the remainder of the last chunk is filler
+size_t sideBlocks(size_t length)
+{
+    return (length + SIDE_CHUNK - 1) / SIDE_CHUNK;
+}
+
+} // namespace
+
+HfeTrackReader::HfeTrackReader()
+    : m_cylinders(0)
+    , m_sides(0)
+    , m_bitRateKbps(250)
+    , m_encoding(Encoding::MFM)
+{
+}
+
+bool HfeTrackReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+
+    uint8_t header[BLOCK];
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        return fail("Truncated HFE header");
+    }
+    if (std::memcmp(header, "HXCHFEV3", 8) == 0) {
+        return fail("HFE v3 stream opcodes are not supported");
+    }
+    if (std::memcmp(header, "HXCPICFE", 8) != 0) {
+        return fail("Not an HFE image");
+    }
+
+    m_cylinders = header[HEADER_TRACKS];
+    m_sides = header[HEADER_SIDES] >= 2 ? 2 : 1;
+    m_encoding = header[HEADER_ENCODING] == ENCODING_ISOIBM_FM ? Encoding::FM : Encoding::MFM;
+    m_bitRateKbps = readLe16(header + HEADER_BIT_RATE);
+    if (m_bitRateKbps == 0) {
+        return fail("HFE image has no bit rate");
+    }
+
+    std::vector<uint8_t> list(static_cast<size_t>(m_cylinders) * 4);
+    m_file.seekg(static_cast<std::streamoff>(readLe16(header + HEADER_TRACK_LIST)) * BLOCK);
+    if (!m_file.read(reinterpret_cast<char *>(list.data()), static_cast<std::streamsize>(list.size()))) {
+        return fail("Truncated HFE track list");
+    }
+    m_tracks.resize(static_cast<size_t>(m_cylinders));
+    for (int i = 0; i < m_cylinders; ++i) {
+        m_tracks[i].offset = readLe16(list.data() + i * 4);
+        m_tracks[i].length = readLe16(list.data() + i * 4 + 2);
+    }
+    return true;
+}
+
+bool HfeTrackReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    block.cylinder = cylinder;
+    block.side = side;
+    block.encoding = m_encoding;
+
+    const TrackEntry &entry = m_tracks[cylinder];
+    block.bytes.resize(entry.length / 2);
+    std::streamoff position = static_cast<std::streamoff>(entry.offset) * BLOCK + side * SIDE_CHUNK;
+    m_file.clear();
+    for (size_t done = 0; done < block.bytes.size(); done += SIDE_CHUNK) {
+        const size_t length = block.bytes.size() - done < SIDE_CHUNK ? block.bytes.size() - done : SIDE_CHUNK;
+        m_file.seekg(position);
+        if (!m_file.read(reinterpret_cast<char *>(block.bytes.data() + done), static_cast<std::streamsize>(length))) {
+            return fail("Truncated HFE track " + std::to_string(cylinder) + "/" + std::to_string(side));
+        }
+        position += BLOCK;
+    }
+    return true;
+}
+
+Track HfeTrackReader::decode(const TrackBlock &block) const
+{
+    Track track;
+    track.cylinder = block.cylinder;
+    track.side = block.side;
+    track.encoding = block.encoding;
+    track.revolutions = 1;
+
+    // FM recorded at the MFM bit rate spends two stored cells on each FM cell
+    const bool doubled = block.encoding == Encoding::FM && m_bitRateKbps >= 250;
+    BitstreamDecoder decoder(block.encoding);
+    bool pair = false;
+    for (uint8_t value : block.bytes) {
+        for (int bit = 0; bit < 8; ++bit) {
+            const bool cell = (value >> bit) & 1;
+            if (!doubled) {
+                decoder.pushCell(cell);
+            } else if (bit & 1) {
+                decoder.pushCell(pair || cell);
+            } else {
+                pair = cell;
+            }
+        }
+    }
+    decoder.finish();
+    track.sectors = decoder.takeSectors();
+    return track;
+}
+
+HfeWriter::HfeWriter()
+    : m_cylinders(0)
+    , m_sides(1)
+    , m_bitRateKbps(250)
+    , m_encoding(Encoding::MFM)
+    , m_nextBlock(0)
+{
+}
+
+bool HfeWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    if (cylinders > 255 || sides > 2) {
+        return fail("HFE holds at most 255 cylinders and 2 sides");
+    }
+    m_cylinders = cylinders;
+    m_sides = sides;
+    m_bitRateKbps = dataRateKbps > 250 ? dataRateKbps : 250;
+    m_trackList.assign(static_cast<size_t>(cylinders) * 4, 0xFF);
+
+    // Header and track list are written last; track data starts after them
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    m_nextBlock = static_cast<uint32_t>(1 + (m_trackList.size() + BLOCK - 1) / BLOCK);
+    const std::vector<uint8_t> reserved(m_nextBlock * BLOCK, 0xFF);
+    if (!m_file.write(reinterpret_cast<const char *>(reserved.data()), static_cast<std::streamsize>(reserved.size()))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool HfeWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    (void)error;
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    block.encoding = track.encoding;
+
+    // One revolution at 300 RPM: 25 bytes per kbit/s for MFM, half that for FM
+    const bool fm = track.encoding == Encoding::FM;
+    const size_t trackBytes = static_cast<size_t>(m_bitRateKbps) * (fm ? 25 : 50) / 2;
+    BitstreamEncoder encoder(track.encoding);
+    encoder.encodeTrack(track, trackBytes);
+
+    const std::vector<uint8_t> &cells = encoder.cells();
+    const size_t cellCount = encoder.cellCount();
+    const size_t stored = fm ? cellCount * 2 : cellCount;
+    block.bytes.assign((stored + 7) / 8, 0);
+    for (size_t i = 0; i < cellCount; ++i) {
+        if (cells[i / 8] & (0x80 >> (i & 7))) {
+            const size_t out = fm ? i * 2 : i;
+            block.bytes[out / 8] |= static_cast<uint8_t>(1 << (out & 7));
+        }
+    }
+    return true;
+}
+
+bool HfeWriter::writeBlock(const TrackBlock &block)
+{
+    if (block.cylinder == 0 && block.side == 0) {
+        m_encoding = block.encoding;
+    }
+    if (m_sides == 1) {
+        return writeCylinder(block, nullptr);
+    }
+    if (block.side == 0) {
+        m_pending = block;
+        return true;
+    }
+    return writeCylinder(m_pending, &block);
+}
+
+bool HfeWriter::writeCylinder(const TrackBlock &side0, const TrackBlock *side1)
+{
+    size_t length = side0.bytes.size();
+    if (side1 && side1->bytes.size() > length) {
+        length = side1->bytes.size();
+    }
+    if (length * 2 > 0xFFFF) {
+        return fail("Track " + std::to_string(side0.cylinder) + " is too long for HFE");
+    }
+
+    const size_t blocks = sideBlocks(length);
+    std::vector<uint8_t> data(blocks * BLOCK, 0);
+    for (int side = 0; side < 2; ++side) {
+        const TrackBlock *track = side == 0 ? &side0 : side1;
+        const std::vector<uint8_t> &bytes = track ? track->bytes : side0.bytes;
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            data[(i / SIDE_CHUNK) * BLOCK + side * SIDE_CHUNK + i % SIDE_CHUNK] = bytes[i];
+        }
+    }
+    if (!m_file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()))) {
+        return fail("Write error");
+    }
+
+    uint8_t *entry = m_trackList.data() + side0.cylinder * 4;
+    writeLe16(entry, m_nextBlock);
+    writeLe16(entry + 2, static_cast<uint32_t>(length * 2));
+    m_nextBlock += static_cast<uint32_t>(blocks);
+    if (m_nextBlock > 0xFFFF) {
+        return fail("HFE image exceeds 32 MB");
+    }
+    return true;
+}
+
+bool HfeWriter::finish()
+{
+    uint8_t header[BLOCK];
+    std::memset(header, 0xFF, sizeof(header));
+    std::memcpy(header, "HXCPICFE", 8);
+    header[HEADER_REVISION] = 0;
+    header[HEADER_TRACKS] = static_cast<uint8_t>(m_cylinders);
+    header[HEADER_SIDES] = static_cast<uint8_t>(m_sides);
+    header[HEADER_ENCODING] = m_encoding == Encoding::FM ? ENCODING_ISOIBM_FM : ENCODING_ISOIBM_MFM;
+    writeLe16(header + HEADER_BIT_RATE, static_cast<uint32_t>(m_bitRateKbps));
+    writeLe16(header + HEADER_RPM, 300);
+    header[HEADER_INTERFACE] = INTERFACE_GENERIC_SHUGART_DD;
+    header[HEADER_RESERVED] = 0x01;
+    writeLe16(header + HEADER_TRACK_LIST, 1);
+    header[HEADER_WRITE_ALLOWED] = 0xFF;
+
+    m_file.seekp(0);
+    if (!m_file.write(reinterpret_cast<const char *>(header), sizeof(header))) {
+        return fail("Write error");
+    }
+    m_file.seekp(static_cast<std::streamoff>(BLOCK));
+    if (!m_file.write(reinterpret_cast<const char *>(m_trackList.data()),
+                      static_cast<std::streamsize>(m_trackList.size()))) {
+        return fail("Write error");
+    }
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
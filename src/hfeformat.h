@@ -0,0 +1,70 @@
+#ifndef HFEFORMAT_H
+#define HFEFORMAT_H
+
+#include "trackstream.h"
+
+#include <fstream>
+#include <vector>
+
+// HxC HFE (revision 1) as a track image. Unlike HfeReader, which feeds the
+// cells through the PLL like any flux capture, this reads the stored cells
+// straight into the FM/MFM decoder, and writes tracks encoded in the
+// standard IBM layout. Cells are stored least significant bit first, both
+// sides of a cylinder interleaved in 256 byte chunks. FM tracks use two
+// cells per FM cell so that FM and MFM share the 250 kbit/s bit rate.
+class HfeTrackReader : public TrackReader
+{
+public:
+    HfeTrackReader();
+
+    const char *formatName() const override { return "HFE"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    int dataRateKbps() const override { return m_bitRateKbps > 250 ? m_bitRateKbps : 250; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    struct TrackEntry {
+        uint32_t offset;    // In 512-byte blocks
+        uint32_t length;    // Bytes for both sides together
+    };
+
+    std::ifstream m_file;
+    int m_cylinders;
+    int m_sides;
+    int m_bitRateKbps;
+    Encoding m_encoding;
+    std::vector<TrackEntry> m_tracks;
+};
+
+class HfeWriter : public TrackWriter
+{
+public:
+    HfeWriter();
+
+    const char *formatName() const override { return "HFE"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    bool writeCylinder(const TrackBlock &side0, const TrackBlock *side1);
+
+    std::ofstream m_file;
+    int m_cylinders;
+    int m_sides;
+    int m_bitRateKbps;
+    Encoding m_encoding;                // Taken from track 0
+    uint32_t m_nextBlock;
+    std::vector<uint8_t> m_trackList;
+    TrackBlock m_pending;               // Side 0 waiting for side 1
+};
+
+#endif // HFEFORMAT_H
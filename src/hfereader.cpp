@@ -0,0 +1,116 @@
+#include "hfereader.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr size_t BLOCK = 512;
+constexpr size_t SIDE_CHUNK = BLOCK / 2;
+
+uint16_t readLe16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+} // namespace
+
+HfeReader::HfeReader()
+    : m_cylinders(0)
+    , m_sides(0)
+    , m_cellNs(2000.0)
+{
+}
+
+bool HfeReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+
+    uint8_t header[BLOCK];
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        return fail("Truncated HFE header");
+    }
+    if (std::memcmp(header, "HXCHFEV3", 8) == 0) {
+        return fail("HFE v3 stream opcodes are not supported");
+    }
+    if (std::memcmp(header, "HXCPICFE", 8) != 0) {
+        return fail("Not an HFE image");
+    }
+
+    m_cylinders = header[9];
+    m_sides = header[10] >= 2 ? 2 : 1;
+    const uint16_t bitRateKbps = readLe16(header + 12);
+    const uint16_t trackListBlock = readLe16(header + 18);
+    if (bitRateKbps == 0) {
+        return fail("HFE image has no bit rate");
+    }
+    // The bit rate counts data bits; every data bit occupies two cells
+    m_cellNs = 1.0e6 / (bitRateKbps * 2.0);
+
+    std::vector<uint8_t> lut(static_cast<size_t>(m_cylinders) * 4);
+    m_file.seekg(static_cast<std::streamoff>(trackListBlock) * BLOCK);
+    if (!m_file.read(reinterpret_cast<char *>(lut.data()), static_cast<std::streamsize>(lut.size()))) {
+        return fail("Truncated HFE track list");
+    }
+    m_tracks.resize(static_cast<size_t>(m_cylinders));
+    for (int i = 0; i < m_cylinders; ++i) {
+        m_tracks[i].offset = readLe16(lut.data() + i * 4);
+        m_tracks[i].length = readLe16(lut.data() + i * 4 + 2);
+    }
+    return true;
+}
+
+int HfeReader::revolutionCount(int cylinder, int side) const
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return 0;
+    }
+    return m_tracks[cylinder].length > 0 ? 1 : 0;
+}
+
+bool HfeReader::readRevolution(int cylinder, int side, int revolution, FluxSink &sink)
+{
+    if (revolution != 0 || revolutionCount(cylinder, side) == 0) {
+        return fail("Track not present in HFE image");
+    }
+
+    const TrackEntry &entry = m_tracks[cylinder];
+    size_t remaining = entry.length / 2;
+    std::streamoff blockPos = static_cast<std::streamoff>(entry.offset) * BLOCK + side * SIDE_CHUNK;
+
+    // Each 512-byte block holds 256 bytes of side 0 followed by 256 bytes of side 1
+    uint8_t chunk[SIDE_CHUNK];
+    uint32_t intervals[BLOCK_SIZE];
+    size_t count = 0;
+    uint32_t cellsSinceFlux = 0;
+    m_file.clear();
+    while (remaining > 0) {
+        const size_t length = remaining < SIDE_CHUNK ? remaining : SIDE_CHUNK;
+        m_file.seekg(blockPos);
+        if (!m_file.read(reinterpret_cast<char *>(chunk), static_cast<std::streamsize>(length))) {
+            return fail("Truncated HFE track data");
+        }
+        for (size_t i = 0; i < length; ++i) {
+            // Cells are stored least significant bit first
+            for (int bit = 0; bit < 8; ++bit) {
+                ++cellsSinceFlux;
+                if (chunk[i] & (1 << bit)) {
+                    intervals[count++] = static_cast<uint32_t>(cellsSinceFlux * m_cellNs + 0.5);
+                    cellsSinceFlux = 0;
+                    if (count == BLOCK_SIZE) {
+                        sink.fluxBlock(intervals, count);
+                        count = 0;
+                    }
+                }
+            }
+        }
+        remaining -= length;
+        blockPos += BLOCK;
+    }
+    if (count > 0) {
+        sink.fluxBlock(intervals, count);
+    }
+    return true;
+}
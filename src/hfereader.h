@@ -0,0 +1,39 @@
+#ifndef HFEREADER_H
+#define HFEREADER_H
+
+#include "fluxreader.h"
+
+#include <fstream>
+#include <vector>
+
+// HxC Floppy Emulator (.hfe, revision 1) reader. HFE stores one revolution
+// of raw cells per track; set cells are replayed as flux transitions.
+class HfeReader : public FluxReader
+{
+public:
+    HfeReader();
+
+    const char *formatName() const override { return "HxC HFE"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    int revolutionCount(int cylinder, int side) const override;
+    bool readRevolution(int cylinder, int side, int revolution, FluxSink &sink) override;
+    double nominalCellNs() const override { return m_cellNs; }
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    struct TrackEntry {
+        uint32_t offset;    // In 512-byte blocks
+        uint32_t length;    // Bytes for both sides together
+    };
+
+    std::ifstream m_file;
+    int m_cylinders;
+    int m_sides;
+    double m_cellNs;
+    std::vector<TrackEntry> m_tracks;
+};
+
+#endif // HFEREADER_H
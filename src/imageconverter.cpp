@@ -0,0 +1,262 @@
+#include "imageconverter.h"
+#include "perftrace.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Hand-over between two stages. The in-flight limit bounds how much it can
+// hold, so it needs no bound of its own.
+template <typename T>
+class StageQueue
+{
+public:
+    void push(T item)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_items.push_back(std::move(item));
+        m_ready.notify_one();
+    }
+
+    // Waits for the next item; false once the queue is closed and drained,
+    // or right away when the pipeline was aborted
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return !m_items.empty() || m_closed; });
+        if (m_items.empty() || m_aborted) {
+            return false;
+        }
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        return true;
+    }
+
+    void close(bool abort = false)
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_closed = true;
+        m_aborted = m_aborted || abort;
+        m_ready.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<T> m_items;
+    bool m_closed = false;
+    bool m_aborted = false;
+};
+
+// Tracks between reading and writing: the reader takes a slot before it
+// reads a track, the writer gives it back once the track is on disk
+class InFlightLimit
+{
+public:
+    explicit InFlightLimit(int limit)
+        : m_limit(limit > 0 ? limit : 1)
+    {
+    }
+
+    bool acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_free.wait(lock, [this] { return m_count < m_limit || m_aborted; });
+        if (m_aborted) {
+            return false;
+        }
+        ++m_count;
+        m_peak = m_count > m_peak ? m_count : m_peak;
+        return true;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        --m_count;
+        m_free.notify_one();
+    }
+
+    void abort()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_aborted = true;
+        m_free.notify_all();
+    }
+
+    int peak() const { return m_peak; }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_free;
+    const int m_limit;
+    int m_count = 0;
+    int m_peak = 0;
+    bool m_aborted = false;
+};
+
+// Compares the files rather than the spellings, so x.trd and ./x.trd match
+bool sameFile(const std::string &a, const std::string &b)
+{
+    std::error_code error;
+    return a == b || std::filesystem::equivalent(a, b, error);
+}
+
+} // namespace
+
+bool ImageConverter::convert(const std::string &input, const std::string &output,
+                             const ConvertOptions &options, ConvertStats *stats,
+                             std::string *error, const Progress &progress)
+{
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    const ImageFormat format = options.format != ImageFormat::Unknown ? options.format : imageFormatFromPath(output);
+    if (format == ImageFormat::Unknown) {
+        return fail("Cannot tell the output format from " + output);
+    }
+    // The output is built under a temporary name and renamed over the target
+    // once complete, so neither a failure nor a crash leaves a partial file
+    const std::string partial = output + ".tmp";
+    if (sameFile(input, output) || sameFile(input, partial)) {
+        return fail("Input and output are the same file");
+    }
+
+    std::string message;
+    std::unique_ptr<TrackReader> reader = TrackReader::open(input, &message);
+    if (!reader) {
+        return fail(message);
+    }
+    const int cylinders = reader->cylinderCount();
+    const int sides = reader->sideCount();
+    std::unique_ptr<TrackWriter> writer = TrackWriter::create(partial, format, cylinders, sides,
+                                                              reader->dataRateKbps(), &message);
+    if (!writer) {
+        return fail(message);
+    }
+
+    StageQueue<TrackBlock> readQueue;
+    StageQueue<Track> decodeQueue;
+    StageQueue<TrackBlock> encodeQueue;
+    InFlightLimit inFlight(options.maxInFlight);
+
+    std::mutex failureLock;
+    std::string failure;
+    auto abort = [&](const std::string &reason) {
+        {
+            std::lock_guard<std::mutex> guard(failureLock);
+            if (failure.empty()) {
+                failure = reason.empty() ? std::string("Conversion failed") : reason;
+            }
+        }
+        inFlight.abort();
+        readQueue.close(true);
+        decodeQueue.close(true);
+        encodeQueue.close(true);
+    };
+
+    uint64_t bytesRead = 0;
+    std::thread readStage([&] {
+        FLOPPY_TRACE_THREAD("ImageConverter read");
+        for (int cylinder = 0; cylinder < cylinders; ++cylinder) {
+            for (int side = 0; side < sides; ++side) {
+                if (!inFlight.acquire()) {
+                    return;
+                }
+                TrackBlock block;
+                FLOPPY_TRACE_ZONE("io", "TrackReader::readBlock");
+                if (!reader->readBlock(cylinder, side, block)) {
+                    abort(reader->errorString());
+                    return;
+                }
+                bytesRead += block.bytes.size();
+                readQueue.push(std::move(block));
+            }
+        }
+        readQueue.close();
+    });
+
+    // decode() never touches the file, so it runs alongside readBlock()
+    std::thread decodeStage([&] {
+        FLOPPY_TRACE_THREAD("ImageConverter decode");
+        TrackBlock block;
+        while (readQueue.pop(block)) {
+            FLOPPY_TRACE_ZONE("decode", "TrackReader::decode");
+            decodeQueue.push(reader->decode(block));
+        }
+        decodeQueue.close();
+    });
+
+    std::thread encodeStage([&] {
+        FLOPPY_TRACE_THREAD("ImageConverter encode");
+        Track track;
+        while (decodeQueue.pop(track)) {
+            FLOPPY_TRACE_ZONE("io", "TrackWriter::encode");
+            TrackBlock block;
+            std::string reason;
+            if (!writer->encode(track, block, &reason)) {
+                abort(reason);
+                return;
+            }
+            encodeQueue.push(std::move(block));
+        }
+        encodeQueue.close();
+    });
+
+    const int total = cylinders * sides;
+    int done = 0;
+    uint64_t bytesWritten = 0;
+    TrackBlock block;
+    while (encodeQueue.pop(block)) {
+        if (!writer->writeBlock(block)) {
+            abort(writer->errorString());
+            break;
+        }
+        bytesWritten += block.bytes.size();
+        inFlight.release();
+        ++done;
+        if (progress) {
+            progress(done, total);
+        }
+    }
+
+    readStage.join();
+    decodeStage.join();
+    encodeStage.join();
+
+    if (failure.empty() && done == total && !writer->finish()) {
+        failure = writer->errorString();
+    }
+    const char *outputFormat = writer->formatName();
+    writer.reset();
+    if (!failure.empty() || done != total) {
+        std::remove(partial.c_str());
+        return fail(failure.empty() ? std::string("Conversion stopped early") : failure);
+    }
+    std::error_code renameError;
+    std::filesystem::rename(partial, output, renameError);
+    if (renameError) {
+        std::remove(partial.c_str());
+        return fail("Cannot replace " + output + ": " + renameError.message());
+    }
+
+    if (stats) {
+        stats->inputFormat = reader->formatName();
+        stats->outputFormat = outputFormat;
+        stats->tracks = done;
+        stats->bytesRead = bytesRead;
+        stats->bytesWritten = bytesWritten;
+        stats->peakInFlight = inFlight.peak();
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef IMAGECONVERTER_H
+#define IMAGECONVERTER_H
+
+#include "trackstream.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct ConvertOptions {
+    ImageFormat format = ImageFormat::Unknown;  // Unknown picks it from the output extension
+    int maxInFlight = 4;        // Tracks read but not yet written
+};
+
+struct ConvertStats {
+    const char *inputFormat = "";
+    const char *outputFormat = "";
+    int tracks = 0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    int peakInFlight = 0;
+};
+
+// Converts between the track image formats as a four stage pipeline: read
+// track, decode, encode, write. Read, decode and encode run on their own
+// threads, the writer on the caller's; at most maxInFlight tracks exist
+// between the first and the last stage, so memory stays constant whatever
+// the image size. The output is written as output + ".tmp" and renamed into
+// place once complete; the first failing stage stops the others and the
+// partial file is removed, so an existing output is only ever replaced whole.
+// Input and output must be different files, however they are spelled.
+class ImageConverter
+{
+public:
+    // Called from the writer with tracks written so far and the total
+    using Progress = std::function<void(int done, int total)>;
+
+    static bool convert(const std::string &input, const std::string &output,
+                        const ConvertOptions &options = ConvertOptions(), ConvertStats *stats = nullptr,
+                        std::string *error = nullptr, const Progress &progress = Progress());
+};
+
+#endif // IMAGECONVERTER_H
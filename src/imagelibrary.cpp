@@ -0,0 +1,426 @@
+#include "imagelibrary.h"
+#include "perftrace.h"
+#include "taskpool.h"
+#include "trdformat.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMAGE_LIBRARY_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x494C4651;     // "QFLI"
+constexpr uint32_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 32;
+constexpr size_t LABEL_SIZE = 8;
+
+constexpr uint8_t FLAG_READABLE = 0x01;
+constexpr uint8_t FLAG_CATALOG = 0x02;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t stringBytes;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(Header) == HEADER_SIZE, "Header layout");
+
+int64_t mtimeNs(const std::filesystem::file_time_type &time)
+{
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+} // namespace
+
+struct ImageLibraryIndex::Record {
+    uint64_t size;
+    int64_t mtimeNs;
+    uint32_t pathOffset;
+    uint16_t pathLength;
+    uint8_t format;
+    uint8_t flags;
+    uint16_t cylinders;
+    uint8_t sides;
+    uint8_t sectorsPerTrack;
+    uint16_t sectorSize;
+    uint16_t files;
+    uint16_t freeSectors;
+    char label[LABEL_SIZE];
+    uint8_t reserved[6];
+};
+
+// The index file, mapped where mmap exists and read into memory elsewhere
+struct ImageLibraryMapping {
+    const uint8_t *base = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> copy;
+
+    ~ImageLibraryMapping()
+    {
+#ifdef IMAGE_LIBRARY_HAVE_MMAP
+        if (base && copy.empty()) {
+            munmap(const_cast<uint8_t *>(base), size);
+        }
+#endif
+    }
+};
+
+ImageLibraryIndex::ImageLibraryIndex()
+    : m_records(nullptr)
+    , m_strings(nullptr)
+    , m_stringBytes(0)
+    , m_count(0)
+{
+    static_assert(sizeof(Record) == 48, "Record layout");
+}
+
+ImageLibraryIndex::~ImageLibraryIndex() = default;
+
+bool ImageLibraryIndex::open(const std::string &path, std::string *error)
+{
+    close();
+    auto mapping = std::make_shared<ImageLibraryMapping>();
+#ifdef IMAGE_LIBRARY_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        if (error) {
+            *error = "Cannot open " + path;
+        }
+        return false;
+    }
+    struct stat info;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(HEADER_SIZE)) {
+        mapping->size = static_cast<size_t>(info.st_size);
+        memory = mmap(nullptr, mapping->size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory != MAP_FAILED) {
+        mapping->base = static_cast<const uint8_t *>(memory);
+    }
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return true;
+    }
+    mapping->copy.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(mapping->copy.data()), static_cast<std::streamsize>(mapping->copy.size()));
+    if (file && mapping->copy.size() >= HEADER_SIZE) {
+        mapping->base = mapping->copy.data();
+        mapping->size = mapping->copy.size();
+    }
+#endif
+
+    const Header *header = mapping->base ? reinterpret_cast<const Header *>(mapping->base) : nullptr;
+    if (!header || header->magic != MAGIC || header->version != VERSION ||
+        header->count > (mapping->size - HEADER_SIZE) / sizeof(Record) ||
+        header->stringBytes > mapping->size - HEADER_SIZE - header->count * sizeof(Record)) {
+        if (error) {
+            *error = "Not a library index: " + path;
+        }
+        return false;
+    }
+    m_count = static_cast<size_t>(header->count);
+    m_records = reinterpret_cast<const Record *>(mapping->base + HEADER_SIZE);
+    m_strings = reinterpret_cast<const char *>(m_records + m_count);
+    m_stringBytes = header->stringBytes;
+    m_mapping = std::move(mapping);
+    return true;
+}
+
+void ImageLibraryIndex::close()
+{
+    m_mapping.reset();
+    m_records = nullptr;
+    m_strings = nullptr;
+    m_stringBytes = 0;
+    m_count = 0;
+}
+
+std::string ImageLibraryIndex::path(size_t index) const
+{
+    const Record &stored = m_records[index];
+    // A damaged record reads as an empty path rather than past the strings
+    if (static_cast<uint64_t>(stored.pathOffset) + stored.pathLength > m_stringBytes) {
+        return std::string();
+    }
+    return std::string(m_strings + stored.pathOffset, stored.pathLength);
+}
+
+LibraryEntry ImageLibraryIndex::entry(size_t index) const
+{
+    const Record *stored = m_records + index;
+    LibraryEntry entry;
+    entry.path = path(index);
+    entry.size = stored->size;
+    entry.mtimeNs = stored->mtimeNs;
+    entry.format = static_cast<ImageFormat>(stored->format);
+    entry.readable = (stored->flags & FLAG_READABLE) != 0;
+    entry.cylinders = stored->cylinders;
+    entry.sides = stored->sides;
+    entry.sectorsPerTrack = stored->sectorsPerTrack;
+    entry.sectorSize = stored->sectorSize;
+    entry.hasCatalog = (stored->flags & FLAG_CATALOG) != 0;
+    entry.files = stored->files;
+    entry.freeSectors = stored->freeSectors;
+    entry.label.assign(stored->label, std::find(stored->label, stored->label + LABEL_SIZE, '\0'));
+    return entry;
+}
+
+size_t ImageLibraryIndex::find(const std::string &path) const
+{
+    // Binary search on the mapped records without building any strings
+    auto less = [this, &path](const Record &stored) {
+        if (static_cast<uint64_t>(stored.pathOffset) + stored.pathLength > m_stringBytes) {
+            return true;
+        }
+        const int order = std::memcmp(m_strings + stored.pathOffset, path.data(),
+                                      std::min<size_t>(stored.pathLength, path.size()));
+        return order < 0 || (order == 0 && stored.pathLength < path.size());
+    };
+    size_t low = 0;
+    size_t high = m_count;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (less(m_records[middle])) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < m_count && this->path(low) == path ? low : m_count;
+}
+
+bool ImageLibraryIndex::write(const std::string &path, std::vector<LibraryEntry> entries, std::string *error)
+{
+    std::sort(entries.begin(), entries.end(),
+              [](const LibraryEntry &a, const LibraryEntry &b) { return a.path < b.path; });
+
+    std::vector<Record> records(entries.size());
+    std::string strings;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const LibraryEntry &entry = entries[i];
+        Record &stored = records[i];
+        std::memset(&stored, 0, sizeof(stored));
+        stored.size = entry.size;
+        stored.mtimeNs = entry.mtimeNs;
+        stored.pathOffset = static_cast<uint32_t>(strings.size());
+        stored.pathLength = static_cast<uint16_t>(std::min<size_t>(entry.path.size(), 0xFFFF));
+        stored.format = static_cast<uint8_t>(entry.format);
+        stored.flags = (entry.readable ? FLAG_READABLE : 0) | (entry.hasCatalog ? FLAG_CATALOG : 0);
+        stored.cylinders = static_cast<uint16_t>(entry.cylinders);
+        stored.sides = static_cast<uint8_t>(entry.sides);
+        stored.sectorsPerTrack = static_cast<uint8_t>(std::min(entry.sectorsPerTrack, 0xFF));
+        stored.sectorSize = static_cast<uint16_t>(entry.sectorSize);
+        stored.files = static_cast<uint16_t>(entry.files);
+        stored.freeSectors = static_cast<uint16_t>(entry.freeSectors);
+        std::memcpy(stored.label, entry.label.data(), std::min(entry.label.size(), LABEL_SIZE));
+        strings.append(entry.path, 0, stored.pathLength);
+    }
+    const Header header = { MAGIC, VERSION, records.size(), strings.size(), 0 };
+
+    // Written next to the index and renamed over it, so no reader sees half of it
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(records.data()),
+                   static_cast<std::streamsize>(records.size() * sizeof(Record)));
+        file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+        if (!file.flush()) {
+            if (error) {
+                *error = "Write error on " + temporary;
+            }
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0 &&
+        (std::remove(path.c_str()) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0)) {
+        if (error) {
+            *error = "Cannot replace " + path;
+        }
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ImageLibrary::rescan(const std::string &root, const std::string &indexPath, const ImageLibraryIndex &previous,
+                          LibraryScanStats *stats, std::string *error, const Progress &progress,
+                          const std::atomic<bool> *cancel, int threads)
+{
+    namespace fs = std::filesystem;
+    FLOPPY_TRACE_ZONE("io", "ImageLibrary::rescan");
+    const auto started = std::chrono::steady_clock::now();
+    LibraryScanStats counts;
+    auto cancelled = [cancel] { return cancel && cancel->load(std::memory_order_relaxed); };
+
+    // Walking the tree only stats files; nothing is opened yet
+    std::vector<LibraryEntry> entries;
+    std::vector<size_t> changed;
+    size_t seen = 0;
+    std::error_code failure;
+    const fs::path rootPath(root);
+    fs::recursive_directory_iterator walk(rootPath, fs::directory_options::skip_permission_denied, failure);
+    for (; !failure && walk != fs::recursive_directory_iterator(); walk.increment(failure)) {
+        if (cancelled()) {
+            return false;
+        }
+        std::error_code ignored;
+        if (!walk->is_regular_file(ignored) || imageFormatFromPath(walk->path().string()) == ImageFormat::Unknown) {
+            continue;
+        }
+        LibraryEntry entry;
+        entry.path = walk->path().lexically_relative(rootPath).generic_string();
+        entry.size = walk->file_size(ignored);
+        entry.mtimeNs = mtimeNs(walk->last_write_time(ignored));
+
+        const size_t found = previous.find(entry.path);
+        if (found < previous.size()) {
+            ++seen;
+            LibraryEntry indexed = previous.entry(found);
+            if (indexed.size == entry.size && indexed.mtimeNs == entry.mtimeNs) {
+                entries.push_back(std::move(indexed));
+                ++counts.unchanged;
+                continue;
+            }
+        }
+        changed.push_back(entries.size());
+        entries.push_back(std::move(entry));
+    }
+    if (failure) {
+        if (error) {
+            *error = "Cannot read " + root + ": " + failure.message();
+        }
+        return false;
+    }
+
+    // Only new and changed images are opened, several at a time
+    std::atomic<size_t> done(0);
+    TaskPool pool(threads);
+    pool.parallelFor(changed.size(), [&](size_t index, int) {
+        if (cancelled()) {
+            return;
+        }
+        LibraryEntry &entry = entries[changed[index]];
+        LibraryEntry probed = probe((rootPath / entry.path).string());
+        probed.path = std::move(entry.path);
+        probed.size = entry.size;
+        probed.mtimeNs = entry.mtimeNs;
+        entry = std::move(probed);
+        if (progress) {
+            progress(++done, changed.size());
+        }
+    });
+    if (cancelled()) {
+        return false;
+    }
+
+    counts.files = entries.size();
+    counts.probed = changed.size();
+    counts.removed = previous.size() - seen;
+    counts.written = counts.probed > 0 || counts.removed > 0;
+    if (counts.written && !ImageLibraryIndex::write(indexPath, std::move(entries), error)) {
+        return false;
+    }
+    counts.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (stats) {
+        *stats = counts;
+    }
+    return true;
+}
+
+LibraryEntry ImageLibrary::probe(const std::string &path)
+{
+    FLOPPY_TRACE_ZONE("io", "ImageLibrary::probe");
+    LibraryEntry entry;
+    entry.path = path;
+    entry.format = imageFormatFromPath(path);
+    std::unique_ptr<TrackReader> reader = TrackReader::open(path);
+    if (!reader) {
+        return entry;
+    }
+    entry.readable = true;
+    entry.cylinders = reader->cylinderCount();
+    entry.sides = reader->sideCount();
+
+    TrackBlock block;
+    if (entry.cylinders > 0 && entry.sides > 0 && reader->readBlock(0, 0, block)) {
+        const Track track = reader->decode(block);
+        entry.sectorsPerTrack = static_cast<int>(track.sectors.size());
+        entry.sectorSize = track.sectors.empty() ? 0 : track.sectors.front().size();
+        TrDos::CatalogSummary catalog;
+        if (TrDos::catalogSummary(track, catalog)) {
+            entry.hasCatalog = true;
+            entry.files = catalog.files;
+            entry.freeSectors = catalog.freeSectors;
+            entry.label = catalog.label;
+        }
+    }
+    return entry;
+}
+
+bool ImageLibrary::sectorMap(const std::string &path, SectorMap &map, std::string *error)
+{
+    FLOPPY_TRACE_ZONE("io", "ImageLibrary::sectorMap");
+    const std::shared_ptr<DiskImage> image = TrackReader::loadImage(path, error);
+    if (!image) {
+        return false;
+    }
+    map.cylinders = image->cylinderCount();
+    map.sides = image->sideCount();
+    map.sectorsPerTrack = 0;
+    for (int cylinder = 0; cylinder < map.cylinders; ++cylinder) {
+        for (int side = 0; side < map.sides; ++side) {
+            map.sectorsPerTrack = std::max(map.sectorsPerTrack, static_cast<int>(image->track(cylinder, side)->sectors.size()));
+        }
+    }
+    map.sectorsPerTrack = std::min(map.sectorsPerTrack, static_cast<int>(SectorMap::MAX_SECTORS));
+
+    map.states.assign(static_cast<size_t>(map.cylinders) * map.sides * map.sectorsPerTrack, SectorMap::Missing);
+    for (int cylinder = 0; cylinder < map.cylinders; ++cylinder) {
+        for (int side = 0; side < map.sides; ++side) {
+            const std::vector<Sector> &sectors = image->track(cylinder, side)->sectors;
+            const size_t first = (static_cast<size_t>(cylinder) * map.sides + side) * map.sectorsPerTrack;
+            for (int i = 0; i < std::min(static_cast<int>(sectors.size()), map.sectorsPerTrack); ++i) {
+                const Sector &sector = sectors[static_cast<size_t>(i)];
+                uint8_t state = SectorMap::Good;
+                if (!sector.idCrcOk || !sector.dataCrcOk || !sector.hasData()) {
+                    state = SectorMap::Bad;
+                } else if (sector.weak) {
+                    state = SectorMap::Weak;
+                }
+                map.states[first + static_cast<size_t>(i)] = state;
+            }
+        }
+    }
+    return true;
+}
+
+int64_t ImageLibrary::unixTimeMs(int64_t mtimeNs)
+{
+    // The file clock has an epoch of its own in C++17; both clocks' current time relate them
+    using namespace std::chrono;
+    const int64_t fileNow = duration_cast<nanoseconds>(std::filesystem::file_time_type::clock::now().time_since_epoch()).count();
+    const int64_t systemNow = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    return (mtimeNs - fileNow + systemNow) / 1000000;
+}
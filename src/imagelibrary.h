@@ -0,0 +1,125 @@
+#ifndef IMAGELIBRARY_H
+#define IMAGELIBRARY_H
+
+#include "trackstream.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One image of a library, as the index keeps it
+struct LibraryEntry {
+    std::string path;           // Relative to the library root, '/' separated
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    ImageFormat format = ImageFormat::Unknown;
+    bool readable = false;      // False when no reader accepted the file
+    int cylinders = 0;
+    int sides = 0;
+    int sectorsPerTrack = 0;    // Of cylinder 0, side 0
+    int sectorSize = 0;
+    bool hasCatalog = false;    // TR-DOS system sector found; the fields below are valid
+    int files = 0;
+    int freeSectors = 0;
+    std::string label;
+};
+
+// Sector states of a whole image, for a thumbnail of the sector map
+struct SectorMap {
+    enum State : uint8_t {
+        Missing,
+        Good,
+        Weak,
+        Bad             // CRC error in the ID or data field
+    };
+    static constexpr int MAX_SECTORS = 32;
+
+    int cylinders = 0;
+    int sides = 0;
+    int sectorsPerTrack = 0;    // Most sectors on any track, at most MAX_SECTORS
+    std::vector<uint8_t> states;    // Cylinder-major, sectors in angular order
+
+    uint8_t at(int cylinder, int side, int sector) const
+    {
+        return states[(static_cast<size_t>(cylinder) * sides + side) * sectorsPerTrack + sector];
+    }
+};
+
+struct ImageLibraryMapping;
+
+// Persistent index of a library, sorted by path. The file is memory-mapped
+// and entries are decoded from the mapping on demand, so opening an index
+// of 100k images costs one mmap and a view can show any row right away.
+//
+// File layout, native byte order:
+//   header  "QFLI" magic, version, entry count, string bytes (32 bytes)
+//   records 48 bytes per entry, path as offset and length into the strings
+//   strings paths, not terminated
+class ImageLibraryIndex
+{
+public:
+    ImageLibraryIndex();
+    ~ImageLibraryIndex();
+
+    // An index that does not exist yet opens empty
+    bool open(const std::string &path, std::string *error = nullptr);
+    void close();
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    LibraryEntry entry(size_t index) const;
+    std::string path(size_t index) const;
+    // Position of 'path', or size() when it is not indexed
+    size_t find(const std::string &path) const;
+
+    // Sorts 'entries' and replaces the index at 'path' with them; readers
+    // that have the old file mapped keep seeing it
+    static bool write(const std::string &path, std::vector<LibraryEntry> entries, std::string *error = nullptr);
+
+private:
+    struct Record;
+
+    std::shared_ptr<ImageLibraryMapping> m_mapping;
+    const Record *m_records;
+    const char *m_strings;
+    uint64_t m_stringBytes;
+    size_t m_count;
+};
+
+struct LibraryScanStats {
+    size_t files = 0;           // Images found under the root
+    size_t unchanged = 0;       // Taken from the old index by size and mtime
+    size_t probed = 0;          // New or changed, opened again
+    size_t removed = 0;         // Indexed but gone
+    bool written = false;       // False when nothing changed
+    double seconds = 0.0;
+};
+
+// Image collections on disk. rescan() walks a directory tree, opens only
+// images whose size or mtime differ from the index, on a thread pool, and
+// writes a new index; probe() and sectorMap() are what a browser needs for
+// a single entry.
+class ImageLibrary
+{
+public:
+    // Progress is reported from the probing threads
+    using Progress = std::function<void(size_t done, size_t total)>;
+
+    static bool rescan(const std::string &root, const std::string &indexPath, const ImageLibraryIndex &previous,
+                       LibraryScanStats *stats = nullptr, std::string *error = nullptr,
+                       const Progress &progress = Progress(), const std::atomic<bool> *cancel = nullptr,
+                       int threads = 0);
+
+    // Format, geometry and catalog from the first track of 'path'
+    static LibraryEntry probe(const std::string &path);
+    // Loads the whole image
+    static bool sectorMap(const std::string &path, SectorMap &map, std::string *error = nullptr);
+    // LibraryEntry::mtimeNs as milliseconds since 1970, for display
+    static int64_t unixTimeMs(int64_t mtimeNs);
+};
+
+#endif // IMAGELIBRARY_H
@@ -0,0 +1,451 @@
+#include "imagelibrarywidget.h"
+#include "perftrace.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QItemSelectionModel>
+#include <QLabel>
+#include <QLocale>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTableView>
+#include <QVBoxLayout>
+
+namespace {
+
+const QRgb STATE_COLORS[] = {
+    qRgb(0xE0, 0xE0, 0xE0),     // Missing
+    qRgb(0x4C, 0xAF, 0x50),     // Good
+    qRgb(0xFF, 0xC1, 0x07),     // Weak
+    qRgb(0xF4, 0x43, 0x36),     // Bad
+};
+
+QString settingsPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1String("/library.ini");
+}
+
+} // namespace
+
+ImageLibraryModel::ImageLibraryModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , cachedRow(-1)
+    , thumbnails(2048)
+    , placeholder(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, QImage::Format_RGB32)
+    , generation(0)
+    , firstVisible(0)
+    , lastVisible(-1)
+{
+    placeholder.fill(STATE_COLORS[SectorMap::Missing]);
+    // Leave cores for the emulation and the rescan
+    thumbnailPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+ImageLibraryModel::~ImageLibraryModel()
+{
+    thumbnailPool.clear();
+    thumbnailPool.waitForDone();
+}
+
+void ImageLibraryModel::setIndex(const QString &libraryRoot, std::shared_ptr<const ImageLibraryIndex> libraryIndex)
+{
+    beginResetModel();
+    root = libraryRoot;
+    indexFile = std::move(libraryIndex);
+    cachedRow = -1;
+    ++generation;
+    endResetModel();
+}
+
+const LibraryEntry &ImageLibraryModel::entryAt(int row) const
+{
+    // The view asks for every column of a row in turn; decode it once
+    if (row != cachedRow) {
+        cachedEntry = indexFile->entry(static_cast<size_t>(row));
+        cachedRow = row;
+    }
+    return cachedEntry;
+}
+
+QString ImageLibraryModel::filePath(int row) const
+{
+    if (!indexFile || row < 0 || row >= rowCount()) {
+        return QString();
+    }
+    return root + QLatin1Char('/') + QFile::decodeName(QByteArray::fromStdString(indexFile->path(static_cast<size_t>(row))));
+}
+
+int ImageLibraryModel::rowOf(const QString &path) const
+{
+    if (!indexFile || !path.startsWith(root + QLatin1Char('/'))) {
+        return -1;
+    }
+    const size_t found = indexFile->find(QFile::encodeName(path.mid(root.size() + 1)).toStdString());
+    return found < indexFile->size() ? static_cast<int>(found) : -1;
+}
+
+void ImageLibraryModel::setVisibleRows(int first, int last)
+{
+    firstVisible = first;
+    lastVisible = last;
+}
+
+bool ImageLibraryModel::isVisible(int row) const
+{
+    return row >= firstVisible - VISIBLE_MARGIN && row <= lastVisible + VISIBLE_MARGIN;
+}
+
+int ImageLibraryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() || !indexFile ? 0 : static_cast<int>(indexFile->size());
+}
+
+int ImageLibraryModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : COLUMN_COUNT;
+}
+
+QVariant ImageLibraryModel::data(const QModelIndex &modelIndex, int role) const
+{
+    if (!modelIndex.isValid() || modelIndex.row() >= rowCount()) {
+        return QVariant();
+    }
+    const int row = modelIndex.row();
+    const LibraryEntry &entry = entryAt(row);
+
+    if (role == Qt::ToolTipRole) {
+        return filePath(row);
+    }
+    if (role == Qt::TextAlignmentRole && modelIndex.column() == SizeColumn) {
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+    if (modelIndex.column() == MapColumn) {
+        if (role == Qt::SizeHintRole) {
+            return QSize(THUMBNAIL_WIDTH + 8, THUMBNAIL_HEIGHT + 4);
+        }
+        if (role != Qt::DecorationRole || !entry.readable) {
+            return QVariant();
+        }
+        const QString key = QString::fromStdString(entry.path) + QLatin1Char('@') + QString::number(entry.mtimeNs);
+        if (const QImage *thumbnail = thumbnails.object(key)) {
+            return *thumbnail;
+        }
+        requestThumbnail(row, key);
+        return placeholder;
+    }
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+
+    switch (modelIndex.column()) {
+    case NameColumn:
+        return QFile::decodeName(QByteArray::fromStdString(entry.path));
+    case FormatColumn:
+        return entry.readable ? QString::fromLatin1(imageFormatExtension(entry.format)).toUpper() : tr("unreadable");
+    case GeometryColumn:
+        if (!entry.readable) {
+            return QVariant();
+        }
+        return tr("%1 x %2, %3 x %4")
+            .arg(entry.cylinders)
+            .arg(entry.sides)
+            .arg(entry.sectorsPerTrack)
+            .arg(entry.sectorSize);
+    case CatalogColumn:
+        if (!entry.hasCatalog) {
+            return QVariant();
+        }
+        return tr("%1: %2 files, %3 free")
+            .arg(QString::fromLatin1(entry.label.c_str()))
+            .arg(entry.files)
+            .arg(entry.freeSectors);
+    case SizeColumn:
+        return QLocale().formattedDataSize(static_cast<qint64>(entry.size));
+    case ModifiedColumn:
+        return QDateTime::fromMSecsSinceEpoch(ImageLibrary::unixTimeMs(entry.mtimeNs)).toString(Qt::ISODate);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant ImageLibraryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    switch (section) {
+    case MapColumn:
+        return tr("Sectors");
+    case NameColumn:
+        return tr("Image");
+    case FormatColumn:
+        return tr("Format");
+    case GeometryColumn:
+        return tr("Geometry");
+    case CatalogColumn:
+        return tr("Catalog");
+    case SizeColumn:
+        return tr("Size");
+    case ModifiedColumn:
+        return tr("Modified");
+    default:
+        return QVariant();
+    }
+}
+
+void ImageLibraryModel::requestThumbnail(int row, const QString &key) const
+{
+    if (pending.contains(key)) {
+        return;
+    }
+    pending.insert(key);
+    const std::string path = QFile::encodeName(filePath(row)).toStdString();
+    const int jobGeneration = generation;
+    ImageLibraryModel *self = const_cast<ImageLibraryModel *>(this);
+    thumbnailPool.start([self, row, key, path, jobGeneration]() {
+        // Rows scrolled past while the job waited are not worth loading
+        if (jobGeneration != self->generation || !self->isVisible(row)) {
+            QMetaObject::invokeMethod(self, [self, row, key, jobGeneration]() {
+                self->thumbnailDone(row, key, jobGeneration, true, QImage());
+            }, Qt::QueuedConnection);
+            return;
+        }
+        FLOPPY_TRACE_ZONE("gui", "ImageLibraryModel thumbnail");
+        SectorMap map;
+        const QImage image = ImageLibrary::sectorMap(path, map) ? renderThumbnail(map) : QImage();
+        QMetaObject::invokeMethod(self, [self, row, key, jobGeneration, image]() {
+            self->thumbnailDone(row, key, jobGeneration, false, image);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ImageLibraryModel::thumbnailDone(int row, const QString &key, int jobGeneration, bool skipped, const QImage &image)
+{
+    pending.remove(key);
+    if (jobGeneration != generation || row >= rowCount()) {
+        return;
+    }
+    if (skipped) {
+        // Back in view by now: the view will not ask again on its own
+        if (isVisible(row)) {
+            requestThumbnail(row, key);
+        }
+        return;
+    }
+    // An image that failed to load keeps the placeholder
+    thumbnails.insert(key, new QImage(image.isNull() ? placeholder : image));
+    const QModelIndex cell = createIndex(row, MapColumn);
+    emit dataChanged(cell, cell, { Qt::DecorationRole });
+}
+
+QImage ImageLibraryModel::renderThumbnail(const SectorMap &map)
+{
+    // Cylinders run left to right, each side's sectors top to bottom
+    QImage image(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, QImage::Format_RGB32);
+    image.fill(STATE_COLORS[SectorMap::Missing]);
+    const int rows = map.sides * map.sectorsPerTrack;
+    if (map.cylinders == 0 || rows == 0) {
+        return image;
+    }
+    for (int y = 0; y < THUMBNAIL_HEIGHT; ++y) {
+        const int slot = y * rows / THUMBNAIL_HEIGHT;
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < THUMBNAIL_WIDTH; ++x) {
+            const int cylinder = x * map.cylinders / THUMBNAIL_WIDTH;
+            line[x] = STATE_COLORS[map.at(cylinder, slot / map.sectorsPerTrack, slot % map.sectorsPerTrack) & 3];
+        }
+    }
+    return image;
+}
+
+ImageLibraryWidget::ImageLibraryWidget(QWidget *parent)
+    : QWidget(parent)
+    , folderButton(new QPushButton(tr("Folder..."), this))
+    , rescanButton(new QPushButton(tr("Rescan"), this))
+    , statusLabel(new QLabel(this))
+    , view(new QTableView(this))
+    , model(new ImageLibraryModel(this))
+    , scanThread(nullptr)
+    , cancelScan(false)
+{
+    QHBoxLayout *controls = new QHBoxLayout;
+    controls->addWidget(folderButton);
+    controls->addWidget(rescanButton);
+    controls->addWidget(statusLabel, 1);
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addLayout(controls);
+    layout->addWidget(view);
+
+    view->setModel(model);
+    view->setSelectionBehavior(QAbstractItemView::SelectRows);
+    view->setSelectionMode(QAbstractItemView::SingleSelection);
+    view->setIconSize(QSize(ImageLibraryModel::THUMBNAIL_WIDTH, ImageLibraryModel::THUMBNAIL_HEIGHT));
+    view->setWordWrap(false);
+    view->verticalHeader()->hide();
+    // Fixed row heights keep 100k rows from being measured
+    view->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    view->verticalHeader()->setDefaultSectionSize(ImageLibraryModel::THUMBNAIL_HEIGHT + 4);
+    view->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    view->horizontalHeader()->resizeSection(ImageLibraryModel::MapColumn, ImageLibraryModel::THUMBNAIL_WIDTH + 8);
+    view->horizontalHeader()->resizeSection(ImageLibraryModel::NameColumn, 220);
+    view->horizontalHeader()->setStretchLastSection(true);
+
+    connect(folderButton, &QPushButton::clicked, this, &ImageLibraryWidget::chooseRoot);
+    connect(rescanButton, &QPushButton::clicked, this, &ImageLibraryWidget::rescan);
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, &ImageLibraryWidget::updateVisibleRows);
+    connect(view->selectionModel(), &QItemSelectionModel::currentRowChanged, this,
+            [this](const QModelIndex &current) {
+                if (current.isValid()) {
+                    emit imageSelected(model->filePath(current.row()));
+                }
+            });
+
+    const QString saved = QSettings(settingsPath(), QSettings::IniFormat).value(QStringLiteral("root")).toString();
+    if (saved.isEmpty()) {
+        statusLabel->setText(tr("No library folder"));
+    } else {
+        setRoot(saved);
+    }
+}
+
+ImageLibraryWidget::~ImageLibraryWidget()
+{
+    stopRescan();
+}
+
+QString ImageLibraryWidget::indexPathFor(const QString &root)
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1String("/library");
+    QDir().mkpath(dir);
+    const QByteArray key = QCryptographicHash::hash(QDir(root).absolutePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return dir + QLatin1Char('/') + QString::fromLatin1(key) + QLatin1String(".qfli");
+}
+
+void ImageLibraryWidget::setRoot(const QString &root)
+{
+    stopRescan();
+    libraryRoot = QDir(root).absolutePath();
+    QSettings(settingsPath(), QSettings::IniFormat).setValue(QStringLiteral("root"), libraryRoot);
+
+    // Whatever the last scan left is shown right away; the rescan catches up
+    auto index = std::make_shared<ImageLibraryIndex>();
+    // A damaged index is rebuilt by the rescan
+    if (!index->open(QFile::encodeName(indexPathFor(libraryRoot)).toStdString())) {
+        index->close();
+    }
+    model->setIndex(libraryRoot, index);
+    updateVisibleRows();
+    showCount();
+    rescan();
+}
+
+void ImageLibraryWidget::chooseRoot()
+{
+    const QString root = QFileDialog::getExistingDirectory(this, tr("Image Library"), libraryRoot);
+    if (!root.isEmpty()) {
+        setRoot(root);
+    }
+}
+
+void ImageLibraryWidget::stopRescan()
+{
+    if (scanThread) {
+        cancelScan = true;
+        scanThread->wait();
+        // Its queued finished() handler sees another thread and does nothing
+        scanThread->deleteLater();
+        scanThread = nullptr;
+    }
+}
+
+void ImageLibraryWidget::rescan()
+{
+    if (scanThread || libraryRoot.isEmpty()) {
+        return;
+    }
+    cancelScan = false;
+    rescanButton->setEnabled(false);
+
+    struct Result {
+        bool ok = false;
+        LibraryScanStats stats;
+        std::string error;
+    };
+    auto result = std::make_shared<Result>();
+    const std::shared_ptr<const ImageLibraryIndex> previous = model->libraryIndex();
+    const std::string rootPath = QFile::encodeName(libraryRoot).toStdString();
+    const std::string indexPath = QFile::encodeName(indexPathFor(libraryRoot)).toStdString();
+    QThread *thread = QThread::create([this, result, previous, rootPath, indexPath]() {
+        result->ok = ImageLibrary::rescan(rootPath, indexPath, *previous, &result->stats, &result->error,
+            [this](size_t done, size_t total) {
+                // One status update per batch keeps the event queue short
+                if (done % 256 == 0 || done == total) {
+                    QMetaObject::invokeMethod(this, [this, done, total]() {
+                        statusLabel->setText(tr("Scanning: %1 of %2 new or changed").arg(done).arg(total));
+                    }, Qt::QueuedConnection);
+                }
+            }, &cancelScan);
+    });
+    scanThread = thread;
+    connect(thread, &QThread::finished, this, [this, thread, result, indexPath]() {
+        if (thread != scanThread) {
+            return;
+        }
+        scanThread->deleteLater();
+        scanThread = nullptr;
+        rescanButton->setEnabled(true);
+        if (!result->ok) {
+            statusLabel->setText(QString::fromStdString(result->error));
+            return;
+        }
+        if (result->stats.written) {
+            // Keep the selection on the same image across the new index
+            const QString selected = model->filePath(view->currentIndex().row());
+            auto index = std::make_shared<ImageLibraryIndex>();
+            if (index->open(indexPath)) {
+                view->selectionModel()->blockSignals(true);
+                model->setIndex(libraryRoot, index);
+                const int row = model->rowOf(selected);
+                if (row >= 0) {
+                    view->setCurrentIndex(model->index(row, ImageLibraryModel::NameColumn));
+                }
+                view->selectionModel()->blockSignals(false);
+                updateVisibleRows();
+            }
+        }
+        showCount();
+        statusLabel->setText(statusLabel->text() + tr(" (%1 rescanned, %2 s)")
+                                 .arg(result->stats.probed)
+                                 .arg(result->stats.seconds, 0, 'f', 1));
+    });
+    scanThread->start();
+}
+
+void ImageLibraryWidget::showCount()
+{
+    statusLabel->setText(tr("%1 images").arg(model->rowCount()));
+}
+
+void ImageLibraryWidget::updateVisibleRows()
+{
+    const int first = view->rowAt(0);
+    int last = view->rowAt(view->viewport()->height() - 1);
+    if (last < 0) {
+        last = model->rowCount() - 1;
+    }
+    model->setVisibleRows(qMax(first, 0), last);
+}
+
+void ImageLibraryWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    updateVisibleRows();
+}
@@ -0,0 +1,123 @@
+#ifndef IMAGELIBRARYWIDGET_H
+#define IMAGELIBRARYWIDGET_H
+
+#include "imagelibrary.h"
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QImage>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QWidget>
+#include <atomic>
+#include <memory>
+
+class QLabel;
+class QPushButton;
+class QTableView;
+
+// Rows of a library index, decoded from the mapped index as the view asks
+// for them, so a library of any size shows at once. The first column is a
+// thumbnail of the sector map. Thumbnails load the whole image, so they are
+// made on a thread pool, only for rows still in view when their turn comes,
+// and cached by path and mtime.
+class ImageLibraryModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        MapColumn,
+        NameColumn,
+        FormatColumn,
+        GeometryColumn,
+        CatalogColumn,
+        SizeColumn,
+        ModifiedColumn,
+        COLUMN_COUNT
+    };
+
+    static constexpr int THUMBNAIL_WIDTH = 80;
+    static constexpr int THUMBNAIL_HEIGHT = 32;
+
+    explicit ImageLibraryModel(QObject *parent = nullptr);
+    ~ImageLibraryModel() override;
+
+    void setIndex(const QString &root, std::shared_ptr<const ImageLibraryIndex> index);
+    std::shared_ptr<const ImageLibraryIndex> libraryIndex() const { return indexFile; }
+    QString filePath(int row) const;
+    int rowOf(const QString &filePath) const;
+    // Rows the view shows; thumbnails of other rows are not made
+    void setVisibleRows(int first, int last);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    static constexpr int VISIBLE_MARGIN = 8;    // Rows beyond the view that still get thumbnails
+
+    const LibraryEntry &entryAt(int row) const;
+    bool isVisible(int row) const;
+    void requestThumbnail(int row, const QString &key) const;
+    void thumbnailDone(int row, const QString &key, int generation, bool skipped, const QImage &image);
+    static QImage renderThumbnail(const SectorMap &map);
+
+    QString root;
+    std::shared_ptr<const ImageLibraryIndex> indexFile;
+    mutable int cachedRow;
+    mutable LibraryEntry cachedEntry;
+    mutable QCache<QString, QImage> thumbnails;
+    mutable QSet<QString> pending;
+    QImage placeholder;
+    std::atomic<int> generation;        // Bumped by setIndex(); older thumbnail jobs skip
+    std::atomic<int> firstVisible;
+    std::atomic<int> lastVisible;
+    mutable QThreadPool thumbnailPool;
+};
+
+// Browser for a directory of images. The last directory's index opens
+// when the panel is created and the tree is rescanned in the background;
+// only images whose size or mtime changed are opened again. Selecting a
+// row emits imageSelected() with its path; loading it is up to the owner.
+class ImageLibraryWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ImageLibraryWidget(QWidget *parent = nullptr);
+    ~ImageLibraryWidget() override;
+
+    void setRoot(const QString &root);
+    QString root() const { return libraryRoot; }
+    // Where the index of 'root' is kept, outside the library itself
+    static QString indexPathFor(const QString &root);
+
+signals:
+    void imageSelected(const QString &path);
+
+protected:
+    void resizeEvent(QResizeEvent *event) override;
+
+private slots:
+    void chooseRoot();
+    void rescan();
+
+private:
+    void stopRescan();
+    void updateVisibleRows();
+    void showCount();
+
+    QPushButton *folderButton;
+    QPushButton *rescanButton;
+    QLabel *statusLabel;
+    QTableView *view;
+    ImageLibraryModel *model;
+    QString libraryRoot;
+    QThread *scanThread;
+    std::atomic<bool> cancelScan;
+};
+
+#endif // IMAGELIBRARYWIDGET_H
@@ -0,0 +1,379 @@
+#include "imagewriteback.h"
+#include "imgformat.h"
+#include "perftrace.h"
+#include "trdformat.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define WRITE_BACK_HAVE_FSYNC 1
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Makes what was written to 'path' durable
+bool syncFile(const std::string &path, std::string &error)
+{
+#ifdef WRITE_BACK_HAVE_FSYNC
+    const int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    const bool synced = ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !synced) {
+        error = "Cannot sync " + path;
+        return false;
+    }
+#else
+    (void)path;
+    (void)error;
+#endif
+    return true;
+}
+
+bool replaceFile(const std::string &from, const std::string &to, std::string &error)
+{
+    // POSIX rename replaces the target atomically; elsewhere it may refuse to
+    if (std::rename(from.c_str(), to.c_str()) != 0 &&
+        (std::remove(to.c_str()) != 0 || std::rename(from.c_str(), to.c_str()) != 0)) {
+        error = "Cannot replace " + to;
+        return false;
+    }
+    return true;
+}
+
+// SCL only keeps the files its catalog lists, so a write to any other
+// sector, or one that changes the catalog, would be dropped on saving
+bool holdsEverySector(ImageFormat format)
+{
+    return format != ImageFormat::Scl;
+}
+
+struct Patch {
+    uint64_t offset;
+    std::vector<uint8_t> bytes;
+};
+
+bool writePatches(const std::string &path, const std::vector<Patch> &patches, std::string &error)
+{
+#ifdef WRITE_BACK_HAVE_FSYNC
+    const int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        error = "Cannot open " + path;
+        return false;
+    }
+    bool ok = true;
+    for (const Patch &patch : patches) {
+        size_t done = 0;
+        while (ok && done < patch.bytes.size()) {
+            const ssize_t written = ::pwrite(fd, patch.bytes.data() + done, patch.bytes.size() - done,
+                                             static_cast<off_t>(patch.offset + done));
+            ok = written > 0;
+            done += ok ? static_cast<size_t>(written) : 0;
+        }
+    }
+    ok = ok && ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !ok) {
+        error = "Write error on " + path;
+        return false;
+    }
+    return true;
+#else
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    for (const Patch &patch : patches) {
+        file.seekp(static_cast<std::streamoff>(patch.offset));
+        file.write(reinterpret_cast<const char *>(patch.bytes.data()), static_cast<std::streamsize>(patch.bytes.size()));
+    }
+    if (!file.flush()) {
+        error = "Write error on " + path;
+        return false;
+    }
+    return true;
+#endif
+}
+
+} // namespace
+
+ImageWriteBack::ImageWriteBack(const WriteBackOptions &options)
+    : m_options(options)
+    , m_format(ImageFormat::Unknown)
+    , m_dataRateKbps(250)
+    , m_inFlight(0)
+    , m_syncRequested(0)
+    , m_syncDone(0)
+    , m_stopping(false)
+    , m_failed(false)
+    , m_fileBytes(0)
+{
+}
+
+ImageWriteBack::~ImageWriteBack()
+{
+    close();
+}
+
+bool ImageWriteBack::open(const std::string &path, const DiskImage &image, std::string *error)
+{
+    close();
+    const ImageFormat format = imageFormatFromPath(path);
+    std::string message;
+    std::unique_ptr<TrackReader> reader = TrackReader::open(path, &message);
+    if (format == ImageFormat::Unknown || !reader) {
+        if (error) {
+            *error = reader ? "Unsupported image format" : message;
+        }
+        return false;
+    }
+    if (!holdsEverySector(format)) {
+        if (error) {
+            *error = std::string(reader->formatName()) + " images cannot hold sector writes";
+        }
+        return false;
+    }
+
+    m_path = path;
+    m_format = format;
+    m_dataRateKbps = reader->dataRateKbps();
+    reader.reset();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    m_fileBytes = file ? static_cast<uint64_t>(file.tellg()) : 0;
+    m_disk = image;
+
+    m_pending.clear();
+    m_inFlight = 0;
+    m_syncRequested = 0;
+    m_syncDone = 0;
+    m_stopping = false;
+    m_failed = false;
+    m_stats = WriteBackStats();
+    m_error.clear();
+    m_thread = std::thread(&ImageWriteBack::run, this);
+    return true;
+}
+
+void ImageWriteBack::close()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+        m_wake.notify_all();
+    }
+    m_thread.join();
+    m_disk = DiskImage();
+}
+
+void ImageWriteBack::trackChanged(int cylinder, int side, const Track &track)
+{
+    // Copying shares the sector data, so this costs the sector table only
+    Track copy = track;
+    copy.cylinder = cylinder;
+    copy.side = side;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    ++m_stats.trackWrites;
+    auto entry = m_pending.emplace(TrackKey(cylinder, side), Track());
+    if (!entry.second) {
+        ++m_stats.coalesced;
+    } else if (m_pending.size() == 1) {
+        m_firstPending = Clock::now();
+    }
+    entry.first->second = std::move(copy);
+    // A time-bounded queue only needs a wake-up to start its clock
+    if (m_options.policy == WriteBackPolicy::WriteThrough ||
+        (m_options.policy == WriteBackPolicy::TimeBounded && m_pending.size() == 1)) {
+        m_wake.notify_one();
+    }
+}
+
+bool ImageWriteBack::sync(std::string *error)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        const uint64_t request = ++m_syncRequested;
+        m_wake.notify_one();
+        m_saved.wait(lock, [this, request] { return m_syncDone >= request; });
+    }
+    if (m_failed && error) {
+        *error = m_error;
+    }
+    return !m_failed;
+}
+
+WriteBackStats ImageWriteBack::stats() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    WriteBackStats stats = m_stats;
+    stats.queueDepth = m_pending.size() + m_inFlight;
+    return stats;
+}
+
+std::string ImageWriteBack::errorString() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_error;
+}
+
+void ImageWriteBack::run()
+{
+    FLOPPY_TRACE_THREAD("ImageWriteBack");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        // Everything goes out on sync() and close(); otherwise the policy decides
+        bool due = m_stopping || m_syncRequested != m_syncDone;
+        if (!due && !m_pending.empty()) {
+            if (m_options.policy == WriteBackPolicy::WriteThrough) {
+                due = true;
+            } else if (m_options.policy == WriteBackPolicy::TimeBounded) {
+                const Clock::time_point deadline = m_firstPending + std::chrono::milliseconds(m_options.maxDelayMs);
+                due = Clock::now() >= deadline;
+                if (!due) {
+                    m_wake.wait_until(lock, deadline);
+                    continue;
+                }
+            }
+        }
+        if (!due) {
+            m_wake.wait(lock);
+            continue;
+        }
+
+        std::map<TrackKey, Track> batch;
+        batch.swap(m_pending);
+        const uint64_t request = m_syncRequested;
+        if (!batch.empty()) {
+            m_inFlight = batch.size();
+            lock.unlock();
+            const Clock::time_point started = Clock::now();
+            uint64_t bytes = 0;
+            std::string error;
+            const bool saved = flush(batch, bytes, error);
+            const uint64_t elapsedNs = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+            batch.clear();
+            lock.lock();
+
+            m_stats.flushedTracks += m_inFlight;
+            ++m_stats.batches;
+            m_stats.fileSyncs += saved ? 1 : 0;
+            m_stats.bytesWritten += bytes;
+            m_stats.lastFlushNs = elapsedNs;
+            m_stats.maxFlushNs = std::max(m_stats.maxFlushNs, elapsedNs);
+            m_inFlight = 0;
+            if (!saved) {
+                m_error = error;
+                m_failed = true;
+            }
+        }
+        m_syncDone = request;
+        m_saved.notify_all();
+        if (m_stopping && m_pending.empty()) {
+            return;
+        }
+    }
+}
+
+bool ImageWriteBack::flush(const std::map<TrackKey, Track> &batch, uint64_t &bytes, std::string &error)
+{
+    FLOPPY_TRACE_ZONE("io", "ImageWriteBack::flush");
+    for (const auto &entry : batch) {
+        if (Track *track = m_disk.track(entry.first.first, entry.first.second)) {
+            *track = entry.second;
+        }
+    }
+    if ((m_format == ImageFormat::Trd || m_format == ImageFormat::Img) && patchInPlace(batch, bytes, error)) {
+        return true;
+    }
+    // Tracks the fixed layout cannot hold fail again here, with the format's own message
+    error.clear();
+    return rewrite(bytes, error);
+}
+
+bool ImageWriteBack::patchInPlace(const std::map<TrackKey, Track> &batch, uint64_t &bytes, std::string &error)
+{
+    // Every track has the same size and its place in cylinder-major order
+    const uint64_t tracks = static_cast<uint64_t>(m_disk.cylinderCount()) * m_disk.sideCount();
+    uint64_t trackBytes = TrDos::TRACK_BYTES;
+    if (m_format == ImageFormat::Img) {
+        if (tracks == 0 || m_fileBytes % tracks != 0) {
+            return false;
+        }
+        trackBytes = m_fileBytes / tracks;
+    }
+
+    TrdWriter trd;
+    ImgWriter img;
+    const TrackWriter &encoder = m_format == ImageFormat::Trd ? static_cast<const TrackWriter &>(trd) : img;
+    std::vector<Patch> patches;
+    patches.reserve(batch.size());
+    TrackBlock block;
+    for (const auto &entry : batch) {
+        const int cylinder = entry.first.first;
+        const int side = entry.first.second;
+        if (cylinder >= m_disk.cylinderCount() || side >= m_disk.sideCount()) {
+            continue;
+        }
+        if (!encoder.encode(entry.second, block, &error)) {
+            return false;
+        }
+        // A raw image keeps unformatted tracks as zeros
+        if (block.bytes.empty() && m_format == ImageFormat::Img) {
+            block.bytes.assign(trackBytes, 0);
+        }
+        if (block.bytes.size() != trackBytes) {
+            return false;
+        }
+        patches.push_back(Patch{ (static_cast<uint64_t>(cylinder) * m_disk.sideCount() + side) * trackBytes,
+                                 std::move(block.bytes) });
+    }
+
+    if (!writePatches(m_path, patches, error)) {
+        return false;
+    }
+    for (const Patch &patch : patches) {
+        bytes += patch.bytes.size();
+        m_fileBytes = std::max(m_fileBytes, patch.offset + patch.bytes.size());
+    }
+    return true;
+}
+
+bool ImageWriteBack::rewrite(uint64_t &bytes, std::string &error)
+{
+    const std::string temporary = m_path + ".tmp";
+    std::unique_ptr<TrackWriter> writer = TrackWriter::create(temporary, m_format, m_disk.cylinderCount(),
+                                                              m_disk.sideCount(), m_dataRateKbps, &error);
+    if (!writer) {
+        return false;
+    }
+    TrackBlock block;
+    bool ok = true;
+    for (int cylinder = 0; ok && cylinder < m_disk.cylinderCount(); ++cylinder) {
+        for (int side = 0; ok && side < m_disk.sideCount(); ++side) {
+            ok = writer->encode(*m_disk.track(cylinder, side), block, &error) && writer->writeBlock(block);
+        }
+    }
+    ok = ok && writer->finish();
+    if (!ok && error.empty()) {
+        error = writer->errorString();
+    }
+    writer.reset();
+
+    if (!ok || !syncFile(temporary, error) || !replaceFile(temporary, m_path, error)) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    // Encoded tracks are not what reaches the file: formats pack, compress or drop them
+    std::ifstream file(m_path, std::ios::binary | std::ios::ate);
+    m_fileBytes = file ? static_cast<uint64_t>(file.tellg()) : 0;
+    bytes += m_fileBytes;
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef IMAGEWRITEBACK_H
+#define IMAGEWRITEBACK_H
+
+#include "diskimage.h"
+#include "trackstream.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// When written tracks reach the image file
+enum class WriteBackPolicy {
+    WriteThrough,   // As soon as the writer thread gets to them
+    TimeBounded,    // At most maxDelayMs after the first unsaved write
+    OnEject         // Only on sync() and close()
+};
+
+struct WriteBackOptions {
+    WriteBackPolicy policy = WriteBackPolicy::TimeBounded;
+    int maxDelayMs = 500;
+};
+
+struct WriteBackStats {
+    size_t queueDepth = 0;          // Tracks written but not yet durable, including the batch being saved
+    uint64_t trackWrites = 0;       // trackChanged() calls
+    uint64_t coalesced = 0;         // Of those, writes to a track that was already queued
+    uint64_t flushedTracks = 0;
+    uint64_t batches = 0;
+    uint64_t fileSyncs = 0;         // One per batch
+    uint64_t bytesWritten = 0;      // To the image file, headers included
+    uint64_t lastFlushNs = 0;       // Wall time of the last batch, encoding to fsync
+    uint64_t maxFlushNs = 0;
+};
+
+// Saves tracks the controller writes back to the image file they were
+// loaded from, without the emulation ever waiting on the file. The
+// controller reports a written track with trackChanged(), which only
+// queues a copy of it (sector data is shared copy-on-write); writes to a
+// queued track replace it, so a track written sector by sector is saved
+// once. A background thread takes the whole queue as one batch, applies it
+// to its own copy of the disk and saves it with a single fsync. TRD and
+// IMG files are patched in place, one track-sized write per track; other
+// formats are rewritten from the copy to a temporary file that replaces
+// the image once it is durable, so a crash leaves the old image or the new
+// one, never a mix.
+class ImageWriteBack
+{
+public:
+    explicit ImageWriteBack(const WriteBackOptions &options = WriteBackOptions());
+    // Saves what is still queued
+    ~ImageWriteBack();
+
+    ImageWriteBack(const ImageWriteBack &) = delete;
+    ImageWriteBack &operator=(const ImageWriteBack &) = delete;
+
+    // Starts saving to 'path', which holds 'image' as loaded. Fails for
+    // formats that cannot hold every sector the controller may write (SCL)
+    bool open(const std::string &path, const DiskImage &image, std::string *error = nullptr);
+    // Saves what is still queued and stops, for eject
+    void close();
+    bool isOpen() const { return m_thread.joinable(); }
+    const std::string &path() const { return m_path; }
+    const WriteBackOptions &options() const { return m_options; }
+
+    // Called on the emulation thread after a write to the track under the head
+    void trackChanged(int cylinder, int side, const Track &track);
+    // Blocks until every track queued so far is durable; false if a save
+    // has failed since open()
+    bool sync(std::string *error = nullptr);
+
+    WriteBackStats stats() const;
+    // Last save error, empty if none
+    std::string errorString() const;
+
+private:
+    using TrackKey = std::pair<int, int>;
+    using Clock = std::chrono::steady_clock;
+
+    void run();
+    bool flush(const std::map<TrackKey, Track> &batch, uint64_t &bytes, std::string &error);
+    bool patchInPlace(const std::map<TrackKey, Track> &batch, uint64_t &bytes, std::string &error);
+    bool rewrite(uint64_t &bytes, std::string &error);
+
+    WriteBackOptions m_options;
+    std::string m_path;
+    ImageFormat m_format;
+    int m_dataRateKbps;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;     // Writer thread: work queued, sync requested or stopping
+    std::condition_variable m_saved;    // sync(): a batch is durable
+    std::map<TrackKey, Track> m_pending;
+    Clock::time_point m_firstPending;   // First write since the last batch was taken
+    size_t m_inFlight;
+    uint64_t m_syncRequested;
+    uint64_t m_syncDone;
+    bool m_stopping;
+    bool m_failed;
+    WriteBackStats m_stats;
+    std::string m_error;
+    std::thread m_thread;
+
+    // Writer thread only
+    DiskImage m_disk;
+    uint64_t m_fileBytes;               // Size of a patched-in-place image
+};
+
+#endif // IMAGEWRITEBACK_H
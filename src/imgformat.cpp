@@ -0,0 +1,186 @@
+#include "imgformat.h"
+#include "diskgeometry.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr int SECTOR_SIZE = 512;
+constexpr uint8_t SIZE_CODE = 2;
+
+constexpr DiskGeometry GEOMETRIES[] = {
+    { 40, 1, Encoding::MFM, 8, SECTOR_SIZE, 250 },      // 160 KB
+    { 40, 1, Encoding::MFM, 9, SECTOR_SIZE, 250 },      // 180 KB
+    { 40, 2, Encoding::MFM, 8, SECTOR_SIZE, 250 },      // 320 KB
+    Geometry::PC_360K,
+    { 80, 2, Encoding::MFM, 8, SECTOR_SIZE, 250 },      // 640 KB
+    Geometry::PC_720K,
+    { 80, 2, Encoding::MFM, 15, SECTOR_SIZE, 500 },     // 1.2 MB
+    Geometry::PC_1440K,
+};
+
+} // namespace
+
+ImgReader::ImgReader()
+    : m_cylinders(0)
+    , m_sides(0)
+    , m_sectors(0)
+    , m_dataRateKbps(250)
+{
+}
+
+bool ImgReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary | std::ios::ate);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+    const uint64_t size = static_cast<uint64_t>(m_file.tellg());
+    for (const DiskGeometry &geometry : GEOMETRIES) {
+        if (geometry.diskDataBytes() == size) {
+            m_cylinders = geometry.cylinders;
+            m_sides = geometry.sides;
+            m_sectors = geometry.sectors;
+            m_dataRateKbps = geometry.dataRateKbps;
+            return true;
+        }
+    }
+    return fail("Unknown IMG geometry for " + std::to_string(size) + " bytes");
+}
+
+bool ImgReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    block.cylinder = cylinder;
+    block.side = side;
+    block.bytes.resize(static_cast<size_t>(m_sectors) * SECTOR_SIZE);
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(cylinder * m_sides + side) * static_cast<std::streamoff>(block.bytes.size()));
+    if (!m_file.read(reinterpret_cast<char *>(block.bytes.data()), static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Truncated IMG file");
+    }
+    return true;
+}
+
+Track ImgReader::decode(const TrackBlock &block) const
+{
+    Track track;
+    track.cylinder = block.cylinder;
+    track.side = block.side;
+    track.encoding = Encoding::MFM;
+    track.sectors.resize(static_cast<size_t>(m_sectors));
+    for (int i = 0; i < m_sectors; ++i) {
+        Sector &sector = track.sectors[i];
+        sector.cylinder = static_cast<uint8_t>(block.cylinder);
+        sector.head = static_cast<uint8_t>(block.side);
+        sector.id = static_cast<uint8_t>(i + 1);
+        sector.sizeCode = SIZE_CODE;
+        const uint8_t *data = block.bytes.data() + i * SECTOR_SIZE;
+        sector.data.assign(data, data + SECTOR_SIZE);
+    }
+    return track;
+}
+
+ImgWriter::ImgWriter()
+    : m_cylinders(0)
+    , m_sides(1)
+    , m_trackBytes(0)
+    , m_written(0)
+{
+}
+
+bool ImgWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    (void)dataRateKbps;
+    m_cylinders = cylinders;
+    m_sides = sides;
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    return true;
+}
+
+bool ImgWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    block.bytes.clear();
+    if (!track.isFormatted()) {
+        return true;
+    }
+
+    // IDs run from 1; an unreadable sector leaves a zero-filled hole
+    const int size = track.sectors.front().size();
+    int count = 0;
+    for (const Sector &sector : track.sectors) {
+        if (sector.size() != size || sector.id < 1) {
+            if (error) {
+                *error = "Track " + std::to_string(track.cylinder) + "/" + std::to_string(track.side) +
+                         " mixes sector sizes or IDs that a raw image cannot hold";
+            }
+            return false;
+        }
+        count = sector.id > count ? sector.id : count;
+    }
+    if (count > static_cast<int>(track.sectors.size()) + 1) {
+        if (error) {
+            *error = "Track " + std::to_string(track.cylinder) + "/" + std::to_string(track.side) +
+                     " has sector IDs that are not numbered from 1";
+        }
+        return false;
+    }
+
+    block.bytes.assign(static_cast<size_t>(count) * size, 0);
+    for (const Sector &sector : track.sectors) {
+        const size_t stored = sector.data.size() < static_cast<size_t>(size) ? sector.data.size() : size;
+        std::memcpy(block.bytes.data() + (sector.id - 1) * size, sector.data.data(), stored);
+    }
+    return true;
+}
+
+bool ImgWriter::writeBlock(const TrackBlock &block)
+{
+    if (block.bytes.empty()) {
+        return true;
+    }
+    if (m_trackBytes == 0) {
+        m_trackBytes = block.bytes.size();
+    } else if (block.bytes.size() != m_trackBytes) {
+        return fail("A raw image needs the same sector count and size on every track (track " +
+                    std::to_string(block.cylinder) + "/" + std::to_string(block.side) + ")");
+    }
+    if (!padTo(block.cylinder * m_sides + block.side)) {
+        return false;
+    }
+    if (!m_file.write(reinterpret_cast<const char *>(block.bytes.data()),
+                      static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Write error");
+    }
+    ++m_written;
+    return true;
+}
+
+bool ImgWriter::padTo(int tracks)
+{
+    // Unformatted tracks read back as zeros
+    const std::vector<uint8_t> zeros(m_trackBytes, 0);
+    for (; m_written < tracks; ++m_written) {
+        if (!m_file.write(reinterpret_cast<const char *>(zeros.data()), static_cast<std::streamsize>(zeros.size()))) {
+            return fail("Write error");
+        }
+    }
+    return true;
+}
+
+bool ImgWriter::finish()
+{
+    if (m_trackBytes == 0) {
+        return fail("Disk has no formatted tracks");
+    }
+    if (!padTo(m_cylinders * m_sides)) {
+        return false;
+    }
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
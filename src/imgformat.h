@@ -0,0 +1,58 @@
+#ifndef IMGFORMAT_H
+#define IMGFORMAT_H
+
+#include "trackstream.h"
+
+#include <fstream>
+
+// Raw sector dump with sector IDs from 1 and the same sector count and
+// size on every track. Reading only knows the PC geometries (512 byte
+// sectors, 160 KB to 1.44 MB), told apart by the file size; writing takes
+// the sector count and size from the first formatted track.
+class ImgReader : public TrackReader
+{
+public:
+    ImgReader();
+
+    const char *formatName() const override { return "IMG"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    int dataRateKbps() const override { return m_dataRateKbps; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    std::ifstream m_file;
+    int m_cylinders;
+    int m_sides;
+    int m_sectors;
+    int m_dataRateKbps;
+};
+
+class ImgWriter : public TrackWriter
+{
+public:
+    ImgWriter();
+
+    const char *formatName() const override { return "IMG"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    bool padTo(int tracks);
+
+    std::ofstream m_file;
+    int m_cylinders;
+    int m_sides;
+    size_t m_trackBytes;    // 0 until the first formatted track
+    int m_written;          // Tracks in the file so far
+};
+
+#endif // IMGFORMAT_H
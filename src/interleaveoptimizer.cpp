@@ -0,0 +1,195 @@
+#include "interleaveoptimizer.h"
+#include "floppydrive.h"
+#include "taskpool.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+constexpr uint8_t COMMAND_RESTORE = 0x00;
+constexpr uint8_t COMMAND_SEEK = 0x10;
+constexpr uint8_t COMMAND_READ_SECTOR = 0x80;
+constexpr uint8_t COMMAND_WRITE_SECTOR = 0xA0;
+
+// Runs the command in progress to its end with a host that moves data as soon as DRQ rises
+void runCommand(Wd1793 &fdc, std::vector<uint8_t> &buffer)
+{
+    while (fdc.isBusy()) {
+        if (fdc.drq()) {
+            if (fdc.commandType() == Wd1793::CommandType::TypeII && (fdc.commandRegister() & 0x20)) {
+                fdc.writeDataBlock(buffer.data(), buffer.size(), fdc.time(), 0);
+            } else {
+                fdc.readDataBlock(buffer.data(), buffer.size(), fdc.time(), 0);
+            }
+        } else {
+            fdc.advance(std::max(fdc.nextEventTime(), fdc.time()));
+        }
+    }
+}
+
+} // namespace
+
+std::vector<uint8_t> InterleaveOptimizer::sectorOrder(std::vector<uint8_t> ids, int interleave, int skew)
+{
+    const size_t count = ids.size();
+    std::vector<uint8_t> order(count, 0);
+    if (count == 0) {
+        return order;
+    }
+    std::sort(ids.begin(), ids.end());
+    std::vector<bool> used(count, false);
+    size_t slot = static_cast<size_t>(((skew % static_cast<int>(count)) + static_cast<int>(count))) % count;
+    const size_t step = static_cast<size_t>(std::max(1, interleave)) % count;
+    for (uint8_t id : ids) {
+        while (used[slot]) {
+            slot = (slot + 1) % count;
+        }
+        order[slot] = id;
+        used[slot] = true;
+        slot = (slot + step) % count;
+    }
+    return order;
+}
+
+std::shared_ptr<DiskImage> InterleaveOptimizer::applyLayout(const DiskImage &source, int interleave, int skew)
+{
+    auto image = std::make_shared<DiskImage>(source);
+    const int sides = image->sideCount();
+    for (int cylinder = 0; cylinder < image->cylinderCount(); ++cylinder) {
+        for (int side = 0; side < sides; ++side) {
+            Track &track = *image->track(cylinder, side);
+            if (track.sectors.size() < 2) {
+                continue;
+            }
+            std::vector<uint8_t> ids;
+            for (const Sector &sector : track.sectors) {
+                ids.push_back(sector.id);
+            }
+            const std::vector<uint8_t> order = sectorOrder(ids, interleave, (cylinder * sides + side) * skew);
+
+            // Contents move, slots stay where they are; duplicate IDs keep their order
+            const Track &original = *source.track(cylinder, side);
+            std::vector<bool> taken(original.sectors.size(), false);
+            std::vector<Sector> sectors;
+            sectors.reserve(order.size());
+            for (size_t slot = 0; slot < order.size(); ++slot) {
+                size_t from = 0;
+                while (taken[from] || original.sectors[from].id != order[slot]) {
+                    ++from;
+                }
+                taken[from] = true;
+                Sector sector = original.sectors[from];
+                sector.angle = static_cast<float>(original.idAngle(slot));
+                sectors.push_back(std::move(sector));
+            }
+            track.sectors = std::move(sectors);
+        }
+    }
+    image->updateLayout();
+    return image;
+}
+
+uint64_t InterleaveOptimizer::replay(const DiskImage &image, const AccessTrace &trace, const Wd1793::Timing &timing)
+{
+    FloppyDrive drive;
+    drive.insertDisk(std::make_shared<DiskImage>(image));
+    Wd1793 fdc(&drive);
+    fdc.setTiming(timing);
+    fdc.setDoubleDensity(image.isDoubleDensity());
+    std::vector<uint8_t> buffer(1024, 0);
+
+    fdc.write(Wd1793::CommandRegister, COMMAND_RESTORE, 0);
+    runCommand(fdc, buffer);
+    const uint64_t start = fdc.time();
+
+    for (const AccessTrace::Access &access : trace.accesses()) {
+        uint64_t t = fdc.time() + access.idleNs;
+        drive.setSide(access.side);
+        if (drive.cylinder() != access.cylinder) {
+            fdc.write(Wd1793::DataRegister, static_cast<uint8_t>(access.cylinder), t);
+            fdc.write(Wd1793::CommandRegister, COMMAND_SEEK, t);
+            runCommand(fdc, buffer);
+            t = fdc.time();
+        }
+        fdc.write(Wd1793::SectorRegister, static_cast<uint8_t>(access.sector), t);
+        fdc.write(Wd1793::CommandRegister, access.write ? COMMAND_WRITE_SECTOR : COMMAND_READ_SECTOR, t);
+        runCommand(fdc, buffer);
+    }
+    return fdc.time() - start;
+}
+
+InterleaveResult InterleaveOptimizer::optimize(const DiskImage &source, const AccessTrace &trace,
+                                               const InterleaveOptions &options)
+{
+    InterleaveResult result;
+    result.baselineNs = replay(source, trace, options.timing);
+
+    int maxSectors = 1;
+    for (int cylinder = 0; cylinder < source.cylinderCount(); ++cylinder) {
+        for (int side = 0; side < source.sideCount(); ++side) {
+            maxSectors = std::max(maxSectors, static_cast<int>(source.track(cylinder, side)->sectors.size()));
+        }
+    }
+
+    struct Candidate {
+        int interleave;
+        int skew;
+        uint64_t ns;
+    };
+    std::vector<Candidate> candidates;
+    for (int interleave = 1; interleave < std::max(2, maxSectors); ++interleave) {
+        for (int skew = 0; skew < maxSectors; ++skew) {
+            candidates.push_back({ interleave, skew, 0 });
+        }
+    }
+
+    TaskPool pool(options.threads);
+    pool.parallelFor(candidates.size(), [&](size_t index, int) {
+        Candidate &candidate = candidates[index];
+        candidate.ns = replay(*applyLayout(source, candidate.interleave, candidate.skew), trace, options.timing);
+    });
+
+    // Candidates are in (interleave, skew) order, so the first minimum wins ties
+    const Candidate *best = &candidates.front();
+    for (const Candidate &candidate : candidates) {
+        if (candidate.ns < best->ns) {
+            best = &candidate;
+        }
+    }
+    result.interleave = best->interleave;
+    result.skew = best->skew;
+    result.bestNs = best->ns;
+    result.candidates = static_cast<int>(candidates.size());
+    result.image = applyLayout(source, best->interleave, best->skew);
+    return result;
+}
+
+std::string InterleaveOptimizer::formatSpec(const DiskImage &image, const InterleaveResult &result, size_t traceSize)
+{
+    std::string spec;
+    char line[160];
+    std::snprintf(line, sizeof(line), "# qt-floppy format spec: interleave %d, track skew %d\n", result.interleave,
+                  result.skew);
+    spec += line;
+    std::snprintf(line, sizeof(line), "# %zu accesses: %.3f s as recorded, %.3f s with this layout\n", traceSize,
+                  result.baselineNs / 1e9, result.bestNs / 1e9);
+    spec += line;
+    spec += image.isDoubleDensity() ? "encoding MFM\n" : "encoding FM\n";
+    for (int cylinder = 0; cylinder < image.cylinderCount(); ++cylinder) {
+        for (int side = 0; side < image.sideCount(); ++side) {
+            const Track &track = *image.track(cylinder, side);
+            if (!track.isFormatted()) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "track %d %d %d:", cylinder, side, track.sectors.front().size());
+            spec += line;
+            for (const Sector &sector : track.sectors) {
+                std::snprintf(line, sizeof(line), " %d", sector.id);
+                spec += line;
+            }
+            spec += '\n';
+        }
+    }
+    return spec;
+}
@@ -0,0 +1,56 @@
+#ifndef INTERLEAVEOPTIMIZER_H
+#define INTERLEAVEOPTIMIZER_H
+
+#include "accesstrace.h"
+#include "diskimage.h"
+#include "wd1793.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct InterleaveOptions {
+    int threads = 0;            // 0 uses all cores
+    Wd1793::Timing timing;
+};
+
+struct InterleaveResult {
+    int interleave = 1;
+    int skew = 0;               // Slots each track is rotated against the previous one
+    uint64_t baselineNs = 0;    // Trace replayed on the source image as it is
+    uint64_t bestNs = 0;        // Trace replayed on 'image'
+    int candidates = 0;
+    std::shared_ptr<DiskImage> image;   // Source reformatted with the best layout
+};
+
+// Finds the sector interleave and track-to-track skew that let a host
+// program finish soonest. Every candidate keeps the physical sector slots of
+// the source image and only changes which sector sits in which slot; it is
+// scored by replaying the access trace through FloppyDrive and Wd1793, seeks
+// included, with a host that answers DRQ immediately and otherwise idles as
+// recorded. Candidates are replayed in parallel; ties go to the smaller
+// interleave, then the smaller skew.
+class InterleaveOptimizer
+{
+public:
+    static InterleaveResult optimize(const DiskImage &source, const AccessTrace &trace,
+                                     const InterleaveOptions &options = InterleaveOptions());
+
+    // Emulated time from the first command to the end of the last one
+    static uint64_t replay(const DiskImage &image, const AccessTrace &trace, const Wd1793::Timing &timing);
+
+    // Sector IDs by physical slot: logical sector k goes 'interleave' slots
+    // after sector k-1 (the next free one on collision), the first one at 'skew'
+    static std::vector<uint8_t> sectorOrder(std::vector<uint8_t> ids, int interleave, int skew);
+
+    // 'source' with the sectors of track t (cylinder * sides + side) laid out
+    // at sectorOrder(ids, interleave, t * skew)
+    static std::shared_ptr<DiskImage> applyLayout(const DiskImage &source, int interleave, int skew);
+
+    // Text formatting spec, one line per formatted track:
+    //   track <cylinder> <side> <size>: <sector ids in physical order>
+    static std::string formatSpec(const DiskImage &image, const InterleaveResult &result, size_t traceSize);
+};
+
+#endif // INTERLEAVEOPTIMIZER_H
@@ -0,0 +1,290 @@
+#include "kfstreamreader.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+// Default KryoFlux sample clock: ((18.432 MHz * 73) / 14) / 2
+constexpr double DEFAULT_SAMPLE_CLOCK_HZ = 24027428.5714285;
+
+constexpr uint8_t OP_NOP1 = 0x08;
+constexpr uint8_t OP_NOP2 = 0x09;
+constexpr uint8_t OP_NOP3 = 0x0A;
+constexpr uint8_t OP_OVL16 = 0x0B;
+constexpr uint8_t OP_FLUX3 = 0x0C;
+constexpr uint8_t OP_OOB = 0x0D;
+
+constexpr uint8_t OOB_INDEX = 0x02;
+constexpr uint8_t OOB_KFINFO = 0x04;
+constexpr uint8_t OOB_EOF = 0x0D;
+
+// Buffered forward-only reader over a stream file
+class StreamFile
+{
+public:
+    explicit StreamFile(const std::string &path)
+        : m_file(path, std::ios::binary)
+        , m_buffer(65536)
+        , m_pos(0)
+        , m_end(0)
+    {
+    }
+
+    bool isOpen() const { return m_file.is_open(); }
+
+    bool get(uint8_t &byte)
+    {
+        if (m_pos == m_end) {
+            m_file.read(reinterpret_cast<char *>(m_buffer.data()), static_cast<std::streamsize>(m_buffer.size()));
+            m_end = static_cast<size_t>(m_file.gcount());
+            m_pos = 0;
+            if (m_end == 0) {
+                return false;
+            }
+        }
+        byte = m_buffer[m_pos++];
+        return true;
+    }
+
+    bool read(uint8_t *out, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            if (!get(out[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::ifstream m_file;
+    std::vector<uint8_t> m_buffer;
+    size_t m_pos;
+    size_t m_end;
+};
+
+uint32_t readLe32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+         | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Walks a stream, calling onFlux(ticks, streamPos) for every flux interval
+// and onOob(type, payload, size) for every out-of-band block. streamPos is
+// the in-band offset where the flux code (including overflow prefixes) begins.
+template<typename FluxFn, typename OobFn>
+bool parseStream(StreamFile &file, FluxFn onFlux, OobFn onOob)
+{
+    uint32_t streamPos = 0;
+    uint32_t fluxStart = 0;
+    uint32_t overflow = 0;
+    std::vector<uint8_t> payload(65536);
+    uint8_t op;
+
+    while (file.get(op)) {
+        if (overflow == 0) {
+            fluxStart = streamPos;
+        }
+        if (op == OP_OOB) {
+            uint8_t head[3];
+            if (!file.read(head, sizeof(head))) {
+                return false;
+            }
+            if (head[0] == OOB_EOF) {
+                return true;
+            }
+            const size_t size = static_cast<size_t>(head[1] | (head[2] << 8));
+            if (!file.read(payload.data(), size)) {
+                return false;
+            }
+            onOob(head[0], payload.data(), size);
+            continue;
+        }
+
+        uint8_t extra[2];
+        if (op <= 0x07) {
+            if (!file.get(extra[0])) {
+                return false;
+            }
+            streamPos += 2;
+            if (!onFlux(overflow + (static_cast<uint32_t>(op) << 8) + extra[0], fluxStart)) {
+                return true;
+            }
+            overflow = 0;
+        } else if (op == OP_NOP1 || op == OP_NOP2 || op == OP_NOP3) {
+            const size_t skip = static_cast<size_t>(op - OP_NOP1);
+            if (skip > 0 && !file.read(extra, skip)) {
+                return false;
+            }
+            streamPos += static_cast<uint32_t>(skip + 1);
+        } else if (op == OP_OVL16) {
+            streamPos += 1;
+            overflow += 0x10000;
+        } else if (op == OP_FLUX3) {
+            if (!file.read(extra, 2)) {
+                return false;
+            }
+            streamPos += 3;
+            if (!onFlux(overflow + (static_cast<uint32_t>(extra[0]) << 8) + extra[1], fluxStart)) {
+                return true;
+            }
+            overflow = 0;
+        } else {
+            streamPos += 1;
+            if (!onFlux(overflow + op, fluxStart)) {
+                return true;
+            }
+            overflow = 0;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+KfStreamReader::KfStreamReader()
+    : m_cylinders(0)
+    , m_sides(0)
+{
+}
+
+bool KfStreamReader::isStreamFileName(const std::string &path)
+{
+    // ...NN.S.raw
+    const size_t length = path.size();
+    return length >= 8 && path.compare(length - 4, 4, ".raw") == 0 && path[length - 6] == '.'
+        && (path[length - 5] == '0' || path[length - 5] == '1')
+        && std::isdigit(static_cast<unsigned char>(path[length - 7]))
+        && std::isdigit(static_cast<unsigned char>(path[length - 8]));
+}
+
+std::string KfStreamReader::trackPath(int cylinder, int side) const
+{
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "%02d.%d.raw", cylinder, side);
+    return m_prefix + suffix;
+}
+
+bool KfStreamReader::load(const std::string &path)
+{
+    if (!isStreamFileName(path)) {
+        return fail("Not a KryoFlux stream file name (expected trackNN.S.raw)");
+    }
+    m_prefix = path.substr(0, path.size() - 8);
+
+    m_trackInfo.assign(static_cast<size_t>(MAX_CYLINDERS * 2), TrackInfo());
+    for (int cylinder = 0; cylinder < MAX_CYLINDERS; ++cylinder) {
+        for (int side = 0; side < 2; ++side) {
+            std::ifstream probe(trackPath(cylinder, side), std::ios::binary);
+            if (probe.is_open()) {
+                m_trackInfo[cylinder * 2 + side].present = true;
+                m_cylinders = cylinder + 1;
+                m_sides = side + 1 > m_sides ? side + 1 : m_sides;
+            }
+        }
+    }
+    if (m_cylinders == 0) {
+        return fail("No KryoFlux stream files found next to " + path);
+    }
+    return true;
+}
+
+KfStreamReader::TrackInfo *KfStreamReader::trackInfo(int cylinder, int side)
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return nullptr;
+    }
+    TrackInfo *info = &m_trackInfo[cylinder * 2 + side];
+    return info->present ? info : nullptr;
+}
+
+const KfStreamReader::TrackInfo *KfStreamReader::scannedTrack(int cylinder, int side) const
+{
+    TrackInfo *info = const_cast<KfStreamReader *>(this)->trackInfo(cylinder, side);
+    if (!info || info->scanned) {
+        return info;
+    }
+
+    // First pass: only the index marks and the sample clock, flux is skipped
+    info->scanned = true;
+    info->tickNs = 1.0e9 / DEFAULT_SAMPLE_CLOCK_HZ;
+    StreamFile file(trackPath(cylinder, side));
+    if (!file.isOpen()) {
+        return info;
+    }
+    parseStream(file, [](uint32_t, uint32_t) { return true; },
+                [info](uint8_t type, const uint8_t *payload, size_t size) {
+                    if (type == OOB_INDEX && size >= 12) {
+                        info->indexes.push_back({ readLe32(payload), readLe32(payload + 4) });
+                    } else if (type == OOB_KFINFO) {
+                        const std::string text(reinterpret_cast<const char *>(payload), size);
+                        const size_t at = text.find("sck=");
+                        if (at != std::string::npos) {
+                            const double clock = std::strtod(text.c_str() + at + 4, nullptr);
+                            if (clock > 0.0) {
+                                info->tickNs = 1.0e9 / clock;
+                            }
+                        }
+                    }
+                });
+    return info;
+}
+
+int KfStreamReader::revolutionCount(int cylinder, int side) const
+{
+    const TrackInfo *info = scannedTrack(cylinder, side);
+    if (!info || info->indexes.size() < 2) {
+        return 0;
+    }
+    return static_cast<int>(info->indexes.size()) - 1;
+}
+
+bool KfStreamReader::readRevolution(int cylinder, int side, int revolution, FluxSink &sink)
+{
+    const TrackInfo *info = scannedTrack(cylinder, side);
+    if (!info || revolution < 0 || revolution + 1 >= static_cast<int>(info->indexes.size())) {
+        return fail("Revolution not present in KryoFlux stream");
+    }
+    StreamFile file(trackPath(cylinder, side));
+    if (!file.isOpen()) {
+        return fail("Cannot open " + trackPath(cylinder, side));
+    }
+
+    // Second pass: emit the flux between two index marks. The flux that
+    // contains an index mark is split at its sample counter.
+    const IndexMark start = info->indexes[revolution];
+    const IndexMark end = info->indexes[revolution + 1];
+    const double tickNs = info->tickNs;
+    uint32_t intervals[BLOCK_SIZE];
+    size_t count = 0;
+    bool started = false;
+
+    const bool ok = parseStream(file,
+        [&](uint32_t ticks, uint32_t streamPos) {
+            if (streamPos >= end.streamPos) {
+                return false;
+            }
+            if (!started) {
+                if (streamPos < start.streamPos) {
+                    return true;
+                }
+                started = true;
+                ticks = ticks > start.sampleCounter ? ticks - start.sampleCounter : 0;
+            }
+            intervals[count++] = static_cast<uint32_t>(ticks * tickNs + 0.5);
+            if (count == BLOCK_SIZE) {
+                sink.fluxBlock(intervals, count);
+                count = 0;
+            }
+            return true;
+        },
+        [](uint8_t, const uint8_t *, size_t) {});
+    if (count > 0) {
+        sink.fluxBlock(intervals, count);
+    }
+    return ok ? true : fail("Truncated KryoFlux stream");
+}
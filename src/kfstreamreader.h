@@ -0,0 +1,52 @@
+#ifndef KFSTREAMREADER_H
+#define KFSTREAMREADER_H
+
+#include "fluxreader.h"
+
+#include <vector>
+
+// KryoFlux raw stream reader. A capture is a set of trackNN.S.raw files in
+// one directory; opening any of them picks up the whole set.
+class KfStreamReader : public FluxReader
+{
+public:
+    KfStreamReader();
+
+    const char *formatName() const override { return "KryoFlux stream"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    int revolutionCount(int cylinder, int side) const override;
+    bool readRevolution(int cylinder, int side, int revolution, FluxSink &sink) override;
+
+    // True if the path looks like a member of a stream set
+    static bool isStreamFileName(const std::string &path);
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    static constexpr int MAX_CYLINDERS = 86;
+
+    struct IndexMark {
+        uint32_t streamPos;
+        uint32_t sampleCounter;
+    };
+
+    struct TrackInfo {
+        bool present = false;
+        bool scanned = false;
+        double tickNs = 0.0;
+        std::vector<IndexMark> indexes;
+    };
+
+    std::string trackPath(int cylinder, int side) const;
+    TrackInfo *trackInfo(int cylinder, int side);
+    const TrackInfo *scannedTrack(int cylinder, int side) const;
+
+    std::string m_prefix;
+    int m_cylinders;
+    int m_sides;
+    mutable std::vector<TrackInfo> m_trackInfo;
+};
+
+#endif // KFSTREAMREADER_H
@@ -0,0 +1,346 @@
+#include "logicanalyzerwidget.h"
+#include <QFont>
+#include <QFontMetrics>
+#include <QKeyEvent>
+#include <QLineF>
+#include <QMouseEvent>
+#include <QPen>
+#include <QWheelEvent>
+#include <QtMath>
+
+#include <algorithm>
+
+namespace {
+constexpr double MIN_NS_PER_PIXEL = 10.0;
+constexpr double MAX_NS_PER_PIXEL = 1e9;        // About a quarter of an hour across the pane
+constexpr double ZOOM_STEP = 1.25;              // Per wheel notch
+constexpr int MIN_TICK_SPACING = 80;            // Pixels between ruler labels
+
+QString formatTime(uint64_t ns, uint64_t unit)
+{
+    if (unit >= 1000000000ULL) {
+        return QString("%1 s").arg(ns / 1e9, 0, 'f', 0);
+    }
+    if (unit >= 1000000ULL) {
+        return QString("%1 ms").arg(ns / 1e6, 0, 'f', 0);
+    }
+    if (unit >= 1000ULL) {
+        return QString("%1 us").arg(ns / 1e3, 0, 'f', 0);
+    }
+    return QString("%1 ns").arg(ns);
+}
+}
+
+LogicAnalyzerWidget::LogicAnalyzerWidget(QWidget *parent)
+    : QWidget(parent)
+    , signalTrace(nullptr)
+    , following(true)
+    , viewEnd(0)
+    , nsPerPixel(20000.0)
+    , dragViewEnd(0)
+{
+    setMinimumSize(300, RULER_HEIGHT + SignalTrace::SIGNAL_COUNT * LANE_HEIGHT + 4);
+    setFocusPolicy(Qt::ClickFocus);
+}
+
+void LogicAnalyzerWidget::setSignalTrace(SignalTrace *trace)
+{
+    signalTrace = trace;
+    clear();
+}
+
+void LogicAnalyzerWidget::clear()
+{
+    signalHistory.clear();
+    following = true;
+    viewEnd = 0;
+    update();
+}
+
+void LogicAnalyzerWidget::sampleSignals()
+{
+    if (!signalTrace || signalHistory.drain(*signalTrace) == 0) {
+        return;
+    }
+    if (following) {
+        viewEnd = signalHistory.lastTime();
+    }
+    update();
+}
+
+QString LogicAnalyzerWidget::commandName(uint8_t command)
+{
+    switch (command & 0xF0) {
+    case 0x00:
+        return "Restore";
+    case 0x10:
+        return "Seek";
+    case 0x20:
+    case 0x30:
+        return "Step";
+    case 0x40:
+    case 0x50:
+        return "Step In";
+    case 0x60:
+    case 0x70:
+        return "Step Out";
+    case 0x80:
+    case 0x90:
+        return "Read Sector";
+    case 0xA0:
+    case 0xB0:
+        return "Write Sector";
+    case 0xC0:
+        return "Read Address";
+    case 0xD0:
+        return "Force Int";
+    case 0xE0:
+        return "Read Track";
+    default:
+        return "Write Track";
+    }
+}
+
+int LogicAnalyzerWidget::plotWidth() const
+{
+    return qMax(1, width() - LABEL_WIDTH);
+}
+
+uint64_t LogicAnalyzerWidget::viewStart() const
+{
+    const uint64_t span = static_cast<uint64_t>(plotWidth() * nsPerPixel);
+    return viewEnd > span ? viewEnd - span : 0;
+}
+
+void LogicAnalyzerWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+    painter.setFont(QFont("Arial", 8));
+
+    const int plot = plotWidth();
+    const uint64_t stepNs = qMax<uint64_t>(1, static_cast<uint64_t>(nsPerPixel));
+    const uint64_t start = viewStart();
+    drawRuler(painter, start);
+
+    // One span per pixel column, straight from the pyramid
+    columns.resize(plot);
+    for (int signal = 0; signal < SignalTrace::SIGNAL_COUNT; ++signal) {
+        const int top = RULER_HEIGHT + signal * LANE_HEIGHT;
+        painter.setPen(Qt::black);
+        painter.drawText(QRect(4, top, LABEL_WIDTH - 8, LANE_HEIGHT), Qt::AlignVCenter | Qt::AlignLeft,
+                         SignalTrace::signalName(signal));
+        signalHistory.spans(signal, start, stepNs, static_cast<size_t>(plot), columns.data());
+        if (signal < SignalTrace::PIN_COUNT) {
+            drawPinLane(painter, signal, top, columns);
+        } else {
+            drawBusLane(painter, signal, top, columns);
+        }
+    }
+
+    if (signalHistory.empty()) {
+        painter.setPen(Qt::gray);
+        painter.drawText(rect().adjusted(LABEL_WIDTH, RULER_HEIGHT, 0, 0), Qt::AlignCenter, "No controller activity yet");
+    }
+    if (signalTrace && signalTrace->dropped() > 0) {
+        // The emulation outran the display; the lanes have gaps
+        painter.setPen(Qt::red);
+        painter.drawText(QRect(0, 0, width() - 4, RULER_HEIGHT), Qt::AlignVCenter | Qt::AlignRight,
+                         QString("%1 edges dropped").arg(signalTrace->dropped()));
+    }
+}
+
+void LogicAnalyzerWidget::drawRuler(QPainter &painter, uint64_t start)
+{
+    // 1-2-5 tick spacing, at least MIN_TICK_SPACING pixels apart
+    const double minimum = MIN_TICK_SPACING * nsPerPixel;
+    uint64_t tick = 1;
+    while (tick < minimum) {
+        const uint64_t decade = tick;
+        tick = decade * 2;
+        if (tick >= minimum) {
+            break;
+        }
+        tick = decade * 5;
+        if (tick >= minimum) {
+            break;
+        }
+        tick = decade * 10;
+    }
+    uint64_t unit = 1;
+    while (unit * 1000 <= tick && unit < 1000000000ULL) {
+        unit *= 1000;
+    }
+
+    painter.setPen(QColor(200, 200, 200));
+    painter.drawLine(LABEL_WIDTH, RULER_HEIGHT - 1, width(), RULER_HEIGHT - 1);
+    const uint64_t end = start + static_cast<uint64_t>(plotWidth() * nsPerPixel);
+    for (uint64_t t = (start + tick - 1) / tick * tick; t <= end; t += tick) {
+        const int x = LABEL_WIDTH + static_cast<int>((t - start) / nsPerPixel);
+        painter.setPen(QColor(220, 220, 220));
+        painter.drawLine(x, RULER_HEIGHT, x, height());
+        painter.setPen(Qt::darkGray);
+        painter.drawText(x + 2, RULER_HEIGHT - 4, formatTime(t, unit));
+    }
+}
+
+void LogicAnalyzerWidget::drawPinLane(QPainter &painter, int signal, int top, const QVector<SignalHistory::Span> &spans)
+{
+    Q_UNUSED(signal);
+    const qreal high = top + 3;
+    const qreal low = top + LANE_HEIGHT - 3;
+    QVector<QLineF> lines;
+
+    // Constant columns merge into level runs; a column with edges is a vertical bar
+    int runStart = -1;
+    qreal runY = 0;
+    auto flush = [&](int x) {
+        if (runStart >= 0) {
+            lines.append(QLineF(LABEL_WIDTH + runStart, runY, LABEL_WIDTH + x, runY));
+            runStart = -1;
+        }
+    };
+    for (int x = 0; x < spans.size(); ++x) {
+        const SignalHistory::Span &span = spans[x];
+        if (!span.known) {
+            flush(x);
+        } else if (span.low == span.high) {
+            const qreal y = span.low ? high : low;
+            if (runStart >= 0 && y != runY) {
+                flush(x);
+            }
+            if (runStart < 0) {
+                runStart = x;
+                runY = y;
+            }
+        } else {
+            flush(x);
+            lines.append(QLineF(LABEL_WIDTH + x, high, LABEL_WIDTH + x, low));
+        }
+    }
+    flush(spans.size());
+
+    painter.setPen(QPen(QColor(0, 150, 0), 1));
+    painter.drawLines(lines);
+}
+
+void LogicAnalyzerWidget::drawBusLane(QPainter &painter, int signal, int top, const QVector<SignalHistory::Span> &spans)
+{
+    const qreal upper = top + 2;
+    const qreal lower = top + LANE_HEIGHT - 2;
+    const QFontMetrics metrics(painter.font());
+    QVector<QLineF> outline;
+    QVector<QLineF> busy;
+
+    // A run of one value is a box labelled with it when there is room; columns
+    // in which the value changes are shaded
+    int runStart = -1;
+    uint8_t runValue = 0;
+    auto flush = [&](int x) {
+        if (runStart < 0) {
+            return;
+        }
+        const qreal left = LABEL_WIDTH + runStart;
+        const qreal right = LABEL_WIDTH + x;
+        outline.append(QLineF(left, upper, right, upper));
+        outline.append(QLineF(left, lower, right, lower));
+        outline.append(QLineF(left, upper, left, lower));
+        const QString text = signal == SignalTrace::Command ? commandName(runValue)
+                                                            : QString("%1").arg(runValue, 2, 16, QLatin1Char('0')).toUpper();
+        if (metrics.horizontalAdvance(text) + 4 < right - left) {
+            painter.drawText(QRectF(left, upper, right - left, lower - upper), Qt::AlignCenter, text);
+        }
+        runStart = -1;
+    };
+
+    painter.setPen(Qt::black);
+    for (int x = 0; x < spans.size(); ++x) {
+        const SignalHistory::Span &span = spans[x];
+        if (!span.known) {
+            flush(x);
+        } else if (span.low == span.high) {
+            if (runStart >= 0 && span.low != runValue) {
+                flush(x);
+            }
+            if (runStart < 0) {
+                runStart = x;
+                runValue = span.low;
+            }
+        } else {
+            flush(x);
+            busy.append(QLineF(LABEL_WIDTH + x, upper, LABEL_WIDTH + x, lower));
+        }
+    }
+    flush(spans.size());
+
+    painter.setPen(QPen(QColor(0, 0, 170), 1));
+    painter.drawLines(outline);
+    painter.setPen(QPen(QColor(120, 120, 200), 1));
+    painter.drawLines(busy);
+}
+
+void LogicAnalyzerWidget::wheelEvent(QWheelEvent *event)
+{
+    const double notches = event->angleDelta().y() / 120.0;
+    if (notches == 0.0) {
+        return;
+    }
+    const double scale = qBound(MIN_NS_PER_PIXEL, nsPerPixel * qPow(ZOOM_STEP, -notches), MAX_NS_PER_PIXEL);
+
+    // Keep the time under the pointer in place; a live view stays live
+    if (!following) {
+        const double x = qBound(0.0, event->position().x() - LABEL_WIDTH, static_cast<double>(plotWidth()));
+        const double pointer = viewStart() + x * nsPerPixel;
+        const double end = pointer + (plotWidth() - x) * scale;
+        viewEnd = static_cast<uint64_t>(qBound(0.0, end, static_cast<double>(signalHistory.lastTime())));
+    }
+    nsPerPixel = scale;
+    event->accept();
+    update();
+}
+
+void LogicAnalyzerWidget::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        dragOrigin = event->pos();
+        dragViewEnd = viewEnd;
+    }
+}
+
+void LogicAnalyzerWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!(event->buttons() & Qt::LeftButton)) {
+        return;
+    }
+    const double end = dragViewEnd - (event->pos().x() - dragOrigin.x()) * nsPerPixel;
+    const uint64_t last = signalHistory.lastTime();
+    viewEnd = static_cast<uint64_t>(qBound(0.0, end, static_cast<double>(last)));
+    // Dragging back to the newest edge resumes following
+    following = viewEnd >= last;
+    update();
+}
+
+void LogicAnalyzerWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    following = true;
+    viewEnd = signalHistory.lastTime();
+    update();
+}
+
+void LogicAnalyzerWidget::keyPressEvent(QKeyEvent *event)
+{
+    if (event->key() == Qt::Key_End) {
+        following = true;
+        viewEnd = signalHistory.lastTime();
+        update();
+        return;
+    }
+    QWidget::keyPressEvent(event);
+}
+
+QSize LogicAnalyzerWidget::sizeHint() const
+{
+    return QSize(800, RULER_HEIGHT + SignalTrace::SIGNAL_COUNT * LANE_HEIGHT + 4);
+}
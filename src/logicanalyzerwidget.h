@@ -0,0 +1,66 @@
+#ifndef LOGICANALYZERWIDGET_H
+#define LOGICANALYZERWIDGET_H
+
+#include "signaltrace.h"
+
+#include <QWidget>
+#include <QPainter>
+#include <QPoint>
+#include <QVector>
+
+// Scrolling logic analyzer of the controller: one lane per pin (INT, DRQ,
+// INDEX, STEP, DIR, HLD, WG) and bus lanes for the decoded command and the
+// track, sector and data registers, over emulated time. Edges come from a
+// SignalTrace the controller writes; sampleSignals() moves them into the
+// history at display rate. Every pixel column is drawn from the history's
+// min/max pyramid, so a column covering thousands of edges costs about as
+// much as one covering none.
+//
+// The wheel zooms around the pointer, dragging pans back in time, and a
+// double click (or End) follows the newest edges again.
+class LogicAnalyzerWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit LogicAnalyzerWidget(QWidget *parent = nullptr);
+
+    void setSignalTrace(SignalTrace *trace);
+    void sampleSignals();
+    void clear();
+
+    const SignalHistory &history() const { return signalHistory; }
+    // WD1793 mnemonic of a command register value
+    static QString commandName(uint8_t command);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    QSize sizeHint() const override;
+
+private:
+    static constexpr int LABEL_WIDTH = 56;
+    static constexpr int RULER_HEIGHT = 16;
+    static constexpr int LANE_HEIGHT = 16;
+
+    int plotWidth() const;
+    uint64_t viewStart() const;
+    void drawRuler(QPainter &painter, uint64_t start);
+    void drawPinLane(QPainter &painter, int signal, int top, const QVector<SignalHistory::Span> &columns);
+    void drawBusLane(QPainter &painter, int signal, int top, const QVector<SignalHistory::Span> &columns);
+
+    SignalTrace *signalTrace;
+    SignalHistory signalHistory;
+    bool following;             // The view ends at the newest edge
+    uint64_t viewEnd;
+    double nsPerPixel;
+    QPoint dragOrigin;
+    uint64_t dragViewEnd;
+    QVector<SignalHistory::Span> columns;
+};
+
+#endif // LOGICANALYZERWIDGET_H
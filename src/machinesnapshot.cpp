@@ -0,0 +1,429 @@
+#include "machinesnapshot.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr char MAGIC[4] = { 'Q', 'F', 'S', 'N' };
+constexpr uint8_t VERSION = 1;
+constexpr uint8_t KIND_FULL = 0;
+constexpr uint8_t KIND_DELTA = 1;
+
+constexpr uint8_t FLAG_ID_CRC_OK = 0x01;
+constexpr uint8_t FLAG_DATA_CRC_OK = 0x02;
+constexpr uint8_t FLAG_DELETED = 0x04;
+constexpr uint8_t FLAG_WEAK = 0x08;
+
+class ByteWriter
+{
+public:
+    void put8(uint64_t value) { m_bytes.push_back(static_cast<uint8_t>(value)); }
+    void put16(uint64_t value) { putLe(value, 2); }
+    void put32(uint64_t value) { putLe(value, 4); }
+    void put64(uint64_t value) { putLe(value, 8); }
+    void putBytes(const uint8_t *data, size_t size)
+    {
+        put32(size);
+        m_bytes.insert(m_bytes.end(), data, data + size);
+    }
+
+    std::vector<uint8_t> &bytes() { return m_bytes; }
+
+private:
+    void putLe(uint64_t value, int size)
+    {
+        for (int i = 0; i < size; ++i) {
+            m_bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    std::vector<uint8_t> m_bytes;
+};
+
+// Reads past the end return zeros and clear ok()
+class ByteReader
+{
+public:
+    ByteReader(const uint8_t *data, size_t size)
+        : m_data(data)
+        , m_size(size)
+        , m_pos(0)
+        , m_ok(true)
+    {
+    }
+
+    uint8_t get8() { return static_cast<uint8_t>(getLe(1)); }
+    uint16_t get16() { return static_cast<uint16_t>(getLe(2)); }
+    uint32_t get32() { return static_cast<uint32_t>(getLe(4)); }
+    uint64_t get64() { return getLe(8); }
+    const uint8_t *getBytes(size_t &size)
+    {
+        size = get32();
+        if (!take(size)) {
+            size = 0;
+            return nullptr;
+        }
+        return m_data + m_pos - size;
+    }
+
+    bool ok() const { return m_ok; }
+    bool atEnd() const { return m_pos == m_size; }
+
+private:
+    bool take(size_t size)
+    {
+        if (!m_ok || size > m_size - m_pos) {
+            m_ok = false;
+            return false;
+        }
+        m_pos += size;
+        return true;
+    }
+
+    uint64_t getLe(int size)
+    {
+        if (!take(static_cast<size_t>(size))) {
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i) {
+            value |= static_cast<uint64_t>(m_data[m_pos - size + i]) << (8 * i);
+        }
+        return value;
+    }
+
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_pos;
+    bool m_ok;
+};
+
+void writeController(ByteWriter &out, const Wd1793::State &state)
+{
+    out.put8(state.status);
+    out.put8(state.command);
+    out.put8(state.track);
+    out.put8(state.sector);
+    out.put8(state.data);
+    out.put8((state.intrq ? 0x01 : 0) | (state.drq ? 0x02 : 0) | (state.headLoaded ? 0x04 : 0) |
+             (state.indexInterrupt ? 0x08 : 0) | (state.doubleDensity ? 0x10 : 0) | (state.stepped ? 0x20 : 0) |
+             (state.readTrack ? 0x40 : 0) | (state.readAddress ? 0x80 : 0));
+    out.put8(static_cast<uint8_t>(state.type));
+    out.put8(static_cast<uint8_t>(state.phase));
+    out.put64(state.time);
+    out.put64(state.eventTime);
+    out.put64(state.commandStart);
+    out.put64(state.commandEnd);
+    out.put64(state.traceIdleNs);
+    out.put32(static_cast<uint32_t>(state.stepDirection));
+    out.put32(static_cast<uint32_t>(state.restoreSteps));
+    out.put64(state.searchFrom);
+    out.put64(state.searchDeadline);
+    out.put32(static_cast<uint32_t>(state.pendingId));
+    out.put64(state.pendingIdStart);
+    out.putBytes(state.buffer.data(), state.buffer.size());
+    out.put32(state.index);
+    out.put64(state.transferStart);
+    out.put64(state.firstFetch);
+    out.put64(state.drqTime);
+    out.put32(static_cast<uint32_t>(state.targetSector));
+    out.put64(state.trackEnd);
+
+    const BitstreamEncoder::State &encoder = state.trackEncoder;
+    out.put8((encoder.encoding == Encoding::FM ? 0 : 0x01) | (encoder.lastDataBit ? 0x02 : 0) |
+             (encoder.lastWasSync ? 0x04 : 0));
+    out.put16(encoder.crc);
+    out.put64(encoder.cellCount);
+    out.putBytes(encoder.cells.data(), encoder.cells.size());
+}
+
+bool readController(ByteReader &in, Wd1793::State &state)
+{
+    state.status = in.get8();
+    state.command = in.get8();
+    state.track = in.get8();
+    state.sector = in.get8();
+    state.data = in.get8();
+    const uint8_t flags = in.get8();
+    state.intrq = (flags & 0x01) != 0;
+    state.drq = (flags & 0x02) != 0;
+    state.headLoaded = (flags & 0x04) != 0;
+    state.indexInterrupt = (flags & 0x08) != 0;
+    state.doubleDensity = (flags & 0x10) != 0;
+    state.stepped = (flags & 0x20) != 0;
+    state.readTrack = (flags & 0x40) != 0;
+    state.readAddress = (flags & 0x80) != 0;
+    const uint8_t type = in.get8();
+    const uint8_t phase = in.get8();
+    if (type > static_cast<uint8_t>(Wd1793::CommandType::TypeIV) ||
+        phase > static_cast<uint8_t>(Wd1793::Phase::WritingTrack)) {
+        return false;
+    }
+    state.type = static_cast<Wd1793::CommandType>(type);
+    state.phase = static_cast<Wd1793::Phase>(phase);
+    state.time = in.get64();
+    state.eventTime = in.get64();
+    state.commandStart = in.get64();
+    state.commandEnd = in.get64();
+    state.traceIdleNs = in.get64();
+    state.stepDirection = static_cast<int32_t>(in.get32());
+    state.restoreSteps = static_cast<int32_t>(in.get32());
+    state.searchFrom = in.get64();
+    state.searchDeadline = in.get64();
+    state.pendingId = static_cast<int32_t>(in.get32());
+    state.pendingIdStart = in.get64();
+    size_t size = 0;
+    const uint8_t *bytes = in.getBytes(size);
+    state.buffer.assign(bytes, bytes + size);
+    state.index = in.get32();
+    state.transferStart = in.get64();
+    state.firstFetch = in.get64();
+    state.drqTime = in.get64();
+    state.targetSector = static_cast<int32_t>(in.get32());
+    state.trackEnd = in.get64();
+
+    BitstreamEncoder::State &encoder = state.trackEncoder;
+    const uint8_t encoderFlags = in.get8();
+    encoder.encoding = (encoderFlags & 0x01) ? Encoding::MFM : Encoding::FM;
+    encoder.lastDataBit = (encoderFlags & 0x02) != 0;
+    encoder.lastWasSync = (encoderFlags & 0x04) != 0;
+    encoder.crc = in.get16();
+    encoder.cellCount = static_cast<size_t>(in.get64());
+    bytes = in.getBytes(size);
+    encoder.cells.assign(bytes, bytes + size);
+    return in.ok() && encoder.cellCount <= encoder.cells.size() * 8;
+}
+
+void writeDrive(ByteWriter &out, const FloppyDrive::State &state)
+{
+    out.put8(state.writeProtected ? 1 : 0);
+    out.put8(static_cast<uint8_t>(state.cylinder));
+    out.put8(static_cast<uint8_t>(state.side));
+    out.put32(static_cast<uint32_t>(state.stepCount));
+}
+
+void readDrive(ByteReader &in, FloppyDrive::State &state)
+{
+    state.writeProtected = in.get8() != 0;
+    state.cylinder = in.get8();
+    state.side = in.get8();
+    state.stepCount = static_cast<int32_t>(in.get32());
+}
+
+bool sameSector(const Sector &a, const Sector &b)
+{
+    return a.cylinder == b.cylinder && a.head == b.head && a.id == b.id && a.sizeCode == b.sizeCode &&
+           a.idCrcOk == b.idCrcOk && a.dataCrcOk == b.dataCrcOk && a.deleted == b.deleted && a.weak == b.weak &&
+           a.angle == b.angle && a.data.isSharedWith(b.data);
+}
+
+bool sameTrack(const Track &a, const Track &b)
+{
+    if (a.encoding != b.encoding || a.revolutions != b.revolutions || a.sectors.size() != b.sectors.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.sectors.size(); ++i) {
+        if (!sameSector(a.sectors[i], b.sectors[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void writeTrack(ByteWriter &out, const Track &track)
+{
+    out.put8(static_cast<uint8_t>(track.cylinder));
+    out.put8(static_cast<uint8_t>(track.side));
+    out.put8(track.encoding == Encoding::FM ? 0 : 1);
+    out.put8(static_cast<uint8_t>(track.revolutions));
+    out.put16(track.sectors.size());
+    for (const Sector &sector : track.sectors) {
+        out.put8(sector.cylinder);
+        out.put8(sector.head);
+        out.put8(sector.id);
+        out.put8(sector.sizeCode);
+        out.put8((sector.idCrcOk ? FLAG_ID_CRC_OK : 0) | (sector.dataCrcOk ? FLAG_DATA_CRC_OK : 0) |
+                 (sector.deleted ? FLAG_DELETED : 0) | (sector.weak ? FLAG_WEAK : 0));
+        uint32_t angle;
+        std::memcpy(&angle, &sector.angle, sizeof(angle));
+        out.put32(angle);
+        out.putBytes(sector.data.data(), sector.data.size());
+    }
+}
+
+bool readTrack(ByteReader &in, DiskImage &disk)
+{
+    const int cylinder = in.get8();
+    const int side = in.get8();
+    Track *track = disk.track(cylinder, side);
+    if (!in.ok() || !track) {
+        return false;
+    }
+    Track decoded;
+    decoded.cylinder = cylinder;
+    decoded.side = side;
+    decoded.encoding = in.get8() == 0 ? Encoding::FM : Encoding::MFM;
+    decoded.revolutions = in.get8();
+    decoded.sectors.resize(in.get16());
+    for (Sector &sector : decoded.sectors) {
+        sector.cylinder = in.get8();
+        sector.head = in.get8();
+        sector.id = in.get8();
+        sector.sizeCode = in.get8();
+        const uint8_t flags = in.get8();
+        sector.idCrcOk = (flags & FLAG_ID_CRC_OK) != 0;
+        sector.dataCrcOk = (flags & FLAG_DATA_CRC_OK) != 0;
+        sector.deleted = (flags & FLAG_DELETED) != 0;
+        sector.weak = (flags & FLAG_WEAK) != 0;
+        const uint32_t angle = in.get32();
+        std::memcpy(&sector.angle, &angle, sizeof(angle));
+        size_t size = 0;
+        const uint8_t *bytes = in.getBytes(size);
+        if (size > 0) {
+            sector.data = std::vector<uint8_t>(bytes, bytes + size);
+        }
+        if (!in.ok()) {
+            return false;
+        }
+    }
+    *track = std::move(decoded);
+    return true;
+}
+
+} // namespace
+
+MachineSnapshot MachineSnapshot::capture(const Wd1793 &controller, const FloppyDrive &drive)
+{
+    MachineSnapshot snapshot;
+    snapshot.controller = controller.state();
+    snapshot.drive = drive.state();
+    if (drive.disk()) {
+        snapshot.disk = std::make_shared<const DiskImage>(*drive.disk());
+    }
+    return snapshot;
+}
+
+void MachineSnapshot::restore(Wd1793 &controller, FloppyDrive &drive) const
+{
+    if (disk) {
+        auto copy = std::make_shared<DiskImage>(*disk);
+        copy->refreshLayout();
+        drive.insertDisk(std::move(copy));
+    } else {
+        drive.ejectDisk();
+    }
+    drive.restoreState(this->drive);
+    controller.restoreState(this->controller);
+}
+
+std::vector<uint8_t> SnapshotCodec::encode(const MachineSnapshot &snapshot, const MachineSnapshot *base)
+{
+    ByteWriter out;
+    for (char c : MAGIC) {
+        out.put8(static_cast<uint8_t>(c));
+    }
+    out.put8(VERSION);
+    out.put8(base ? KIND_DELTA : KIND_FULL);
+    writeController(out, snapshot.controller);
+    writeDrive(out, snapshot.drive);
+
+    const DiskImage *disk = snapshot.disk.get();
+    out.put8(disk ? 1 : 0);
+    if (!disk) {
+        return std::move(out.bytes());
+    }
+
+    // Tracks are only left out when the base had the same geometry
+    const DiskImage *previous = base ? base->disk.get() : nullptr;
+    if (previous && (previous->cylinderCount() != disk->cylinderCount() ||
+                     previous->sideCount() != disk->sideCount())) {
+        previous = nullptr;
+    }
+    out.put8(previous ? 1 : 0);
+    out.put8(static_cast<uint8_t>(disk->cylinderCount()));
+    out.put8(static_cast<uint8_t>(disk->sideCount()));
+
+    const size_t countAt = out.bytes().size();
+    out.put16(0);
+    int changed = 0;
+    for (int cylinder = 0; cylinder < disk->cylinderCount(); ++cylinder) {
+        for (int side = 0; side < disk->sideCount(); ++side) {
+            const Track *track = disk->track(cylinder, side);
+            if (previous && sameTrack(*track, *previous->track(cylinder, side))) {
+                continue;
+            }
+            writeTrack(out, *track);
+            ++changed;
+        }
+    }
+    out.bytes()[countAt] = static_cast<uint8_t>(changed);
+    out.bytes()[countAt + 1] = static_cast<uint8_t>(changed >> 8);
+    return std::move(out.bytes());
+}
+
+bool SnapshotCodec::isDelta(const uint8_t *data, size_t size)
+{
+    return size > 5 && data[5] == KIND_DELTA;
+}
+
+bool SnapshotCodec::decode(const uint8_t *data, size_t size, const MachineSnapshot *base,
+                           MachineSnapshot &snapshot, std::string *error)
+{
+    auto fail = [error](const std::string &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    ByteReader in(data, size);
+    char magic[4];
+    for (char &c : magic) {
+        c = static_cast<char>(in.get8());
+    }
+    if (!in.ok() || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return fail("Not a snapshot");
+    }
+    if (in.get8() != VERSION) {
+        return fail("Unsupported snapshot version");
+    }
+    const bool delta = in.get8() == KIND_DELTA;
+    if (delta && !base) {
+        return fail("Delta snapshot without its base");
+    }
+
+    MachineSnapshot result;
+    if (!readController(in, result.controller)) {
+        return fail("Corrupt controller state");
+    }
+    readDrive(in, result.drive);
+
+    if (in.get8() != 0) {
+        const bool onBase = in.get8() != 0;
+        const int cylinders = in.get8();
+        const int sides = in.get8();
+        std::shared_ptr<DiskImage> disk;
+        if (onBase) {
+            if (!delta || !base->disk || base->disk->cylinderCount() != cylinders ||
+                base->disk->sideCount() != sides) {
+                return fail("Snapshot does not match its base");
+            }
+            disk = std::make_shared<DiskImage>(*base->disk);
+        } else {
+            disk = std::make_shared<DiskImage>(cylinders, sides);
+        }
+        const int changed = in.get16();
+        for (int i = 0; i < changed; ++i) {
+            if (!readTrack(in, *disk)) {
+                return fail("Corrupt track in snapshot");
+            }
+        }
+        disk->updateLayout();
+        result.disk = std::move(disk);
+    }
+    if (!in.ok() || !in.atEnd()) {
+        return fail("Corrupt snapshot");
+    }
+    snapshot = std::move(result);
+    return true;
+}
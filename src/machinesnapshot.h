@@ -0,0 +1,48 @@
+#ifndef MACHINESNAPSHOT_H
+#define MACHINESNAPSHOT_H
+
+#include "diskimage.h"
+#include "floppydrive.h"
+#include "wd1793.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Complete emulation state of one drive and its controller: registers,
+// the command in progress with its pending event, head position and the
+// disk contents including everything written to it. The rotation phase
+// follows from the controller's time.
+struct MachineSnapshot {
+    Wd1793::State controller;
+    FloppyDrive::State drive;
+    std::shared_ptr<const DiskImage> disk;  // Null without a disk
+
+    // Cheap enough to take between two host accesses: sector bytes are
+    // shared with the live disk and only copied once either side writes
+    static MachineSnapshot capture(const Wd1793 &controller, const FloppyDrive &drive);
+
+    // Puts the state back; the drive gets its own copy of the disk
+    void restore(Wd1793 &controller, FloppyDrive &drive) const;
+};
+
+// Compact binary form of snapshots. A delta against an earlier snapshot
+// holds the controller and drive state and only the tracks that changed
+// since; tracks are compared by sector identity, so nothing is scanned.
+class SnapshotCodec
+{
+public:
+    static std::vector<uint8_t> encode(const MachineSnapshot &snapshot, const MachineSnapshot *base = nullptr);
+
+    // Rebuilds a snapshot from encode()'s output. A delta needs the
+    // snapshot it was taken against as 'base'.
+    static bool decode(const uint8_t *data, size_t size, const MachineSnapshot *base,
+                       MachineSnapshot &snapshot, std::string *error = nullptr);
+
+    // Whether encode() made a delta, so the data needs a base to decode
+    static bool isDelta(const uint8_t *data, size_t size);
+};
+
+#endif // MACHINESNAPSHOT_H
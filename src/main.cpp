@@ -1,10 +1,32 @@
 #include "mainwindow.h"
+#include "perftrace.h"
 #include <QApplication>
+#include <QTimer>
+#include <cstdio>
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
+
+    // QT_FLOPPY_TRACE=file.json records trace zones and writes them on exit
+    const QByteArray tracePath = qgetenv("QT_FLOPPY_TRACE");
+    QTimer traceCollector;
+    if (!tracePath.isEmpty()) {
+        PerfTrace::setEnabled(true);
+        PerfTrace::setThreadName("GUI");
+        QObject::connect(&traceCollector, &QTimer::timeout, [] { PerfTrace::collect(); });
+        traceCollector.start(250);
+    }
+
     MainWindow window;
     window.show();
-    return app.exec();
-} 
\ No newline at end of file
+    const int result = app.exec();
+
+    if (!tracePath.isEmpty()) {
+        std::string error;
+        if (!PerfTrace::exportChromeTrace(tracePath.toStdString(), &error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+        }
+    }
+    return result;
+}
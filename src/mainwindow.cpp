@@ -1,20 +1,108 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "diskimage.h"
+#include "fluxdecoder.h"
+#include "fluxreader.h"
+#include "imageconverter.h"
+#include "interleaveoptimizer.h"
+#include "perftrace.h"
+#include "trackstream.h"
 #include <QPushButton>
 #include <QComboBox>
 #include <QLabel>
+#include <QFile>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
 
 MainWindow::MainWindow(QWidget *parent)
-        : QMainWindow(parent), ui(new Ui::MainWindow), isPlaying(false), currentSpeed(1.0) {
+        : QMainWindow(parent), ui(new Ui::MainWindow), isPlaying(false), currentSpeed(1.0), decodeThread(nullptr),
+          optimizeThread(nullptr), convertThread(nullptr), mountThread(nullptr), observedCylinder(-1), observedSide(-1) {
     ui->setupUi(this);
     createConnections();
 
     animationTimer = new QTimer(this);
     connect(animationTimer, &QTimer::timeout, this, &MainWindow::updateAnimation);
     animationTimer->start(16); // ~60 FPS
+
+    // The register view follows the controller at display rate, independent of playback
+    controller.setDrive(&drive);
+    controller.setMetrics(&metrics);
+    controller.setDrqMonitor(&drqMonitor);
+    ui->fdcWidget->setController(&controller);
+    ui->fdcWidget->setDrqMonitor(&drqMonitor);
+    controller.setSignalTrace(&signalTrace);
+    ui->logicAnalyzer->setSignalTrace(&signalTrace);
+    registerTimer = new QTimer(this);
+    connect(registerTimer, &QTimer::timeout, this, &MainWindow::sampleController);
+    registerTimer->start(16);
+
+    // Snapshots every few seconds let the next start pick up after a crash.
+    // The journal of an instance that is still running is not offered for
+    // recovery; this one then journals to a file of its own.
+    QString journalPath = SnapshotJournal::defaultPath();
+    std::unique_ptr<QLockFile> journalLock = SnapshotJournal::claim(journalPath);
+    if (journalLock) {
+        recoverSession(journalPath);
+    } else {
+        journalPath = SnapshotJournal::instancePath();
+        journalLock = SnapshotJournal::claim(journalPath);
+    }
+    journal.reset(new SnapshotJournal(journalPath, std::move(journalLock)));
+    snapshotTimer = new QTimer(this);
+    connect(snapshotTimer, &QTimer::timeout, this, &MainWindow::takeSnapshot);
+    snapshotTimer->start(5000);
+
+    // External emulators and test rigs drive the controller over a local socket
+    // or, when embedded, over the shared memory bus; both take controllerLock
+    hostServer = new FdcHostServer(&controller, this);
+    hostServer->setControllerLock(&controllerLock);
+    QString hostMessage = hostServer->listen(FdcHostServer::defaultServerName())
+        ? tr("Host interface listening on %1").arg(hostServer->serverName())
+        : tr("Host interface unavailable: %1").arg(hostServer->errorString());
+
+    std::string error;
+    sharedBus = FdcSharedBus::create(FdcSharedBus::defaultName(), &error);
+    if (sharedBus) {
+        sharedBus->publish(controller);
+        hostServer->setSharedBus(sharedBus.get());
+        ui->fdcWidget->setSharedBus(sharedBus.get());
+        sharedBusService.reset(new FdcSharedBusService(*sharedBus, controller, controllerLock));
+        sharedBusService->start();
+        hostMessage += tr(", shared memory bus %1").arg(QString::fromStdString(sharedBus->name()));
+    }
+
+    // Counters are scraped over HTTP and summarised once a second in the panel
+    ui->metricsWidget->setMetrics(&metrics);
+    metricsTimer = new QTimer(this);
+    connect(metricsTimer, &QTimer::timeout, ui->metricsWidget, &MetricsPanelWidget::sampleMetrics);
+    metricsTimer->start(1000);
+    metricsServer = new MetricsHttpServer(&metrics, this);
+    hostMessage += metricsServer->listen()
+        ? tr(", metrics on http://127.0.0.1:%1/metrics").arg(metricsServer->serverPort())
+        : tr(", metrics unavailable: %1").arg(metricsServer->errorString());
+    ui->statusbar->showMessage(hostMessage);
 }
 
 MainWindow::~MainWindow() {
+    if (decodeThread) {
+        decodeThread->wait();
+    }
+    if (optimizeThread) {
+        optimizeThread->wait();
+    }
+    if (convertThread) {
+        convertThread->wait();
+    }
+    if (mountThread) {
+        mountThread->wait();
+    }
+    sharedBusService.reset();
+    // Saves what the mounted image still has queued
+    controller.setWriteBack(nullptr);
+    writeBack.reset();
+    // A clean exit leaves nothing to recover
+    journal->discard();
     delete ui;
 }
 
@@ -35,6 +123,15 @@ void MainWindow::createConnections() {
     ui->speedComboBox->setCurrentIndex(5);
 
     connect(ui->actionToggleView, &QAction::toggled, this, &MainWindow::onToggleView);
+    connect(ui->actionOpenFlux, &QAction::triggered, this, &MainWindow::onOpenFluxImage);
+    connect(ui->actionConvertImage, &QAction::triggered, this, &MainWindow::onConvertImage);
+    connect(ui->actionRecordTrace, &QAction::toggled, this, &MainWindow::onRecordTrace);
+    connect(ui->actionOptimizeInterleave, &QAction::triggered, this, &MainWindow::onOptimizeInterleave);
+
+    // The library panel can be closed from its title bar as well
+    connect(ui->actionImageLibrary, &QAction::toggled, ui->libraryDock, &QDockWidget::setVisible);
+    connect(ui->libraryDock->toggleViewAction(), &QAction::toggled, ui->actionImageLibrary, &QAction::setChecked);
+    connect(ui->libraryWidget, &ImageLibraryWidget::imageSelected, this, &MainWindow::onMountImage);
 }
 
 void MainWindow::onPlayPauseClicked() {
@@ -98,7 +195,373 @@ void MainWindow::onToggleView(bool checked)
     }
 }
 
+void MainWindow::onOpenFluxImage() {
+    if (decodeThread) {
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, tr("Open Flux Image"), QString(),
+                                                tr("Flux images (*.scp *.hfe *.raw);;All files (*)"));
+    if (path.isEmpty()) {
+        return;
+    }
+
+    std::string error;
+    std::shared_ptr<FluxReader> reader(FluxReader::open(QFile::encodeName(path).toStdString(), &error));
+    if (!reader) {
+        QMessageBox::warning(this, tr("Open Flux Image"), QString::fromStdString(error));
+        return;
+    }
+
+    QString fileName = QFileInfo(path).fileName();
+    ui->statusbar->showMessage(tr("Decoding %1 (%2)...").arg(fileName, reader->formatName()));
+    ui->actionOpenFlux->setEnabled(false);
+
+    // Decode off the GUI thread; the reader streams one revolution at a time
+    auto result = std::make_shared<std::shared_ptr<DiskImage>>();
+    decodeThread = QThread::create([this, reader, result, fileName]() {
+        *result = FluxDiskDecoder::decode(*reader, FluxDecodeOptions(), [this, fileName](int done, int total) {
+            QMetaObject::invokeMethod(this, [this, fileName, done, total]() {
+                ui->statusbar->showMessage(tr("Decoding %1: revolution %2 of %3").arg(fileName).arg(done).arg(total));
+            }, Qt::QueuedConnection);
+        });
+    });
+    connect(decodeThread, &QThread::finished, this, [this, result, fileName]() {
+        decodeThread->deleteLater();
+        decodeThread = nullptr;
+        ui->actionOpenFlux->setEnabled(true);
+
+        // Counted before the controller, which may write to it, gets the image
+        std::shared_ptr<DiskImage> image = *result;
+        const QString message = tr("%1: %2 sectors, %3 weak, %4 bad")
+                                    .arg(fileName)
+                                    .arg(image->sectorTotal())
+                                    .arg(image->weakSectorTotal())
+                                    .arg(image->badSectorTotal());
+        {
+            std::lock_guard<std::mutex> guard(controllerLock);
+            drive.insertDisk(image);
+            // Decoded flux stays a writable copy in memory, never written back
+            drive.setWriteProtected(false);
+            controller.setWriteBack(nullptr);
+            drqMonitor.clear();
+        }
+        writeBack.reset();
+        ui->floppyWidget->setDiskImage(image);
+        ui->statusbar->showMessage(message);
+    });
+    decodeThread->start();
+}
+
+void MainWindow::onConvertImage() {
+    if (convertThread) {
+        return;
+    }
+
+    const QString filters = tr("Disk images (*.trd *.scl *.img *.ima *.dsk *.hfe *.qfr);;All files (*)");
+    QString input = QFileDialog::getOpenFileName(this, tr("Convert Image"), QString(), filters);
+    if (input.isEmpty()) {
+        return;
+    }
+    QString selectedFilter;
+    QString output = QFileDialog::getSaveFileName(this, tr("Save Converted Image"), QString(),
+                                                  tr("TR-DOS (*.trd);;TR-DOS archive (*.scl);;Raw sectors (*.img);;"
+                                                     "Extended DSK (*.dsk);;HxC HFE (*.hfe);;"
+                                                     "Sector table (*.qfr)"),
+                                                  &selectedFilter);
+    if (output.isEmpty()) {
+        return;
+    }
+    // The output format follows the extension; take it from the filter if none was typed
+    if (QFileInfo(output).suffix().isEmpty()) {
+        const int star = selectedFilter.indexOf(QLatin1String("*."));
+        output += selectedFilter.mid(star + 1, selectedFilter.indexOf(QLatin1Char(')')) - star - 1);
+    }
+
+    QString fileName = QFileInfo(input).fileName();
+    ui->actionConvertImage->setEnabled(false);
+    ui->statusbar->showMessage(tr("Converting %1...").arg(fileName));
+
+    // The converter runs its own stage threads; this one is the writer
+    struct Outcome {
+        bool ok = false;
+        ConvertStats stats;
+        std::string error;
+    };
+    auto outcome = std::make_shared<Outcome>();
+    const std::string inputPath = QFile::encodeName(input).toStdString();
+    const std::string outputPath = QFile::encodeName(output).toStdString();
+    convertThread = QThread::create([this, outcome, inputPath, outputPath, fileName]() {
+        outcome->ok = ImageConverter::convert(inputPath, outputPath, ConvertOptions(), &outcome->stats, &outcome->error,
+                                              [this, fileName](int done, int total) {
+            QMetaObject::invokeMethod(this, [this, fileName, done, total]() {
+                ui->statusbar->showMessage(tr("Converting %1: track %2 of %3").arg(fileName).arg(done).arg(total));
+            }, Qt::QueuedConnection);
+        });
+    });
+    connect(convertThread, &QThread::finished, this, [this, outcome, fileName, output]() {
+        convertThread->deleteLater();
+        convertThread = nullptr;
+        ui->actionConvertImage->setEnabled(true);
+
+        if (!outcome->ok) {
+            ui->statusbar->clearMessage();
+            QMessageBox::warning(this, tr("Convert Image"), QString::fromStdString(outcome->error));
+            return;
+        }
+        ui->statusbar->showMessage(tr("%1: %2 to %3, %4 tracks written to %5")
+                                       .arg(fileName)
+                                       .arg(QString::fromLatin1(outcome->stats.inputFormat))
+                                       .arg(QString::fromLatin1(outcome->stats.outputFormat))
+                                       .arg(outcome->stats.tracks)
+                                       .arg(QFileInfo(output).fileName()));
+    });
+    convertThread->start();
+}
+
+void MainWindow::onMountImage(const QString &path) {
+    // Arrowing through the library selects faster than images load; only
+    // the last selection made during a load is mounted after it
+    if (mountThread) {
+        pendingMount = path;
+        return;
+    }
+    pendingMount.clear();
+
+    QString fileName = QFileInfo(path).fileName();
+    ui->statusbar->showMessage(tr("Loading %1...").arg(fileName));
+
+    // The outgoing disk is read-only while the next one loads, and what it
+    // still has queued is saved before its file may be loaded again
+    std::shared_ptr<ImageWriteBack> outgoing(writeBack.release());
+    {
+        std::lock_guard<std::mutex> guard(controllerLock);
+        if (outgoing) {
+            controller.setWriteBack(nullptr);
+            drive.setWriteProtected(true);
+        }
+    }
+
+    struct Loaded {
+        std::shared_ptr<DiskImage> image;
+        std::string error;
+        std::unique_ptr<ImageWriteBack> writeBack;
+        std::string writeBackError;
+    };
+    auto loaded = std::make_shared<Loaded>();
+    const std::string imagePath = QFile::encodeName(path).toStdString();
+    mountThread = QThread::create([loaded, imagePath, outgoing]() {
+        if (outgoing) {
+            outgoing->close();
+        }
+        loaded->image = TrackReader::loadImage(imagePath, &loaded->error);
+        if (loaded->image) {
+            loaded->writeBack.reset(new ImageWriteBack());
+            if (!loaded->writeBack->open(imagePath, *loaded->image, &loaded->writeBackError)) {
+                loaded->writeBack.reset();
+            }
+        }
+    });
+    connect(mountThread, &QThread::finished, this, [this, loaded, fileName]() {
+        mountThread->deleteLater();
+        mountThread = nullptr;
+
+        if (!pendingMount.isEmpty()) {
+            onMountImage(pendingMount);
+            return;
+        }
+        if (!loaded->image) {
+            // The outgoing disk stays in the drive, write-protected if it was saving writes
+            ui->statusbar->showMessage(tr("%1: %2").arg(fileName, QString::fromStdString(loaded->error)));
+            return;
+        }
+        std::shared_ptr<DiskImage> image = loaded->image;
+        QString message = tr("%1: %2 sectors, %3 weak, %4 bad")
+                              .arg(fileName)
+                              .arg(image->sectorTotal())
+                              .arg(image->weakSectorTotal())
+                              .arg(image->badSectorTotal());
+        // Without a way to save writes the disk is mounted write-protected
+        if (!loaded->writeBack) {
+            message += tr(", write-protected: %1").arg(QString::fromStdString(loaded->writeBackError));
+        }
+        {
+            std::lock_guard<std::mutex> guard(controllerLock);
+            drive.insertDisk(image);
+            drive.setWriteProtected(!loaded->writeBack);
+            controller.setWriteBack(loaded->writeBack.get());
+            drqMonitor.clear();
+        }
+        writeBack = std::move(loaded->writeBack);
+        ui->floppyWidget->setDiskImage(image);
+        ui->statusbar->showMessage(message);
+    });
+    mountThread->start();
+}
+
+void MainWindow::onRecordTrace(bool checked) {
+    size_t recorded = 0;
+    {
+        std::lock_guard<std::mutex> guard(controllerLock);
+        if (checked) {
+            accessTrace.clear();
+        }
+        controller.setAccessTrace(checked ? &accessTrace : nullptr);
+        recorded = accessTrace.size();
+    }
+    if (checked) {
+        ui->statusbar->showMessage(tr("Recording sector accesses..."));
+        return;
+    }
+
+    ui->statusbar->showMessage(tr("Recorded %1 sector accesses").arg(recorded));
+    QString path = QFileDialog::getSaveFileName(this, tr("Save Access Trace"), QString(),
+                                                tr("Access traces (*.trace);;All files (*)"));
+    if (path.isEmpty()) {
+        return;
+    }
+    std::string error;
+    if (!accessTrace.save(QFile::encodeName(path).toStdString(), &error)) {
+        QMessageBox::warning(this, tr("Save Access Trace"), QString::fromStdString(error));
+    }
+}
+
+void MainWindow::onOptimizeInterleave() {
+    if (optimizeThread) {
+        return;
+    }
+
+    // Work on copies; the controller keeps running
+    std::shared_ptr<DiskImage> source;
+    auto trace = std::make_shared<AccessTrace>();
+    {
+        std::lock_guard<std::mutex> guard(controllerLock);
+        if (drive.disk()) {
+            source = std::make_shared<DiskImage>(*drive.disk());
+        }
+        *trace = accessTrace;
+    }
+    if (!source) {
+        QMessageBox::information(this, tr("Optimize Interleave"), tr("Open a disk image first."));
+        return;
+    }
+    if (trace->empty()) {
+        QString path = QFileDialog::getOpenFileName(this, tr("Open Access Trace"), QString(),
+                                                    tr("Access traces (*.trace *.txt);;All files (*)"));
+        if (path.isEmpty()) {
+            return;
+        }
+        std::string error;
+        if (!trace->load(QFile::encodeName(path).toStdString(), &error)) {
+            QMessageBox::warning(this, tr("Open Access Trace"), QString::fromStdString(error));
+            return;
+        }
+    }
+
+    ui->actionOptimizeInterleave->setEnabled(false);
+    ui->statusbar->showMessage(tr("Optimizing interleave for %1 accesses...").arg(trace->size()));
+
+    auto result = std::make_shared<InterleaveResult>();
+    optimizeThread = QThread::create([source, trace, result]() {
+        *result = InterleaveOptimizer::optimize(*source, *trace);
+    });
+    connect(optimizeThread, &QThread::finished, this, [this, trace, result]() {
+        optimizeThread->deleteLater();
+        optimizeThread = nullptr;
+        ui->actionOptimizeInterleave->setEnabled(true);
+
+        ui->floppyWidget->setInterleavePreview(result->image);
+        ui->statusbar->showMessage(tr("Interleave %1, skew %2: %3 s instead of %4 s for %5 accesses")
+                                       .arg(result->interleave)
+                                       .arg(result->skew)
+                                       .arg(result->bestNs / 1e9, 0, 'f', 3)
+                                       .arg(result->baselineNs / 1e9, 0, 'f', 3)
+                                       .arg(trace->size()));
+
+        QString path = QFileDialog::getSaveFileName(this, tr("Save Format Spec"), QString(),
+                                                    tr("Format specs (*.fmt);;All files (*)"));
+        if (path.isEmpty()) {
+            return;
+        }
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QMessageBox::warning(this, tr("Save Format Spec"), file.errorString());
+            return;
+        }
+        file.write(QByteArray::fromStdString(InterleaveOptimizer::formatSpec(*result->image, *result, trace->size())));
+    });
+    optimizeThread->start();
+}
+
+void MainWindow::sampleController() {
+    ui->fdcWidget->sampleController();
+    ui->logicAnalyzer->sampleSignals();
+
+    // Sectors written since the last frame reach the disk view's layout here,
+    // not on every write; a busy controller just defers it to the next frame
+    {
+        std::unique_lock<std::mutex> guard(controllerLock, std::try_to_lock);
+        if (guard.owns_lock() && drive.disk()) {
+            drive.disk()->publishLayout();
+        }
+    }
+
+    // With the bus attached the disk view follows the head the host moves
+    if (!sharedBus) {
+        return;
+    }
+    const FdcSharedBusLayout::RegisterFile registers = sharedBus->registers();
+    if (registers.cylinder != observedCylinder) {
+        observedCylinder = registers.cylinder;
+        ui->floppyWidget->setTrack(observedCylinder);
+    }
+    if (registers.side != observedSide) {
+        observedSide = registers.side;
+        ui->floppyWidget->setSide(observedSide);
+    }
+}
+
+void MainWindow::takeSnapshot() {
+    MachineSnapshot snapshot;
+    {
+        std::lock_guard<std::mutex> guard(controllerLock);
+        snapshot = MachineSnapshot::capture(controller, drive);
+    }
+    journal->submit(std::move(snapshot));
+}
+
+void MainWindow::recoverSession(const QString &path) {
+    if (!QFile::exists(path)) {
+        return;
+    }
+    const QMessageBox::StandardButton answer =
+        QMessageBox::question(this, tr("Recover Session"),
+                              tr("The previous session did not end cleanly. Restore its last snapshot?"));
+    if (answer != QMessageBox::Yes) {
+        return;
+    }
+
+    MachineSnapshot snapshot;
+    QString error;
+    if (!SnapshotJournal::recover(path, snapshot, &error)) {
+        QMessageBox::warning(this, tr("Recover Session"), error);
+        return;
+    }
+    int cylinder = 0;
+    int side = 0;
+    {
+        std::lock_guard<std::mutex> guard(controllerLock);
+        snapshot.restore(controller, drive);
+        cylinder = drive.cylinder();
+        side = drive.side();
+    }
+    ui->floppyWidget->setDiskImage(drive.disk());
+    ui->floppyWidget->setTrack(cylinder);
+    ui->floppyWidget->setSide(side);
+}
+
 void MainWindow::updateAnimation() {
+    FLOPPY_TRACE_ZONE("gui", "MainWindow::updateAnimation");
     static double angle = 0;
     static int indexPulseCounter = 0;
 
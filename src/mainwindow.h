@@ -3,8 +3,22 @@
 
 #include <QMainWindow>
 #include <QTimer>
+#include <QThread>
+#include <memory>
+#include <mutex>
 #include "floppydiskwidget.h"
 #include "fdccontrollerwidget.h"
+#include "logicanalyzerwidget.h"
+#include "imagelibrarywidget.h"
+#include "fdchostserver.h"
+#include "fdcsharedbus.h"
+#include "accesstrace.h"
+#include "fdcmetrics.h"
+#include "imagewriteback.h"
+#include "metricshttpserver.h"
+#include "snapshotjournal.h"
+#include "floppydrive.h"
+#include "wd1793.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -24,6 +38,13 @@ private slots:
     void onSpeedChanged(int index);
     void updateAnimation();
     void onToggleView(bool checked);
+    void onOpenFluxImage();
+    void onConvertImage();
+    void onMountImage(const QString &path);
+    void onRecordTrace(bool checked);
+    void onOptimizeInterleave();
+    void sampleController();
+    void takeSnapshot();
 
 private:
     Ui::MainWindow *ui;
@@ -32,8 +53,32 @@ private:
     QTimer *animationTimer;
     bool isPlaying;
     double currentSpeed;
+    QThread *decodeThread;
+    QThread *optimizeThread;
+    QThread *convertThread;
+    QThread *mountThread;
+    QString pendingMount;       // Selected while another image was loading
+    FloppyDrive drive;
+    FdcMetrics metrics;
+    DrqMonitor drqMonitor;
+    AccessTrace accessTrace;
+    SignalTrace signalTrace;
+    Wd1793 controller;
+    QTimer *registerTimer;
+    FdcHostServer *hostServer;
+    std::mutex controllerLock;
+    std::unique_ptr<FdcSharedBus> sharedBus;
+    std::unique_ptr<FdcSharedBusService> sharedBusService;
+    QTimer *metricsTimer;
+    MetricsHttpServer *metricsServer;
+    int observedCylinder;
+    int observedSide;
+    std::unique_ptr<SnapshotJournal> journal;
+    std::unique_ptr<ImageWriteBack> writeBack;  // Saves writes to the mounted image file
+    QTimer *snapshotTimer;
     
     void setupUI();
+    void recoverSession(const QString &path);
     void createConnections();
 };
 #endif // MAINWINDOW_H 
\ No newline at end of file
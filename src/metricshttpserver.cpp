@@ -0,0 +1,102 @@
+#include "metricshttpserver.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+
+// Requests larger than this are not scrapes
+constexpr int MAX_REQUEST_BYTES = 8192;
+// A scraper sends its request at once; a connection without one by then is dropped
+constexpr int REQUEST_TIMEOUT_MS = 5000;
+
+} // namespace
+
+MetricsHttpServer::MetricsHttpServer(const FdcMetrics *registry, QObject *parent)
+    : QObject(parent)
+    , metrics(registry)
+    , server(new QTcpServer(this))
+    , haveLastScrape(false)
+{
+    connect(server, &QTcpServer::newConnection, this, &MetricsHttpServer::onNewConnection);
+}
+
+bool MetricsHttpServer::listen(const QHostAddress &address, quint16 port)
+{
+    return server->listen(address, port);
+}
+
+quint16 MetricsHttpServer::serverPort() const
+{
+    return server->serverPort();
+}
+
+QString MetricsHttpServer::errorString() const
+{
+    return server->errorString();
+}
+
+void MetricsHttpServer::onNewConnection()
+{
+    while (QTcpSocket *socket = server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, &MetricsHttpServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        // Answered sockets are already closing and get to finish sending
+        QTimer::singleShot(REQUEST_TIMEOUT_MS, socket, [socket]() {
+            if (socket->state() == QAbstractSocket::ConnectedState) {
+                socket->abort();
+            }
+        });
+    }
+}
+
+void MetricsHttpServer::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket) {
+        return;
+    }
+    if (socket->bytesAvailable() > MAX_REQUEST_BYTES) {
+        socket->abort();
+        return;
+    }
+    // Only the request line matters; wait until the header is complete
+    if (!socket->canReadLine() || !socket->peek(MAX_REQUEST_BYTES).contains("\r\n\r\n")) {
+        return;
+    }
+
+    const QList<QByteArray> requestLine = socket->readLine().trimmed().split(' ');
+    socket->readAll();
+    if (requestLine.size() < 2 || requestLine[0] != "GET") {
+        respond(socket, "405 Method Not Allowed", "text/plain", "GET only\n");
+        return;
+    }
+
+    const FdcMetrics::Snapshot current = metrics->snapshot();
+    const FdcMetrics::Snapshot *previous = haveLastScrape ? &lastScrape : nullptr;
+    const QByteArray path = requestLine[1];
+    if (path == "/metrics") {
+        respond(socket, "200 OK", "text/plain; version=0.0.4",
+                QByteArray::fromStdString(FdcMetrics::prometheusText(current, previous)));
+    } else if (path == "/metrics.json") {
+        respond(socket, "200 OK", "application/json", QByteArray::fromStdString(FdcMetrics::jsonText(current, previous)));
+    } else {
+        respond(socket, "404 Not Found", "text/plain", "Try /metrics or /metrics.json\n");
+        return;
+    }
+    lastScrape = current;
+    haveLastScrape = true;
+}
+
+void MetricsHttpServer::respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType,
+                                const QByteArray &body)
+{
+    QByteArray response = "HTTP/1.0 " + status + "\r\n"
+                          "Content-Type: " + contentType + "\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n";
+    response += body;
+    socket->write(response);
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,42 @@
+#ifndef METRICSHTTPSERVER_H
+#define METRICSHTTPSERVER_H
+
+#include "fdcmetrics.h"
+
+#include <QObject>
+#include <QHostAddress>
+
+class QTcpServer;
+class QTcpSocket;
+
+// Minimal HTTP/1.0 endpoint for scrapers: GET /metrics answers in the
+// Prometheus text format, GET /metrics.json with the same counters as JSON.
+// Every response closes the connection, and a client that has not sent a
+// complete request within a few seconds is disconnected.
+class MetricsHttpServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsHttpServer(const FdcMetrics *metrics, QObject *parent = nullptr);
+
+    bool listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = defaultPort());
+    quint16 serverPort() const;
+    QString errorString() const;
+
+    static quint16 defaultPort() { return 9793; }
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+
+private:
+    void respond(QTcpSocket *socket, const QByteArray &status, const QByteArray &contentType, const QByteArray &body);
+
+    const FdcMetrics *metrics;
+    QTcpServer *server;
+    FdcMetrics::Snapshot lastScrape;
+    bool haveLastScrape;
+};
+
+#endif // METRICSHTTPSERVER_H
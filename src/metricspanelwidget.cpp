@@ -0,0 +1,83 @@
+#include "metricspanelwidget.h"
+#include <QPen>
+#include <QFont>
+
+MetricsPanelWidget::MetricsPanelWidget(QWidget *parent)
+    : QWidget(parent)
+    , metrics(nullptr)
+    , haveSample(false)
+{
+    setMinimumSize(260, 200);
+}
+
+void MetricsPanelWidget::setMetrics(const FdcMetrics *registry)
+{
+    metrics = registry;
+    haveSample = false;
+    sampleMetrics();
+}
+
+void MetricsPanelWidget::sampleMetrics()
+{
+    if (!metrics) {
+        return;
+    }
+    previous = haveSample ? current : metrics->snapshot();
+    current = metrics->snapshot();
+    haveSample = true;
+    update();
+}
+
+void MetricsPanelWidget::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    painter.fillRect(rect(), Qt::white);
+    painter.setPen(QPen(Qt::black, 1));
+
+    painter.setFont(QFont("Arial", 12, QFont::Bold));
+    painter.drawText(10, 20, "Controller Metrics");
+
+    const uint64_t commands = current[FdcMetrics::CommandsTypeI] + current[FdcMetrics::CommandsTypeII]
+                            + current[FdcMetrics::CommandsTypeIII] + current[FdcMetrics::CommandsTypeIV];
+    const uint64_t serviced = current[FdcMetrics::DrqServiced];
+    const double drqLatencyUs = serviced ? current[FdcMetrics::DrqLatencyNs] / 1000.0 / serviced : 0.0;
+
+    int y = 40;
+    drawRow(painter, "Commands", QString("%1 (I %2, II %3, III %4, IV %5)")
+                .arg(commands)
+                .arg(current[FdcMetrics::CommandsTypeI])
+                .arg(current[FdcMetrics::CommandsTypeII])
+                .arg(current[FdcMetrics::CommandsTypeIII])
+                .arg(current[FdcMetrics::CommandsTypeIV]), 10, y);
+    drawRow(painter, "Sectors", QString("%1 read, %2 written")
+                .arg(current[FdcMetrics::SectorsRead])
+                .arg(current[FdcMetrics::SectorsWritten]), 10, y + 20);
+    drawRow(painter, "Errors", QString("CRC %1, RNF %2, Lost %3")
+                .arg(current[FdcMetrics::CrcErrors])
+                .arg(current[FdcMetrics::RecordNotFound])
+                .arg(current[FdcMetrics::LostData]), 10, y + 40);
+    drawRow(painter, "Steps", QString("%1, seek %2 ms")
+                .arg(current[FdcMetrics::Steps])
+                .arg(current[FdcMetrics::SeekTimeNs] / 1e6, 0, 'f', 1), 10, y + 60);
+    drawRow(painter, "DRQ", QString("%1 served, mean %2 us")
+                .arg(serviced)
+                .arg(drqLatencyUs, 0, 'f', 2), 10, y + 80);
+    drawRow(painter, "Emulated", QString("%1 s, %2x wall")
+                .arg(current[FdcMetrics::EmulatedNs] / 1e9, 0, 'f', 3)
+                .arg(FdcMetrics::emulatedWallRatio(current, previous), 0, 'f', 2), 10, y + 100);
+}
+
+void MetricsPanelWidget::drawRow(QPainter &painter, const QString &name, const QString &value, int x, int y)
+{
+    painter.setFont(QFont("Arial", 10));
+    painter.drawText(x, y, name + ":");
+    painter.drawText(x + 80, y, value);
+}
+
+QSize MetricsPanelWidget::sizeHint() const
+{
+    return QSize(320, 200);
+}
@@ -0,0 +1,35 @@
+#ifndef METRICSPANELWIDGET_H
+#define METRICSPANELWIDGET_H
+
+#include "fdcmetrics.h"
+
+#include <QWidget>
+#include <QPainter>
+
+// Live view of the controller counters next to the register panel. Samples
+// the registry on demand (MainWindow does so once a second) and shows rates
+// over the last interval alongside the totals.
+class MetricsPanelWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsPanelWidget(QWidget *parent = nullptr);
+
+    void setMetrics(const FdcMetrics *metrics);
+    void sampleMetrics();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    QSize sizeHint() const override;
+
+private:
+    void drawRow(QPainter &painter, const QString &name, const QString &value, int x, int y);
+
+    const FdcMetrics *metrics;
+    FdcMetrics::Snapshot current;
+    FdcMetrics::Snapshot previous;
+    bool haveSample;
+};
+
+#endif // METRICSPANELWIDGET_H
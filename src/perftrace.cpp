@@ -0,0 +1,297 @@
+#include "perftrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef QT_FLOPPY_TRACING
+
+namespace {
+
+// Single producer (the owning thread), single consumer (collect())
+struct Ring {
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    std::unique_ptr<PerfTrace::Zone[]> slots{new PerfTrace::Zone[PerfTrace::RING_SLOTS]};
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<Ring *> idle;                   // Rings of threads that have exited
+    std::vector<PerfTrace::Zone> zones;
+    std::map<uint32_t, std::string> threadNames;
+    uint32_t nextThread = 1;
+};
+
+// Never destroyed: threads may still exit after main() returns
+Registry &registry()
+{
+    static Registry *instance = new Registry;
+    return *instance;
+}
+
+std::atomic<bool> enabled(false);
+std::atomic<uint64_t> droppedZones(0);
+
+// A thread keeps its ring until it exits; the next new thread reuses it.
+// Zones carry their thread, so those still queued keep their owner.
+struct ThreadRing {
+    Ring *ring = nullptr;
+    uint32_t thread = 0;
+
+    ~ThreadRing()
+    {
+        if (ring) {
+            Registry &shared = registry();
+            std::lock_guard<std::mutex> guard(shared.mutex);
+            shared.idle.push_back(ring);
+        }
+    }
+};
+
+thread_local ThreadRing threadRing;
+
+// Caller holds the registry lock
+uint32_t threadId(Registry &shared)
+{
+    if (threadRing.thread == 0) {
+        threadRing.thread = shared.nextThread++;
+    }
+    return threadRing.thread;
+}
+
+Ring &ownRing()
+{
+    if (!threadRing.ring) {
+        Registry &shared = registry();
+        std::lock_guard<std::mutex> guard(shared.mutex);
+        threadId(shared);
+        if (shared.idle.empty()) {
+            shared.rings.emplace_back(new Ring);
+            threadRing.ring = shared.rings.back().get();
+        } else {
+            threadRing.ring = shared.idle.back();
+            shared.idle.pop_back();
+        }
+    }
+    return *threadRing.ring;
+}
+
+// Caller holds the registry lock
+void collectLocked(Registry &shared)
+{
+    for (const std::unique_ptr<Ring> &ring : shared.rings) {
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        const uint32_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            if (shared.zones.size() < PerfTrace::MAX_ZONES) {
+                shared.zones.push_back(ring->slots[tail & (PerfTrace::RING_SLOTS - 1)]);
+            } else {
+                droppedZones.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void writeString(std::ostream &out, const char *text)
+{
+    out << '"';
+    for (const char *c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\' << *c;
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(*c));
+            out << escaped;
+        } else {
+            out << *c;
+        }
+    }
+    out << '"';
+}
+
+// Chrome trace timestamps are microseconds
+void writeMicroseconds(std::ostream &out, uint64_t ns)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%llu.%03u", static_cast<unsigned long long>(ns / 1000),
+                  static_cast<unsigned>(ns % 1000));
+    out << text;
+}
+
+} // namespace
+
+void PerfTrace::setEnabled(bool on)
+{
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool PerfTrace::isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t PerfTrace::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void PerfTrace::record(const char *category, const char *name, uint64_t beginNs, uint64_t endNs)
+{
+    Ring &ring = ownRing();
+    const uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= RING_SLOTS) {
+        droppedZones.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring.slots[head & (RING_SLOTS - 1)] = Zone{ category, name, beginNs, endNs, threadRing.thread };
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void PerfTrace::setThreadName(const char *name)
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    shared.threadNames[threadId(shared)] = name;
+}
+
+void PerfTrace::collect()
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    collectLocked(shared);
+}
+
+void PerfTrace::clear()
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    collectLocked(shared);
+    shared.zones.clear();
+    droppedZones.store(0, std::memory_order_relaxed);
+}
+
+size_t PerfTrace::zoneCount()
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    return shared.zones.size();
+}
+
+uint64_t PerfTrace::dropped()
+{
+    return droppedZones.load(std::memory_order_relaxed);
+}
+
+bool PerfTrace::exportChromeTrace(const std::string &path, std::string *error)
+{
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> guard(shared.mutex);
+    collectLocked(shared);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        if (error) {
+            *error = "Cannot create " + path;
+        }
+        return false;
+    }
+
+    // Zones are queued as they end; the viewer wants them by start
+    std::vector<const Zone *> order;
+    order.reserve(shared.zones.size());
+    for (const Zone &zone : shared.zones) {
+        order.push_back(&zone);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Zone *a, const Zone *b) { return a->beginNs < b->beginNs; });
+    const uint64_t origin = order.empty() ? 0 : order.front()->beginNs;
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"qt-floppy\"}}";
+    for (const auto &entry : shared.threadNames) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << entry.first << ",\"args\":{\"name\":";
+        writeString(out, entry.second.c_str());
+        out << "}}";
+    }
+    for (const Zone *zone : order) {
+        out << ",\n{\"name\":";
+        writeString(out, zone->name);
+        out << ",\"cat\":";
+        writeString(out, zone->category);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << zone->thread << ",\"ts\":";
+        writeMicroseconds(out, zone->beginNs - origin);
+        out << ",\"dur\":";
+        writeMicroseconds(out, zone->endNs - zone->beginNs);
+        out << '}';
+    }
+    out << "\n]}\n";
+    if (!out.flush()) {
+        if (error) {
+            *error = "Write error on " + path;
+        }
+        return false;
+    }
+    return true;
+}
+
+#else
+
+void PerfTrace::setEnabled(bool)
+{
+}
+
+bool PerfTrace::isEnabled()
+{
+    return false;
+}
+
+uint64_t PerfTrace::now()
+{
+    return 0;
+}
+
+void PerfTrace::record(const char *, const char *, uint64_t, uint64_t)
+{
+}
+
+void PerfTrace::setThreadName(const char *)
+{
+}
+
+void PerfTrace::collect()
+{
+}
+
+void PerfTrace::clear()
+{
+}
+
+size_t PerfTrace::zoneCount()
+{
+    return 0;
+}
+
+uint64_t PerfTrace::dropped()
+{
+    return 0;
+}
+
+bool PerfTrace::exportChromeTrace(const std::string &, std::string *error)
+{
+    if (error) {
+        *error = "Tracing is not built in; configure with -DQT_FLOPPY_TRACING=ON";
+    }
+    return false;
+}
+
+#endif
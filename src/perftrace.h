@@ -0,0 +1,100 @@
+#ifndef PERFTRACE_H
+#define PERFTRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Scoped trace zones for looking at emulation, decode, I/O and rendering
+// on one timeline. A zone is a FLOPPY_TRACE_ZONE() at the top of a block;
+// it records its wall-clock begin and end into a lock-free ring owned by
+// the calling thread, so threads never contend while tracing. collect()
+// moves what the rings hold into the trace, exportChromeTrace() writes the
+// trace as Chrome trace-event JSON, which chrome://tracing and Perfetto
+// open. A ring that fills up before the next collect() drops zones and
+// counts them.
+//
+// Zones are only compiled in with the QT_FLOPPY_TRACING CMake option;
+// without it the macros expand to nothing and cost nothing. Built in, a
+// zone costs one relaxed load until setEnabled(true).
+class PerfTrace
+{
+public:
+    struct Zone {
+        const char *category;   // String literals, never copied
+        const char *name;
+        uint64_t beginNs;
+        uint64_t endNs;
+        uint32_t thread;
+    };
+
+    static constexpr uint32_t RING_SLOTS = 1 << 15;     // Per thread, power of two
+    static constexpr size_t MAX_ZONES = size_t(1) << 22; // Kept by collect()
+
+    static constexpr bool isCompiledIn()
+    {
+#ifdef QT_FLOPPY_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    // Wall clock shared by all threads
+    static uint64_t now();
+    static void record(const char *category, const char *name, uint64_t beginNs, uint64_t endNs);
+    // Names the calling thread in the exported trace
+    static void setThreadName(const char *name);
+
+    // Moves zones from the thread rings into the trace; call it often
+    // enough that a busy thread does not fill its ring
+    static void collect();
+    static void clear();
+    static size_t zoneCount();
+    static uint64_t dropped();
+
+    // Collects, then writes the whole trace
+    static bool exportChromeTrace(const std::string &path, std::string *error = nullptr);
+};
+
+class PerfTraceZone
+{
+public:
+    PerfTraceZone(const char *category, const char *name)
+        : m_category(category)
+        , m_name(name)
+        , m_beginNs(PerfTrace::isEnabled() ? PerfTrace::now() : 0)
+    {
+    }
+
+    ~PerfTraceZone()
+    {
+        if (m_beginNs != 0) {
+            PerfTrace::record(m_category, m_name, m_beginNs, PerfTrace::now());
+        }
+    }
+
+    PerfTraceZone(const PerfTraceZone &) = delete;
+    PerfTraceZone &operator=(const PerfTraceZone &) = delete;
+
+private:
+    const char *m_category;
+    const char *m_name;
+    uint64_t m_beginNs;     // 0: tracing was off when the zone started
+};
+
+#ifdef QT_FLOPPY_TRACING
+#define FLOPPY_TRACE_CONCAT_(a, b) a##b
+#define FLOPPY_TRACE_CONCAT(a, b) FLOPPY_TRACE_CONCAT_(a, b)
+#define FLOPPY_TRACE_ZONE(category, name) \
+    PerfTraceZone FLOPPY_TRACE_CONCAT(perfTraceZone, __LINE__)(category, name)
+#define FLOPPY_TRACE_THREAD(name) PerfTrace::setThreadName(name)
+#else
+#define FLOPPY_TRACE_ZONE(category, name) static_cast<void>(0)
+#define FLOPPY_TRACE_THREAD(name) static_cast<void>(0)
+#endif
+
+#endif // PERFTRACE_H
@@ -0,0 +1,137 @@
+#include "scpreader.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 0x10;
+constexpr size_t TRACK_TABLE_OFFSET = 0x10;
+constexpr size_t EXTENDED_TRACK_TABLE_OFFSET = 0x80;
+constexpr uint8_t FLAG_EXTENDED = 0x40;
+constexpr double BASE_RESOLUTION_NS = 25.0;
+
+uint32_t readLe32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+         | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+} // namespace
+
+ScpReader::ScpReader()
+    : m_revolutions(0)
+    , m_heads(0)
+    , m_cylinders(0)
+    , m_sides(0)
+    , m_tickNs(BASE_RESOLUTION_NS)
+{
+}
+
+bool ScpReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header)) || std::memcmp(header, "SCP", 3) != 0) {
+        return fail("Not a SuperCard Pro image");
+    }
+
+    m_revolutions = header[5];
+    const int endTrack = header[7];
+    const uint8_t flags = header[8];
+    const uint8_t cellWidth = header[9];
+    m_heads = header[10];
+    m_tickNs = BASE_RESOLUTION_NS * (header[11] + 1);
+
+    if (cellWidth != 0 && cellWidth != 16) {
+        return fail("Unsupported SCP bit cell width");
+    }
+
+    // Heads 0 interleaves both sides as cylinder * 2 + side, 1 and 2 hold a single side
+    if (m_heads == 0) {
+        m_sides = 2;
+        m_cylinders = endTrack / 2 + 1;
+    } else {
+        m_sides = (m_heads == 2) ? 2 : 1;
+        m_cylinders = endTrack + 1;
+    }
+
+    const size_t tableOffset = (flags & FLAG_EXTENDED) ? EXTENDED_TRACK_TABLE_OFFSET : TRACK_TABLE_OFFSET;
+    uint8_t table[MAX_TRACKS * 4];
+    m_file.seekg(static_cast<std::streamoff>(tableOffset));
+    if (!m_file.read(reinterpret_cast<char *>(table), sizeof(table))) {
+        return fail("Truncated SCP track table");
+    }
+    m_trackOffsets.resize(MAX_TRACKS);
+    for (int i = 0; i < MAX_TRACKS; ++i) {
+        m_trackOffsets[i] = readLe32(table + i * 4);
+    }
+    return true;
+}
+
+int ScpReader::trackIndex(int cylinder, int side) const
+{
+    if (cylinder < 0 || cylinder >= m_cylinders || side < 0 || side >= m_sides) {
+        return -1;
+    }
+    int index = -1;
+    if (m_heads == 0) {
+        index = cylinder * 2 + side;
+    } else if ((m_heads == 1 && side == 0) || (m_heads == 2 && side == 1)) {
+        index = cylinder;
+    }
+    return (index >= 0 && index < MAX_TRACKS) ? index : -1;
+}
+
+int ScpReader::revolutionCount(int cylinder, int side) const
+{
+    const int index = trackIndex(cylinder, side);
+    return (index >= 0 && m_trackOffsets[index] != 0) ? m_revolutions : 0;
+}
+
+bool ScpReader::readRevolution(int cylinder, int side, int revolution, FluxSink &sink)
+{
+    const int index = trackIndex(cylinder, side);
+    if (index < 0 || m_trackOffsets[index] == 0 || revolution < 0 || revolution >= m_revolutions) {
+        return fail("Track not present in SCP image");
+    }
+
+    const uint32_t trackOffset = m_trackOffsets[index];
+    uint8_t entry[12];
+    m_file.clear();
+    m_file.seekg(static_cast<std::streamoff>(trackOffset) + 4 + revolution * 12);
+    if (!m_file.read(reinterpret_cast<char *>(entry), sizeof(entry))) {
+        return fail("Truncated SCP track header");
+    }
+    uint32_t remaining = readLe32(entry + 4);
+    const uint32_t dataOffset = readLe32(entry + 8);
+
+    m_file.seekg(static_cast<std::streamoff>(trackOffset) + dataOffset);
+
+    // Samples are big-endian 16-bit; a zero sample carries 65536 ticks into the next
+    uint8_t raw[BLOCK_SIZE * 2];
+    uint32_t intervals[BLOCK_SIZE];
+    uint32_t carry = 0;
+    while (remaining > 0) {
+        const uint32_t chunk = remaining < BLOCK_SIZE ? remaining : static_cast<uint32_t>(BLOCK_SIZE);
+        if (!m_file.read(reinterpret_cast<char *>(raw), chunk * 2)) {
+            return fail("Truncated SCP flux data");
+        }
+        size_t count = 0;
+        for (uint32_t i = 0; i < chunk; ++i) {
+            const uint32_t sample = (static_cast<uint32_t>(raw[i * 2]) << 8) | raw[i * 2 + 1];
+            if (sample == 0) {
+                carry += 0x10000;
+                continue;
+            }
+            intervals[count++] = static_cast<uint32_t>((carry + sample) * m_tickNs + 0.5);
+            carry = 0;
+        }
+        sink.fluxBlock(intervals, count);
+        remaining -= chunk;
+    }
+    return true;
+}
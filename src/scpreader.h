@@ -0,0 +1,38 @@
+#ifndef SCPREADER_H
+#define SCPREADER_H
+
+#include "fluxreader.h"
+
+#include <fstream>
+#include <vector>
+
+// SuperCard Pro (.scp) flux image reader
+class ScpReader : public FluxReader
+{
+public:
+    ScpReader();
+
+    const char *formatName() const override { return "SuperCard Pro"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    int revolutionCount(int cylinder, int side) const override;
+    bool readRevolution(int cylinder, int side, int revolution, FluxSink &sink) override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    static constexpr int MAX_TRACKS = 168;
+
+    int trackIndex(int cylinder, int side) const;
+
+    std::ifstream m_file;
+    int m_revolutions;
+    int m_heads;
+    int m_cylinders;
+    int m_sides;
+    double m_tickNs;
+    std::vector<uint32_t> m_trackOffsets;
+};
+
+#endif // SCPREADER_H
@@ -0,0 +1,127 @@
+#include "sectorpool.h"
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+constexpr int CLASS_COUNT = 8;     // 64 ... 8192
+constexpr uint32_t HEAP_CLASS = CLASS_COUNT;
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+struct SizeClass {
+    std::mutex mutex;
+    FreeBlock *free = nullptr;
+    std::vector<void *> slabs;
+    size_t inUse = 0;
+};
+
+struct Pool {
+    SizeClass classes[CLASS_COUNT];
+    std::mutex heapMutex;
+    size_t heapBlocks = 0;
+    size_t heapBytes = 0;
+};
+
+// Never destroyed: buffers may outlive static destructors
+Pool &pool()
+{
+    static Pool *instance = new Pool();
+    return *instance;
+}
+
+int classOf(size_t size)
+{
+    int index = 0;
+    for (size_t capacity = SectorPool::MIN_CLASS; capacity < size; capacity *= 2) {
+        ++index;
+    }
+    return index;
+}
+
+size_t blockBytes(int index)
+{
+    return sizeof(SectorPool::Block) + (SectorPool::MIN_CLASS << index);
+}
+
+} // namespace
+
+SectorPool::Block *SectorPool::allocate(size_t size)
+{
+    Block *block;
+    uint32_t index;
+    if (size > MAX_CLASS) {
+        index = HEAP_CLASS;
+        block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+        std::lock_guard<std::mutex> lock(pool().heapMutex);
+        ++pool().heapBlocks;
+        pool().heapBytes += sizeof(Block) + size;
+    } else {
+        index = static_cast<uint32_t>(classOf(size));
+        SizeClass &sizeClass = pool().classes[index];
+        const size_t bytes = blockBytes(static_cast<int>(index));
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        if (!sizeClass.free) {
+            char *slab = static_cast<char *>(::operator new(SLAB_BYTES));
+            sizeClass.slabs.push_back(slab);
+            for (size_t offset = SLAB_BYTES / bytes * bytes; offset >= bytes; offset -= bytes) {
+                FreeBlock *free = reinterpret_cast<FreeBlock *>(slab + offset - bytes);
+                free->next = sizeClass.free;
+                sizeClass.free = free;
+            }
+        }
+        FreeBlock *free = sizeClass.free;
+        sizeClass.free = free->next;
+        ++sizeClass.inUse;
+        block = reinterpret_cast<Block *>(free);
+        size = MIN_CLASS << index;
+    }
+    new (block) Block{ { 1 }, static_cast<uint32_t>(size), index };
+    return block;
+}
+
+void SectorPool::release(Block *block)
+{
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    const uint32_t index = block->sizeClass;
+    if (index == HEAP_CLASS) {
+        {
+            std::lock_guard<std::mutex> lock(pool().heapMutex);
+            --pool().heapBlocks;
+            pool().heapBytes -= sizeof(Block) + block->capacity;
+        }
+        block->~Block();
+        ::operator delete(block);
+        return;
+    }
+    SizeClass &sizeClass = pool().classes[index];
+    block->~Block();
+    FreeBlock *free = reinterpret_cast<FreeBlock *>(block);
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    free->next = sizeClass.free;
+    sizeClass.free = free;
+    --sizeClass.inUse;
+}
+
+SectorPool::Stats SectorPool::stats()
+{
+    Stats stats;
+    for (int index = 0; index < CLASS_COUNT; ++index) {
+        SizeClass &sizeClass = pool().classes[index];
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        stats.blocksInUse += sizeClass.inUse;
+        stats.bytesInUse += sizeClass.inUse * blockBytes(index);
+        stats.bytesReserved += sizeClass.slabs.size() * SLAB_BYTES;
+    }
+    std::lock_guard<std::mutex> lock(pool().heapMutex);
+    stats.blocksInUse += pool().heapBlocks;
+    stats.bytesInUse += pool().heapBytes;
+    stats.bytesReserved += pool().heapBytes;
+    return stats;
+}
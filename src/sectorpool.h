@@ -0,0 +1,46 @@
+#ifndef SECTORPOOL_H
+#define SECTORPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Process-wide allocator for sector buffers. Sizes are rounded up to a
+// power of two from 64 to 8192 bytes; each class carves fixed-size blocks
+// out of 64 KiB slabs and keeps freed blocks on a free list for reuse, so
+// loading and dropping images does not go through the general heap and a
+// buffer costs its class size plus a 16-byte header. Larger buffers fall
+// back to the heap. Blocks carry their own reference count; SectorData is
+// the only user. Slabs are never returned to the system.
+class SectorPool
+{
+public:
+    static constexpr size_t MIN_CLASS = 64;
+    static constexpr size_t MAX_CLASS = 8192;
+    static constexpr size_t SLAB_BYTES = 64 * 1024;
+
+    struct alignas(16) Block {
+        std::atomic<uint32_t> refs;
+        uint32_t capacity;
+        uint32_t sizeClass;
+
+        uint8_t *bytes() { return reinterpret_cast<uint8_t *>(this + 1); }
+        const uint8_t *bytes() const { return reinterpret_cast<const uint8_t *>(this + 1); }
+    };
+
+    struct Stats {
+        size_t blocksInUse = 0;
+        size_t bytesInUse = 0;      // Capacity of live blocks, headers included
+        size_t bytesReserved = 0;   // Slabs plus heap blocks
+    };
+
+    // A block of at least 'size' bytes with one reference, contents undefined
+    static Block *allocate(size_t size);
+    static void retain(Block *block) { block->refs.fetch_add(1, std::memory_order_relaxed); }
+    // Drops a reference and frees the block with the last one
+    static void release(Block *block);
+
+    static Stats stats();
+};
+
+#endif // SECTORPOOL_H
@@ -0,0 +1,458 @@
+#include "sectorstore.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SECTOR_STORE_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x53534651;     // "QFSS"
+constexpr uint32_t VERSION = 1;
+constexpr uint64_t HEADER_SIZE = 32;
+constexpr uint64_t RECORD_HEADER_SIZE = 16;
+constexpr uint64_t MIN_CAPACITY = 1 << 20;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t end;
+    uint64_t records;
+    uint64_t reserved;
+};
+
+struct RecordHeader {
+    uint64_t hash;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == HEADER_SIZE, "Header layout");
+static_assert(sizeof(RecordHeader) == RECORD_HEADER_SIZE, "RecordHeader layout");
+
+uint64_t recordSize(size_t size)
+{
+    return RECORD_HEADER_SIZE + ((size + 7) & ~static_cast<uint64_t>(7));
+}
+
+// XXH64
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t read64(const uint8_t *p)
+{
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= xxhRound(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+void setError(std::string *error, const std::string &what)
+{
+    if (error) {
+        *error = what + ": " + std::strerror(errno);
+    }
+}
+
+} // namespace
+
+// One mmap of the file. Growing the store maps the file again; views into
+// an older mapping keep it alive until they are gone.
+struct SectorStoreMapping {
+    const uint8_t *base = nullptr;
+    uint64_t size = 0;
+
+    ~SectorStoreMapping()
+    {
+#ifdef SECTOR_STORE_HAVE_MMAP
+        if (base) {
+            munmap(const_cast<uint8_t *>(base), size);
+        }
+#endif
+    }
+};
+
+uint64_t SectorStore::hash(const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = PRIME1 + PRIME2;
+        uint64_t v2 = PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME1;
+        do {
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else {
+        h = PRIME5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxhRound(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+SectorStore::SectorStore(std::string path, int fd, bool writable)
+    : m_path(std::move(path))
+    , m_fd(fd)
+    , m_writable(writable)
+    , m_end(HEADER_SIZE)
+    , m_records(0)
+    , m_added(0)
+    , m_duplicates(0)
+{
+}
+
+SectorData SectorStore::get(Ref ref) const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (!m_mapping || ref < HEADER_SIZE || ref + RECORD_HEADER_SIZE > m_end || (ref & 7) != 0) {
+        return SectorData();
+    }
+    RecordHeader record;
+    std::memcpy(&record, m_mapping->base + ref, sizeof(record));
+    if (ref + recordSize(record.size) > m_end) {
+        return SectorData();
+    }
+    return SectorData::view(m_mapping->base + ref + RECORD_HEADER_SIZE, record.size, m_mapping);
+}
+
+uint64_t SectorStore::sectorCount() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_records;
+}
+
+uint64_t SectorStore::storedBytes() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_end;
+}
+
+uint64_t SectorStore::addedSectors() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_added;
+}
+
+uint64_t SectorStore::duplicateSectors() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_duplicates;
+}
+
+#ifdef SECTOR_STORE_HAVE_MMAP
+
+namespace {
+
+// Read-only stores, and mappings still viewed by loaded sectors, by path.
+// Reopening a store whose images are alive reuses their mapping.
+std::mutex openStoresMutex;
+std::map<std::string, std::weak_ptr<SectorStore>> openStores;
+std::map<std::string, std::weak_ptr<SectorStoreMapping>> openMappings;
+
+} // namespace
+
+SectorStore::~SectorStore()
+{
+    // A file that failed to load as a store is left alone
+    if (m_writable && m_mapping && flush()) {
+        // Give back the room grow() reserved ahead
+        if (ftruncate(m_fd, static_cast<off_t>(m_end)) != 0) {
+            m_end = 0;
+        }
+    }
+    m_mapping.reset();
+    close(m_fd);
+}
+
+std::shared_ptr<SectorStore> SectorStore::openWritable(const std::string &path, std::string *error)
+{
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        setError(error, "open " + path);
+        return nullptr;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        setError(error, "Sector store " + path + " is being written by another process");
+        close(fd);
+        return nullptr;
+    }
+    std::shared_ptr<SectorStore> store(new SectorStore(path, fd, true));
+    if (!store->load(error)) {
+        return nullptr;
+    }
+    return store;
+}
+
+std::shared_ptr<SectorStore> SectorStore::openReadOnly(const std::string &path, std::string *error)
+{
+    std::lock_guard<std::mutex> guard(openStoresMutex);
+    std::shared_ptr<SectorStore> store = openStores[path].lock();
+    if (store) {
+        store->refresh();
+        return store;
+    }
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        setError(error, "open " + path);
+        return nullptr;
+    }
+    store.reset(new SectorStore(path, fd, false));
+    if (!store->load(error)) {
+        return nullptr;
+    }
+    openStores[path] = store;
+    return store;
+}
+
+bool SectorStore::map(uint64_t size, std::string *error)
+{
+    void *memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (memory == MAP_FAILED) {
+        setError(error, "mmap " + m_path);
+        return false;
+    }
+    auto mapping = std::make_shared<SectorStoreMapping>();
+    mapping->base = static_cast<const uint8_t *>(memory);
+    mapping->size = size;
+    m_mapping = std::move(mapping);
+    return true;
+}
+
+bool SectorStore::load(std::string *error)
+{
+    struct stat info;
+    if (fstat(m_fd, &info) != 0) {
+        setError(error, "stat " + m_path);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(info.st_size);
+    if (size == 0 && m_writable) {
+        const Header header = { MAGIC, VERSION, HEADER_SIZE, 0, 0 };
+        if (pwrite(m_fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            setError(error, "write " + m_path);
+            return false;
+        }
+        size = HEADER_SIZE;
+    }
+
+    Header header;
+    if (size < HEADER_SIZE || pread(m_fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        header.magic != MAGIC || header.version != VERSION || header.end < HEADER_SIZE || header.end > size) {
+        if (error) {
+            *error = m_path + ": not a sector store";
+        }
+        return false;
+    }
+    if (!m_writable) {
+        std::shared_ptr<SectorStoreMapping> mapping = openMappings[m_path].lock();
+        if (mapping && mapping->size >= header.end) {
+            m_mapping = std::move(mapping);
+        }
+    }
+    if (!m_mapping && !map(size, error)) {
+        return false;
+    }
+    if (!m_writable) {
+        openMappings[m_path] = m_mapping;
+    }
+    m_end = header.end;
+    m_records = header.records;
+
+    // Only the writer needs the content index; anything past 'end' is an
+    // append a crashed writer never committed and gets overwritten
+    if (m_writable) {
+        for (Ref ref = HEADER_SIZE; ref + RECORD_HEADER_SIZE <= m_end;) {
+            RecordHeader record;
+            std::memcpy(&record, m_mapping->base + ref, sizeof(record));
+            m_index.emplace(record.hash, ref);
+            ref += recordSize(record.size);
+        }
+    }
+    return true;
+}
+
+bool SectorStore::grow(uint64_t needed)
+{
+    if (needed <= m_mapping->size) {
+        return true;
+    }
+    uint64_t capacity = m_mapping->size * 2 > MIN_CAPACITY ? m_mapping->size * 2 : MIN_CAPACITY;
+    capacity = capacity > needed ? capacity : needed;
+    if (ftruncate(m_fd, static_cast<off_t>(capacity)) != 0) {
+        return false;
+    }
+    return map(capacity, nullptr);
+}
+
+SectorStore::Ref SectorStore::add(const uint8_t *data, size_t size)
+{
+    if (!m_writable || size > UINT32_MAX) {
+        return NO_REF;
+    }
+    const uint64_t h = hash(data, size);
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    ++m_added;
+    auto range = m_index.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        RecordHeader record;
+        std::memcpy(&record, m_mapping->base + it->second, sizeof(record));
+        if (record.size == size && std::memcmp(m_mapping->base + it->second + RECORD_HEADER_SIZE, data, size) == 0) {
+            ++m_duplicates;
+            return it->second;
+        }
+    }
+
+    const Ref ref = m_end;
+    const uint64_t length = recordSize(size);
+    if (!grow(ref + length)) {
+        return NO_REF;
+    }
+    const RecordHeader record = { h, static_cast<uint32_t>(size), 0 };
+    static const uint8_t padding[8] = {};
+    const size_t pad = static_cast<size_t>(length - RECORD_HEADER_SIZE - size);
+    if (pwrite(m_fd, &record, sizeof(record), static_cast<off_t>(ref)) != static_cast<ssize_t>(sizeof(record)) ||
+        pwrite(m_fd, data, size, static_cast<off_t>(ref + RECORD_HEADER_SIZE)) != static_cast<ssize_t>(size) ||
+        pwrite(m_fd, padding, pad, static_cast<off_t>(ref + RECORD_HEADER_SIZE + size)) != static_cast<ssize_t>(pad)) {
+        return NO_REF;
+    }
+    m_end += length;
+    ++m_records;
+    m_index.emplace(h, ref);
+    return ref;
+}
+
+bool SectorStore::flush()
+{
+    if (!m_writable) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    const Header header = { MAGIC, VERSION, m_end, m_records, 0 };
+    return pwrite(m_fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+}
+
+bool SectorStore::refresh()
+{
+    if (m_writable) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    Header header;
+    struct stat info;
+    if (pread(m_fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        fstat(m_fd, &info) != 0 || header.magic != MAGIC || header.end > static_cast<uint64_t>(info.st_size)) {
+        return false;
+    }
+    if (header.end > m_mapping->size && !map(static_cast<uint64_t>(info.st_size), nullptr)) {
+        return false;
+    }
+    m_end = header.end;
+    m_records = header.records;
+    return true;
+}
+
+#else
+
+SectorStore::~SectorStore()
+{
+}
+
+std::shared_ptr<SectorStore> SectorStore::openWritable(const std::string &path, std::string *error)
+{
+    (void)path;
+    if (error) {
+        *error = "Sector stores need mmap";
+    }
+    return nullptr;
+}
+
+std::shared_ptr<SectorStore> SectorStore::openReadOnly(const std::string &path, std::string *error)
+{
+    return openWritable(path, error);
+}
+
+SectorStore::Ref SectorStore::add(const uint8_t *data, size_t size)
+{
+    (void)data;
+    (void)size;
+    return NO_REF;
+}
+
+bool SectorStore::flush()
+{
+    return false;
+}
+
+bool SectorStore::refresh()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef SECTORSTORE_H
+#define SECTORSTORE_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Content-addressed sector store. Every distinct sector content is kept
+// once in an append-only file and addressed by its offset there; images
+// refer to sectors instead of carrying them (see SectorTableReader), so
+// filler sectors, catalogs and boot loaders shared by a library are stored
+// and mapped only once.
+//
+// File layout, little endian:
+//   header  "QFSS" magic, version, end offset, record count (32 bytes)
+//   records hash (XXH64), size, reserved, data padded to 8 bytes
+//
+// The file is memory-mapped read-only and sectors loaded from it view the
+// mapping, so any number of images and processes share the same pages.
+// One process at a time may add sectors; it holds an exclusive lock on the
+// file. Readers see sectors added after they opened the store only after
+// refresh().
+struct SectorStoreMapping;
+
+class SectorStore
+{
+public:
+    using Ref = uint64_t;
+    static constexpr Ref NO_REF = 0;
+
+    // File name of the store shared by all tables in a directory
+    static constexpr const char *DEFAULT_FILE_NAME = "sectors.qfs";
+
+    ~SectorStore();
+
+    SectorStore(const SectorStore &) = delete;
+    SectorStore &operator=(const SectorStore &) = delete;
+
+    // Opens or creates the store for adding sectors
+    static std::shared_ptr<SectorStore> openWritable(const std::string &path, std::string *error = nullptr);
+    // Maps an existing store read-only. Opening the same path again while
+    // the first one is alive returns the same mapping.
+    static std::shared_ptr<SectorStore> openReadOnly(const std::string &path, std::string *error = nullptr);
+
+    static uint64_t hash(const uint8_t *data, size_t size);
+
+    const std::string &path() const { return m_path; }
+    bool isWritable() const { return m_writable; }
+
+    // Stores 'data' unless the same bytes are already there; NO_REF on error
+    Ref add(const uint8_t *data, size_t size);
+    // View of the sector at 'ref' that keeps the mapping alive; empty for a bad ref
+    SectorData get(Ref ref) const;
+
+    // Writes the header so readers see the sectors added so far
+    bool flush();
+    // Picks up sectors another process added since this one mapped the file
+    bool refresh();
+
+    uint64_t sectorCount() const;
+    uint64_t storedBytes() const;
+    // Sectors add() was asked for and how many of them were already present
+    uint64_t addedSectors() const;
+    uint64_t duplicateSectors() const;
+
+private:
+    SectorStore(std::string path, int fd, bool writable);
+
+    bool load(std::string *error);
+    bool map(uint64_t size, std::string *error);
+    bool grow(uint64_t needed);
+
+    std::string m_path;
+    int m_fd;
+    bool m_writable;
+
+    mutable std::mutex m_mutex;
+    std::shared_ptr<SectorStoreMapping> m_mapping;
+    uint64_t m_end;
+    uint64_t m_records;
+    uint64_t m_added;
+    uint64_t m_duplicates;
+    std::unordered_multimap<uint64_t, Ref> m_index;     // Writable stores only
+};
+
+#endif // SECTORSTORE_H
@@ -0,0 +1,216 @@
+#include "sectortable.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr char MAGIC[4] = { 'Q', 'F', 'R', 'T' };
+constexpr uint8_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 64;
+constexpr size_t HEADER_VERSION = 4;
+constexpr size_t HEADER_CYLINDERS = 5;
+constexpr size_t HEADER_SIDES = 6;
+constexpr size_t HEADER_STORE = 8;
+constexpr size_t STORE_NAME_SIZE = HEADER_SIZE - HEADER_STORE;
+
+constexpr size_t TRACK_HEADER_SIZE = 8;
+constexpr size_t SECTOR_ENTRY_SIZE = 24;
+
+constexpr uint8_t FLAG_ID_CRC_OK = 0x01;
+constexpr uint8_t FLAG_DATA_CRC_OK = 0x02;
+constexpr uint8_t FLAG_DELETED = 0x04;
+constexpr uint8_t FLAG_WEAK = 0x08;
+
+std::string directoryOf(const std::string &path)
+{
+    const size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+void putLe(uint8_t *p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint64_t getLe(const uint8_t *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    return value;
+}
+
+} // namespace
+
+SectorTableReader::SectorTableReader()
+    : m_cylinders(0)
+    , m_sides(0)
+{
+}
+
+bool SectorTableReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+    uint8_t header[HEADER_SIZE];
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+        std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+        return fail("Not a sector table");
+    }
+    if (header[HEADER_VERSION] != VERSION) {
+        return fail("Unsupported sector table version " + std::to_string(header[HEADER_VERSION]));
+    }
+    m_cylinders = header[HEADER_CYLINDERS];
+    m_sides = header[HEADER_SIDES];
+
+    const char *name = reinterpret_cast<const char *>(header + HEADER_STORE);
+    const std::string storeName(name, strnlen(name, STORE_NAME_SIZE));
+    std::string error;
+    m_store = SectorStore::openReadOnly(directoryOf(path) + storeName, &error);
+    if (!m_store) {
+        return fail(error);
+    }
+    return true;
+}
+
+bool SectorTableReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    block.cylinder = cylinder;
+    block.side = side;
+    block.bytes.resize(TRACK_HEADER_SIZE);
+    if (!m_file.read(reinterpret_cast<char *>(block.bytes.data()), TRACK_HEADER_SIZE)) {
+        return fail("Truncated sector table");
+    }
+    const size_t count = static_cast<size_t>(getLe(block.bytes.data() + 2, 2));
+    block.bytes.resize(TRACK_HEADER_SIZE + count * SECTOR_ENTRY_SIZE);
+    if (!m_file.read(reinterpret_cast<char *>(block.bytes.data() + TRACK_HEADER_SIZE),
+                     static_cast<std::streamsize>(count * SECTOR_ENTRY_SIZE))) {
+        return fail("Truncated sector table");
+    }
+    return true;
+}
+
+Track SectorTableReader::decode(const TrackBlock &block) const
+{
+    Track track;
+    track.cylinder = block.cylinder;
+    track.side = block.side;
+    const uint8_t *header = block.bytes.data();
+    track.encoding = header[0] == 0 ? Encoding::FM : Encoding::MFM;
+    track.revolutions = header[1];
+
+    const size_t count = (block.bytes.size() - TRACK_HEADER_SIZE) / SECTOR_ENTRY_SIZE;
+    track.sectors.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *entry = header + TRACK_HEADER_SIZE + i * SECTOR_ENTRY_SIZE;
+        Sector &sector = track.sectors[i];
+        sector.cylinder = entry[0];
+        sector.head = entry[1];
+        sector.id = entry[2];
+        sector.sizeCode = entry[3];
+        sector.idCrcOk = (entry[4] & FLAG_ID_CRC_OK) != 0;
+        sector.dataCrcOk = (entry[4] & FLAG_DATA_CRC_OK) != 0;
+        sector.deleted = (entry[4] & FLAG_DELETED) != 0;
+        sector.weak = (entry[4] & FLAG_WEAK) != 0;
+        const uint32_t angle = static_cast<uint32_t>(getLe(entry + 8, 4));
+        std::memcpy(&sector.angle, &angle, sizeof(angle));
+        if (getLe(entry + 12, 4) > 0) {
+            sector.data = m_store->get(getLe(entry + 16, 8));
+        }
+    }
+    return track;
+}
+
+SectorTableWriter::SectorTableWriter()
+{
+}
+
+bool SectorTableWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    (void)dataRateKbps;
+    if (cylinders > 255) {
+        return fail("Sector tables hold at most 255 cylinders");
+    }
+    std::string error;
+    m_store = SectorStore::openWritable(directoryOf(path) + SectorStore::DEFAULT_FILE_NAME, &error);
+    if (!m_store) {
+        return fail(error);
+    }
+
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    uint8_t header[HEADER_SIZE] = {};
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    header[HEADER_VERSION] = VERSION;
+    header[HEADER_CYLINDERS] = static_cast<uint8_t>(cylinders);
+    header[HEADER_SIDES] = static_cast<uint8_t>(sides);
+    std::strncpy(reinterpret_cast<char *>(header + HEADER_STORE), SectorStore::DEFAULT_FILE_NAME, STORE_NAME_SIZE - 1);
+    if (!m_file.write(reinterpret_cast<const char *>(header), sizeof(header))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool SectorTableWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    block.bytes.assign(TRACK_HEADER_SIZE + track.sectors.size() * SECTOR_ENTRY_SIZE, 0);
+    uint8_t *header = block.bytes.data();
+    header[0] = track.encoding == Encoding::FM ? 0 : 1;
+    header[1] = static_cast<uint8_t>(track.revolutions);
+    putLe(header + 2, track.sectors.size(), 2);
+
+    // The store is locked internally, so encoding may run next to the writer
+    for (size_t i = 0; i < track.sectors.size(); ++i) {
+        const Sector &sector = track.sectors[i];
+        uint8_t *entry = header + TRACK_HEADER_SIZE + i * SECTOR_ENTRY_SIZE;
+        entry[0] = sector.cylinder;
+        entry[1] = sector.head;
+        entry[2] = sector.id;
+        entry[3] = sector.sizeCode;
+        entry[4] = static_cast<uint8_t>((sector.idCrcOk ? FLAG_ID_CRC_OK : 0) | (sector.dataCrcOk ? FLAG_DATA_CRC_OK : 0) |
+                                        (sector.deleted ? FLAG_DELETED : 0) | (sector.weak ? FLAG_WEAK : 0));
+        uint32_t angle;
+        std::memcpy(&angle, &sector.angle, sizeof(angle));
+        putLe(entry + 8, angle, 4);
+        if (sector.hasData()) {
+            const SectorStore::Ref ref = m_store->add(sector.data.data(), sector.data.size());
+            if (ref == SectorStore::NO_REF) {
+                if (error) {
+                    *error = "Cannot add sectors to " + m_store->path();
+                }
+                return false;
+            }
+            putLe(entry + 12, sector.data.size(), 4);
+            putLe(entry + 16, ref, 8);
+        }
+    }
+    return true;
+}
+
+bool SectorTableWriter::writeBlock(const TrackBlock &block)
+{
+    if (!m_file.write(reinterpret_cast<const char *>(block.bytes.data()),
+                      static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool SectorTableWriter::finish()
+{
+    // Sectors first: a table must never refer past the store's committed end
+    if (!m_store->flush()) {
+        return fail("Cannot update " + m_store->path());
+    }
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
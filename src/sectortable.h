@@ -0,0 +1,61 @@
+#ifndef SECTORTABLE_H
+#define SECTORTABLE_H
+
+#include "sectorstore.h"
+#include "trackstream.h"
+
+#include <fstream>
+#include <memory>
+
+// Disk image kept as a table of references into a SectorStore (.qfr).
+// All tables in a directory share the store SectorStore::DEFAULT_FILE_NAME
+// next to them, so a library converted into one directory keeps every
+// distinct sector once. Tracks read from a table view the store's mapping
+// instead of copying their sectors.
+//
+// Layout, little endian:
+//   header  "QFRT", version, cylinders, sides, store file name (64 bytes)
+//   tracks  encoding, revolutions, sector count (8 bytes), then per sector
+//           C, H, R, N, flags, angle, data size, store reference (24 bytes)
+class SectorTableReader : public TrackReader
+{
+public:
+    SectorTableReader();
+
+    const char *formatName() const override { return "QFR"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+    const std::shared_ptr<SectorStore> &store() const { return m_store; }
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    std::ifstream m_file;
+    int m_cylinders;
+    int m_sides;
+    std::shared_ptr<SectorStore> m_store;
+};
+
+class SectorTableWriter : public TrackWriter
+{
+public:
+    SectorTableWriter();
+
+    const char *formatName() const override { return "QFR"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    std::ofstream m_file;
+    std::shared_ptr<SectorStore> m_store;
+};
+
+#endif // SECTORTABLE_H
@@ -0,0 +1,224 @@
+#include "sessionfarm.h"
+#include "floppydrive.h"
+#include "perftrace.h"
+#include "sectorstore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint8_t COMMAND_RESTORE = 0x00;
+constexpr uint8_t COMMAND_SEEK = 0x10;
+constexpr uint8_t COMMAND_READ_SECTOR = 0x80;
+constexpr uint8_t COMMAND_WRITE_SECTOR = 0xA0;
+
+constexpr uint8_t TYPE_I_ERRORS = Wd1793::STATUS_SEEK_ERROR | Wd1793::STATUS_CRC_ERROR;
+constexpr uint8_t TYPE_II_ERRORS = Wd1793::STATUS_RECORD_NOT_FOUND | Wd1793::STATUS_CRC_ERROR |
+                                   Wd1793::STATUS_LOST_DATA | Wd1793::STATUS_WRITE_PROTECT;
+
+constexpr uint64_t DIGEST_PRIME = 0x100000001B3ULL;
+
+// 'source' with every sector in a buffer of its own, so copies of the
+// result share reference counts with nobody else
+DiskImage deepCopy(const DiskImage &source)
+{
+    DiskImage copy(source.cylinderCount(), source.sideCount());
+    for (int cylinder = 0; cylinder < source.cylinderCount(); ++cylinder) {
+        for (int side = 0; side < source.sideCount(); ++side) {
+            Track &track = *copy.track(cylinder, side);
+            track = *source.track(cylinder, side);
+            for (Sector &sector : track.sectors) {
+                if (sector.hasData()) {
+                    sector.data = SectorData(std::vector<uint8_t>(sector.data.begin(), sector.data.end()));
+                }
+            }
+        }
+    }
+    return copy;
+}
+
+} // namespace
+
+// Everything one worker needs to run sessions back to back
+class SessionFarm::Arena
+{
+public:
+    explicit Arena(const Wd1793::Timing &timing)
+        : m_disk(std::make_shared<DiskImage>())
+        , m_buffer(1024, 0)
+        , m_transferred(0)
+    {
+        m_fdc.setDrive(&m_drive);
+        m_fdc.setTiming(timing);
+        m_drive.insertDisk(m_disk);
+    }
+
+    FarmResult run(const FarmSession &session)
+    {
+        FLOPPY_TRACE_ZONE("fdc", "SessionFarm session");
+        FarmResult result;
+        const DiskImage &pristine = image(session.image);
+        // Same shape every time, so this reuses the track and sector vectors
+        *m_disk = pristine;
+        m_drive.restoreState(FloppyDrive::State());
+        m_fdc.reset(0);
+        m_fdc.setDoubleDensity(pristine.isDoubleDensity());
+
+        m_fdc.write(Wd1793::CommandRegister, COMMAND_RESTORE, 0);
+        runCommand(result);
+        const uint64_t start = m_fdc.time();
+
+        for (const AccessTrace::Access &access : session.trace->accesses()) {
+            uint64_t t = m_fdc.time() + access.idleNs;
+            m_drive.setSide(access.side);
+            if (m_drive.cylinder() != access.cylinder) {
+                m_fdc.write(Wd1793::DataRegister, static_cast<uint8_t>(access.cylinder), t);
+                m_fdc.write(Wd1793::CommandRegister, COMMAND_SEEK, t);
+                runCommand(result);
+                t = m_fdc.time();
+            }
+            m_fdc.write(Wd1793::SectorRegister, static_cast<uint8_t>(access.sector), t);
+            m_fdc.write(Wd1793::CommandRegister, access.write ? COMMAND_WRITE_SECTOR : COMMAND_READ_SECTOR, t);
+            runCommand(result);
+        }
+        result.emulatedNs = m_fdc.time() - start;
+        result.privateBytes = privateBytes(pristine);
+        return result;
+    }
+
+    size_t imageBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto &entry : m_images) {
+            const DiskImage &copy = entry.second.copy;
+            for (int cylinder = 0; cylinder < copy.cylinderCount(); ++cylinder) {
+                for (int side = 0; side < copy.sideCount(); ++side) {
+                    for (const Sector &sector : copy.track(cylinder, side)->sectors) {
+                        bytes += sector.data.size();
+                    }
+                }
+            }
+        }
+        return bytes;
+    }
+
+private:
+    struct CachedImage {
+        std::shared_ptr<const DiskImage> source;    // Keeps the key's address from being reused
+        DiskImage copy;
+    };
+
+    const DiskImage &image(const std::shared_ptr<const DiskImage> &source)
+    {
+        auto found = m_images.find(source.get());
+        if (found == m_images.end()) {
+            found = m_images.emplace(source.get(), CachedImage{ source, deepCopy(*source) }).first;
+        }
+        return found->second.copy;
+    }
+
+    // Runs the command in progress to its end, moving data as soon as DRQ rises
+    void runCommand(FarmResult &result)
+    {
+        const bool reading = m_fdc.commandType() == Wd1793::CommandType::TypeII && !(m_fdc.commandRegister() & 0x20);
+        m_transferred = 0;
+        while (m_fdc.isBusy()) {
+            if (m_fdc.drq()) {
+                if (m_transferred >= m_buffer.size()) {
+                    m_transferred = 0;
+                }
+                uint8_t *span = m_buffer.data() + m_transferred;
+                const size_t room = m_buffer.size() - m_transferred;
+                if (m_fdc.commandType() == Wd1793::CommandType::TypeII && (m_fdc.commandRegister() & 0x20)) {
+                    m_transferred += m_fdc.writeDataBlock(span, room, m_fdc.time(), 0);
+                } else {
+                    m_transferred += m_fdc.readDataBlock(span, room, m_fdc.time(), 0);
+                }
+            } else {
+                m_fdc.advance(std::max(m_fdc.nextEventTime(), m_fdc.time()));
+            }
+        }
+
+        ++result.commands;
+        const uint8_t errors = m_fdc.commandType() == Wd1793::CommandType::TypeI ? TYPE_I_ERRORS : TYPE_II_ERRORS;
+        if (m_fdc.statusRegister() & errors) {
+            ++result.errors;
+        }
+        if (reading) {
+            result.digest = (result.digest ^ SectorStore::hash(m_buffer.data(), m_transferred)) * DIGEST_PRIME;
+        }
+    }
+
+    // Drive, controller, buffers and track tables, plus sectors the session
+    // wrote; unwritten sectors share the worker's image copy
+    size_t privateBytes(const DiskImage &pristine) const
+    {
+        size_t bytes = sizeof(FloppyDrive) + sizeof(Wd1793) + sizeof(DiskImage) + m_buffer.capacity();
+        for (int cylinder = 0; cylinder < m_disk->cylinderCount(); ++cylinder) {
+            for (int side = 0; side < m_disk->sideCount(); ++side) {
+                const Track &track = *m_disk->track(cylinder, side);
+                const Track &original = *pristine.track(cylinder, side);
+                bytes += sizeof(Track) + track.sectors.capacity() * sizeof(Sector);
+                for (size_t index = 0; index < track.sectors.size(); ++index) {
+                    const SectorData &data = track.sectors[index].data;
+                    if (index >= original.sectors.size() || !data.isSharedWith(original.sectors[index].data)) {
+                        bytes += data.size();
+                    }
+                }
+            }
+        }
+        return bytes;
+    }
+
+    FloppyDrive m_drive;
+    Wd1793 m_fdc;
+    std::shared_ptr<DiskImage> m_disk;
+    std::vector<uint8_t> m_buffer;
+    size_t m_transferred;
+    std::unordered_map<const DiskImage *, CachedImage> m_images;
+};
+
+SessionFarm::SessionFarm(const FarmOptions &options)
+    : m_options(options)
+    , m_pool(options.threads)
+{
+    // Each arena is allocated by the thread that first uses it, next to its data
+    m_arenas.resize(static_cast<size_t>(m_pool.threadCount()));
+}
+
+SessionFarm::~SessionFarm() = default;
+
+std::vector<FarmResult> SessionFarm::run(const std::vector<FarmSession> &sessions, FarmStats *stats)
+{
+    std::vector<FarmResult> results(sessions.size());
+    const auto started = std::chrono::steady_clock::now();
+    m_pool.parallelForStealing(sessions.size(), [&](size_t index, int worker) {
+        std::unique_ptr<Arena> &arena = m_arenas[static_cast<size_t>(worker)];
+        if (!arena) {
+            arena.reset(new Arena(m_options.timing));
+        }
+        results[index] = arena->run(sessions[index]);
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    if (stats) {
+        *stats = FarmStats();
+        stats->instances = sessions.size();
+        stats->threads = m_pool.threadCount();
+        stats->seconds = elapsed.count();
+        stats->instancesPerSecond = stats->seconds > 0.0 ? sessions.size() / stats->seconds : 0.0;
+        size_t totalBytes = 0;
+        for (const FarmResult &result : results) {
+            stats->emulatedNs += result.emulatedNs;
+            stats->peakInstanceBytes = std::max(stats->peakInstanceBytes, result.privateBytes);
+            totalBytes += result.privateBytes;
+        }
+        stats->averageInstanceBytes = results.empty() ? 0 : totalBytes / results.size();
+        for (const std::unique_ptr<Arena> &arena : m_arenas) {
+            stats->imageBytes += arena ? arena->imageBytes() : 0;
+        }
+    }
+    return results;
+}
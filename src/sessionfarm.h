@@ -0,0 +1,76 @@
+#ifndef SESSIONFARM_H
+#define SESSIONFARM_H
+
+#include "accesstrace.h"
+#include "diskimage.h"
+#include "taskpool.h"
+#include "wd1793.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// One scripted session: a disk and the sector accesses a host makes on it
+struct FarmSession {
+    std::shared_ptr<const DiskImage> image;
+    std::shared_ptr<const AccessTrace> trace;
+};
+
+struct FarmResult {
+    uint64_t emulatedNs = 0;    // From the end of the power-on Restore to the end of the last command
+    uint32_t commands = 0;      // Seeks included
+    uint32_t errors = 0;        // Commands ending with Seek Error, RNF, CRC error, Lost Data or write protect
+    uint64_t digest = 0;        // Of every byte read, in order
+    size_t privateBytes = 0;    // Memory of the instance not shared with other instances
+};
+
+struct FarmOptions {
+    int threads = 0;            // 0 uses all cores
+    Wd1793::Timing timing;
+};
+
+struct FarmStats {
+    size_t instances = 0;
+    int threads = 0;
+    double seconds = 0.0;
+    double instancesPerSecond = 0.0;
+    uint64_t emulatedNs = 0;
+    size_t averageInstanceBytes = 0;
+    size_t peakInstanceBytes = 0;
+    size_t imageBytes = 0;      // Worker-private copies of the source images, all workers
+};
+
+// Runs many independent drive + controller instances in one process, for
+// regression farms. Each session is replayed like InterleaveOptimizer
+// replays a trace: power-on Restore, seeks where needed, and a host that
+// answers DRQ immediately. Sessions are spread over a work-stealing
+// TaskPool; every worker owns an arena with its drive, controller, transfer
+// buffer, scratch disk and private copies of the source images, all reset
+// rather than freed between sessions. In steady state an instance only
+// allocates for the sectors it writes, and workers share no reference
+// counts, so throughput grows with the core count. Results depend only on
+// the session, never on the worker or thread count.
+class SessionFarm
+{
+public:
+    explicit SessionFarm(const FarmOptions &options = FarmOptions());
+    ~SessionFarm();
+
+    SessionFarm(const SessionFarm &) = delete;
+    SessionFarm &operator=(const SessionFarm &) = delete;
+
+    int threadCount() const { return m_pool.threadCount(); }
+
+    // One result per session, in order; arenas stay warm for the next call
+    std::vector<FarmResult> run(const std::vector<FarmSession> &sessions, FarmStats *stats = nullptr);
+
+private:
+    class Arena;
+
+    FarmOptions m_options;
+    TaskPool m_pool;
+    std::vector<std::unique_ptr<Arena>> m_arenas;
+};
+
+#endif // SESSIONFARM_H
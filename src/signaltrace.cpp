@@ -0,0 +1,285 @@
+#include "signaltrace.h"
+
+#include <algorithm>
+#include <limits>
+
+SignalTrace::SignalTrace()
+    : m_head(0)
+    , m_tail(0)
+    , m_dropped(0)
+    , m_slots(new Edge[RING_SLOTS])
+    , m_levels{}
+    , m_haveLevels(false)
+    , m_pulseEndNs{}
+{
+}
+
+void SignalTrace::push(uint64_t timeNs, uint8_t signal, uint8_t value)
+{
+    const uint32_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == RING_SLOTS) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_slots[head & (RING_SLOTS - 1)] = Edge{ timeNs, signal, value };
+    m_head.store(head + 1, std::memory_order_release);
+}
+
+bool SignalTrace::pop(Edge &edge)
+{
+    const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (m_head.load(std::memory_order_acquire) == tail) {
+        return false;
+    }
+    edge = m_slots[tail & (RING_SLOTS - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void SignalTrace::flushPulses(uint64_t timeNs)
+{
+    for (;;) {
+        int next = -1;
+        for (int signal = 0; signal < PIN_COUNT; ++signal) {
+            const uint64_t end = m_pulseEndNs[signal];
+            if (end != 0 && end <= timeNs && (next < 0 || end < m_pulseEndNs[next])) {
+                next = signal;
+            }
+        }
+        if (next < 0) {
+            return;
+        }
+        push(m_pulseEndNs[next], static_cast<uint8_t>(next), 0);
+        m_pulseEndNs[next] = 0;
+    }
+}
+
+void SignalTrace::sample(uint64_t timeNs, const Levels &levels)
+{
+    flushPulses(timeNs);
+    for (int signal = 0; signal < SIGNAL_COUNT; ++signal) {
+        if (signal == Index || signal == Step) {
+            continue;
+        }
+        if (!m_haveLevels || levels[signal] != m_levels[signal]) {
+            push(timeNs, static_cast<uint8_t>(signal), levels[signal]);
+            m_levels[signal] = levels[signal];
+        }
+    }
+    m_haveLevels = true;
+}
+
+void SignalTrace::pulse(uint64_t timeNs, Signal signal, uint64_t widthNs)
+{
+    flushPulses(timeNs);
+    push(timeNs, signal, 1);
+    m_pulseEndNs[signal] = timeNs + std::max<uint64_t>(widthNs, 1);
+}
+
+const char *SignalTrace::signalName(int signal)
+{
+    static const char *const NAMES[SIGNAL_COUNT] = {
+        "INT", "DRQ", "INDEX", "STEP", "DIR", "HLD", "WG", "CMD", "TRACK", "SECTOR", "DATA"
+    };
+    return signal >= 0 && signal < SIGNAL_COUNT ? NAMES[signal] : "?";
+}
+
+void SignalHistory::Lane::append(uint64_t timeNs, uint8_t value)
+{
+    times.push_back(timeNs);
+    values.push_back(value);
+    const size_t count = values.size();
+    const size_t last = count - 1;
+
+    size_t span = FANOUT;
+    for (size_t level = 0; span <= count || level < pyramid.size(); ++level, span *= FANOUT) {
+        if (level == pyramid.size()) {
+            // The first full node of a new level, built from the level below
+            // (it already covers the new edge)
+            const Node first = range(0, span);
+            pyramid.emplace_back(1, first);
+            continue;
+        }
+        std::vector<Node> &nodes = pyramid[level];
+        const size_t node = last / span;
+        if (node == nodes.size()) {
+            nodes.push_back(Node{ value, value });
+        } else {
+            nodes[node].low = std::min(nodes[node].low, value);
+            nodes[node].high = std::max(nodes[node].high, value);
+        }
+    }
+}
+
+void SignalHistory::Lane::rebuild()
+{
+    std::vector<uint64_t> oldTimes;
+    std::vector<uint8_t> oldValues;
+    oldTimes.swap(times);
+    oldValues.swap(values);
+    pyramid.clear();
+    times.reserve(oldTimes.size());
+    values.reserve(oldValues.size());
+    for (size_t i = 0; i < oldTimes.size(); ++i) {
+        append(oldTimes[i], oldValues[i]);
+    }
+}
+
+SignalHistory::Node SignalHistory::Lane::range(size_t begin, size_t end) const
+{
+    Node result{ 0xFF, 0x00 };
+    while (begin < end) {
+        // Largest aligned node that fits, single edges at the ragged ends
+        size_t level = 0;
+        size_t span = 1;
+        while (level < pyramid.size() && begin % (span * FANOUT) == 0 && begin + span * FANOUT <= end) {
+            span *= FANOUT;
+            ++level;
+        }
+        const Node node = level == 0 ? Node{ values[begin], values[begin] } : pyramid[level - 1][begin / span];
+        result.low = std::min(result.low, node.low);
+        result.high = std::max(result.high, node.high);
+        begin += span;
+    }
+    return result;
+}
+
+size_t SignalHistory::drain(SignalTrace &trace)
+{
+    size_t taken = 0;
+    SignalTrace::Edge edge;
+    while (trace.pop(edge)) {
+        append(edge);
+        ++taken;
+    }
+    return taken;
+}
+
+void SignalHistory::append(const SignalTrace::Edge &edge)
+{
+    if (edge.signal >= SignalTrace::SIGNAL_COUNT) {
+        return;
+    }
+    Lane &lane = m_lanes[edge.signal];
+    if (!lane.times.empty() && edge.timeNs < lane.times.back()) {
+        clear();
+    }
+    if (lane.times.size() >= MAX_EDGES) {
+        lane.times.erase(lane.times.begin(), lane.times.begin() + MAX_EDGES / 2);
+        lane.values.erase(lane.values.begin(), lane.values.begin() + MAX_EDGES / 2);
+        lane.rebuild();
+    }
+    lane.append(edge.timeNs, edge.value);
+    m_lastTime = std::max(m_lastTime, edge.timeNs);
+}
+
+void SignalHistory::clear()
+{
+    for (Lane &lane : m_lanes) {
+        lane.times.clear();
+        lane.values.clear();
+        lane.pyramid.clear();
+    }
+    m_lastTime = 0;
+}
+
+bool SignalHistory::empty() const
+{
+    for (const Lane &lane : m_lanes) {
+        if (!lane.times.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t SignalHistory::firstTime() const
+{
+    uint64_t first = std::numeric_limits<uint64_t>::max();
+    for (const Lane &lane : m_lanes) {
+        if (!lane.times.empty()) {
+            first = std::min(first, lane.times.front());
+        }
+    }
+    return empty() ? 0 : first;
+}
+
+SignalHistory::Span SignalHistory::span(int signal, uint64_t from, uint64_t to) const
+{
+    Span result;
+    const Lane &lane = m_lanes[signal];
+    // Edges at or before 'from' set the entering level, later ones fall inside
+    const size_t begin = static_cast<size_t>(std::upper_bound(lane.times.begin(), lane.times.end(), from) - lane.times.begin());
+    const size_t end = std::max(begin, static_cast<size_t>(std::lower_bound(lane.times.begin(), lane.times.end(), to) - lane.times.begin()));
+    Node node{ 0xFF, 0x00 };
+    if (begin > 0) {
+        node.low = node.high = lane.values[begin - 1];
+        result.known = true;
+    }
+    if (end > begin) {
+        const Node inside = lane.range(begin, end);
+        node.low = std::min(node.low, inside.low);
+        node.high = std::max(node.high, inside.high);
+        result.known = true;
+    }
+    if (result.known) {
+        result.low = node.low;
+        result.high = node.high;
+    }
+    return result;
+}
+
+void SignalHistory::spans(int signal, uint64_t from, uint64_t stepNs, size_t count, Span *out) const
+{
+    const Lane &lane = m_lanes[signal];
+    const auto times = lane.times.begin();
+    const size_t size = lane.times.size();
+    // First edge after the column start; columns share boundaries
+    size_t begin = static_cast<size_t>(std::upper_bound(times, lane.times.end(), from) - times);
+    for (size_t column = 0; column < count; ++column) {
+        const uint64_t to = from + (column + 1) * stepNs;
+        // Gallop forward from 'begin': most columns hold few edges
+        size_t low = begin;
+        size_t probe = 1;
+        while (low + probe < size && lane.times[low + probe - 1] < to) {
+            low += probe;
+            probe *= 2;
+        }
+        const size_t end = static_cast<size_t>(
+            std::lower_bound(times + static_cast<std::ptrdiff_t>(low), times + static_cast<std::ptrdiff_t>(std::min(size, low + probe)), to) - times);
+
+        Span &result = out[column];
+        result = Span();
+        Node node{ 0xFF, 0x00 };
+        if (begin > 0) {
+            node.low = node.high = lane.values[begin - 1];
+            result.known = true;
+        }
+        if (end > begin) {
+            const Node inside = lane.range(begin, end);
+            node.low = std::min(node.low, inside.low);
+            node.high = std::max(node.high, inside.high);
+            result.known = true;
+        }
+        if (result.known) {
+            result.low = node.low;
+            result.high = node.high;
+        }
+        // Edges exactly at the boundary belong to the next column's entering level
+        begin = end;
+        while (begin < size && lane.times[begin] <= to) {
+            ++begin;
+        }
+    }
+}
+
+bool SignalHistory::valueAt(int signal, uint64_t timeNs, uint8_t &value) const
+{
+    const Lane &lane = m_lanes[signal];
+    const size_t after = static_cast<size_t>(std::upper_bound(lane.times.begin(), lane.times.end(), timeNs) - lane.times.begin());
+    if (after == 0) {
+        return false;
+    }
+    value = lane.values[after - 1];
+    return true;
+}
@@ -0,0 +1,141 @@
+#ifndef SIGNALTRACE_H
+#define SIGNALTRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Edges of the controller's pins and registers for a logic analyzer view.
+// Wd1793 samples its levels after every event and host access and only
+// changes are queued, stamped with emulated time, in a single producer /
+// single consumer lock-free ring. The emulation never waits: when the
+// reader falls behind, edges are dropped and counted. Pulses (INDEX, STEP)
+// are queued with their falling edge held back until time passes it, so
+// the ring stays in time order.
+class SignalTrace
+{
+public:
+    enum Signal : uint8_t {
+        Intrq,
+        Drq,
+        Index,
+        Step,
+        Direction,      // 1 steps in, towards higher cylinders
+        HeadLoad,
+        WriteGate,
+        Command,
+        Track,
+        Sector,
+        Data,
+        SIGNAL_COUNT
+    };
+    // Signals below this are one bit wide, the rest are register bytes
+    static constexpr int PIN_COUNT = Command;
+
+    static constexpr uint32_t RING_SLOTS = 1 << 16;     // Power of two
+    static constexpr uint64_t STEP_PULSE_NS = 4000;     // 4 us at 1 MHz
+
+    struct Edge {
+        uint64_t timeNs;
+        uint8_t signal;
+        uint8_t value;
+    };
+
+    // Index and Step are pulses; their entries are ignored by sample()
+    using Levels = std::array<uint8_t, SIGNAL_COUNT>;
+
+    SignalTrace();
+
+    SignalTrace(const SignalTrace &) = delete;
+    SignalTrace &operator=(const SignalTrace &) = delete;
+
+    // Producer side; time must not go backwards between calls
+    void sample(uint64_t timeNs, const Levels &levels);
+    void pulse(uint64_t timeNs, Signal signal, uint64_t widthNs);
+
+    // Consumer side
+    bool pop(Edge &edge);
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    static const char *signalName(int signal);
+
+private:
+    void push(uint64_t timeNs, uint8_t signal, uint8_t value);
+    // Falling edges of pulses that ended by timeNs, in time order
+    void flushPulses(uint64_t timeNs);
+
+    alignas(64) std::atomic<uint32_t> m_head;
+    alignas(64) std::atomic<uint32_t> m_tail;
+    std::atomic<uint64_t> m_dropped;
+    std::unique_ptr<Edge[]> m_slots;
+
+    // Producer only
+    Levels m_levels;
+    bool m_haveLevels;
+    std::array<uint64_t, PIN_COUNT> m_pulseEndNs;   // 0: no pulse pending
+};
+
+// Everything a SignalTrace delivered, per signal, with a min/max pyramid
+// over the edges: level k holds the lowest and highest value of each run
+// of FANOUT^(k+1) edges. A query for the values a signal takes over a
+// time range costs two binary searches and O(FANOUT * log n) node reads,
+// however many edges fall inside, so a view can ask once per pixel column
+// and stay fast zoomed out over millions of edges. Each signal keeps at
+// most MAX_EDGES edges; the older half goes when it is full. Not thread
+// safe; the view drains the trace and queries from its own thread.
+class SignalHistory
+{
+public:
+    static constexpr size_t FANOUT = 8;
+    static constexpr size_t MAX_EDGES = size_t(1) << 22;
+
+    // Values over a time range; constant when low == high
+    struct Span {
+        bool known = false;     // False before the first edge of the signal
+        uint8_t low = 0;
+        uint8_t high = 0;
+    };
+
+    // Pops everything queued; returns the number of edges taken
+    size_t drain(SignalTrace &trace);
+    // Edges must come in time order per signal; an earlier one (controller
+    // reset or a restored snapshot) starts the history over
+    void append(const SignalTrace::Edge &edge);
+    void clear();
+
+    size_t edgeCount(int signal) const { return m_lanes[signal].times.size(); }
+    bool empty() const;
+    uint64_t firstTime() const;
+    uint64_t lastTime() const { return m_lastTime; }
+
+    // Level entering 'from' and every value taken in [from, to)
+    Span span(int signal, uint64_t from, uint64_t to) const;
+    // span() of 'count' adjacent ranges of 'stepNs' each starting at 'from',
+    // one per pixel column; each boundary is searched from the previous one
+    void spans(int signal, uint64_t from, uint64_t stepNs, size_t count, Span *out) const;
+    // Level at timeNs; false before the first edge
+    bool valueAt(int signal, uint64_t timeNs, uint8_t &value) const;
+
+private:
+    struct Node {
+        uint8_t low;
+        uint8_t high;
+    };
+    struct Lane {
+        std::vector<uint64_t> times;
+        std::vector<uint8_t> values;
+        std::vector<std::vector<Node>> pyramid;
+
+        void append(uint64_t timeNs, uint8_t value);
+        void rebuild();
+        Node range(size_t begin, size_t end) const;
+    };
+
+    std::array<Lane, SignalTrace::SIGNAL_COUNT> m_lanes;
+    uint64_t m_lastTime = 0;
+};
+
+#endif // SIGNALTRACE_H
@@ -0,0 +1,211 @@
+#include "snapshotjournal.h"
+#include "perftrace.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+
+const QByteArray MAGIC("QFSJ");
+
+QByteArray record(const std::vector<uint8_t> &encoded)
+{
+    const QByteArray compressed = qCompress(reinterpret_cast<const uchar *>(encoded.data()),
+                                            static_cast<int>(encoded.size()));
+    QByteArray bytes(4, '\0');
+    const quint32 size = static_cast<quint32>(compressed.size());
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>(size >> (8 * i));
+    }
+    return bytes + compressed;
+}
+
+} // namespace
+
+SnapshotJournal::SnapshotJournal(const QString &path, std::unique_ptr<QLockFile> lock)
+    : m_path(path)
+    , m_lock(std::move(lock))
+    , m_stopping(false)
+    , m_sinceFull(0)
+{
+    m_thread = std::thread(&SnapshotJournal::run, this);
+}
+
+SnapshotJournal::~SnapshotJournal()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+        m_wake.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+QString SnapshotJournal::defaultPath()
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + QLatin1String("/recovery.qfsj");
+}
+
+QString SnapshotJournal::instancePath()
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + QStringLiteral("/recovery-%1.qfsj").arg(QCoreApplication::applicationPid());
+}
+
+std::unique_ptr<QLockFile> SnapshotJournal::claim(const QString &path)
+{
+    std::unique_ptr<QLockFile> lock(new QLockFile(path + QLatin1String(".lock")));
+    // Held for the whole session, so never stale by age; a lock whose
+    // process has exited still is
+    lock->setStaleLockTime(0);
+    if (!lock->tryLock(0)) {
+        return nullptr;
+    }
+    return lock;
+}
+
+void SnapshotJournal::submit(MachineSnapshot snapshot)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_pending.reset(new MachineSnapshot(std::move(snapshot)));
+    m_wake.notify_one();
+}
+
+void SnapshotJournal::discard()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_pending.reset();
+        m_stopping = true;
+        m_wake.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    QFile::remove(m_path);
+    m_lock.reset();
+}
+
+QString SnapshotJournal::errorString() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_error;
+}
+
+void SnapshotJournal::run()
+{
+    FLOPPY_TRACE_THREAD("SnapshotJournal");
+    for (;;) {
+        std::unique_ptr<MachineSnapshot> snapshot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_pending || m_stopping; });
+            if (!m_pending) {
+                return;
+            }
+            snapshot = std::move(m_pending);
+        }
+        if (write(*snapshot)) {
+            m_base = std::move(snapshot);
+        }
+    }
+}
+
+bool SnapshotJournal::write(const MachineSnapshot &snapshot)
+{
+    FLOPPY_TRACE_ZONE("io", "SnapshotJournal::write");
+    QString error;
+    if (!m_base || m_sinceFull >= FULL_INTERVAL) {
+        // Start over; the old journal stays valid until the new one is in place
+        QSaveFile file(m_path);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(MAGIC);
+            file.write(record(SnapshotCodec::encode(snapshot)));
+        }
+        if (file.commit()) {
+            m_sinceFull = 0;
+        } else {
+            error = file.errorString();
+        }
+    } else {
+        QFile file(m_path);
+        if (file.open(QIODevice::Append)) {
+            const QByteArray bytes = record(SnapshotCodec::encode(snapshot, m_base.get()));
+            if (file.write(bytes) == bytes.size() && file.flush()) {
+                ++m_sinceFull;
+            } else {
+                error = file.errorString();
+            }
+        } else {
+            error = file.errorString();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_error = error;
+    }
+    // After a failed write the next snapshot starts a fresh journal
+    if (!error.isEmpty()) {
+        m_base.reset();
+    }
+    return error.isEmpty();
+}
+
+bool SnapshotJournal::recover(const QString &path, MachineSnapshot &snapshot, QString *error)
+{
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(file.errorString());
+    }
+    const QByteArray bytes = file.readAll();
+    if (!bytes.startsWith(MAGIC)) {
+        return fail(QObject::tr("%1 is not a snapshot journal").arg(path));
+    }
+
+    // A crash while appending leaves a partial record at the end; the
+    // snapshots before it are still good
+    std::unique_ptr<MachineSnapshot> last;
+    int pos = MAGIC.size();
+    while (bytes.size() - pos >= 4) {
+        quint32 size = 0;
+        for (int i = 0; i < 4; ++i) {
+            size |= static_cast<quint32>(static_cast<uchar>(bytes[pos + i])) << (8 * i);
+        }
+        if (size > static_cast<quint32>(bytes.size() - pos - 4)) {
+            break;
+        }
+        const QByteArray encoded = qUncompress(bytes.mid(pos + 4, static_cast<int>(size)));
+        auto decoded = std::make_unique<MachineSnapshot>();
+        std::string message;
+        if (encoded.isEmpty() ||
+            !SnapshotCodec::decode(reinterpret_cast<const uint8_t *>(encoded.constData()),
+                                   static_cast<size_t>(encoded.size()), last.get(), *decoded, &message)) {
+            break;
+        }
+        last = std::move(decoded);
+        pos += 4 + static_cast<int>(size);
+    }
+    if (!last) {
+        return fail(QObject::tr("%1 holds no complete snapshot").arg(path));
+    }
+    snapshot = std::move(*last);
+    return true;
+}
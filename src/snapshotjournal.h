@@ -0,0 +1,76 @@
+#ifndef SNAPSHOTJOURNAL_H
+#define SNAPSHOTJOURNAL_H
+
+#include "machinesnapshot.h"
+
+#include <QLockFile>
+#include <QString>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Crash recovery journal of emulation snapshots. submit() only queues a
+// snapshot taken with MachineSnapshot::capture(); a background thread
+// encodes it as a delta against the previous one, compresses it with
+// qCompress and appends it to the journal. Every FULL_INTERVAL snapshots
+// the journal is replaced by one holding a full snapshot, so it stays
+// small and recovery never replays a long chain. A snapshot submitted
+// while the previous one is still being written replaces it.
+//
+// Every running instance needs a journal of its own: the one that holds the
+// lock from claim() on a path journals there, others use instancePath().
+//
+// File layout: "QFSJ", then records of a little-endian uint32 length and
+// the qCompress'ed SnapshotCodec data.
+class SnapshotJournal
+{
+public:
+    static constexpr int FULL_INTERVAL = 32;
+
+    // 'lock' from claim(path) is held until the journal is gone
+    explicit SnapshotJournal(const QString &path, std::unique_ptr<QLockFile> lock = nullptr);
+    // Writes what is still queued
+    ~SnapshotJournal();
+
+    SnapshotJournal(const SnapshotJournal &) = delete;
+    SnapshotJournal &operator=(const SnapshotJournal &) = delete;
+
+    // Default journal in the application's data directory
+    static QString defaultPath();
+    // Journal of this process alone, for when another instance holds the default one
+    static QString instancePath();
+    // Lock on the journal at 'path', null while another running instance
+    // holds it; a lock left behind by a crashed instance is taken over
+    static std::unique_ptr<QLockFile> claim(const QString &path);
+
+    const QString &path() const { return m_path; }
+    void submit(MachineSnapshot snapshot);
+    // Stops journaling and removes the file, for a clean shutdown
+    void discard();
+    // Last write error, empty if none
+    QString errorString() const;
+
+    // Replays the journal at 'path' up to its last complete record
+    static bool recover(const QString &path, MachineSnapshot &snapshot, QString *error = nullptr);
+
+private:
+    void run();
+    bool write(const MachineSnapshot &snapshot);
+
+    const QString m_path;
+    std::unique_ptr<QLockFile> m_lock;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::unique_ptr<MachineSnapshot> m_pending;
+    bool m_stopping;
+    QString m_error;
+    std::thread m_thread;
+
+    // Worker thread only
+    std::unique_ptr<MachineSnapshot> m_base;
+    int m_sinceFull;
+};
+
+#endif // SNAPSHOTJOURNAL_H
@@ -0,0 +1,214 @@
+#include "taskpool.h"
+#include "perftrace.h"
+
+#include <algorithm>
+
+namespace {
+
+// Shares pack 32-bit bounds; longer ranges run as several batches
+constexpr size_t MAX_SHARED_BATCH = 0xFFFFFFFFu;
+
+uint64_t packRange(uint64_t begin, uint64_t end)
+{
+    return begin << 32 | end;
+}
+
+uint32_t rangeBegin(uint64_t range)
+{
+    return static_cast<uint32_t>(range >> 32);
+}
+
+uint32_t rangeEnd(uint64_t range)
+{
+    return static_cast<uint32_t>(range);
+}
+
+} // namespace
+
+TaskPool::TaskPool(int threads)
+    : m_task(nullptr)
+    , m_count(0)
+    , m_next(0)
+    , m_busy(0)
+    , m_stealing(false)
+    , m_generation(0)
+    , m_stopping(false)
+{
+    if (threads <= 0) {
+        threads = defaultThreadCount();
+    }
+    m_shares.reset(new Share[static_cast<size_t>(threads)]);
+    m_workers.reserve(static_cast<size_t>(threads - 1));
+    for (int worker = 1; worker < threads; ++worker) {
+        m_workers.emplace_back(&TaskPool::workerLoop, this, worker);
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &thread : m_workers) {
+        thread.join();
+    }
+}
+
+int TaskPool::defaultThreadCount()
+{
+    const unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+void TaskPool::parallelFor(size_t count, const Task &task)
+{
+    if (count == 0) {
+        return;
+    }
+    if (m_workers.empty() || count == 1) {
+        for (size_t index = 0; index < count; ++index) {
+            task(index, 0);
+        }
+        return;
+    }
+
+    start(count, task, false);
+}
+
+void TaskPool::parallelForStealing(size_t count, const Task &task)
+{
+    if (count == 0) {
+        return;
+    }
+    if (m_workers.empty() || count == 1) {
+        for (size_t index = 0; index < count; ++index) {
+            task(index, 0);
+        }
+        return;
+    }
+    if (count <= MAX_SHARED_BATCH) {
+        start(count, task, true);
+        return;
+    }
+    for (size_t base = 0; base < count; base += MAX_SHARED_BATCH) {
+        const Task offset = [&](size_t index, int worker) { task(base + index, worker); };
+        start(std::min(count - base, MAX_SHARED_BATCH), offset, true);
+    }
+}
+
+void TaskPool::start(size_t count, const Task &task, bool stealing)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_stealing = stealing;
+        if (stealing) {
+            const size_t threads = static_cast<size_t>(threadCount());
+            for (size_t worker = 0; worker < threads; ++worker) {
+                m_shares[worker].range.store(packRange(count * worker / threads, count * (worker + 1) / threads),
+                                             std::memory_order_relaxed);
+            }
+        } else {
+            m_next.store(0, std::memory_order_relaxed);
+        }
+        m_busy = static_cast<int>(m_workers.size());
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    if (stealing) {
+        runShares(0);
+    } else {
+        runBatch(0);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_busy == 0; });
+    m_task = nullptr;
+}
+
+void TaskPool::runBatch(int worker)
+{
+    for (;;) {
+        const size_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= m_count) {
+            return;
+        }
+        (*m_task)(index, worker);
+    }
+}
+
+void TaskPool::runShares(int worker)
+{
+    Share &own = m_shares[worker];
+    do {
+        uint64_t range = own.range.load(std::memory_order_acquire);
+        while (rangeBegin(range) < rangeEnd(range)) {
+            // Take from the front; thieves take from the back
+            if (own.range.compare_exchange_weak(range, packRange(rangeBegin(range) + 1, rangeEnd(range)),
+                                                std::memory_order_acq_rel, std::memory_order_acquire)) {
+                (*m_task)(rangeBegin(range), worker);
+                range = own.range.load(std::memory_order_acquire);
+            }
+        }
+    } while (steal(worker));
+}
+
+bool TaskPool::steal(int worker)
+{
+    const int threads = threadCount();
+    for (;;) {
+        int victim = -1;
+        uint64_t victimRange = 0;
+        uint32_t largest = 0;
+        for (int other = 0; other < threads; ++other) {
+            const uint64_t range = m_shares[other].range.load(std::memory_order_acquire);
+            const uint32_t size = rangeEnd(range) > rangeBegin(range) ? rangeEnd(range) - rangeBegin(range) : 0;
+            if (other != worker && size > largest) {
+                victim = other;
+                victimRange = range;
+                largest = size;
+            }
+        }
+        if (victim < 0) {
+            // Indices a thief is about to store still get run by that thief
+            return false;
+        }
+        const uint32_t split = rangeEnd(victimRange) - (largest + 1) / 2;
+        if (m_shares[victim].range.compare_exchange_strong(victimRange, packRange(rangeBegin(victimRange), split),
+                                                           std::memory_order_acq_rel, std::memory_order_acquire)) {
+            m_shares[worker].range.store(packRange(split, rangeEnd(victimRange)), std::memory_order_release);
+            return true;
+        }
+    }
+}
+
+void TaskPool::workerLoop(int worker)
+{
+    FLOPPY_TRACE_THREAD("TaskPool worker");
+    unsigned seenGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stopping || m_generation != seenGeneration; });
+            if (m_stopping) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        if (m_stealing) {
+            runShares(worker);
+        } else {
+            runBatch(worker);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0) {
+            m_done.notify_one();
+        }
+    }
+}
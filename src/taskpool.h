@@ -0,0 +1,71 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run index-based batches. The calling
+// thread joins in as worker 0, so a pool of one thread runs inline.
+// parallelFor() hands tasks out in index order from a shared counter;
+// parallelForStealing() splits the indices between the workers up front and
+// lets a worker that runs out steal half of the largest share left. Either
+// way, anything that must be deterministic has to depend on the index,
+// never on the worker.
+class TaskPool
+{
+public:
+    using Task = std::function<void(size_t index, int worker)>;
+
+    // 0 picks std::thread::hardware_concurrency()
+    explicit TaskPool(int threads = 0);
+    ~TaskPool();
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    int threadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    // Runs task(index, worker) for every index in [0, count); returns when all are done
+    void parallelFor(size_t count, const Task &task);
+    // Same, with per-worker shares of the index range and work stealing.
+    // Workers only meet on a share when one of them runs dry, and a worker
+    // runs neighbouring indices, which suits many short tasks of uneven
+    // length that each touch per-worker state.
+    void parallelForStealing(size_t count, const Task &task);
+
+    static int defaultThreadCount();
+
+private:
+    // Unclaimed indices [begin, end) of one worker, packed into one word so
+    // owner and thieves claim with a single compare-and-swap
+    struct alignas(64) Share {
+        std::atomic<uint64_t> range{ 0 };
+    };
+
+    void start(size_t count, const Task &task, bool stealing);
+    void workerLoop(int worker);
+    void runBatch(int worker);
+    void runShares(int worker);
+    bool steal(int worker);
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const Task *m_task;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    int m_busy;
+    bool m_stealing;
+    std::unique_ptr<Share[]> m_shares;
+    unsigned m_generation;
+    bool m_stopping;
+};
+
+#endif // TASKPOOL_H
@@ -0,0 +1,145 @@
+#include "tracereplay.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr uint8_t COMMAND_RESTORE = 0x00;
+constexpr uint8_t COMMAND_SEEK = 0x10;
+constexpr uint8_t COMMAND_READ_SECTOR = 0x80;
+constexpr uint8_t COMMAND_WRITE_SECTOR = 0xA0;
+constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+bool isWriting(const Wd1793 &fdc)
+{
+    if (!fdc.isBusy()) {
+        return false;
+    }
+    const uint8_t command = fdc.commandRegister();
+    return (fdc.commandType() == Wd1793::CommandType::TypeII && (command & 0x20)) ||
+           (fdc.commandType() == Wd1793::CommandType::TypeIII && (command & 0xF0) == 0xF0);
+}
+
+} // namespace
+
+TraceReplay::TraceReplay(std::shared_ptr<const DiskImage> image, const AccessTrace &trace,
+                         const ReplayOptions &options)
+    : m_trace(trace)
+    , m_options(options)
+    , m_disk(std::move(image))
+    , m_fdc(&m_drive)
+{
+    m_fdc.setTiming(m_options.timing);
+    if (m_disk) {
+        m_drive.insertDisk(std::make_shared<DiskImage>(*m_disk));
+        m_fdc.setDoubleDensity(m_disk->isDoubleDensity());
+    }
+    m_fdc.write(Wd1793::CommandRegister, COMMAND_RESTORE, 0);
+    start();
+}
+
+TraceReplay::TraceReplay(const MachineSnapshot &session, const AccessTrace &trace, const ReplayOptions &options)
+    : m_trace(trace)
+    , m_options(options)
+    , m_disk(session.disk)
+    , m_fdc(&m_drive)
+{
+    m_fdc.setTiming(m_options.timing);
+    session.restore(m_fdc, m_drive);
+    start();
+}
+
+void TraceReplay::start()
+{
+    m_options.framesPerSecond = std::max(1, m_options.framesPerSecond);
+    m_frameNs = 1000000000ULL / static_cast<uint64_t>(m_options.framesPerSecond);
+    m_startNs = m_fdc.time();
+    m_endNs = 0;
+    m_access = 0;
+    m_frame = 0;
+    m_seeking = false;
+    m_done = false;
+    m_issueNs = m_fdc.time() + (m_trace.empty() ? 0 : m_trace.accesses().front().idleNs);
+}
+
+uint64_t TraceReplay::pendingTime()
+{
+    if (m_fdc.isBusy()) {
+        // The host answers DRQ the moment it rises
+        return m_fdc.drq() ? m_fdc.time() : std::max(m_fdc.nextEventTime(), m_fdc.time());
+    }
+    if (m_access < m_trace.size()) {
+        return m_issueNs;
+    }
+    if (!m_done) {
+        m_done = true;
+        m_endNs = m_fdc.time();
+    }
+    return NEVER;
+}
+
+void TraceReplay::step()
+{
+    const uint64_t now = m_fdc.time();
+    if (m_fdc.isBusy()) {
+        if (!m_fdc.drq()) {
+            m_fdc.advance(std::max(m_fdc.nextEventTime(), now));
+        } else if (isWriting(m_fdc)) {
+            m_fdc.write(Wd1793::DataRegister, 0, now);
+        } else {
+            m_fdc.read(Wd1793::DataRegister, now);
+        }
+    } else {
+        const AccessTrace::Access &access = m_trace.accesses()[m_access];
+        m_drive.setSide(access.side);
+        if (!m_seeking && m_drive.cylinder() != access.cylinder) {
+            m_fdc.write(Wd1793::DataRegister, static_cast<uint8_t>(access.cylinder), m_issueNs);
+            m_fdc.write(Wd1793::CommandRegister, COMMAND_SEEK, m_issueNs);
+            m_seeking = true;
+        } else {
+            m_fdc.write(Wd1793::SectorRegister, static_cast<uint8_t>(access.sector), m_issueNs);
+            m_fdc.write(Wd1793::CommandRegister, access.write ? COMMAND_WRITE_SECTOR : COMMAND_READ_SECTOR,
+                        m_issueNs);
+            m_seeking = false;
+            ++m_access;
+        }
+    }
+
+    // Idle time counts from the end of the command; a sector access follows its seek at once
+    if (!m_fdc.isBusy()) {
+        const bool idle = !m_seeking && m_access < m_trace.size();
+        m_issueNs = m_fdc.time() + (idle ? m_trace.accesses()[m_access].idleNs : 0);
+    }
+}
+
+bool TraceReplay::next(ReplayFrame &frame)
+{
+    // Exact frame times, so long replays do not drift from the frame rate
+    const uint64_t t = m_startNs + m_frame * 1000000000ULL / static_cast<uint64_t>(m_options.framesPerSecond);
+    while (pendingTime() <= t) {
+        step();
+    }
+    if (m_done && t > m_endNs + m_options.holdNs) {
+        return false;
+    }
+    if (t > m_fdc.time()) {
+        m_fdc.advance(t);
+    }
+
+    frame.index = m_frame++;
+    frame.timeNs = t;
+    frame.cylinder = m_drive.cylinder();
+    frame.side = m_drive.side();
+    frame.angle = m_drive.angleAt(t);
+    frame.indexPulse = m_drive.indexAt(t);
+    frame.write = isWriting(m_fdc);
+    frame.status = m_fdc.statusRegister();
+    frame.command = m_fdc.commandRegister();
+    frame.track = m_fdc.trackRegister();
+    frame.sector = m_fdc.sectorRegister();
+    frame.data = m_fdc.dataRegister();
+    frame.intrq = m_fdc.intrq();
+    frame.drq = m_fdc.drq();
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include "accesstrace.h"
+#include "floppydrive.h"
+#include "machinesnapshot.h"
+#include "wd1793.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Registers, pins and head of one drive and controller at one instant,
+// everything the disk view and the controller panel show
+struct ReplayFrame {
+    size_t index = 0;
+    uint64_t timeNs = 0;
+    int cylinder = 0;
+    int side = 0;
+    double angle = 0.0;     // Fraction of a revolution after index
+    bool indexPulse = false;
+    bool write = false;     // A write command is in progress
+    uint8_t status = 0;
+    uint8_t command = 0;
+    uint8_t track = 0;
+    uint8_t sector = 0;
+    uint8_t data = 0;
+    bool intrq = false;
+    bool drq = false;
+};
+
+struct ReplayOptions {
+    int framesPerSecond = 60;
+    uint64_t holdNs = 0;    // Frames to keep producing after the last command
+    Wd1793::Timing timing;
+};
+
+// Plays an access trace through FloppyDrive and Wd1793 and samples their
+// state at a fixed frame rate of emulated time. The host issues commands
+// as the trace recorded, seeks where needed, and moves data one byte at a
+// time as soon as DRQ rises, so frames inside a transfer see DRQ and the
+// data register change. Emulation only runs as far as the frame asked
+// for, and every frame is exact: the controller is stopped at its time,
+// not at the nearest event.
+class TraceReplay
+{
+public:
+    // Starts from power on with a Restore
+    TraceReplay(std::shared_ptr<const DiskImage> image, const AccessTrace &trace,
+                const ReplayOptions &options = ReplayOptions());
+    // Continues a saved session, command in progress included
+    TraceReplay(const MachineSnapshot &session, const AccessTrace &trace,
+                const ReplayOptions &options = ReplayOptions());
+
+    TraceReplay(const TraceReplay &) = delete;
+    TraceReplay &operator=(const TraceReplay &) = delete;
+
+    // Next frame; false once the trace and the hold time are over
+    bool next(ReplayFrame &frame);
+
+    int framesPerSecond() const { return m_options.framesPerSecond; }
+    uint64_t frameNs() const { return m_frameNs; }
+    // Disk as it was before the replay; the replay writes into its own copy
+    const std::shared_ptr<const DiskImage> &disk() const { return m_disk; }
+    // Accesses issued so far
+    size_t position() const { return m_access; }
+
+private:
+    void start();
+    // Time of the next host action or controller event
+    uint64_t pendingTime();
+    void step();
+
+    const AccessTrace &m_trace;
+    ReplayOptions m_options;
+    std::shared_ptr<const DiskImage> m_disk;
+    FloppyDrive m_drive;
+    Wd1793 m_fdc;
+    uint64_t m_frameNs;
+    uint64_t m_startNs;
+    uint64_t m_issueNs;     // When the host issues its next command while idle
+    uint64_t m_endNs;       // Set once the last command is done
+    size_t m_access;
+    size_t m_frame;
+    bool m_seeking;         // The command in progress is the seek for m_access
+    bool m_done;
+};
+
+#endif // TRACEREPLAY_H
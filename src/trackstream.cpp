@@ -0,0 +1,204 @@
+#include "trackstream.h"
+#include "dskformat.h"
+#include "hfeformat.h"
+#include "imgformat.h"
+#include "perftrace.h"
+#include "sectortable.h"
+#include "trdformat.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+std::string lowerExtension(const std::string &path)
+{
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) {
+        return std::string();
+    }
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+} // namespace
+
+ImageFormat imageFormatFromPath(const std::string &path)
+{
+    const std::string ext = lowerExtension(path);
+    if (ext == "trd") {
+        return ImageFormat::Trd;
+    }
+    if (ext == "scl") {
+        return ImageFormat::Scl;
+    }
+    if (ext == "img" || ext == "ima") {
+        return ImageFormat::Img;
+    }
+    if (ext == "dsk" || ext == "edsk") {
+        return ImageFormat::Dsk;
+    }
+    if (ext == "hfe") {
+        return ImageFormat::Hfe;
+    }
+    if (ext == "qfr") {
+        return ImageFormat::SectorTable;
+    }
+    return ImageFormat::Unknown;
+}
+
+const char *imageFormatExtension(ImageFormat format)
+{
+    switch (format) {
+    case ImageFormat::Trd:
+        return "trd";
+    case ImageFormat::Scl:
+        return "scl";
+    case ImageFormat::Img:
+        return "img";
+    case ImageFormat::Dsk:
+        return "dsk";
+    case ImageFormat::Hfe:
+        return "hfe";
+    case ImageFormat::SectorTable:
+        return "qfr";
+    case ImageFormat::Unknown:
+        break;
+    }
+    return "";
+}
+
+std::unique_ptr<TrackReader> TrackReader::open(const std::string &path, std::string *error)
+{
+    char signature[8] = {};
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            if (error) {
+                *error = "Cannot open " + path;
+            }
+            return nullptr;
+        }
+        file.read(signature, sizeof(signature));
+    }
+
+    ImageFormat format = imageFormatFromPath(path);
+    if (std::memcmp(signature, "MV - CPC", 8) == 0 || std::memcmp(signature, "EXTENDED", 8) == 0) {
+        format = ImageFormat::Dsk;
+    } else if (std::memcmp(signature, "SINCLAIR", 8) == 0) {
+        format = ImageFormat::Scl;
+    } else if (std::memcmp(signature, "HXCPICFE", 8) == 0 || std::memcmp(signature, "HXCHFEV3", 8) == 0) {
+        format = ImageFormat::Hfe;
+    } else if (std::memcmp(signature, "QFRT", 4) == 0) {
+        format = ImageFormat::SectorTable;
+    }
+
+    std::unique_ptr<TrackReader> reader;
+    switch (format) {
+    case ImageFormat::Trd:
+        reader.reset(new TrdReader());
+        break;
+    case ImageFormat::Scl:
+        reader.reset(new SclReader());
+        break;
+    case ImageFormat::Img:
+        reader.reset(new ImgReader());
+        break;
+    case ImageFormat::Dsk:
+        reader.reset(new DskReader());
+        break;
+    case ImageFormat::Hfe:
+        reader.reset(new HfeTrackReader());
+        break;
+    case ImageFormat::SectorTable:
+        reader.reset(new SectorTableReader());
+        break;
+    case ImageFormat::Unknown:
+        break;
+    }
+
+    if (!reader) {
+        if (error) {
+            *error = "Unrecognized image format";
+        }
+        return nullptr;
+    }
+    if (!reader->load(path)) {
+        if (error) {
+            *error = reader->errorString();
+        }
+        return nullptr;
+    }
+    return reader;
+}
+
+std::shared_ptr<DiskImage> TrackReader::loadImage(const std::string &path, std::string *error)
+{
+    FLOPPY_TRACE_ZONE("io", "TrackReader::loadImage");
+    std::unique_ptr<TrackReader> reader = open(path, error);
+    if (!reader) {
+        return nullptr;
+    }
+    auto image = std::make_shared<DiskImage>(reader->cylinderCount(), reader->sideCount());
+    TrackBlock block;
+    for (int cylinder = 0; cylinder < reader->cylinderCount(); ++cylinder) {
+        for (int side = 0; side < reader->sideCount(); ++side) {
+            if (!reader->readBlock(cylinder, side, block)) {
+                if (error) {
+                    *error = reader->errorString();
+                }
+                return nullptr;
+            }
+            *image->track(cylinder, side) = reader->decode(block);
+        }
+    }
+    image->updateLayout();
+    return image;
+}
+
+std::unique_ptr<TrackWriter> TrackWriter::create(const std::string &path, ImageFormat format,
+                                                 int cylinders, int sides, int dataRateKbps,
+                                                 std::string *error)
+{
+    std::unique_ptr<TrackWriter> writer;
+    switch (format) {
+    case ImageFormat::Trd:
+        writer.reset(new TrdWriter());
+        break;
+    case ImageFormat::Scl:
+        writer.reset(new SclWriter());
+        break;
+    case ImageFormat::Img:
+        writer.reset(new ImgWriter());
+        break;
+    case ImageFormat::Dsk:
+        writer.reset(new DskWriter());
+        break;
+    case ImageFormat::Hfe:
+        writer.reset(new HfeWriter());
+        break;
+    case ImageFormat::SectorTable:
+        writer.reset(new SectorTableWriter());
+        break;
+    case ImageFormat::Unknown:
+        break;
+    }
+
+    if (!writer) {
+        if (error) {
+            *error = "Unsupported output format";
+        }
+        return nullptr;
+    }
+    if (!writer->begin(path, cylinders, sides, dataRateKbps)) {
+        if (error) {
+            *error = writer->errorString();
+        }
+        return nullptr;
+    }
+    return writer;
+}
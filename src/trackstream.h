@@ -0,0 +1,105 @@
+#ifndef TRACKSTREAM_H
+#define TRACKSTREAM_H
+
+#include "diskimage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Sector and track level image formats the converter reads and writes
+enum class ImageFormat {
+    Unknown,
+    Trd,    // TR-DOS, 16 x 256 byte sectors per track
+    Scl,    // TR-DOS file archive
+    Img,    // Raw 512 byte sectors, PC geometries
+    Dsk,    // CPCEMU DSK and Extended DSK
+    Hfe,    // HxC HFE v1 cell stream
+    SectorTable // References into a directory's SectorStore, see sectortable.h
+};
+
+ImageFormat imageFormatFromPath(const std::string &path);
+const char *imageFormatExtension(ImageFormat format);
+
+// One track as stored in the image file: sector data for the sector
+// formats, the track's part of the interleaved cell stream for HFE
+struct TrackBlock {
+    int cylinder = 0;
+    int side = 0;
+    Encoding encoding = Encoding::MFM;  // For formats that record it per image or track
+    std::vector<uint8_t> bytes;
+};
+
+// Reads an image one track at a time, in cylinder-major order. readBlock()
+// only does file I/O and is called from one thread in that order; decode()
+// never touches the file and may run on another thread at the same time.
+class TrackReader
+{
+public:
+    virtual ~TrackReader() = default;
+
+    // Picks the reader from the file signature, falling back to the extension
+    static std::unique_ptr<TrackReader> open(const std::string &path, std::string *error = nullptr);
+    // Reads every track of the image at 'path'. Sector tables come back as
+    // views into their store, so images loaded this way share its pages.
+    static std::shared_ptr<DiskImage> loadImage(const std::string &path, std::string *error = nullptr);
+
+    virtual const char *formatName() const = 0;
+    virtual int cylinderCount() const = 0;
+    virtual int sideCount() const = 0;
+    // Data rate the tracks were written at: 250 for DD, 500 for HD
+    virtual int dataRateKbps() const { return 250; }
+
+    virtual bool readBlock(int cylinder, int side, TrackBlock &block) = 0;
+    virtual Track decode(const TrackBlock &block) const = 0;
+
+    const std::string &errorString() const { return m_error; }
+
+protected:
+    virtual bool load(const std::string &path) = 0;
+
+    bool fail(const std::string &message)
+    {
+        m_error = message;
+        return false;
+    }
+
+    std::string m_error;
+};
+
+// Writes an image one track at a time. encode() is const and may run on
+// another thread than writeBlock(), which receives the tracks in
+// cylinder-major order; finish() patches headers and checksums. Tracks the
+// format cannot hold fail in encode() rather than being written lossily.
+class TrackWriter
+{
+public:
+    virtual ~TrackWriter() = default;
+
+    static std::unique_ptr<TrackWriter> create(const std::string &path, ImageFormat format,
+                                               int cylinders, int sides, int dataRateKbps = 250,
+                                               std::string *error = nullptr);
+
+    virtual const char *formatName() const = 0;
+
+    virtual bool encode(const Track &track, TrackBlock &block, std::string *error) const = 0;
+    virtual bool writeBlock(const TrackBlock &block) = 0;
+    virtual bool finish() = 0;
+
+    const std::string &errorString() const { return m_error; }
+
+protected:
+    virtual bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) = 0;
+
+    bool fail(const std::string &message)
+    {
+        m_error = message;
+        return false;
+    }
+
+    std::string m_error;
+};
+
+#endif // TRACKSTREAM_H
@@ -0,0 +1,428 @@
+#include "trdformat.h"
+
+#include <cstring>
+
+namespace {
+
+// Physical sector order of a TR-DOS formatted track
+constexpr uint8_t FORMAT_ORDER[TrDos::SECTORS] = { 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15, 8, 16 };
+
+// System sector (track 0, sector 9)
+constexpr size_t INFO_OFFSET = 8 * TrDos::SECTOR_SIZE;
+constexpr size_t INFO_FIRST_FREE_SECTOR = 0xE1;
+constexpr size_t INFO_FIRST_FREE_TRACK = 0xE2;
+constexpr size_t INFO_DISK_TYPE = 0xE3;
+constexpr size_t INFO_FILE_COUNT = 0xE4;
+constexpr size_t INFO_FREE_SECTORS = 0xE5;
+constexpr size_t INFO_TRDOS_ID = 0xE7;
+constexpr size_t INFO_LABEL = 0xF5;
+constexpr uint8_t TRDOS_ID = 0x10;
+
+// Catalog entries fill sectors 1-8 of track 0
+constexpr int MAX_FILES = 128;
+constexpr size_t ENTRY_SIZE = 16;
+constexpr size_t SCL_ENTRY_SIZE = 14;     // Entry without its start sector and track
+constexpr size_t ENTRY_SECTORS = 13;
+constexpr size_t ENTRY_START_SECTOR = 14;
+constexpr size_t ENTRY_START_TRACK = 15;
+
+constexpr char SCL_SIGNATURE[] = "SINCLAIR";
+constexpr size_t SCL_SIGNATURE_SIZE = 8;
+
+bool diskType(uint8_t type, int &cylinders, int &sides)
+{
+    switch (type) {
+    case 0x16:
+        cylinders = 80;
+        sides = 2;
+        return true;
+    case 0x17:
+        cylinders = 40;
+        sides = 2;
+        return true;
+    case 0x18:
+        cylinders = 80;
+        sides = 1;
+        return true;
+    case 0x19:
+        cylinders = 40;
+        sides = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void readAt(std::ifstream &file, uint64_t offset, uint8_t *data, size_t size)
+{
+    // Images may be cut short after the last used track; the rest reads as zeros
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char *>(data), static_cast<std::streamsize>(size));
+    const size_t got = file ? size : static_cast<size_t>(file.gcount());
+    std::memset(data + got, 0, size - got);
+}
+
+} // namespace
+
+Track TrDos::track(int cylinder, int side, const uint8_t *bytes)
+{
+    Track track;
+    track.cylinder = cylinder;
+    track.side = side;
+    track.encoding = Encoding::MFM;
+    track.sectors.resize(SECTORS);
+    for (int i = 0; i < SECTORS; ++i) {
+        Sector &sector = track.sectors[i];
+        sector.cylinder = static_cast<uint8_t>(cylinder);
+        sector.head = static_cast<uint8_t>(side);
+        sector.id = FORMAT_ORDER[i];
+        sector.sizeCode = 1;
+        const uint8_t *data = bytes + (sector.id - 1) * SECTOR_SIZE;
+        sector.data.assign(data, data + SECTOR_SIZE);
+    }
+    return track;
+}
+
+bool TrDos::trackBytes(const Track &track, std::vector<uint8_t> &bytes, std::string *error)
+{
+    bytes.assign(TRACK_BYTES, 0);
+    for (const Sector &sector : track.sectors) {
+        if (sector.id < 1 || sector.id > SECTORS || sector.size() != SECTOR_SIZE) {
+            if (error) {
+                *error = "Track " + std::to_string(track.cylinder) + "/" + std::to_string(track.side) +
+                         " is not in TR-DOS layout (sector " + std::to_string(sector.id) + ", " +
+                         std::to_string(sector.size()) + " bytes)";
+            }
+            return false;
+        }
+        const size_t size = sector.data.size() < SECTOR_SIZE ? sector.data.size() : SECTOR_SIZE;
+        std::memcpy(bytes.data() + (sector.id - 1) * SECTOR_SIZE, sector.data.data(), size);
+    }
+    return true;
+}
+
+bool TrDos::catalogSummary(const Track &track0, CatalogSummary &summary)
+{
+    const Sector *systemSector = track0.findSector(9);
+    if (!systemSector || systemSector->data.size() < SECTOR_SIZE || systemSector->data.data()[INFO_TRDOS_ID] != TRDOS_ID) {
+        return false;
+    }
+    const uint8_t *info = systemSector->data.data();
+    summary.files = info[INFO_FILE_COUNT];
+    summary.freeSectors = info[INFO_FREE_SECTORS] | info[INFO_FREE_SECTORS + 1] << 8;
+    summary.label.clear();
+    for (size_t i = 0; i < 8; ++i) {
+        const char c = static_cast<char>(info[INFO_LABEL + i]);
+        summary.label += c >= 0x20 && c < 0x7F ? c : ' ';
+    }
+    summary.label.erase(summary.label.find_last_not_of(' ') + 1);
+    return true;
+}
+
+TrdReader::TrdReader()
+    : m_size(0)
+    , m_cylinders(0)
+    , m_sides(0)
+{
+}
+
+bool TrdReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary | std::ios::ate);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+    m_size = static_cast<uint64_t>(m_file.tellg());
+    if (m_size < TrDos::SECTOR_SIZE) {
+        return fail("TRD image is empty");
+    }
+
+    uint8_t type = 0;
+    if (m_size > INFO_OFFSET + INFO_DISK_TYPE) {
+        readAt(m_file, INFO_OFFSET + INFO_DISK_TYPE, &type, 1);
+    }
+    const int tracks = static_cast<int>((m_size + TrDos::TRACK_BYTES - 1) / TrDos::TRACK_BYTES);
+    if (!diskType(type, m_cylinders, m_sides)) {
+        m_sides = 2;
+        m_cylinders = 0;
+    }
+    // Some images carry more tracks than their disk type admits to
+    if (m_cylinders * m_sides < tracks) {
+        m_cylinders = (tracks + m_sides - 1) / m_sides;
+    }
+    return true;
+}
+
+bool TrdReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    block.cylinder = cylinder;
+    block.side = side;
+    block.bytes.resize(TrDos::TRACK_BYTES);
+    readAt(m_file, static_cast<uint64_t>(cylinder * m_sides + side) * TrDos::TRACK_BYTES,
+           block.bytes.data(), block.bytes.size());
+    return true;
+}
+
+Track TrdReader::decode(const TrackBlock &block) const
+{
+    return TrDos::track(block.cylinder, block.side, block.bytes.data());
+}
+
+TrdWriter::TrdWriter()
+    : m_sides(1)
+{
+}
+
+bool TrdWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    (void)cylinders;
+    (void)dataRateKbps;
+    m_sides = sides;
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    return true;
+}
+
+bool TrdWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    return TrDos::trackBytes(track, block.bytes, error);
+}
+
+bool TrdWriter::writeBlock(const TrackBlock &block)
+{
+    m_file.seekp(static_cast<std::streamoff>(block.cylinder * m_sides + block.side) * TrDos::TRACK_BYTES);
+    if (!m_file.write(reinterpret_cast<const char *>(block.bytes.data()),
+                      static_cast<std::streamsize>(block.bytes.size()))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool TrdWriter::finish()
+{
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
+
+SclReader::SclReader()
+    : m_dataOffset(0)
+    , m_dataSize(0)
+    , m_cylinders(0)
+{
+}
+
+bool SclReader::load(const std::string &path)
+{
+    m_file.open(path, std::ios::binary | std::ios::ate);
+    if (!m_file) {
+        return fail("Cannot open " + path);
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(m_file.tellg());
+
+    uint8_t header[SCL_SIGNATURE_SIZE + 1];
+    m_file.seekg(0);
+    if (!m_file.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+        std::memcmp(header, SCL_SIGNATURE, SCL_SIGNATURE_SIZE) != 0) {
+        return fail("Not an SCL archive");
+    }
+    const int fileCount = header[SCL_SIGNATURE_SIZE];
+    if (fileCount > MAX_FILES) {
+        return fail("SCL archive lists more than 128 files");
+    }
+
+    std::vector<uint8_t> entries(static_cast<size_t>(fileCount) * SCL_ENTRY_SIZE);
+    if (!m_file.read(reinterpret_cast<char *>(entries.data()), static_cast<std::streamsize>(entries.size()))) {
+        return fail("Truncated SCL catalog");
+    }
+
+    // Files follow each other from track 1, sector 1 as TR-DOS copies them
+    m_catalogTrack.assign(TrDos::TRACK_BYTES, 0);
+    int next = TrDos::SECTORS;
+    for (int i = 0; i < fileCount; ++i) {
+        uint8_t *entry = m_catalogTrack.data() + i * ENTRY_SIZE;
+        std::memcpy(entry, entries.data() + i * SCL_ENTRY_SIZE, SCL_ENTRY_SIZE);
+        entry[ENTRY_START_SECTOR] = static_cast<uint8_t>(next % TrDos::SECTORS);
+        entry[ENTRY_START_TRACK] = static_cast<uint8_t>(next / TrDos::SECTORS);
+        next += entry[ENTRY_SECTORS];
+    }
+    m_dataOffset = sizeof(header) + entries.size();
+    m_dataSize = static_cast<uint64_t>(next - TrDos::SECTORS) * TrDos::SECTOR_SIZE;
+    if (fileSize < m_dataOffset + m_dataSize) {
+        return fail("Truncated SCL file data");
+    }
+
+    const int tracks = (next + TrDos::SECTORS - 1) / TrDos::SECTORS;
+    m_cylinders = tracks > 160 ? (tracks + 1) / 2 : 80;
+    const int freeSectors = m_cylinders * 2 * TrDos::SECTORS - next;
+
+    uint8_t *info = m_catalogTrack.data() + INFO_OFFSET;
+    info[INFO_FIRST_FREE_SECTOR] = static_cast<uint8_t>(next % TrDos::SECTORS);
+    info[INFO_FIRST_FREE_TRACK] = static_cast<uint8_t>(next / TrDos::SECTORS);
+    info[INFO_DISK_TYPE] = 0x16;
+    info[INFO_FILE_COUNT] = static_cast<uint8_t>(fileCount);
+    info[INFO_FREE_SECTORS] = static_cast<uint8_t>(freeSectors > 0 ? freeSectors & 0xFF : 0);
+    info[INFO_FREE_SECTORS + 1] = static_cast<uint8_t>(freeSectors > 0 ? freeSectors >> 8 : 0);
+    info[INFO_TRDOS_ID] = TRDOS_ID;
+    std::memset(info + 0xEA, 0x20, 9);
+    std::memset(info + INFO_LABEL, 0x20, 8);
+    return true;
+}
+
+bool SclReader::readBlock(int cylinder, int side, TrackBlock &block)
+{
+    block.cylinder = cylinder;
+    block.side = side;
+    const int logical = cylinder * 2 + side;
+    if (logical == 0) {
+        block.bytes = m_catalogTrack;
+        return true;
+    }
+
+    block.bytes.assign(TrDos::TRACK_BYTES, 0);
+    const uint64_t start = static_cast<uint64_t>(logical - 1) * TrDos::TRACK_BYTES;
+    if (start < m_dataSize) {
+        const uint64_t left = m_dataSize - start;
+        const size_t size = left < TrDos::TRACK_BYTES ? static_cast<size_t>(left) : TrDos::TRACK_BYTES;
+        m_file.clear();
+        m_file.seekg(static_cast<std::streamoff>(m_dataOffset + start));
+        if (!m_file.read(reinterpret_cast<char *>(block.bytes.data()), static_cast<std::streamsize>(size))) {
+            return fail("Truncated SCL file data");
+        }
+    }
+    return true;
+}
+
+Track SclReader::decode(const TrackBlock &block) const
+{
+    return TrDos::track(block.cylinder, block.side, block.bytes.data());
+}
+
+SclWriter::SclWriter()
+    : m_sides(2)
+    , m_nextFile(0)
+    , m_sectorsSeen(0)
+    , m_haveCatalog(false)
+    , m_checksum(0)
+{
+}
+
+bool SclWriter::begin(const std::string &path, int cylinders, int sides, int dataRateKbps)
+{
+    (void)cylinders;
+    (void)dataRateKbps;
+    m_sides = sides;
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        return fail("Cannot create " + path);
+    }
+    return true;
+}
+
+bool SclWriter::encode(const Track &track, TrackBlock &block, std::string *error) const
+{
+    block.cylinder = track.cylinder;
+    block.side = track.side;
+    return TrDos::trackBytes(track, block.bytes, error);
+}
+
+bool SclWriter::put(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        m_checksum += data[i];
+    }
+    if (!m_file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size))) {
+        return fail("Write error");
+    }
+    return true;
+}
+
+bool SclWriter::readCatalog(const uint8_t *track)
+{
+    if (track[INFO_OFFSET + INFO_TRDOS_ID] != TRDOS_ID) {
+        return fail("Not a TR-DOS disk");
+    }
+
+    // Deleted files (first name byte 01) are left out of the archive
+    std::vector<const uint8_t *> kept;
+    for (int i = 0; i < MAX_FILES; ++i) {
+        const uint8_t *entry = track + i * ENTRY_SIZE;
+        if (entry[0] == 0x00) {
+            break;
+        }
+        if (entry[0] == 0x01) {
+            continue;
+        }
+        FileRange range;
+        range.start = entry[ENTRY_START_TRACK] * TrDos::SECTORS + entry[ENTRY_START_SECTOR];
+        range.end = range.start + entry[ENTRY_SECTORS];
+        // Streaming needs the files in disk order, which is how TR-DOS allocates them
+        if (range.start < TrDos::SECTORS || (!m_files.empty() && range.start < m_files.back().end)) {
+            return fail("Catalog entries are not in disk order");
+        }
+        m_files.push_back(range);
+        kept.push_back(entry);
+    }
+
+    uint8_t header[SCL_SIGNATURE_SIZE + 1];
+    std::memcpy(header, SCL_SIGNATURE, SCL_SIGNATURE_SIZE);
+    header[SCL_SIGNATURE_SIZE] = static_cast<uint8_t>(kept.size());
+    if (!put(header, sizeof(header))) {
+        return false;
+    }
+    for (const uint8_t *entry : kept) {
+        if (!put(entry, SCL_ENTRY_SIZE)) {
+            return false;
+        }
+    }
+    m_haveCatalog = true;
+    return true;
+}
+
+bool SclWriter::writeBlock(const TrackBlock &block)
+{
+    const int logical = block.cylinder * m_sides + block.side;
+    if (logical == 0) {
+        return readCatalog(block.bytes.data());
+    }
+    if (!m_haveCatalog) {
+        return fail("Disk has no track 0");
+    }
+
+    for (int i = 0; i < TrDos::SECTORS; ++i) {
+        const int sector = logical * TrDos::SECTORS + i;
+        while (m_nextFile < m_files.size() && sector >= m_files[m_nextFile].end) {
+            ++m_nextFile;
+        }
+        if (m_nextFile < m_files.size() && sector >= m_files[m_nextFile].start &&
+            !put(block.bytes.data() + i * TrDos::SECTOR_SIZE, TrDos::SECTOR_SIZE)) {
+            return false;
+        }
+    }
+    m_sectorsSeen = (logical + 1) * TrDos::SECTORS;
+    return true;
+}
+
+bool SclWriter::finish()
+{
+    if (!m_haveCatalog) {
+        return fail("Disk has no track 0");
+    }
+    if (!m_files.empty() && m_files.back().end > m_sectorsSeen) {
+        return fail("Disk ends inside a file");
+    }
+    const uint32_t sum = m_checksum;
+    const uint8_t trailer[4] = {
+        static_cast<uint8_t>(sum), static_cast<uint8_t>(sum >> 8),
+        static_cast<uint8_t>(sum >> 16), static_cast<uint8_t>(sum >> 24)
+    };
+    if (!put(trailer, sizeof(trailer))) {
+        return false;
+    }
+    m_file.close();
+    return m_file ? true : fail("Write error");
+}
@@ -0,0 +1,130 @@
+#ifndef TRDFORMAT_H
+#define TRDFORMAT_H
+
+#include "trackstream.h"
+
+#include <fstream>
+#include <vector>
+
+// TR-DOS images. A TRD file is the plain sector dump of a disk with 16
+// sectors of 256 bytes per track, tracks ordered cylinder-major; the disk
+// type byte in the system sector (track 0, sector 9) gives its geometry.
+// An SCL file only keeps the catalog entries and the file data, so reading
+// one rebuilds the TR-DOS disk the files were copied from, and writing one
+// takes the catalog from track 0 and copies file sectors as they stream by.
+namespace TrDos {
+
+constexpr int SECTORS = 16;
+constexpr int SECTOR_SIZE = 256;
+constexpr size_t TRACK_BYTES = SECTORS * SECTOR_SIZE;
+
+// Track from a 4 KB sector dump, sectors in the physical order TR-DOS formats with
+Track track(int cylinder, int side, const uint8_t *bytes);
+// Sector data by ID into 'bytes'; fails for tracks outside the TR-DOS layout
+bool trackBytes(const Track &track, std::vector<uint8_t> &bytes, std::string *error = nullptr);
+
+// What the system sector says about the disk
+struct CatalogSummary {
+    int files = 0;          // Catalog entries, deleted ones included
+    int freeSectors = 0;
+    std::string label;      // Trailing spaces removed
+};
+// False when track 0 has no TR-DOS system sector
+bool catalogSummary(const Track &track0, CatalogSummary &summary);
+
+} // namespace TrDos
+
+class TrdReader : public TrackReader
+{
+public:
+    TrdReader();
+
+    const char *formatName() const override { return "TRD"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return m_sides; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    std::ifstream m_file;
+    uint64_t m_size;
+    int m_cylinders;
+    int m_sides;
+};
+
+class TrdWriter : public TrackWriter
+{
+public:
+    TrdWriter();
+
+    const char *formatName() const override { return "TRD"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    std::ofstream m_file;
+    int m_sides;
+};
+
+class SclReader : public TrackReader
+{
+public:
+    SclReader();
+
+    const char *formatName() const override { return "SCL"; }
+    int cylinderCount() const override { return m_cylinders; }
+    int sideCount() const override { return 2; }
+    bool readBlock(int cylinder, int side, TrackBlock &block) override;
+    Track decode(const TrackBlock &block) const override;
+
+protected:
+    bool load(const std::string &path) override;
+
+private:
+    std::ifstream m_file;
+    std::vector<uint8_t> m_catalogTrack;
+    uint64_t m_dataOffset;
+    uint64_t m_dataSize;
+    int m_cylinders;
+};
+
+class SclWriter : public TrackWriter
+{
+public:
+    SclWriter();
+
+    const char *formatName() const override { return "SCL"; }
+    bool encode(const Track &track, TrackBlock &block, std::string *error) const override;
+    bool writeBlock(const TrackBlock &block) override;
+    bool finish() override;
+
+protected:
+    bool begin(const std::string &path, int cylinders, int sides, int dataRateKbps) override;
+
+private:
+    // Logical sectors [start, end) counted from track 0, sector 1
+    struct FileRange {
+        int start;
+        int end;
+    };
+
+    bool readCatalog(const uint8_t *track);
+    bool put(const uint8_t *data, size_t size);
+
+    std::ofstream m_file;
+    int m_sides;
+    std::vector<FileRange> m_files;
+    size_t m_nextFile;
+    int m_sectorsSeen;
+    bool m_haveCatalog;
+    uint32_t m_checksum;
+};
+
+#endif // TRDFORMAT_H
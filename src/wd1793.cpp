@@ -0,0 +1,1278 @@
+#include "wd1793.h"
+#include "bitstreamdecoder.h"
+#include "crc16.h"
+#include "perftrace.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Type I flags
+constexpr uint8_t FLAG_VERIFY = 0x04;
+constexpr uint8_t FLAG_HEAD_LOAD = 0x08;
+constexpr uint8_t FLAG_UPDATE = 0x10;
+
+// Type II/III flags
+constexpr uint8_t FLAG_DELETED = 0x01;
+constexpr uint8_t FLAG_SIDE_COMPARE = 0x02;
+constexpr uint8_t FLAG_DELAY = 0x04;
+constexpr uint8_t FLAG_SIDE = 0x08;
+constexpr uint8_t FLAG_MULTIPLE = 0x10;
+
+// Force Interrupt conditions
+constexpr uint8_t INTERRUPT_ON_INDEX = 0x04;
+constexpr uint8_t INTERRUPT_IMMEDIATE = 0x08;
+
+constexpr int SEARCH_REVOLUTIONS = 5;
+constexpr int MAX_RESTORE_STEPS = 255;
+
+// Byte times on the track, per encoding
+struct FieldTiming {
+    uint64_t idBytes;           // Sync marks + IDAM + C/H/R/N + CRC
+    uint64_t gapToData;         // ID end until the first data byte is assembled
+    uint64_t writeGap;          // ID end until the first data byte must be in the data register
+    uint64_t writePreamble;     // That point until the second byte is fetched
+    uint8_t gapByte;
+};
+
+constexpr FieldTiming MFM_FIELDS = { 10, 39, 22, 17, 0x4E };
+constexpr FieldTiming FM_FIELDS = { 7, 19, 11, 8, 0xFF };
+
+// Write Track control bytes; returns how many byte times the byte occupies
+int encodeFormatByte(BitstreamEncoder &encoder, uint8_t value)
+{
+    if (value == 0xF7) {
+        encoder.writeCrc();
+        return 2;
+    }
+    if (encoder.encoding() == Encoding::MFM) {
+        if (value == 0xF5) {
+            encoder.writeSyncMark();
+        } else if (value == 0xF6) {
+            encoder.writeIndexSync();
+        } else {
+            encoder.writeByte(value);
+        }
+    } else if ((value >= 0xF8 && value <= 0xFC) || value == 0xFE) {
+        encoder.writeAddressMark(value);
+    } else {
+        encoder.writeByte(value);
+    }
+    return 1;
+}
+
+bool isFormatControl(Encoding encoding, uint8_t value)
+{
+    if (value == 0xF7) {
+        return true;
+    }
+    if (encoding == Encoding::MFM) {
+        return value == 0xF5 || value == 0xF6;
+    }
+    return (value >= 0xF8 && value <= 0xFC) || value == 0xFE;
+}
+
+// encodeFormatByte() over a span; runs of plain bytes go to the encoder in one call
+void encodeFormatBytes(BitstreamEncoder &encoder, const uint8_t *data, size_t size)
+{
+    size_t run = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (isFormatControl(encoder.encoding(), data[i])) {
+            if (i > run) {
+                encoder.writeBytes(data + run, i - run);
+            }
+            encodeFormatByte(encoder, data[i]);
+            run = i + 1;
+        }
+    }
+    if (size > run) {
+        encoder.writeBytes(data + run, size - run);
+    }
+}
+
+} // namespace
+
+Wd1793::Wd1793(FloppyDrive *drive)
+    : m_drive(drive)
+    , m_metrics(nullptr)
+    , m_drqMonitor(nullptr)
+    , m_accessTrace(nullptr)
+    , m_signalTrace(nullptr)
+    , m_writeBack(nullptr)
+    , m_signalIndexNs(0)
+    , m_stepPulse(false)
+    , m_doubleDensity(true)
+    , m_status(0)
+    , m_command(0)
+    , m_track(0)
+    , m_sector(1)
+    , m_data(0)
+    , m_intrq(false)
+    , m_drq(false)
+    , m_headLoaded(false)
+    , m_indexInterrupt(false)
+    , m_type(CommandType::None)
+    , m_phase(Phase::Idle)
+    , m_time(0)
+    , m_eventTime(0)
+    , m_commandStart(0)
+    , m_commandEnd(0)
+    , m_traceIdleNs(0)
+    , m_stepDirection(1)
+    , m_restoreSteps(0)
+    , m_stepped(false)
+    , m_searchFrom(0)
+    , m_searchDeadline(0)
+    , m_pendingId(-1)
+    , m_pendingIdStart(0)
+    , m_index(0)
+    , m_transferStart(0)
+    , m_firstFetch(0)
+    , m_drqTime(0)
+    , m_targetSector(-1)
+    , m_readTrack(false)
+    , m_readAddress(false)
+    , m_trackEnd(0)
+{
+}
+
+void Wd1793::reset(uint64_t now)
+{
+    m_status = 0;
+    m_command = 0;
+    m_track = 0;
+    m_sector = 1;
+    m_data = 0;
+    m_intrq = false;
+    m_drq = false;
+    m_headLoaded = false;
+    m_indexInterrupt = false;
+    m_type = CommandType::None;
+    m_phase = Phase::Idle;
+    m_time = now;
+    m_eventTime = now;
+    m_commandEnd = now;
+    m_buffer.clear();
+    m_signalIndexNs = now;
+    traceSignals();
+}
+
+Wd1793::State Wd1793::state() const
+{
+    State state;
+    state.status = m_status;
+    state.command = m_command;
+    state.track = m_track;
+    state.sector = m_sector;
+    state.data = m_data;
+    state.intrq = m_intrq;
+    state.drq = m_drq;
+    state.headLoaded = m_headLoaded;
+    state.indexInterrupt = m_indexInterrupt;
+    state.doubleDensity = m_doubleDensity;
+    state.type = m_type;
+    state.phase = m_phase;
+    state.time = m_time;
+    state.eventTime = m_eventTime;
+    state.commandStart = m_commandStart;
+    state.commandEnd = m_commandEnd;
+    state.traceIdleNs = m_traceIdleNs;
+    state.stepDirection = m_stepDirection;
+    state.restoreSteps = m_restoreSteps;
+    state.stepped = m_stepped;
+    state.searchFrom = m_searchFrom;
+    state.searchDeadline = m_searchDeadline;
+    state.pendingId = m_pendingId;
+    state.pendingIdStart = m_pendingIdStart;
+    state.buffer = m_buffer;
+    state.index = m_index;
+    state.transferStart = m_transferStart;
+    state.firstFetch = m_firstFetch;
+    state.drqTime = m_drqTime;
+    state.targetSector = m_targetSector;
+    state.readTrack = m_readTrack;
+    state.readAddress = m_readAddress;
+    state.trackEnd = m_trackEnd;
+    state.trackEncoder = m_trackEncoder.state();
+    return state;
+}
+
+void Wd1793::restoreState(const State &state)
+{
+    m_status = state.status;
+    m_command = state.command;
+    m_track = state.track;
+    m_sector = state.sector;
+    m_data = state.data;
+    m_intrq = state.intrq;
+    m_drq = state.drq;
+    m_headLoaded = state.headLoaded;
+    m_indexInterrupt = state.indexInterrupt;
+    m_doubleDensity = state.doubleDensity;
+    m_type = state.type;
+    m_phase = state.phase;
+    m_time = state.time;
+    m_eventTime = state.eventTime;
+    m_commandStart = state.commandStart;
+    m_commandEnd = state.commandEnd;
+    m_traceIdleNs = state.traceIdleNs;
+    m_stepDirection = state.stepDirection;
+    m_restoreSteps = state.restoreSteps;
+    m_stepped = state.stepped;
+    m_searchFrom = state.searchFrom;
+    m_searchDeadline = state.searchDeadline;
+    m_pendingId = state.pendingId;
+    m_pendingIdStart = state.pendingIdStart;
+    m_buffer = state.buffer;
+    m_index = state.index;
+    m_transferStart = state.transferStart;
+    m_firstFetch = state.firstFetch;
+    m_drqTime = state.drqTime;
+    m_targetSector = state.targetSector;
+    m_readTrack = state.readTrack;
+    m_readAddress = state.readAddress;
+    m_trackEnd = state.trackEnd;
+    m_trackEncoder.restoreState(state.trackEncoder);
+    m_signalIndexNs = m_time;
+    traceSignals();
+}
+
+bool Wd1793::isReady() const
+{
+    return m_drive && m_drive->hasDisk();
+}
+
+const Track *Wd1793::searchTrack() const
+{
+    const Track *track = m_drive ? m_drive->currentTrack() : nullptr;
+    const Encoding encoding = m_doubleDensity ? Encoding::MFM : Encoding::FM;
+    return (track && track->isFormatted() && track->encoding == encoding) ? track : nullptr;
+}
+
+bool Wd1793::isWriteCommand() const
+{
+    return (m_type == CommandType::TypeII && (m_command & 0x20))
+        || (m_type == CommandType::TypeIII && (m_command & 0xF0) == 0xF0);
+}
+
+uint8_t Wd1793::statusRegister() const
+{
+    uint8_t status;
+    if (m_type == CommandType::TypeII || m_type == CommandType::TypeIII) {
+        status = m_status & static_cast<uint8_t>(~(STATUS_BUSY | STATUS_DRQ | STATUS_NOT_READY));
+        if (m_drq) {
+            status |= STATUS_DRQ;
+        }
+    } else {
+        status = m_status & (STATUS_SEEK_ERROR | STATUS_CRC_ERROR);
+        if (m_headLoaded) {
+            status |= STATUS_HEAD_LOADED;
+        }
+        if (m_drive) {
+            if (m_drive->isTrack0()) {
+                status |= STATUS_TRACK0;
+            }
+            if (m_drive->indexAt(m_time)) {
+                status |= STATUS_INDEX;
+            }
+            if (m_drive->isWriteProtected()) {
+                status |= STATUS_WRITE_PROTECT;
+            }
+        }
+    }
+    if (!isReady()) {
+        status |= STATUS_NOT_READY;
+    }
+    if (isBusy()) {
+        status |= STATUS_BUSY;
+    }
+    return status;
+}
+
+int Wd1793::transferPosition() const
+{
+    switch (m_phase) {
+    case Phase::ReadingData:
+    case Phase::WaitingFirstWrite:
+    case Phase::WritingData:
+        return static_cast<int>(m_index);
+    case Phase::WritingTrack:
+        return static_cast<int>(m_trackEncoder.byteCount());
+    default:
+        return -1;
+    }
+}
+
+void Wd1793::advance(uint64_t now)
+{
+    while (m_phase != Phase::Idle && m_eventTime <= now) {
+        moveTime(m_eventTime);
+        processEvent();
+        traceSignals();
+    }
+    if (m_indexInterrupt && isReady() && m_drive->nextIndex(m_time + 1) <= now) {
+        m_intrq = true;
+    }
+    moveTime(now);
+    traceSignals();
+}
+
+void Wd1793::moveTime(uint64_t time)
+{
+    if (time > m_time) {
+        count(FdcMetrics::EmulatedNs, time - m_time);
+        m_time = time;
+    }
+}
+
+void Wd1793::drqServiced(uint64_t latencyNs)
+{
+    count(FdcMetrics::DrqServiced);
+    count(FdcMetrics::DrqLatencyNs, latencyNs);
+    if (m_drqMonitor) {
+        m_drqMonitor->recordService(drqCommand(), latencyNs);
+    }
+}
+
+void Wd1793::lostData(size_t byteOffset)
+{
+    m_status |= STATUS_LOST_DATA;
+    if (!m_drqMonitor) {
+        return;
+    }
+    DrqMonitor::LostDataEvent event;
+    event.command = drqCommand();
+    event.cylinder = m_drive ? m_drive->cylinder() : 0;
+    event.side = m_drive ? m_drive->side() : 0;
+    event.trackRegister = m_track;
+    event.sectorRegister = m_sector;
+    event.byteOffset = byteOffset;
+    event.timeNs = m_time;
+    m_drqMonitor->recordLostData(event);
+}
+
+void Wd1793::recordSignals()
+{
+    // Index pulses follow from the rotation; queue the ones passed since the last call
+    if (isReady()) {
+        for (uint64_t index = m_drive->nextIndex(m_signalIndexNs); index <= m_time; index += FloppyDrive::REVOLUTION_NS) {
+            m_signalTrace->pulse(index, SignalTrace::Index, FloppyDrive::INDEX_PULSE_NS);
+            m_signalIndexNs = index + 1;
+        }
+    } else {
+        m_signalIndexNs = m_time;
+    }
+
+    SignalTrace::Levels levels{};
+    levels[SignalTrace::Intrq] = m_intrq;
+    levels[SignalTrace::Drq] = m_drq;
+    levels[SignalTrace::Direction] = m_stepDirection > 0;
+    levels[SignalTrace::HeadLoad] = m_headLoaded;
+    levels[SignalTrace::WriteGate] = m_phase == Phase::WritingData || m_phase == Phase::WritingCrc ||
+                                     m_phase == Phase::WritingTrack;
+    levels[SignalTrace::Command] = m_command;
+    levels[SignalTrace::Track] = m_track;
+    levels[SignalTrace::Sector] = m_sector;
+    levels[SignalTrace::Data] = m_data;
+    m_signalTrace->sample(m_time, levels);
+
+    if (m_stepPulse) {
+        m_signalTrace->pulse(m_time, SignalTrace::Step, SignalTrace::STEP_PULSE_NS);
+        m_stepPulse = false;
+    }
+}
+
+DrqMonitor::Command Wd1793::drqCommand() const
+{
+    switch (m_command & 0xF0) {
+    case 0xA0:
+    case 0xB0:
+        return DrqMonitor::WriteSector;
+    case 0xC0:
+        return DrqMonitor::ReadAddress;
+    case 0xE0:
+        return DrqMonitor::ReadTrack;
+    case 0xF0:
+        return DrqMonitor::WriteTrack;
+    default:
+        return DrqMonitor::ReadSector;
+    }
+}
+
+uint8_t Wd1793::read(int reg, uint64_t now)
+{
+    advance(now);
+    switch (reg & 3) {
+    case StatusRegister: {
+        const uint8_t status = statusRegister();
+        // An immediate Force Interrupt keeps INTRQ up until the next command
+        if ((m_command & 0xF0) != 0xD0 || !(m_command & INTERRUPT_IMMEDIATE)) {
+            m_intrq = false;
+        }
+        traceSignals();
+        return status;
+    }
+    case TrackRegister:
+        return m_track;
+    case SectorRegister:
+        return m_sector;
+    default:
+        if (m_drq && !isWriteCommand()) {
+            drqServiced(m_time - m_drqTime);
+            m_drq = false;
+        }
+        traceSignals();
+        return m_data;
+    }
+}
+
+void Wd1793::write(int reg, uint8_t value, uint64_t now)
+{
+    advance(now);
+    switch (reg & 3) {
+    case CommandRegister:
+        if ((value & 0xF0) == 0xD0) {
+            forceInterrupt(value);
+        } else if (!isBusy()) {
+            startCommand(value);
+        }
+        break;
+    case TrackRegister:
+        m_track = value;
+        break;
+    case SectorRegister:
+        m_sector = value;
+        break;
+    default:
+        m_data = value;
+        if (m_drq && isWriteCommand()) {
+            drqServiced(m_time - m_drqTime);
+            m_drq = false;
+        }
+        break;
+    }
+    traceSignals();
+}
+
+void Wd1793::startCommand(uint8_t command)
+{
+    m_command = command;
+    m_commandStart = m_time;
+    if (m_accessTrace) {
+        m_traceIdleNs += m_time - std::min(m_commandEnd, m_time);
+    }
+    m_intrq = false;
+    m_drq = false;
+    m_status = 0;
+    m_readTrack = false;
+    m_readAddress = false;
+    m_targetSector = -1;
+
+    if (!(command & 0x80)) {
+        count(FdcMetrics::CommandsTypeI);
+        startTypeI(command);
+    } else if ((command & 0xC0) == 0x80) {
+        count(FdcMetrics::CommandsTypeII);
+        if (m_accessTrace) {
+            AccessTrace::Access access;
+            access.cylinder = m_drive ? m_drive->cylinder() : 0;
+            access.side = m_drive ? m_drive->side() : 0;
+            access.sector = m_sector;
+            access.write = (command & 0x20) != 0;
+            access.idleNs = m_traceIdleNs;
+            m_accessTrace->append(access);
+            m_traceIdleNs = 0;
+        }
+        startTypeII(command);
+    } else {
+        count(FdcMetrics::CommandsTypeIII);
+        startTypeIII(command);
+    }
+}
+
+void Wd1793::startTypeI(uint8_t command)
+{
+    m_type = CommandType::TypeI;
+    m_headLoaded = (command & FLAG_HEAD_LOAD) != 0;
+    m_stepped = false;
+    m_restoreSteps = 0;
+
+    switch (command & 0xE0) {
+    case 0x00:
+        if (!(command & 0x10)) {
+            // Restore seeks towards track 0 until the TR00 sensor trips
+            m_track = 0xFF;
+            m_data = 0;
+        }
+        break;
+    case 0x40:
+        m_stepDirection = 1;
+        break;
+    case 0x60:
+        m_stepDirection = -1;
+        break;
+    default:
+        break; // Step repeats the last direction
+    }
+
+    m_phase = Phase::Stepping;
+    schedule(m_time);
+}
+
+void Wd1793::startTypeII(uint8_t command)
+{
+    m_type = CommandType::TypeII;
+    m_headLoaded = true;
+    if (!isReady()) {
+        m_status |= STATUS_NOT_READY;
+        complete();
+        return;
+    }
+    if ((command & 0x20) && m_drive->isWriteProtected()) {
+        m_status |= STATUS_WRITE_PROTECT;
+        complete();
+        return;
+    }
+    if (command & FLAG_DELAY) {
+        m_phase = Phase::Settling;
+        schedule(m_time + m_timing.settleNs);
+    } else {
+        startSearch();
+    }
+}
+
+void Wd1793::startTypeIII(uint8_t command)
+{
+    m_type = CommandType::TypeIII;
+    m_headLoaded = true;
+    if (!isReady()) {
+        m_status |= STATUS_NOT_READY;
+        complete();
+        return;
+    }
+
+    const uint64_t start = m_time + ((command & FLAG_DELAY) ? m_timing.settleNs : 0);
+    switch (command & 0xF0) {
+    case 0xC0:
+        m_readAddress = true;
+        if (command & FLAG_DELAY) {
+            m_phase = Phase::Settling;
+            schedule(start);
+        } else {
+            startSearch();
+        }
+        break;
+    case 0xE0:
+        m_readTrack = true;
+        m_phase = Phase::ReadTrackIndex;
+        schedule(m_drive->nextIndex(start));
+        break;
+    default:
+        if (m_drive->isWriteProtected()) {
+            m_status |= STATUS_WRITE_PROTECT;
+            complete();
+            return;
+        }
+        // DRQ goes up at once; the first byte has to be there by the index pulse
+        m_drq = true;
+        m_drqTime = m_time;
+        m_phase = Phase::WriteTrackIndex;
+        schedule(m_drive->nextIndex(start));
+        break;
+    }
+}
+
+void Wd1793::forceInterrupt(uint8_t command)
+{
+    const bool wasBusy = isBusy();
+    count(FdcMetrics::CommandsTypeIV);
+    m_phase = Phase::Idle;
+    m_command = command;
+    m_drq = false;
+    if (wasBusy) {
+        m_commandEnd = m_time;
+    } else {
+        m_type = CommandType::TypeI;
+        m_status = 0;
+    }
+    m_indexInterrupt = (command & INTERRUPT_ON_INDEX) != 0;
+    if (command & INTERRUPT_IMMEDIATE) {
+        m_intrq = true;
+    } else if ((command & 0x0F) == 0) {
+        m_intrq = false;
+    }
+}
+
+void Wd1793::complete()
+{
+    if (m_status & STATUS_CRC_ERROR) {
+        count(FdcMetrics::CrcErrors);
+    }
+    if (m_type == CommandType::TypeI) {
+        count(FdcMetrics::SeekTimeNs, m_time - m_commandStart);
+    } else {
+        if (m_status & STATUS_RECORD_NOT_FOUND) {
+            count(FdcMetrics::RecordNotFound);
+        }
+        if (m_status & STATUS_LOST_DATA) {
+            count(FdcMetrics::LostData);
+        }
+    }
+    m_phase = Phase::Idle;
+    m_commandEnd = m_time;
+    m_intrq = true;
+    if (isWriteCommand()) {
+        m_drq = false;
+    }
+}
+
+void Wd1793::processEvent()
+{
+    switch (m_phase) {
+    case Phase::Stepping:
+        stepEvent();
+        break;
+    case Phase::Settling:
+        startSearch();
+        break;
+    case Phase::SearchingId:
+        idEvent();
+        break;
+    case Phase::ReadingData:
+        readDataEvent();
+        break;
+    case Phase::WriteDrqPending:
+        m_drq = true;
+        m_drqTime = m_time;
+        m_phase = Phase::WaitingFirstWrite;
+        schedule(m_firstFetch);
+        break;
+    case Phase::WaitingFirstWrite:
+        firstWriteEvent();
+        break;
+    case Phase::WritingData:
+        writeDataEvent();
+        break;
+    case Phase::WritingCrc:
+        if (m_command & FLAG_MULTIPLE) {
+            ++m_sector;
+            startSearch();
+        } else {
+            complete();
+        }
+        break;
+    case Phase::ReadTrackIndex: {
+        // Read Track returns the raw byte stream from index to index
+        const Encoding encoding = m_doubleDensity ? Encoding::MFM : Encoding::FM;
+        const size_t trackBytes = static_cast<size_t>(FloppyDrive::REVOLUTION_NS / byteNs());
+        const Track *track = m_drive->currentTrack();
+        BitstreamEncoder encoder(encoding);
+        if (track && track->encoding == encoding) {
+            encoder.encodeTrack(*track, trackBytes);
+        } else {
+            encoder.padTo(trackBytes, encoding == Encoding::MFM ? MFM_FIELDS.gapByte : FM_FIELDS.gapByte);
+        }
+        const std::vector<uint8_t> &cells = encoder.cells();
+        m_buffer.resize(trackBytes);
+        for (size_t i = 0; i < trackBytes; ++i) {
+            m_buffer[i] = BitstreamDecoder::decodeWord(static_cast<uint16_t>((cells[i * 2] << 8) | cells[i * 2 + 1]));
+        }
+        m_index = 0;
+        m_transferStart = m_time + byteNs();
+        m_trackEnd = m_time + FloppyDrive::REVOLUTION_NS;
+        m_phase = Phase::ReadingData;
+        schedule(m_transferStart);
+        break;
+    }
+    case Phase::WriteTrackIndex:
+        if (m_drq) {
+            lostData(0);
+            complete();
+            break;
+        }
+        m_trackEncoder = BitstreamEncoder(m_doubleDensity ? Encoding::MFM : Encoding::FM);
+        m_trackEnd = m_time + FloppyDrive::REVOLUTION_NS;
+        m_phase = Phase::WritingTrack;
+        schedule(m_time + encodeFormatByte(m_trackEncoder, m_data) * byteNs());
+        m_drq = true;
+        m_drqTime = m_time;
+        break;
+    case Phase::WritingTrack:
+        writeTrackEvent();
+        break;
+    case Phase::Idle:
+        break;
+    }
+}
+
+void Wd1793::stepEvent()
+{
+    const uint64_t stepNs = m_timing.stepNs[m_command & 0x03];
+    const bool restore = (m_command & 0xF0) == 0x00;
+    const bool seek = (m_command & 0xF0) == 0x10;
+
+    if (restore || seek) {
+        if (restore && m_drive && m_drive->isTrack0()) {
+            m_track = 0;
+            finishStepping();
+            return;
+        }
+        if (restore && ++m_restoreSteps > MAX_RESTORE_STEPS) {
+            m_status |= STATUS_SEEK_ERROR;
+            complete();
+            return;
+        }
+        if (!restore && m_track == m_data) {
+            finishStepping();
+            return;
+        }
+        m_stepDirection = (restore || m_data < m_track) ? -1 : 1;
+        if (!restore) {
+            m_track = static_cast<uint8_t>(m_track + m_stepDirection);
+        }
+        if (m_drive) {
+            m_drive->step(m_stepDirection);
+            count(FdcMetrics::Steps);
+        }
+        m_stepPulse = true;
+        schedule(m_time + stepNs);
+        return;
+    }
+
+    // Step, Step In, Step Out: one pulse, then the step rate delay
+    if (m_stepped) {
+        finishStepping();
+        return;
+    }
+    m_stepped = true;
+    if (m_stepDirection < 0 && m_drive && m_drive->isTrack0()) {
+        m_track = 0;
+        finishStepping();
+        return;
+    }
+    if (m_command & FLAG_UPDATE) {
+        m_track = static_cast<uint8_t>(m_track + m_stepDirection);
+    }
+    if (m_drive) {
+        m_drive->step(m_stepDirection);
+        count(FdcMetrics::Steps);
+    }
+    m_stepPulse = true;
+    schedule(m_time + stepNs);
+}
+
+void Wd1793::finishStepping()
+{
+    if (m_command & FLAG_VERIFY) {
+        m_phase = Phase::Settling;
+        schedule(m_time + m_timing.settleNs);
+    } else {
+        complete();
+    }
+}
+
+void Wd1793::startSearch()
+{
+    m_phase = Phase::SearchingId;
+    m_searchFrom = m_time;
+    m_searchDeadline = m_time + SEARCH_REVOLUTIONS * FloppyDrive::REVOLUTION_NS;
+    scheduleNextId();
+}
+
+void Wd1793::scheduleNextId()
+{
+    const FieldTiming &fields = m_doubleDensity ? MFM_FIELDS : FM_FIELDS;
+    const Track *track = searchTrack();
+    m_pendingId = -1;
+    uint64_t best = UINT64_MAX;
+    if (track) {
+        const bool recorded = track->hasRecordedAngles();
+        for (size_t i = 0; i < track->sectors.size(); ++i) {
+            const uint64_t start = m_drive->timeOfAngle(track->idAngle(i, recorded), m_searchFrom);
+            if (start < best) {
+                best = start;
+                m_pendingId = static_cast<int>(i);
+            }
+        }
+    }
+
+    // Read Address hands out the ID bytes as they pass, everything else acts on the complete ID
+    const uint64_t offset = (m_readAddress ? fields.idBytes - 6 : fields.idBytes) * byteNs();
+    if (m_pendingId < 0 || best + offset > m_searchDeadline) {
+        m_pendingId = -1;
+        schedule(m_searchDeadline);
+        return;
+    }
+    m_pendingIdStart = best;
+    schedule(best + offset);
+}
+
+void Wd1793::idEvent()
+{
+    if (m_pendingId < 0) {
+        m_status |= (m_type == CommandType::TypeI) ? STATUS_SEEK_ERROR : STATUS_RECORD_NOT_FOUND;
+        complete();
+        return;
+    }
+
+    const Track *track = searchTrack();
+    if (!track || m_pendingId >= static_cast<int>(track->sectors.size())) {
+        scheduleNextId();
+        return;
+    }
+    const Sector &sector = track->sectors[static_cast<size_t>(m_pendingId)];
+    m_searchFrom = m_pendingIdStart + 1;
+
+    if (m_type == CommandType::TypeI) {
+        if (!sector.idCrcOk) {
+            m_status |= STATUS_CRC_ERROR;
+        } else if (sector.cylinder == m_track) {
+            m_status &= static_cast<uint8_t>(~STATUS_CRC_ERROR);
+            complete();
+            return;
+        }
+        scheduleNextId();
+        return;
+    }
+
+    if (m_readAddress) {
+        const uint8_t id[4] = { sector.cylinder, sector.head, sector.id, sector.sizeCode };
+        uint16_t crc = Crc16::INITIAL_VALUE;
+        if (m_doubleDensity) {
+            for (int i = 0; i < 3; ++i) {
+                crc = Crc16::update(crc, 0xA1);
+            }
+        }
+        crc = Crc16::update(Crc16::update(crc, 0xFE), id, sizeof(id));
+        if (!sector.idCrcOk) {
+            crc = static_cast<uint16_t>(~crc);
+            m_status |= STATUS_CRC_ERROR;
+        }
+        m_buffer.assign(id, id + 4);
+        m_buffer.push_back(static_cast<uint8_t>(crc >> 8));
+        m_buffer.push_back(static_cast<uint8_t>(crc & 0xFF));
+        m_sector = sector.cylinder;
+        m_index = 0;
+        m_transferStart = m_time + byteNs();
+        m_phase = Phase::ReadingData;
+        schedule(m_transferStart);
+        return;
+    }
+
+    const bool sideMatches = !(m_command & FLAG_SIDE_COMPARE)
+                          || ((m_command & FLAG_SIDE) ? 1 : 0) == (sector.head & 1);
+    if (sector.cylinder != m_track || sector.id != m_sector || !sideMatches) {
+        scheduleNextId();
+        return;
+    }
+    if (!sector.idCrcOk) {
+        m_status |= STATUS_CRC_ERROR;
+        scheduleNextId();
+        return;
+    }
+    m_status &= static_cast<uint8_t>(~STATUS_CRC_ERROR);
+    m_targetSector = m_pendingId;
+
+    if (m_command & 0x20) {
+        startWriteTransfer(m_time);
+    } else if (sector.hasData()) {
+        startReadTransfer(sector, m_time);
+    } else {
+        // No data mark behind this ID: keep looking until the search times out
+        scheduleNextId();
+    }
+}
+
+void Wd1793::startReadTransfer(const Sector &sector, uint64_t idEnd)
+{
+    const FieldTiming &fields = m_doubleDensity ? MFM_FIELDS : FM_FIELDS;
+    m_buffer.assign(sector.data.begin(), sector.data.end());
+    m_buffer.resize(static_cast<size_t>(sector.size()), 0);
+    if (sector.deleted) {
+        m_status |= STATUS_RECORD_TYPE;
+    }
+    m_index = 0;
+    m_transferStart = idEnd + fields.gapToData * byteNs();
+    m_phase = Phase::ReadingData;
+    schedule(m_transferStart);
+}
+
+void Wd1793::startWriteTransfer(uint64_t idEnd)
+{
+    const FieldTiming &fields = m_doubleDensity ? MFM_FIELDS : FM_FIELDS;
+    const Track *track = searchTrack();
+    m_buffer.assign(static_cast<size_t>(track->sectors[static_cast<size_t>(m_targetSector)].size()), 0);
+    m_index = 0;
+    m_firstFetch = idEnd + fields.writeGap * byteNs();
+    m_transferStart = m_firstFetch + (fields.writePreamble - 1) * byteNs();
+    m_phase = Phase::WriteDrqPending;
+    schedule(idEnd + 2 * byteNs());
+}
+
+uint64_t Wd1793::fetchTime(size_t position) const
+{
+    return position == 0 ? m_firstFetch : m_transferStart + position * byteNs();
+}
+
+uint64_t Wd1793::transferEndTime() const
+{
+    if (m_readTrack) {
+        return m_trackEnd;
+    }
+    const uint64_t lastArrival = m_transferStart + (m_buffer.size() - 1) * byteNs();
+    return lastArrival + (m_readAddress ? 1 : 2) * byteNs();
+}
+
+void Wd1793::readDataEvent()
+{
+    if (m_index < m_buffer.size()) {
+        // The previous byte was never read: it is overwritten
+        if (m_drq) {
+            lostData(m_index - 1);
+        }
+        m_data = m_buffer[m_index++];
+        m_drq = true;
+        m_drqTime = m_time;
+        schedule(m_index < m_buffer.size() ? m_transferStart + m_index * byteNs() : transferEndTime());
+        return;
+    }
+
+    if (m_readTrack || m_readAddress) {
+        complete();
+        return;
+    }
+
+    const Track *track = searchTrack();
+    const bool crcOk = track && m_targetSector >= 0 && m_targetSector < static_cast<int>(track->sectors.size())
+                    && track->sectors[static_cast<size_t>(m_targetSector)].dataCrcOk;
+    if (!crcOk) {
+        m_status |= STATUS_CRC_ERROR;
+        complete();
+        return;
+    }
+    count(FdcMetrics::SectorsRead);
+    if (m_command & FLAG_MULTIPLE) {
+        ++m_sector;
+        startSearch();
+        return;
+    }
+    complete();
+}
+
+void Wd1793::firstWriteEvent()
+{
+    if (m_drq) {
+        lostData(0);
+        complete();
+        return;
+    }
+    m_buffer[0] = m_data;
+    m_index = 1;
+    m_drq = true;
+    m_drqTime = m_time;
+    m_phase = Phase::WritingData;
+    schedule(fetchTime(1));
+}
+
+void Wd1793::writeDataEvent()
+{
+    // A byte the host did not supply in time is written as zero
+    uint8_t value = m_data;
+    if (m_drq) {
+        lostData(m_index);
+        value = 0x00;
+    }
+    m_buffer[m_index++] = value;
+    if (m_index < m_buffer.size()) {
+        m_drq = true;
+        m_drqTime = m_time;
+        schedule(fetchTime(m_index));
+        return;
+    }
+
+    Track *track = m_drive->currentTrack();
+    if (track && m_targetSector >= 0 && m_targetSector < static_cast<int>(track->sectors.size())) {
+        Sector &sector = track->sectors[static_cast<size_t>(m_targetSector)];
+        sector.data = m_buffer;
+        sector.dataCrcOk = true;
+        sector.weak = false;
+        sector.deleted = (m_command & FLAG_DELETED) != 0;
+        m_drive->disk()->markTrackChanged(m_drive->cylinder(), m_drive->side());
+        if (m_writeBack) {
+            m_writeBack->trackChanged(m_drive->cylinder(), m_drive->side(), *track);
+        }
+        count(FdcMetrics::SectorsWritten);
+    }
+    m_phase = Phase::WritingCrc;
+    schedule(m_time + 3 * byteNs());
+}
+
+void Wd1793::writeTrackEvent()
+{
+    if (m_time >= m_trackEnd) {
+        finishWriteTrack();
+        return;
+    }
+    uint8_t value = m_data;
+    if (m_drq) {
+        lostData(m_trackEncoder.byteCount());
+        value = 0x00;
+    }
+    const uint64_t next = m_time + encodeFormatByte(m_trackEncoder, value) * byteNs();
+    m_drq = true;
+    m_drqTime = m_time;
+    schedule(std::min(next, m_trackEnd));
+}
+
+void Wd1793::finishWriteTrack()
+{
+    FLOPPY_TRACE_ZONE("decode", "Wd1793::finishWriteTrack");
+    const Encoding encoding = m_trackEncoder.encoding();
+    const FieldTiming &fields = (encoding == Encoding::MFM) ? MFM_FIELDS : FM_FIELDS;
+    m_trackEncoder.padTo(static_cast<size_t>(FloppyDrive::REVOLUTION_NS / byteNs()), fields.gapByte);
+
+    // Whatever was written is read back like any other track; padTo() left whole bytes
+    BitstreamDecoder decoder(encoding);
+    decoder.pushWords(m_trackEncoder.cells().data(), m_trackEncoder.cellCount() / 16);
+    decoder.finish();
+
+    // Cylinders beyond the image cannot be formatted
+    if (Track *track = m_drive->currentTrack()) {
+        track->encoding = encoding;
+        track->revolutions = 1;
+        track->sectors = decoder.takeSectors();
+        m_drive->disk()->markTrackChanged(m_drive->cylinder(), m_drive->side());
+        if (m_writeBack) {
+            m_writeBack->trackChanged(m_drive->cylinder(), m_drive->side(), *track);
+        }
+    }
+    complete();
+}
+
+size_t Wd1793::writeTrackBlock(const uint8_t *buffer, size_t count, uint64_t &t, uint64_t hostByteNs)
+{
+    // Same steps as write() and writeTrackEvent() for a host that keeps up:
+    // each byte lands while DRQ is up and is fetched at the next event
+    const uint64_t period = byteNs();
+    const bool observed = isObserved();
+    uint64_t now = m_time;
+    uint64_t drqTime = m_drqTime;
+    uint64_t fetchAt = m_eventTime;
+    bool drq = m_drq;
+    size_t moved = 0;
+    size_t fetched = 0;
+    while (moved < count && drq) {
+        const uint64_t writeAt = std::max(t, drqTime);
+        if (writeAt >= fetchAt) {
+            break;
+        }
+        if (observed) {
+            drqServiced(writeAt - drqTime);
+        }
+        now = writeAt;
+        drq = false;
+        t = writeAt + hostByteNs;
+        // The last byte waits in the data register, as does one the index will cut off
+        if (++moved == count || fetchAt >= m_trackEnd) {
+            break;
+        }
+        now = fetchAt;
+        fetchAt = std::min(now + (buffer[fetched++] == 0xF7 ? 2 : 1) * period, m_trackEnd);
+        drq = true;
+        drqTime = now;
+        t = std::max(t, now);
+    }
+
+    if (moved > 0) {
+        encodeFormatBytes(m_trackEncoder, buffer, fetched);
+        m_data = buffer[moved - 1];
+        m_drq = drq;
+        m_drqTime = drqTime;
+        schedule(fetchAt);
+        moveTime(now);
+    }
+    return moved;
+}
+
+size_t Wd1793::readDataBlock(uint8_t *buffer, size_t count, uint64_t now, uint64_t hostByteNs, uint64_t *endNs)
+{
+    FLOPPY_TRACE_ZONE("fdc", "Wd1793::readDataBlock");
+    advance(now);
+    uint64_t t = m_time;
+
+    // The host is blocked on DRQ: let the search and any delays run
+    while (!m_drq && isBusy() && m_phase != Phase::ReadingData && !isWriteCommand()) {
+        advance(m_eventTime);
+        t = m_time;
+    }
+
+    if (endNs) {
+        *endNs = t;
+    }
+    if (count == 0 || isWriteCommand()) {
+        return 0;
+    }
+    if (m_phase != Phase::ReadingData) {
+        // The command ended with the last byte still waiting in the data register
+        if (!m_drq) {
+            return 0;
+        }
+        buffer[0] = read(DataRegister, t);
+        if (endNs) {
+            *endNs = t + hostByteNs;
+        }
+        return 1;
+    }
+
+    const uint64_t period = byteNs();
+    const size_t size = m_buffer.size();
+    if (!m_drq && m_index >= size) {
+        return 0;
+    }
+
+    const size_t first = m_drq ? m_index - 1 : m_index;
+    const size_t available = std::min(count, size - first);
+    auto arrival = [&](size_t position) { return m_transferStart + position * period; };
+
+    // Byte j is read at max(arrival, previous read + hostByteNs); it is lost
+    // if the next byte arrives first. A host at least as fast as the disk can
+    // never fall behind once it holds the first byte.
+    const uint64_t firstRead = std::max(t, arrival(first));
+    size_t moved = 0;
+    uint64_t lastRead = firstRead;
+    if (hostByteNs <= period) {
+        moved = available;
+        lastRead = std::max(arrival(first + available - 1), firstRead + (available - 1) * hostByteNs);
+        if (isObserved()) {
+            for (size_t j = 0; j < moved; ++j) {
+                drqServiced(std::max(arrival(first + j), firstRead + j * hostByteNs) - arrival(first + j));
+            }
+        }
+    } else {
+        uint64_t readAt = firstRead;
+        while (moved < available) {
+            const size_t position = first + moved;
+            if (moved > 0) {
+                readAt = std::max(arrival(position), lastRead + hostByteNs);
+            }
+            if (position + 1 < size && readAt >= arrival(position + 1)) {
+                break;
+            }
+            drqServiced(readAt - arrival(position));
+            lastRead = readAt;
+            ++moved;
+        }
+    }
+
+    std::memcpy(buffer, m_buffer.data() + first, moved);
+    m_index = first + moved;
+    m_data = m_buffer[m_index - 1];
+    m_drq = false;
+    m_drqTime = arrival(m_index - 1);
+    moveTime(lastRead);
+    schedule(m_index < size ? arrival(m_index) : transferEndTime());
+    // Anything due by the last read (the CRC check after the final byte) happens now
+    advance(m_time);
+
+    if (endNs) {
+        *endNs = lastRead + hostByteNs;
+    }
+    return moved;
+}
+
+size_t Wd1793::writeDataBlock(const uint8_t *buffer, size_t count, uint64_t now, uint64_t hostByteNs, uint64_t *endNs)
+{
+    FLOPPY_TRACE_ZONE("fdc", "Wd1793::writeDataBlock");
+    advance(now);
+    uint64_t t = m_time;
+    size_t moved = 0;
+
+    while (moved < count && isBusy() && isWriteCommand()) {
+        // The host is blocked on DRQ
+        while (!m_drq && isBusy()) {
+            advance(m_eventTime);
+            t = std::max(t, m_time);
+        }
+        if (!m_drq || !isBusy()) {
+            break;
+        }
+
+        // An index interrupt armed by Force Interrupt needs the event loop
+        if (m_phase == Phase::WritingTrack && !m_indexInterrupt) {
+            const size_t accepted = writeTrackBlock(buffer + moved, count - moved, t, hostByteNs);
+            moved += accepted;
+            if (accepted > 0) {
+                continue;
+            }
+        }
+        if (m_phase != Phase::WritingData) {
+            // First byte windows and late Write Track bytes go through the register path,
+            // which applies the deadline of the pending fetch
+            write(DataRegister, buffer[moved++], t);
+            t += hostByteNs;
+            continue;
+        }
+
+        const uint64_t period = byteNs();
+        const size_t size = m_buffer.size();
+        const size_t first = m_index;
+        const size_t available = std::min(count - moved, size - first);
+
+        // Byte j may be written once its DRQ is up and must land before its fetch
+        const uint64_t firstWrite = std::max(t, m_drqTime);
+        uint64_t writeAt = firstWrite;
+        uint64_t lastWrite = writeAt;
+        size_t accepted = 0;
+        if (hostByteNs <= period && writeAt < fetchTime(first)) {
+            accepted = available;
+            if (available > 1) {
+                lastWrite = std::max(fetchTime(first + available - 2), writeAt + (available - 1) * hostByteNs);
+            }
+            if (isObserved()) {
+                drqServiced(firstWrite - m_drqTime);
+                for (size_t j = 1; j < accepted; ++j) {
+                    const uint64_t raised = fetchTime(first + j - 1);
+                    drqServiced(std::max(raised, firstWrite + j * hostByteNs) - raised);
+                }
+            }
+        } else {
+            while (accepted < available) {
+                const size_t position = first + accepted;
+                const uint64_t raised = accepted > 0 ? fetchTime(position - 1) : m_drqTime;
+                if (accepted > 0) {
+                    writeAt = std::max(raised, lastWrite + hostByteNs);
+                }
+                if (writeAt >= fetchTime(position)) {
+                    break;
+                }
+                drqServiced(writeAt - raised);
+                lastWrite = writeAt;
+                ++accepted;
+            }
+        }
+        if (accepted == 0) {
+            break;
+        }
+
+        // Every byte but the last has been fetched; the last one waits in the data register
+        std::memcpy(m_buffer.data() + first, buffer + moved, accepted);
+        moved += accepted;
+        m_index = first + accepted - 1;
+        m_data = m_buffer[m_index];
+        m_drq = false;
+        m_drqTime = m_index > 0 ? fetchTime(m_index - 1) : m_drqTime;
+        moveTime(lastWrite);
+        schedule(fetchTime(m_index));
+        t = lastWrite + hostByteNs;
+        if (accepted < available) {
+            break;
+        }
+    }
+
+    traceSignals();
+    if (endNs) {
+        *endNs = t;
+    }
+    return moved;
+}
@@ -0,0 +1,289 @@
+#ifndef WD1793_H
+#define WD1793_H
+
+#include "accesstrace.h"
+#include "bitstreamencoder.h"
+#include "diskgeometry.h"
+#include "drqmonitor.h"
+#include "fdcmetrics.h"
+#include "floppydrive.h"
+#include "imagewriteback.h"
+#include "signaltrace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// WD1793 floppy disk controller model. Everything runs in emulated
+// nanoseconds: every host access carries the time it happens at and the
+// controller first catches up to it, so the outcome only depends on the
+// access times, never on how fast the emulation runs.
+class Wd1793
+{
+public:
+    enum Register {
+        StatusRegister = 0,
+        CommandRegister = 0,
+        TrackRegister = 1,
+        SectorRegister = 2,
+        DataRegister = 3
+    };
+
+    // Status bits; several are shared and depend on the last command type
+    static constexpr uint8_t STATUS_BUSY = 0x01;
+    static constexpr uint8_t STATUS_INDEX = 0x02;             // Type I
+    static constexpr uint8_t STATUS_DRQ = 0x02;               // Type II/III
+    static constexpr uint8_t STATUS_TRACK0 = 0x04;            // Type I
+    static constexpr uint8_t STATUS_LOST_DATA = 0x04;         // Type II/III
+    static constexpr uint8_t STATUS_CRC_ERROR = 0x08;
+    static constexpr uint8_t STATUS_SEEK_ERROR = 0x10;        // Type I
+    static constexpr uint8_t STATUS_RECORD_NOT_FOUND = 0x10;  // Type II/III
+    static constexpr uint8_t STATUS_HEAD_LOADED = 0x20;       // Type I
+    static constexpr uint8_t STATUS_RECORD_TYPE = 0x20;       // Read Sector: deleted data mark
+    static constexpr uint8_t STATUS_WRITE_PROTECT = 0x40;
+    static constexpr uint8_t STATUS_NOT_READY = 0x80;
+
+    enum class CommandType {
+        None,
+        TypeI,      // Restore, Seek, Step, Step In, Step Out
+        TypeII,     // Read Sector, Write Sector
+        TypeIII,    // Read Address, Read Track, Write Track
+        TypeIV      // Force Interrupt
+    };
+
+    // Defaults are a 1 MHz WD1793 driving a 5.25" drive
+    struct Timing {
+        uint64_t stepNs[4] = { 6000000, 12000000, 20000000, 30000000 };
+        uint64_t settleNs = 15000000;
+        uint64_t mfmByteNs = Geometry::TRDOS_80DS.byteNs();    // 250 kbit/s
+        uint64_t fmByteNs = Geometry::FM_40SS.byteNs();        // 125 kbit/s
+    };
+
+    explicit Wd1793(FloppyDrive *drive = nullptr);
+
+    void setDrive(FloppyDrive *drive) { m_drive = drive; }
+    FloppyDrive *drive() const { return m_drive; }
+    // Optional counters; several controllers may share one registry
+    void setMetrics(FdcMetrics *metrics) { m_metrics = metrics; }
+    FdcMetrics *metrics() const { return m_metrics; }
+    // Optional DRQ latency histograms and Lost Data log, one per controller
+    void setDrqMonitor(DrqMonitor *monitor) { m_drqMonitor = monitor; }
+    DrqMonitor *drqMonitor() const { return m_drqMonitor; }
+    // Optional log of Read/Write Sector commands with the host's idle time before each
+    void setAccessTrace(AccessTrace *trace) { m_accessTrace = trace; m_traceIdleNs = 0; }
+    AccessTrace *accessTrace() const { return m_accessTrace; }
+    // Optional edge log of pins and registers for a logic analyzer
+    void setSignalTrace(SignalTrace *trace) { m_signalTrace = trace; m_signalIndexNs = m_time; }
+    SignalTrace *signalTrace() const { return m_signalTrace; }
+    // Optional saving of written tracks to the image file
+    void setWriteBack(ImageWriteBack *writeBack) { m_writeBack = writeBack; }
+    ImageWriteBack *writeBack() const { return m_writeBack; }
+    void setTiming(const Timing &timing) { m_timing = timing; }
+    const Timing &timing() const { return m_timing; }
+
+    // DDEN input: MFM when true, FM otherwise
+    void setDoubleDensity(bool doubleDensity) { m_doubleDensity = doubleDensity; }
+    bool isDoubleDensity() const { return m_doubleDensity; }
+
+    void reset(uint64_t now = 0);
+
+    // Runs the command in progress up to 'now'
+    void advance(uint64_t now);
+
+    // Port access at emulated time 'now'
+    uint8_t read(int reg, uint64_t now);
+    void write(int reg, uint8_t value, uint64_t now);
+
+    // Bulk DRQ transfer for hosts that move a whole span at once. The host
+    // is blocked on DRQ from 'now' and then needs hostByteNs per byte. Bytes
+    // move while the host keeps ahead of the disk; the call stops at the end
+    // of the sector or where the next byte would have overrun the data
+    // register. The controller ends up exactly where the same accesses done
+    // one by one would have left it, so a slow host continues byte by byte
+    // and sees Lost Data as usual. endNs receives the time the host is done.
+    size_t readDataBlock(uint8_t *buffer, size_t count, uint64_t now, uint64_t hostByteNs, uint64_t *endNs = nullptr);
+    size_t writeDataBlock(const uint8_t *buffer, size_t count, uint64_t now, uint64_t hostByteNs, uint64_t *endNs = nullptr);
+
+    // Register file and pins without side effects, as of time()
+    uint8_t statusRegister() const;
+    uint8_t commandRegister() const { return m_command; }
+    uint8_t trackRegister() const { return m_track; }
+    uint8_t sectorRegister() const { return m_sector; }
+    uint8_t dataRegister() const { return m_data; }
+    bool intrq() const { return m_intrq; }
+    bool drq() const { return m_drq; }
+    bool isBusy() const { return m_phase != Phase::Idle; }
+    bool isHeadLoaded() const { return m_headLoaded; }
+    CommandType commandType() const { return m_type; }
+    uint64_t time() const { return m_time; }
+    // When the command in progress next changes state by itself; hosts
+    // waiting for DRQ or INTRQ can advance straight to it
+    uint64_t nextEventTime() const { return m_eventTime; }
+    uint64_t byteNs() const { return m_doubleDensity ? m_timing.mfmByteNs : m_timing.fmByteNs; }
+
+    // Byte offset within the current data transfer, -1 when not transferring
+    int transferPosition() const;
+
+    // Internal state machine of the command in progress
+    enum class Phase {
+        Idle,
+        Stepping,
+        Settling,
+        SearchingId,
+        ReadingData,
+        WriteDrqPending,
+        WaitingFirstWrite,
+        WritingData,
+        WritingCrc,
+        ReadTrackIndex,
+        WriteTrackIndex,
+        WritingTrack
+    };
+
+    // Registers, pins and the command in progress with its pending event:
+    // restoring it continues the command exactly where it was. The drive,
+    // timing and optional hooks are attachments, not state.
+    struct State {
+        uint8_t status = 0;
+        uint8_t command = 0;
+        uint8_t track = 0;
+        uint8_t sector = 1;
+        uint8_t data = 0;
+        bool intrq = false;
+        bool drq = false;
+        bool headLoaded = false;
+        bool indexInterrupt = false;
+        bool doubleDensity = true;
+        CommandType type = CommandType::None;
+        Phase phase = Phase::Idle;
+        uint64_t time = 0;
+        uint64_t eventTime = 0;
+        uint64_t commandStart = 0;
+        uint64_t commandEnd = 0;
+        uint64_t traceIdleNs = 0;
+        int stepDirection = 1;
+        int restoreSteps = 0;
+        bool stepped = false;
+        uint64_t searchFrom = 0;
+        uint64_t searchDeadline = 0;
+        int pendingId = -1;
+        uint64_t pendingIdStart = 0;
+        std::vector<uint8_t> buffer;
+        size_t index = 0;
+        uint64_t transferStart = 0;
+        uint64_t firstFetch = 0;
+        uint64_t drqTime = 0;
+        int targetSector = -1;
+        bool readTrack = false;
+        bool readAddress = false;
+        BitstreamEncoder::State trackEncoder;
+        uint64_t trackEnd = 0;
+    };
+    State state() const;
+    void restoreState(const State &state);
+
+private:
+    void startCommand(uint8_t command);
+    void startTypeI(uint8_t command);
+    void startTypeII(uint8_t command);
+    void startTypeIII(uint8_t command);
+    void forceInterrupt(uint8_t command);
+
+    void processEvent();
+    void stepEvent();
+    void finishStepping();
+    void startSearch();
+    void scheduleNextId();
+    void idEvent();
+    void startReadTransfer(const Sector &sector, uint64_t idEnd);
+    void startWriteTransfer(uint64_t idEnd);
+    void readDataEvent();
+    void firstWriteEvent();
+    void writeDataEvent();
+    void writeTrackEvent();
+    void finishWriteTrack();
+    // Write Track bytes from writeDataBlock() while the host keeps up; 't' is the host's time
+    size_t writeTrackBlock(const uint8_t *buffer, size_t count, uint64_t &t, uint64_t hostByteNs);
+    void complete();
+
+    bool isReady() const;
+    bool isWriteCommand() const;
+    const Track *searchTrack() const;
+    uint64_t fetchTime(size_t position) const;
+    uint64_t transferEndTime() const;
+    void schedule(uint64_t time) { m_eventTime = time; }
+    void moveTime(uint64_t time);
+    void drqServiced(uint64_t latencyNs);
+    void lostData(size_t byteOffset);
+    // Hands pin and register changes since the last call to the signal trace
+    void traceSignals()
+    {
+        if (m_signalTrace) {
+            recordSignals();
+        }
+    }
+    void recordSignals();
+    DrqMonitor::Command drqCommand() const;
+    // Per-byte accounting in the bulk paths is only needed when someone listens
+    bool isObserved() const { return m_metrics || m_drqMonitor; }
+    void count(FdcMetrics::Counter counter, uint64_t amount = 1)
+    {
+        if (m_metrics) {
+            m_metrics->add(counter, amount);
+        }
+    }
+
+    FloppyDrive *m_drive;
+    FdcMetrics *m_metrics;
+    DrqMonitor *m_drqMonitor;
+    AccessTrace *m_accessTrace;
+    SignalTrace *m_signalTrace;
+    ImageWriteBack *m_writeBack;
+    uint64_t m_signalIndexNs;   // Index pulses before this are in the signal trace
+    bool m_stepPulse;           // A step pulse went out since the last trace
+    Timing m_timing;
+    bool m_doubleDensity;
+
+    uint8_t m_status;
+    uint8_t m_command;
+    uint8_t m_track;
+    uint8_t m_sector;
+    uint8_t m_data;
+    bool m_intrq;
+    bool m_drq;
+    bool m_headLoaded;
+    bool m_indexInterrupt;
+
+    CommandType m_type;
+    Phase m_phase;
+    uint64_t m_time;
+    uint64_t m_eventTime;
+    uint64_t m_commandStart;
+    uint64_t m_commandEnd;
+    uint64_t m_traceIdleNs;     // Host time outside commands since the last traced access
+
+    // Type I
+    int m_stepDirection;
+    int m_restoreSteps;
+    bool m_stepped;
+
+    // ID search
+    uint64_t m_searchFrom;
+    uint64_t m_searchDeadline;
+    int m_pendingId;
+    uint64_t m_pendingIdStart;
+
+    // Data transfer
+    std::vector<uint8_t> m_buffer;
+    size_t m_index;
+    uint64_t m_transferStart;
+    uint64_t m_firstFetch;
+    uint64_t m_drqTime;
+    int m_targetSector;
+    bool m_readTrack;
+    bool m_readAddress;
+    BitstreamEncoder m_trackEncoder;
+    uint64_t m_trackEnd;
+};
+
+#endif // WD1793_H
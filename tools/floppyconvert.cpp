@@ -0,0 +1,121 @@
+// Streaming image converter between TRD, SCL, IMG, DSK/EDSK and HFE.
+//
+//   qt-floppy-convert [--in-flight N] [--trace FILE] [--to FORMAT] input output
+//   qt-floppy-convert [--in-flight N] [--trace FILE] --to FORMAT --out-dir DIR input...
+//
+// The second form converts a whole collection, one image after the other,
+// into DIR with the same base names. Failures are reported per image and
+// make the exit status 1; the remaining images are still converted.
+// --trace writes the read, decode and encode stages as a Chrome trace, in
+// builds configured with QT_FLOPPY_TRACING.
+
+#include "imageconverter.h"
+#include "perftrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string baseName(const std::string &path)
+{
+    const size_t slash = path.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    const size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+bool convertOne(const std::string &input, const std::string &output, const ConvertOptions &options)
+{
+    ConvertStats stats;
+    std::string error;
+    if (!ImageConverter::convert(input, output, options, &stats, &error)) {
+        std::fprintf(stderr, "%s: %s\n", input.c_str(), error.c_str());
+        return false;
+    }
+    std::printf("%s -> %s: %s to %s, %d tracks, %llu bytes read, peak %d tracks in flight\n",
+                input.c_str(), output.c_str(), stats.inputFormat, stats.outputFormat, stats.tracks,
+                static_cast<unsigned long long>(stats.bytesRead), stats.peakInFlight);
+    return true;
+}
+
+bool writeTrace(const std::string &path)
+{
+    std::string error;
+    if (!PerfTrace::exportChromeTrace(path, &error)) {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    std::printf("trace: %zu zones, %llu dropped, written to %s\n", PerfTrace::zoneCount(),
+                static_cast<unsigned long long>(PerfTrace::dropped()), path.c_str());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    ConvertOptions options;
+    std::string outDir;
+    std::string tracePath;
+    std::vector<std::string> paths;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--in-flight" && hasValue) {
+            options.maxInFlight = std::atoi(argv[++i]);
+        } else if (arg == "--to" && hasValue) {
+            options.format = imageFormatFromPath(std::string("image.") + argv[++i]);
+            usage = usage || options.format == ImageFormat::Unknown;
+        } else if (arg == "--out-dir" && hasValue) {
+            outDir = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            tracePath = argv[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage = true;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (outDir.empty() ? paths.size() != 2 : (paths.empty() || options.format == ImageFormat::Unknown)) {
+        usage = true;
+    }
+    if (usage) {
+        std::fprintf(stderr, "usage: %s [--in-flight 4] [--trace FILE] [--to trd|scl|img|dsk|hfe|qfr] input output\n"
+                             "       %s [--in-flight 4] [--trace FILE] --to trd|scl|img|dsk|hfe|qfr --out-dir DIR input...\n",
+                     argv[0], argv[0]);
+        return 2;
+    }
+    if (!tracePath.empty() && !PerfTrace::isCompiledIn()) {
+        std::fprintf(stderr, "--trace needs a build configured with -DQT_FLOPPY_TRACING=ON\n");
+        return 2;
+    }
+    if (!tracePath.empty()) {
+        PerfTrace::setEnabled(true);
+        PerfTrace::setThreadName("main");
+    }
+
+    if (outDir.empty()) {
+        const bool converted = convertOne(paths[0], paths[1], options);
+        return converted && (tracePath.empty() || writeTrace(tracePath)) ? 0 : 1;
+    }
+
+    int failed = 0;
+    for (const std::string &input : paths) {
+        const std::string output = outDir + "/" + baseName(input) + "." + imageFormatExtension(options.format);
+        failed += convertOne(input, output, options) ? 0 : 1;
+        // The stage threads are gone; keep their rings from filling up
+        PerfTrace::collect();
+    }
+    if (!tracePath.empty() && !writeTrace(tracePath)) {
+        return 1;
+    }
+    if (failed > 0) {
+        std::fprintf(stderr, "%d of %zu images failed\n", failed, paths.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Headless frame sequence export of a replayed session or access trace.
+//
+//   qt-floppy-export [options] --image IMAGE [--trace FILE] (--png DIR | --y4m FILE)
+//   qt-floppy-export [options] --session JOURNAL [--trace FILE] (--png DIR | --y4m FILE)
+//
+// The first form starts from power on with IMAGE in the drive, the second
+// continues a crash recovery journal (.qfsj) where its last snapshot left
+// off. Options: --fps N (60), --hold SECONDS after the last command (1),
+// --size N for the disk view side in pixels (480), --threads N (all cores).
+// Y4M output can go straight into an encoder:
+//   ffmpeg -i out.y4m -c:v libx264 -pix_fmt yuv420p out.mp4
+
+#include "frameexporter.h"
+#include "snapshotjournal.h"
+#include "trackstream.h"
+
+#include <QGuiApplication>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    std::string imagePath;
+    std::string sessionPath;
+    std::string tracePath;
+    std::string output;
+    ReplayOptions replayOptions;
+    replayOptions.holdNs = 1000000000;
+    FrameExportOptions options;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--image" && hasValue) {
+            imagePath = argv[++i];
+        } else if (arg == "--session" && hasValue) {
+            sessionPath = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            tracePath = argv[++i];
+        } else if (arg == "--png" && hasValue) {
+            output = argv[++i];
+            options.format = FrameExportOptions::Format::Png;
+        } else if (arg == "--y4m" && hasValue) {
+            output = argv[++i];
+            options.format = FrameExportOptions::Format::Y4m;
+        } else if (arg == "--fps" && hasValue) {
+            replayOptions.framesPerSecond = std::atoi(argv[++i]);
+            usage = usage || replayOptions.framesPerSecond <= 0;
+        } else if (arg == "--hold" && hasValue) {
+            replayOptions.holdNs = static_cast<uint64_t>(std::atof(argv[++i]) * 1e9);
+        } else if (arg == "--size" && hasValue) {
+            options.diskSize = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::atoi(argv[++i]);
+        } else {
+            usage = true;
+        }
+    }
+    if (imagePath.empty() == sessionPath.empty() || output.empty()) {
+        usage = true;
+    }
+    if (usage) {
+        std::fprintf(stderr, "usage: %s [--fps 60] [--hold 1] [--size 480] [--threads N]\n"
+                             "       (--image IMAGE | --session JOURNAL) [--trace FILE] (--png DIR | --y4m FILE)\n",
+                     argv[0]);
+        return 2;
+    }
+
+    // Fonts need an application, never a screen
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+
+    AccessTrace trace;
+    std::string error;
+    if (!tracePath.empty() && !trace.load(tracePath, &error)) {
+        std::fprintf(stderr, "%s: %s\n", tracePath.c_str(), error.c_str());
+        return 1;
+    }
+
+    std::unique_ptr<TraceReplay> replay;
+    if (!imagePath.empty()) {
+        std::shared_ptr<DiskImage> image = TrackReader::loadImage(imagePath, &error);
+        if (!image) {
+            std::fprintf(stderr, "%s: %s\n", imagePath.c_str(), error.c_str());
+            return 1;
+        }
+        replay = std::make_unique<TraceReplay>(std::move(image), trace, replayOptions);
+    } else {
+        MachineSnapshot session;
+        QString message;
+        if (!SnapshotJournal::recover(QString::fromStdString(sessionPath), session, &message)) {
+            std::fprintf(stderr, "%s\n", qPrintable(message));
+            return 1;
+        }
+        replay = std::make_unique<TraceReplay>(session, trace, replayOptions);
+    }
+
+    FrameExportStats stats;
+    QString message;
+    if (!FrameExporter::exportFrames(*replay, QString::fromStdString(output), options, &stats, &message)) {
+        std::fprintf(stderr, "%s: %s\n", output.c_str(), qPrintable(message));
+        return 1;
+    }
+    const double emulated = static_cast<double>(stats.frames) / replayOptions.framesPerSecond;
+    std::printf("%zu frames (%.2f s of emulated time) in %.2f s, %.1fx real time\n", stats.frames, emulated,
+                stats.seconds, stats.seconds > 0.0 ? emulated / stats.seconds : 0.0);
+    return 0;
+}
@@ -0,0 +1,220 @@
+// Many-instance session runner for regression farms.
+//
+//   qt-floppy-farm [--threads N] [--repeat N] [--results FILE] [--trace FILE] [--scaling] MANIFEST...
+//
+// A manifest lists one session per line, '#' starting a comment:
+//   <image> <trace> [count]
+// with paths relative to the manifest. Every session runs on its own drive
+// and controller (count times, times --repeat); the summary gives instances
+// per second and the memory one instance keeps to itself. --results writes
+// one CSV line per instance, for diffing against an earlier run. --scaling
+// runs the whole set on 1, 2, 4 ... N threads and prints the speedup.
+// --trace writes every session as a zone on its worker's timeline, in
+// builds configured with QT_FLOPPY_TRACING.
+
+#include "perftrace.h"
+#include "sessionfarm.h"
+#include "trackstream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Entry {
+    std::string image;
+    std::string trace;
+};
+
+std::string resolve(const std::string &base, const std::string &path)
+{
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    const size_t slash = base.find_last_of("/\\");
+    return slash == std::string::npos ? path : base.substr(0, slash + 1) + path;
+}
+
+bool readManifest(const std::string &path, int repeat, std::vector<Entry> &entries, std::string *error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        *error = "cannot open";
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        ++number;
+        const size_t hash = line.find('#');
+        std::istringstream fields(line.substr(0, hash));
+        Entry entry;
+        int count = 1;
+        if (!(fields >> entry.image)) {
+            continue;
+        }
+        if (!(fields >> entry.trace) || (!(fields >> count) && !fields.eof()) || count < 0) {
+            *error = "line " + std::to_string(number) + ": expected <image> <trace> [count]";
+            return false;
+        }
+        entry.image = resolve(path, entry.image);
+        entry.trace = resolve(path, entry.trace);
+        entries.insert(entries.end(), static_cast<size_t>(count) * static_cast<size_t>(repeat), entry);
+    }
+    return true;
+}
+
+void printStats(const FarmStats &stats, size_t failed)
+{
+    std::printf("%zu instances in %.3f s on %d threads: %.0f instances/s, %.1f s emulated (%.0fx real time)\n",
+                stats.instances, stats.seconds, stats.threads, stats.instancesPerSecond, stats.emulatedNs / 1e9,
+                stats.seconds > 0.0 ? stats.emulatedNs / 1e9 / stats.seconds : 0.0);
+    std::printf("per instance: %zu bytes average, %zu peak; image copies %zu bytes over all workers\n",
+                stats.averageInstanceBytes, stats.peakInstanceBytes, stats.imageBytes);
+    if (failed > 0) {
+        std::printf("%zu instances ended a command with an error\n", failed);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    FarmOptions options;
+    int repeat = 1;
+    bool scaling = false;
+    std::string resultsPath;
+    std::string tracePath;
+    std::vector<std::string> manifests;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = std::atoi(argv[++i]);
+            usage = usage || repeat <= 0;
+        } else if (arg == "--results" && hasValue) {
+            resultsPath = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            tracePath = argv[++i];
+        } else if (arg == "--scaling") {
+            scaling = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage = true;
+        } else {
+            manifests.push_back(arg);
+        }
+    }
+    if (!tracePath.empty() && !PerfTrace::isCompiledIn()) {
+        std::fprintf(stderr, "--trace needs a build configured with -DQT_FLOPPY_TRACING=ON\n");
+        return 2;
+    }
+    if (usage || manifests.empty()) {
+        std::fprintf(stderr, "usage: %s [--threads N] [--repeat N] [--results FILE] [--trace FILE] [--scaling] MANIFEST...\n",
+                     argv[0]);
+        return 2;
+    }
+
+    std::vector<Entry> entries;
+    std::string error;
+    for (const std::string &manifest : manifests) {
+        if (!readManifest(manifest, repeat, entries, &error)) {
+            std::fprintf(stderr, "%s: %s\n", manifest.c_str(), error.c_str());
+            return 1;
+        }
+    }
+
+    // Images and traces are loaded once and shared by all their instances
+    std::map<std::string, std::shared_ptr<const DiskImage>> images;
+    std::map<std::string, std::shared_ptr<const AccessTrace>> traces;
+    std::vector<FarmSession> sessions;
+    sessions.reserve(entries.size());
+    for (const Entry &entry : entries) {
+        std::shared_ptr<const DiskImage> &image = images[entry.image];
+        if (!image) {
+            image = TrackReader::loadImage(entry.image, &error);
+            if (!image) {
+                std::fprintf(stderr, "%s: %s\n", entry.image.c_str(), error.c_str());
+                return 1;
+            }
+        }
+        std::shared_ptr<const AccessTrace> &trace = traces[entry.trace];
+        if (!trace) {
+            auto loaded = std::make_shared<AccessTrace>();
+            if (!loaded->load(entry.trace, &error)) {
+                std::fprintf(stderr, "%s: %s\n", entry.trace.c_str(), error.c_str());
+                return 1;
+            }
+            trace = std::move(loaded);
+        }
+        sessions.push_back(FarmSession{ image, trace });
+    }
+
+    if (!tracePath.empty()) {
+        PerfTrace::setEnabled(true);
+        PerfTrace::setThreadName("main");
+    }
+    std::vector<FarmResult> results;
+    FarmStats stats;
+    if (scaling) {
+        const int maximum = options.threads > 0 ? options.threads : TaskPool::defaultThreadCount();
+        double single = 0.0;
+        std::printf("threads  instances/s  speedup\n");
+        for (int threads = 1;; threads = std::min(threads * 2, maximum)) {
+            FarmOptions step = options;
+            step.threads = threads;
+            SessionFarm farm(step);
+            // The first pass warms the arenas, the second one is measured
+            farm.run(sessions);
+            results = farm.run(sessions, &stats);
+            single = threads == 1 ? stats.instancesPerSecond : single;
+            std::printf("%7d  %11.0f  %7.2f\n", threads, stats.instancesPerSecond,
+                        single > 0.0 ? stats.instancesPerSecond / single : 0.0);
+            if (threads == maximum) {
+                break;
+            }
+        }
+    } else {
+        SessionFarm farm(options);
+        results = farm.run(sessions, &stats);
+    }
+
+    size_t failed = 0;
+    for (const FarmResult &result : results) {
+        failed += result.errors > 0 ? 1 : 0;
+    }
+    printStats(stats, failed);
+
+    if (!tracePath.empty()) {
+        if (!PerfTrace::exportChromeTrace(tracePath, &error)) {
+            std::fprintf(stderr, "%s: %s\n", tracePath.c_str(), error.c_str());
+            return 1;
+        }
+        std::printf("trace: %zu zones, %llu dropped\n", PerfTrace::zoneCount(),
+                    static_cast<unsigned long long>(PerfTrace::dropped()));
+    }
+
+    if (!resultsPath.empty()) {
+        FILE *file = std::fopen(resultsPath.c_str(), "w");
+        if (!file) {
+            std::fprintf(stderr, "%s: cannot create\n", resultsPath.c_str());
+            return 1;
+        }
+        std::fprintf(file, "instance,image,trace,emulated_ns,commands,errors,digest\n");
+        for (size_t index = 0; index < results.size(); ++index) {
+            const FarmResult &result = results[index];
+            std::fprintf(file, "%zu,%s,%s,%llu,%u,%u,%016llx\n", index, entries[index].image.c_str(),
+                         entries[index].trace.c_str(), static_cast<unsigned long long>(result.emulatedNs),
+                         result.commands, result.errors, static_cast<unsigned long long>(result.digest));
+        }
+        std::fclose(file);
+    }
+    return 0;
+}